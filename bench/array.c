@@ -0,0 +1,92 @@
+// New Bastiaan Language Array Functions Benchmark
+// Made by Bastiaan van der Plaat
+// gcc -O2 -Wall -Wextra -Wshadow -Wpedantic --std=c11 bench/array.c -lm -o array && ./array [items]
+
+#define NBL_IMPLEMENTATION
+#include "../src/nbl.h"
+
+// Every benchmark fills an array with pseudo random numbers and runs the same work natively and in NBL itself
+static char *setup =
+    "const items = [];\n"
+    "for (let i = 0; i < %d; i++) items.push((i * 7919) %% 100003);\n";
+
+typedef struct Benchmark {
+    char *name;
+    char *native;
+    char *script;
+} Benchmark;
+
+static Benchmark benchmarks[] = {
+    {"sort", "items.sort();",
+     "fn mergeSort(list) {\n"
+     "    if (list.length() <= 1) return list;\n"
+     "    const left = [];\n"
+     "    const right = [];\n"
+     "    for (let i = 0; i < list.length(); i++) {\n"
+     "        if (i < list.length() / 2) left.push(list[i]);\n"
+     "        else right.push(list[i]);\n"
+     "    }\n"
+     "    const a = mergeSort(left);\n"
+     "    const b = mergeSort(right);\n"
+     "    const result = [];\n"
+     "    let i = 0;\n"
+     "    let j = 0;\n"
+     "    while (i < a.length() && j < b.length()) {\n"
+     "        if (b[j] < a[i]) result.push(b[j++]);\n"
+     "        else result.push(a[i++]);\n"
+     "    }\n"
+     "    while (i < a.length()) result.push(a[i++]);\n"
+     "    while (j < b.length()) result.push(b[j++]);\n"
+     "    return result;\n"
+     "}\n"
+     "mergeSort(items);"},
+    {"sort comparator", "items.sort(fn (a, b) => a - b);", NULL},
+    {"join", "items.join(',');",
+     "let text = '';\n"
+     "for (let i = 0; i < items.length(); i++) {\n"
+     "    if (i > 0) text += ',';\n"
+     "    text += (string)items[i];\n"
+     "}"},
+    {"indexOf", "for (let i = 0; i < 100; i++) items.indexOf(-1);",
+     "for (let i = 0; i < 100; i++) {\n"
+     "    for (let j = 0; j < items.length(); j++) if (items[j] == -1) break;\n"
+     "}"},
+    {"reverse", "items.reverse();",
+     "for (let i = 0; i < items.length() / 2; i++) {\n"
+     "    const item = items[i];\n"
+     "    items[i] = items[items.length() - 1 - i];\n"
+     "    items[items.length() - 1 - i] = item;\n"
+     "}"},
+    {"slice", "items.slice(10, -10);",
+     "const part = [];\n"
+     "for (let i = 10; i < items.length() - 10; i++) part.push(items[i]);"},
+};
+
+static int64_t run(int32_t items, char *work) {
+    // The setup runs first in the same context so only the work is timed
+    char setupText[256];
+    snprintf(setupText, sizeof(setupText), setup, items);
+    NblContext *context = nbl_context_new();
+    nbl_value_free(nbl_context_eval_text(context, setupText));
+    int64_t start = nbl_time_ms();
+    nbl_value_free(nbl_context_eval_text(context, work));
+    int64_t time = nbl_time_ms() - start;
+    nbl_context_free(context);
+    return time;
+}
+
+int main(int argc, char **argv) {
+    int32_t items = argc >= 2 ? atoi(argv[1]) : 100000;
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(Benchmark); i++) {
+        Benchmark *benchmark = &benchmarks[i];
+        int64_t native = run(items, benchmark->native);
+        if (benchmark->script != NULL) {
+            int64_t script = run(items, benchmark->script);
+            printf("%-16s %d items, native %4" PRId64 " ms, nbl %5" PRId64 " ms (%.1fx)\n", benchmark->name, items, native, script,
+                   (double)script / MAX(native, 1));
+        } else {
+            printf("%-16s %d items, native %4" PRId64 " ms\n", benchmark->name, items, native);
+        }
+    }
+    return EXIT_SUCCESS;
+}
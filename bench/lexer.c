@@ -0,0 +1,68 @@
+// New Bastiaan Language Lexer Benchmark
+// Made by Bastiaan van der Plaat
+// gcc -O2 -Wall -Wextra -Wshadow -Wpedantic --std=c11 bench/lexer.c -lm -o lexer && ./lexer [megabytes]
+
+#include <time.h>
+#define NBL_IMPLEMENTATION
+#include "../src/nbl.h"
+
+// A chunk of typical NBL code which is repeated to create a large synthetic corpus
+static char *chunk =
+    "// Person class with some methods\n"
+    "class Person%d extends Animal {\n"
+    "    SOME_STATIC_VAR = 'A constant string with \\'escapes\\' in it',\n"
+    "\n"
+    "    fn constructor(name: string, age: int = 20) {\n"
+    "        super.constructor(name);\n"
+    "        this.age = age;\n"
+    "    }\n"
+    "\n"
+    "    /* Greets the person\n"
+    "       with a multi line comment */\n"
+    "    fn greet() {\n"
+    "        println('Name = ' + this.name + ', Age = ' + (string)this['age']);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "# Some loops and operators\n"
+    "let sum%d = 0;\n"
+    "for (let i = 0; i < 0x%x; i++) {\n"
+    "    if (i %% 2 == 0 && i != 0b101) sum%d += i * 3.14159;\n"
+    "    else sum%d <<= 1;\n"
+    "}\n"
+    "const names = [ \"Bastiaan\", \"Jan\", \"Dirk\" ].map(fn (name) => name + '!');\n"
+    "\n";
+
+int main(int argc, char **argv) {
+    size_t megabytes = argc >= 2 ? (size_t)atoi(argv[1]) : 32;
+    size_t capacity = megabytes * 1024 * 1024;
+
+    // Generate corpus
+    char *text = malloc(capacity + 1024);
+    size_t size = 0;
+    for (int i = 0; size < capacity; i++) {
+        size += sprintf(text + size, chunk, i, i, i, i, i);
+    }
+
+    // Run the lexer a few times and take the fastest run
+    double best = 0;
+    size_t tokenCount = 0;
+    for (int run = 0; run < 5; run++) {
+        clock_t start = clock();
+        NblList *tokens = nbl_lexer("corpus.nbl", text);
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        tokenCount = tokens->size;
+        nbl_list_free(tokens, (NblListFreeFunc *)nbl_token_free);
+        if (run == 0 || seconds < best) best = seconds;
+    }
+
+#ifdef NBL_SIMD
+    char *mode = NBL_VECTOR_SIZE == 32 ? "avx2" : "sse2";
+#else
+    char *mode = "scalar";
+#endif
+    printf("lexer (%s): %.1f MB, %zu tokens, %.3f s, %.1f MB/s, %.1f Mtokens/s\n", mode, size / (1024.0 * 1024.0), tokenCount, best,
+           size / (1024.0 * 1024.0) / best, tokenCount / 1e6 / best);
+    free(text);
+    return EXIT_SUCCESS;
+}
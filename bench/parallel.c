@@ -0,0 +1,51 @@
+// New Bastiaan Language Parallel Array Benchmark
+// Made by Bastiaan van der Plaat
+// gcc -O2 -Wall -Wextra -Wshadow -Wpedantic --std=c11 bench/parallel.c -lm -o parallel && ./parallel [threads] [items]
+
+#define NBL_IMPLEMENTATION
+#include "../src/nbl.h"
+
+// A CPU bound pure function that is mapped over all items
+static char *script =
+    "const items = [];\n"
+    "for (let i = 0; i < %d; i++) items.push(i);\n"
+    "const work = fn (n) {\n"
+    "    let x = 0;\n"
+    "    for (let i = 0; i < 1000; i++) x += (n + i) %% 7;\n"
+    "    return x;\n"
+    "};\n"
+    "const result = items.%s(work%s);\n"
+    "return result.length();\n";
+
+static double run(int32_t threads, int32_t items, char *method, char *chunkSize) {
+    char text[1024];
+    snprintf(text, sizeof(text), script, items, method, chunkSize);
+    NblContext *context = nbl_context_new();
+    context->interpreter->threads = threads;
+    int64_t start = nbl_time_ms();
+    NblValue *returnValue = nbl_context_eval_text(context, text);
+    int64_t time = nbl_time_ms() - start;
+    if (returnValue->type != NBL_VALUE_INT || returnValue->integer != items) {
+        fprintf(stderr, "parallel: %s gave a wrong result\n", method);
+        exit(EXIT_FAILURE);
+    }
+    nbl_value_free(returnValue);
+    nbl_context_free(context);
+    return time;
+}
+
+int main(int argc, char **argv) {
+    int32_t threadsSize = argc >= 2 ? atoi(argv[1]) : nbl_cpu_count();
+    int32_t items = argc >= 3 ? atoi(argv[2]) : 4000;
+
+    double sequential = run(1, items, "map", "");
+    printf("map: %d items in %.0f ms\n", items, sequential);
+    for (int32_t threads = 1; threads <= threadsSize; threads++) {
+        double automatic = run(threads, items, "parallelMap", "");
+        double small = run(threads, items, "parallelMap", ", 1");
+        double large = run(threads, items, "parallelMap", ", 1000");
+        printf("parallelMap: %2d threads, auto chunks %.0f ms (%.2fx), 1 item chunks %.0f ms, 1000 item chunks %.0f ms\n", threads,
+               automatic, sequential / automatic, small, large);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+// New Bastiaan Language Benchmark Suite
+// Made by Bastiaan van der Plaat
+// gcc -O2 -Wall -Wextra -Wshadow -Wpedantic --std=c11 bench/suite.c -lm -o suite && ./suite [save|compare] [baseline]
+
+#include <sys/resource.h>
+#include <time.h>
+#define NBL_IMPLEMENTATION
+#include "../src/nbl.h"
+
+// Every workload is a script in bench/scripts that runs in a new context, startup runs in many contexts
+typedef struct Workload {
+    char *name;
+    char *path;
+    int32_t contexts;
+} Workload;
+
+static Workload workloads[] = {
+    {"fib", "bench/scripts/fib.nbl", 1},
+    {"strings", "bench/scripts/strings.nbl", 1},
+    {"classes", "bench/scripts/classes.nbl", 1},
+    {"arrays", "bench/scripts/arrays.nbl", 1},
+    {"loops", "bench/scripts/loops.nbl", 1},
+    {"exceptions", "bench/scripts/exceptions.nbl", 1},
+    {"startup", "bench/scripts/startup.nbl", 200},
+};
+
+#define WORKLOADS_SIZE (sizeof(workloads) / sizeof(Workload))
+#define RUNS 5
+
+// Times above the baseline by more than this are regressions, allocations are exact so every extra one is
+#define TIME_THRESHOLD 1.10
+#define MEMORY_THRESHOLD 1.10
+
+typedef struct Result {
+    double time;
+    int64_t allocations;
+    int64_t peakMemory;
+} Result;
+
+static double now_ms(void) {
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+static int run_child(Workload *workload) {
+    // A run happens in its own process, so the peak memory of one workload doesn't hide the others
+    int64_t allocations = nbl_value_allocations;
+    double start = now_ms();
+    for (int32_t i = 0; i < workload->contexts; i++) {
+        NblContext *context = nbl_context_new();
+        nbl_value_free(nbl_context_eval_file(context, workload->path));
+        nbl_context_free(context);
+    }
+    double time = now_ms() - start;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%f %" PRIi64 " %ld\n", time, nbl_value_allocations - allocations, (long)usage.ru_maxrss);
+    return EXIT_SUCCESS;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double difference = *(const double *)a - *(const double *)b;
+    return (difference > 0) - (difference < 0);
+}
+
+static bool run_workload(char *program, Workload *workload, Result *result) {
+    // The median time of the runs is used, the allocations are the same every run and the peak memory is the highest
+    double times[RUNS];
+    result->allocations = 0;
+    result->peakMemory = 0;
+    for (int32_t i = 0; i < RUNS; i++) {
+        char command[1024];
+        snprintf(command, sizeof(command), "%s --child %s", program, workload->name);
+        FILE *child = popen(command, "r");
+        if (child == NULL) return false;
+        long peakMemory;
+        bool read = fscanf(child, "%lf %" SCNi64 " %ld", &times[i], &result->allocations, &peakMemory) == 3;
+        if (pclose(child) != 0 || !read) return false;
+        result->peakMemory = MAX(result->peakMemory, peakMemory);
+    }
+    qsort(times, RUNS, sizeof(double), compare_doubles);
+    result->time = times[RUNS / 2];
+    return true;
+}
+
+static bool read_baseline(char *path, Result *baseline, bool *found) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return false;
+    char name[64];
+    Result result;
+    long peakMemory;
+    while (fscanf(file, "%63s %lf %" SCNi64 " %ld", name, &result.time, &result.allocations, &peakMemory) == 4) {
+        result.peakMemory = peakMemory;
+        for (size_t i = 0; i < WORKLOADS_SIZE; i++) {
+            if (!strcmp(workloads[i].name, name)) {
+                baseline[i] = result;
+                found[i] = true;
+            }
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 3 && !strcmp(argv[1], "--child")) {
+        for (size_t i = 0; i < WORKLOADS_SIZE; i++) {
+            if (!strcmp(workloads[i].name, argv[2])) return run_child(&workloads[i]);
+        }
+        return EXIT_FAILURE;
+    }
+
+    char *mode = argc >= 2 ? argv[1] : "run";
+    char *baselinePath = argc >= 3 ? argv[2] : ".nblbench";
+    if (strcmp(mode, "run") && strcmp(mode, "save") && strcmp(mode, "compare")) {
+        fprintf(stderr, "Usage: %s [run|save|compare] [baseline]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Result baseline[WORKLOADS_SIZE];
+    bool found[WORKLOADS_SIZE] = {false};
+    if (!strcmp(mode, "compare") && !read_baseline(baselinePath, baseline, found)) {
+        fprintf(stderr, "Can't read baseline: %s\n", baselinePath);
+        return EXIT_FAILURE;
+    }
+    FILE *save = NULL;
+    if (!strcmp(mode, "save") && (save = fopen(baselinePath, "w")) == NULL) {
+        fprintf(stderr, "Can't write baseline: %s\n", baselinePath);
+        return EXIT_FAILURE;
+    }
+
+    bool regressed = false;
+    printf("%-12s %10s %12s %10s\n", "workload", "median ms", "allocations", "peak kb");
+    for (size_t i = 0; i < WORKLOADS_SIZE; i++) {
+        Workload *workload = &workloads[i];
+        Result result;
+        if (!run_workload(argv[0], workload, &result)) {
+            printf("%-12s failed\n", workload->name);
+            regressed = true;
+            continue;
+        }
+        printf("%-12s %10.1f %12" PRIi64 " %10" PRIi64, workload->name, result.time, result.allocations, result.peakMemory);
+        if (save != NULL) fprintf(save, "%s %f %" PRIi64 " %" PRIi64 "\n", workload->name, result.time, result.allocations, result.peakMemory);
+        if (found[i]) {
+            bool slower = result.time > baseline[i].time * TIME_THRESHOLD;
+            bool allocates = result.allocations > baseline[i].allocations;
+            bool bigger = result.peakMemory > baseline[i].peakMemory * MEMORY_THRESHOLD;
+            printf("  time %+.1f%%, allocations %+" PRIi64 ", memory %+.1f%%%s", (result.time / baseline[i].time - 1) * 100,
+                   result.allocations - baseline[i].allocations, ((double)result.peakMemory / baseline[i].peakMemory - 1) * 100,
+                   slower || allocates || bigger ? "  REGRESSION" : "");
+            if (slower || allocates || bigger) regressed = true;
+        }
+        printf("\n");
+    }
+    if (save != NULL) fclose(save);
+    return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
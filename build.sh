@@ -1,6 +1,6 @@
 rm -f -r .vscode
 if [ "$1" = "clean" ]; then
-    rm -f -r nbl.dSYM dump nbl nbl.exe
+    rm -f -r nbl.dSYM dump nbl nbl-asan nbl.exe .nblcache errors.txt contexts suite profile.txt profile.folded stats.json
     exit
 fi
 
@@ -23,16 +23,105 @@ if [ "$1" = "leaks" ]; then
     exit
 fi
 
+if [ "$1" = "bench" ]; then
+    # Run the benchmark suite, ./build.sh bench save stores a baseline and ./build.sh bench compare checks against it
+    shift
+    gcc -O2 -Wall -Wextra -Wshadow -Wpedantic --std=c11 bench/suite.c -lm -o suite || exit
+    ./suite "$@"
+    status=$?
+    rm -f suite
+    exit $status
+fi
+
 gcc -Wall -Wextra -Wshadow -Wpedantic --std=c11 src/main.c -lm -o nbl || exit
 if [ "$1" = "test" ]; then
+    # Fill new and freed memory with a pattern, so reads of uninitialized memory fail the tests
+    export MALLOC_PERTURB_=165
+    rm -f -r .nblcache
+    mkdir .nblcache
     for file in $(find tests -name *.nbl); do
         echo "Running test $(basename $file)..."
-        ./nbl $file
+        # Run without cache, then with a cold and a warm cache
+        # Uncatched exceptions like failed asserts don't change the exit code, so any error output fails the test too
+        for options in "" "--cache-dir .nblcache" "--cache-dir .nblcache"; do
+            ./nbl $options $file 2> errors.txt
+            if [ $? != 0 ] || [ -s errors.txt ]; then
+                cat errors.txt
+                echo "FAIL"
+                exit
+            fi
+        done
+    done
+
+    # Parse the includes with one, some and more threads than there are files on a level
+    for threads in 1 2 8; do
+        echo "Running test preload.nbl with --threads $threads..."
+        ./nbl --threads $threads tests/preload.nbl 2> errors.txt
+        if [ $? != 0 ] || [ -s errors.txt ]; then
+            cat errors.txt
+            echo "FAIL"
+            exit
+        fi
+    done
+    rm -f -r .nblcache errors.txt
+
+    # Run the assignments with AddressSanitizer, which fails on nodes that are never freed
+    if gcc -g -fsanitize=address --std=c11 src/main.c -lm -o nbl-asan 2> /dev/null; then
+        echo "Running test assigns.nbl with AddressSanitizer..."
+        ./nbl-asan tests/assigns.nbl
         if [ $? != 0 ]; then
             echo "FAIL"
             exit
         fi
+        rm -f nbl-asan
+    fi
+
+    # Profile a script and check that the tables are printed and the folded stacks are written, fib.nbl returns its
+    # result so its exit code is not checked
+    echo "Running test fib.nbl with --profile..."
+    rm -f profile.folded
+    ./nbl --profile --profile-folded profile.folded bench/scripts/fib.nbl 2> profile.txt
+    if ! grep -q "self   total  function" profile.txt || ! grep -q "self   total  line" profile.txt || ! grep -q "^main" profile.folded; then
+        echo "FAIL"
+        exit
+    fi
+    rm -f profile.txt profile.folded
+
+    # Pipe a script through the interpreter in two reads that split a statement in the middle of a line
+    echo "Running test stream.nbl through stdin..."
+    split=$(grep -b -o SPLIT tests/stream.nbl | cut -d : -f 1)
+    { head -c $split tests/stream.nbl; sleep 0.2; tail -c +$((split + 1)) tests/stream.nbl; } | ./nbl - 2> errors.txt
+    if [ $? != 0 ] || [ -s errors.txt ]; then
+        cat errors.txt
+        echo "FAIL"
+        exit
+    fi
+    rm -f errors.txt
+
+    # Count a script and check that every section of the stats is printed
+    echo "Running test loops.nbl with --stats..."
+    ./nbl --stats tests/loops.nbl 2> stats.json
+    if [ $? != 0 ]; then
+        echo "FAIL"
+        exit
+    fi
+    for section in nodes nativeCalls exceptions nodeTypes allocations calls; do
+        if ! grep -q "\"$section\": " stats.json; then
+            echo "FAIL"
+            exit
+        fi
     done
+    rm -f stats.json
+
+    # Run independent contexts on multiple threads at the same time
+    echo "Running test contexts.c..."
+    gcc -Wall -Wextra -Wshadow -Wpedantic --std=c11 tests/contexts.c -lm -o contexts || exit
+    ./contexts
+    if [ $? != 0 ]; then
+        echo "FAIL"
+        exit
+    fi
+    rm -f contexts
     echo "OK"
 else
     ./nbl $2
@@ -30,13 +30,42 @@ static NblValue *env_exit(NblContext *context, NblValue *this, NblList *values)
     return NULL;
 }
 
+// The natives are registered so a snapshot can refer to them
+static NblBinding natives[] = {
+    {"print", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_print},
+    {"println", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_println},
+    {"exit", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_exit},
+};
+
 // Read execute print loop
+static NblContext *replContext = NULL;
+static volatile sig_atomic_t replInterrupted = 0;
+static volatile sig_atomic_t replRunning = 0;
+
+static void repl_interrupt(int number) {
+    // Ctrl+C stops the running statement or clears the line instead of quitting, only a running statement is
+    // interrupted so the next statement doesn't stop right away
+    signal(number, repl_interrupt);
+    replInterrupted = 1;
+    if (replRunning) nbl_context_interrupt(replContext);
+}
+
 void repl(NblContext *context) {
+    replContext = context;
+    signal(SIGINT, repl_interrupt);
     char command[1024];
     for (;;) {
         // Read
         printf("> ");
-        fgets(command, 1024, stdin);
+        if (fgets(command, 1024, stdin) == NULL) {
+            if (replInterrupted) {
+                replInterrupted = 0;
+                clearerr(stdin);
+                printf("\n");
+                continue;
+            }
+            break;
+        }
         if (!strcmp(command, ".exit\n")) {
             break;
         }
@@ -47,7 +76,10 @@ void repl(NblContext *context) {
         command[commandSize] = ';';
         command[commandSize + 1] = '\0';
 
+        replRunning = 1;
         NblValue *returnValue = nbl_context_eval_text_statement(context, command);
+        replRunning = 0;
+        replInterrupted = 0;
         if (returnValue != NULL) {
             char *string = nbl_value_to_string(returnValue);
             printf("%s\n", string);
@@ -59,37 +91,133 @@ void repl(NblContext *context) {
 
 // Main
 int main(int argc, char **argv) {
-    // Create env
-    NblContext *context = nbl_context_new();
+    // Parse options
+    bool stats = false;
+    bool profile = false;
+    char *foldedPath = NULL;
+    bool cache = false;
+    char *cacheDir = NULL;
+    int32_t threads = 0;
+    char *loadPath = NULL;
+    char *savePath = NULL;
+    NblLimits limits = {.memory = 0, .steps = 0, .time = 0, .fatal = false};
+    int position = 1;
+    for (; position < argc && !strncmp(argv[position], "--", 2); position++) {
+        if (!strcmp(argv[position], "--stats")) {
+            stats = true;
+        } else if (!strcmp(argv[position], "--cache")) {
+            cache = true;
+        } else if (!strcmp(argv[position], "--cache-dir") && position + 1 < argc) {
+            cache = true;
+            cacheDir = argv[++position];
+        } else if (!strcmp(argv[position], "--profile")) {
+            profile = true;
+        } else if (!strcmp(argv[position], "--profile-folded") && position + 1 < argc) {
+            profile = true;
+            foldedPath = argv[++position];
+        } else if (!strcmp(argv[position], "--threads") && position + 1 < argc) {
+            threads = atoi(argv[++position]);
+        } else if (!strcmp(argv[position], "--memory-limit") && position + 1 < argc) {
+            limits.memory = atoll(argv[++position]);
+        } else if (!strcmp(argv[position], "--step-limit") && position + 1 < argc) {
+            limits.steps = atoll(argv[++position]);
+        } else if (!strcmp(argv[position], "--time-limit") && position + 1 < argc) {
+            limits.time = atoll(argv[++position]);
+        } else if (!strcmp(argv[position], "--fatal-limits")) {
+            limits.fatal = true;
+        } else if (!strcmp(argv[position], "--load-snapshot") && position + 1 < argc) {
+            loadPath = argv[++position];
+        } else if (!strcmp(argv[position], "--save-snapshot") && position + 1 < argc) {
+            savePath = argv[++position];
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[position]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Create env, or restore a context that was saved after an earlier run, which has the natives below already
+    nbl_native_register(natives, sizeof(natives) / sizeof(NblBinding));
+    NblContext *context;
+    if (loadPath != NULL) {
+        context = nbl_context_load(loadPath);
+        if (context == NULL) {
+            fprintf(stderr, "Can't load snapshot: %s\n", loadPath);
+            return EXIT_FAILURE;
+        }
+    } else {
+        context = nbl_context_new();
 
-    NblList *empty_args = nbl_list_new();
-    nbl_map_set(context->env, "print", nbl_variable_new(NBL_VALUE_NATIVE_FUNCTION, false, nbl_value_new_native_function(empty_args, NBL_VALUE_NULL, env_print)));
-    nbl_map_set(context->env, "println", nbl_variable_new(NBL_VALUE_NATIVE_FUNCTION, false, nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_NULL, env_println)));
+        NblList *empty_args = nbl_list_new();
+        nbl_map_set(context->env, "print", nbl_variable_new(NBL_VALUE_NATIVE_FUNCTION, false, nbl_value_new_native_function(empty_args, NBL_VALUE_NULL, env_print)));
+        nbl_map_set(context->env, "println", nbl_variable_new(NBL_VALUE_NATIVE_FUNCTION, false, nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_NULL, env_println)));
 
-    NblList *exit_args = nbl_list_new();
-    nbl_list_add(exit_args, nbl_argument_new("exitCode", NBL_VALUE_INT, nbl_node_new_value(NULL, nbl_value_new_int(0))));
-    nbl_map_set(context->env, "exit", nbl_variable_new(NBL_VALUE_NATIVE_FUNCTION, false, nbl_value_new_native_function(exit_args, NBL_VALUE_NULL, env_exit)));
+        NblList *exit_args = nbl_list_new();
+        nbl_list_add(exit_args, nbl_argument_new("exitCode", NBL_VALUE_INT, nbl_node_new_value(NULL, nbl_value_new_int(0))));
+        nbl_map_set(context->env, "exit", nbl_variable_new(NBL_VALUE_NATIVE_FUNCTION, false, nbl_value_new_native_function(exit_args, NBL_VALUE_NULL, env_exit)));
+        nbl_context_mark(context);
+    }
+    context->interpreter->cache = cache;
+    context->interpreter->cacheDir = cacheDir != NULL ? strdup(cacheDir) : NULL;
+    context->interpreter->threads = threads;
+    nbl_context_set_limits(context, limits);
 
     // Run repl when no arguments are given
-    if (argc == 1) {
+    if (position == argc) {
         printf("New Bastiaan Language Interpreter\n");
         repl(context);
+        if (savePath != NULL && !nbl_context_save(context, savePath)) fprintf(stderr, "Can't save snapshot to: %s\n", savePath);
         nbl_context_free(context);
         return EXIT_SUCCESS;
     }
 
     // Or else run file
     NblList *arguments = nbl_list_new();
-    for (int i = 2; i < argc; i++) {
+    for (int i = position + 1; i < argc; i++) {
         nbl_list_add(arguments, nbl_value_new_string(argv[i]));
     }
-    nbl_map_set(context->env, "arguments", nbl_variable_new(NBL_VALUE_ARRAY, false, nbl_value_new_array(arguments)));
+    nbl_context_set(context, "arguments", nbl_value_new_array(arguments));
+
+    // Count the nodes, allocations, calls and exceptions of the script for the stats
+    if (stats) context->interpreter->counters = nbl_counters_new();
 
-    NblValue *returnValue = nbl_context_eval_file(context, argv[1]);
-    if (returnValue->type == NBL_VALUE_INT) {
+    // Sample the script every millisecond of cpu time when profiling
+    NblProfiler *profiler = NULL;
+    if (profile) {
+        profiler = nbl_profiler_new(1000);
+        context->interpreter->profiler = profiler;
+        if (!nbl_profiler_start(profiler)) {
+            fprintf(stderr, "Can't start the profiler\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Run script from stdin statement by statement when the path is -
+    NblValue *returnValue;
+    if (!strcmp(argv[position], "-")) {
+        returnValue = nbl_context_eval_stream(context, "stdin", stdin);
+    } else {
+        returnValue = nbl_context_eval_file(context, argv[position]);
+    }
+    if (stats) nbl_context_print_stats(context, stderr);
+    if (profiler != NULL) {
+        nbl_profiler_stop(profiler);
+        nbl_profiler_print(profiler, stderr);
+        if (foldedPath != NULL) {
+            FILE *file = fopen(foldedPath, "w");
+            if (file == NULL) {
+                fprintf(stderr, "Can't write folded stacks to: %s\n", foldedPath);
+            } else {
+                nbl_profiler_print_folded(profiler, file);
+                fclose(file);
+            }
+        }
+    }
+    bool saved = savePath == NULL || nbl_context_save(context, savePath);
+    if (!saved) fprintf(stderr, "Can't save snapshot to: %s\n", savePath);
+    if (saved && returnValue->type == NBL_VALUE_INT) {
         exit(returnValue->integer);
     }
     nbl_value_free(returnValue);
     nbl_context_free(context);
-    return EXIT_SUCCESS;
+    return saved ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -4,8 +4,10 @@
 #define NBL_HEADER
 
 #include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <math.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -15,7 +17,24 @@
 #ifdef _WIN32
 #include <windows.h>
 #else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+#if !defined(NBL_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__)
+#define NBL_SIMD
+#include <immintrin.h>
+#endif
+#if !defined(NBL_NO_THREADS) && !defined(__STDC_NO_THREADS__) && defined(__has_include)
+#if __has_include(<threads.h>)
+#define NBL_THREADS
+#include <stdatomic.h>
+#include <threads.h>
+#endif
 #endif
 
 // Polyfills header
@@ -47,28 +66,80 @@
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
+// SIMD header
+// SSE2 is part of every x86-64 CPU, so the lexer and the kernels use its vectors. The bulk kernels also have AVX2
+// versions that are compiled for AVX2 and only run when the CPU has it, so one binary runs everywhere
+#if defined(NBL_SIMD)
+#define NBL_AVX2 __attribute__((target("avx2")))
+#ifdef __AVX2__
+#define nbl_cpu_avx2() true
+#else
+#define nbl_cpu_avx2() __builtin_cpu_supports("avx2")
+#endif
+typedef __m128i NblVector;
+#define NBL_VECTOR_SIZE 16
+#define NBL_VECTOR_MASK 0xffff
+#define nbl_vector_load(pointer) _mm_loadu_si128((const __m128i *)(pointer))
+#define nbl_vector_set1(character) _mm_set1_epi8(character)
+#define nbl_vector_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define nbl_vector_gt(a, b) _mm_cmpgt_epi8(a, b)
+#define nbl_vector_or(a, b) _mm_or_si128(a, b)
+#define nbl_vector_and(a, b) _mm_and_si128(a, b)
+#define nbl_vector_mask(a) ((uint32_t)_mm_movemask_epi8(a))
+#define nbl_vector_store(pointer, a) _mm_storeu_si128((__m128i *)(pointer), a)
+#define nbl_vector_zero() _mm_setzero_si128()
+#define nbl_vector_add_int(a, b) _mm_add_epi64(a, b)
+typedef __m128d NblFloatVector;
+#define NBL_FLOAT_VECTOR_SIZE 2
+#define nbl_float_vector_load(pointer) _mm_loadu_pd(pointer)
+#define nbl_float_vector_store(pointer, a) _mm_storeu_pd(pointer, a)
+#define nbl_float_vector_set1(x) _mm_set1_pd(x)
+#define nbl_float_vector_add(a, b) _mm_add_pd(a, b)
+#define nbl_float_vector_mul(a, b) _mm_mul_pd(a, b)
+#define nbl_float_vector_min(a, b) _mm_min_pd(a, b)
+#define nbl_float_vector_max(a, b) _mm_max_pd(a, b)
+#else
+#define NBL_VECTOR_SIZE 1
+#endif
+
 char *strdup(const char *str);
 
 char *strndup(const char *str, size_t size);
 
-// Utils header
-extern int64_t nbl_random_seed;
+#ifndef _WIN32
+FILE *popen(const char *command, const char *mode);
+
+int pclose(FILE *stream);
+
+int fileno(FILE *stream);
+#endif
 
-double nbl_random_random(void);
+// Utils header
+double nbl_random_random(int64_t *seed);
 
 int64_t nbl_time_ms(void);
 
 char *nbl_file_read(char *path);
 
+bool nbl_file_stat(char *path, int64_t *modifiedTime, int64_t *fileSize);
+
+char *nbl_path_normalize(char *path);
+
+int32_t nbl_cpu_count(void);
+
 typedef struct NblToken NblToken;  // Forward define
+typedef struct NblMemory NblMemory;  // Forward define
 
 void nbl_print_error(NblToken *token, char *fmt, ...);
 
 // List header
+// A list is a ring buffer, the items start at start and wrap around at capacity
 typedef struct NblList {
     int32_t refs;
+    NblMemory *memory;
     void **items;
     size_t capacity;
+    size_t start;
     size_t size;
 } NblList;
 
@@ -90,6 +161,14 @@ void nbl_list_set(NblList *list, size_t index, void *item);
 
 void nbl_list_add(NblList *list, void *item);
 
+void *nbl_list_pop(NblList *list);
+
+void nbl_list_unshift(NblList *list, void *item);
+
+void *nbl_list_shift(NblList *list);
+
+void **nbl_list_items(NblList *list);
+
 char *nbl_list_to_string(NblList *list);
 
 typedef void NblListFreeFunc(void *item);
@@ -99,6 +178,7 @@ void nbl_list_free(NblList *list, NblListFreeFunc *freeFunc);
 // Map header
 typedef struct NblMap {
     int32_t refs;
+    NblMemory *memory;
     char **keys;
     void **values;
     size_t capacity;
@@ -122,21 +202,29 @@ void *nbl_map_get(NblMap *map, char *key);
 
 void nbl_map_set(NblMap *map, char *key, void *item);
 
+int64_t nbl_map_bytes(NblMap *map);
+
 typedef void NblMapFreeFunc(void *item);
 
 void nbl_map_free(NblMap *map, NblMapFreeFunc *freeFunc);
 
 // Lexer header
+#define NBL_SOURCE_PADDING NBL_VECTOR_SIZE
+
+// A streamed source drops the text its lexer is done with, so its text can start at a later line than the first
 typedef struct NblSource {
     int32_t refs;
     char *path;
     char *basename;
     char *dirname;
     char *text;
+    int32_t firstLine;
 } NblSource;
 
 NblSource *nbl_source_new(char *path, char *text);
 
+char *nbl_source_line(NblSource *source, int32_t line, size_t *size);
+
 NblSource *nbl_source_ref(NblSource *source);
 
 void nbl_source_free(NblSource *source);
@@ -232,7 +320,11 @@ typedef enum NblTokenType {
     NBL_TOKEN_TRY,
     NBL_TOKEN_CATCH,
     NBL_TOKEN_FINALLY,
-    NBL_TOKEN_INCLUDE
+    NBL_TOKEN_INCLUDE,
+    NBL_TOKEN_INCLUDE_ONCE,
+    NBL_TOKEN_ASYNC,
+    NBL_TOKEN_AWAIT,
+    NBL_TOKEN_YIELD
 } NblTokenType;
 
 struct NblToken {
@@ -273,11 +365,50 @@ typedef struct NblKeyword {
     NblTokenType type;
 } NblKeyword;
 
+#define NBL_CHAR_SPACE 1
+#define NBL_CHAR_NEWLINE 2
+#define NBL_CHAR_DIGIT 4
+#define NBL_CHAR_IDENT_START 8
+#define NBL_CHAR_IDENT 16
+
+NblTokenType nbl_lexer_keyword(char *string, size_t size);
+
+char *nbl_lexer_find(char *c, char a, char b, char d);
+
+char *nbl_lexer_skip_spaces(char *c);
+
+char *nbl_lexer_skip_ident(char *c);
+
+// A lexer that reads a file moves to a new source once it has lexed NBL_LEXER_DROP_SIZE bytes, the tokens that are
+// still alive keep the old source
+#define NBL_LEXER_DROP_SIZE 4096
+
+typedef struct NblLexer {
+    NblSource *source;
+    FILE *file;
+    size_t size;
+    size_t capacity;
+    size_t position;
+    size_t lineStart;
+    int32_t line;
+} NblLexer;
+
+NblLexer *nbl_lexer_new(char *path, char *text);
+
+NblLexer *nbl_lexer_new_file(char *path, FILE *file);
+
+bool nbl_lexer_fill(NblLexer *lexer);
+
+NblToken *nbl_lexer_next(NblLexer *lexer);
+
+void nbl_lexer_free(NblLexer *lexer);
+
 NblList *nbl_lexer(char *path, char *text);
 
 // Value
 typedef struct NblNode NblNode;                              // Forward define
 typedef struct NblContext NblContext;  // Forward define
+typedef struct NblInterpreter NblInterpreter;  // Forward define
 
 typedef enum NblValueType {
     NBL_VALUE_ANY,
@@ -294,6 +425,8 @@ typedef enum NblValueType {
     NBL_VALUE_NATIVE_FUNCTION
 } NblValueType;
 
+#define NBL_VALUE_TYPES (NBL_VALUE_NATIVE_FUNCTION + 1)
+
 typedef struct NblArgument {
     char *name;
     NblValueType type;
@@ -306,9 +439,37 @@ void nbl_argument_free(NblArgument *argument);
 
 typedef struct NblValue NblValue;
 
+// The C signature of a typed native, which gets its arguments unboxed so it can be a plain C function. The names
+// give the return type first. A returned string must be malloced and is owned by the interpreter from then on, which
+// frees it with the value, returning NULL throws a type error. String arguments stay owned by the interpreter and are only valid
+// during the call. NBL_SIGNATURE_VALUES binds a plain native that gets the context, this and the list of values
+typedef enum NblSignature {
+    NBL_SIGNATURE_VALUES,
+    NBL_SIGNATURE_FLOAT_FLOAT,
+    NBL_SIGNATURE_FLOAT_FLOAT_FLOAT,
+    NBL_SIGNATURE_INT_INT,
+    NBL_SIGNATURE_INT_INT_INT,
+    NBL_SIGNATURE_INT_STRING,
+    NBL_SIGNATURE_STRING_STRING
+} NblSignature;
+
+#define NBL_SIGNATURE_ARGUMENTS 2
+
+typedef void NblTypedFunc(void);
+
+// Native data of an instance, like the thread of a worker, that is freed together with the instance
+typedef struct NblNative NblNative;
+
+typedef void NblNativeFreeFunc(NblNative *native);
+
+struct NblNative {
+    NblNativeFreeFunc *free;
+};
+
 struct NblValue {
     int32_t refs;
     NblValueType type;
+    NblMemory *memory;
     union {
         bool boolean;
         int64_t integer;
@@ -321,14 +482,21 @@ struct NblValue {
                 NblValue *parentClass;
                 NblValue *instanceClass;
             };
-            bool abstract;
+            union {
+                bool abstract;
+                NblNative *native;
+            };
         };
         struct {
             NblList *arguments;
             NblValueType returnType;
+            bool async;
+            bool generator;
+            uint8_t signature;
             union {
                 NblNode *functionNode;
                 NblValue *(*nativeFunc)(NblContext *context, NblValue *this, NblList *values);
+                NblTypedFunc *typedFunc;
             };
         };
     };
@@ -361,6 +529,22 @@ NblValue *nbl_value_new_function(NblList *args, NblValueType returnType, NblNode
 NblValue *nbl_value_new_native_function(NblList *args, NblValueType returnType,
                                     NblValue *(*nativeFunc)(NblContext *context, NblValue *this, NblList *values));
 
+NblValue *nbl_value_new_native_typed(NblSignature signature, NblTypedFunc *typedFunc);
+
+// A module is bound in bulk from a table of typed natives
+typedef struct NblBinding {
+    char *name;
+    NblSignature signature;
+    NblTypedFunc *function;
+} NblBinding;
+
+void nbl_module_bind(NblMap *module, NblBinding *bindings, size_t size);
+
+// A saved context refers to natives by their index in a table of the natives of the library followed by the natives
+// that the embedder registered, so natives of the embedder must be registered to be saved. Register them once before
+// any context is made, in the same order in every program that loads the saved contexts
+void nbl_native_register(NblBinding *bindings, size_t size);
+
 char *nbl_value_type_to_string(NblValueType type);
 
 NblValueType nbl_token_type_to_value_type(NblTokenType type);
@@ -371,14 +555,24 @@ NblValue *nbl_value_class_get(NblValue *instance, char *key);
 
 bool nbl_value_class_instanceof(NblValue *instance, NblValue *class);
 
+bool nbl_value_equals(NblValue *a, NblValue *b);
+
 NblValue *nbl_value_ref(NblValue *value);
 
 NblValue *nbl_value_retrieve(NblValue *value);
 
+NblValue *nbl_value_copy(NblValue *value);
+
 void nbl_value_clear(NblValue *value);
 
 void nbl_value_free(NblValue *value);
 
+void nbl_value_retype(NblValue *value, NblValueType type);
+
+void nbl_value_set_string(NblValue *value, char *string);
+
+int64_t nbl_value_size(NblValue *value);
+
 // Parser
 typedef enum NblNodeType {
     NBL_NODE_PROGRAM,
@@ -397,6 +591,9 @@ typedef enum NblNodeType {
     NBL_NODE_RETURN,
     NBL_NODE_THROW,
     NBL_NODE_INCLUDE,
+    NBL_NODE_INCLUDE_ONCE,
+    NBL_NODE_AWAIT,
+    NBL_NODE_YIELD,
 
     NBL_NODE_VALUE,
     NBL_NODE_ARRAY,
@@ -440,6 +637,10 @@ typedef enum NblNodeType {
     NBL_NODE_LOGICAL_OR
 } NblNodeType;
 
+#define NBL_NODE_TYPES (NBL_NODE_LOGICAL_OR + 1)
+
+char *nbl_node_type_to_string(NblNodeType type);
+
 struct NblNode {
     int32_t refs;
     NblNodeType type;
@@ -507,12 +708,18 @@ NblNode *nbl_node_ref(NblNode *node);
 void nbl_node_free(NblNode *node);
 
 typedef struct NblParser {
+    NblLexer *lexer;
     NblList *tokens;
     int32_t position;
+    bool yielded;
 } NblParser;
 
 NblNode *nbl_parser(NblList *tokens, bool included);
 
+NblToken *nbl_parser_token(NblParser *nbl_parser, int32_t offset);
+
+void nbl_parser_release(NblParser *nbl_parser);
+
 void nbl_parser_eat(NblParser *nbl_parser, NblTokenType type);
 
 NblValueType nbl_parser_eat_type(NblParser *nbl_parser);
@@ -535,10 +742,74 @@ NblNode *nbl_parser_mul(NblParser *nbl_parser);
 NblNode *nbl_parser_unary(NblParser *nbl_parser);
 NblNode *nbl_parser_primary(NblParser *nbl_parser);
 NblNode *nbl_parser_primary_suffix(NblParser *nbl_parser, NblNode *node);
-NblNode *nbl_parser_function(NblParser *nbl_parser, NblToken *token);
+NblNode *nbl_parser_function(NblParser *nbl_parser, NblToken *token, bool async);
 NblNode *nbl_parser_class(NblParser *nbl_parser, NblToken *token, bool abstract);
 NblArgument *nbl_parser_argument(NblParser *nbl_parser);
 
+// Cache header
+#define NBL_CACHE_MAGIC 0x434c424e  // "NBLC" in little endian
+#define NBL_CACHE_VERSION 4         // Bump when the node layout or the meaning of a node changes
+
+typedef struct NblCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t textHash;
+    uint64_t textSize;
+    uint64_t dataHash;
+    uint64_t dataSize;
+} NblCacheHeader;
+
+typedef struct NblCacheWriter {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    NblToken *lastToken;
+    bool failed;
+} NblCacheWriter;
+
+typedef struct NblCacheReader {
+    uint8_t *data;
+    size_t size;
+    size_t position;
+    NblSource *source;
+    NblToken *lastToken;
+    bool failed;
+} NblCacheReader;
+
+uint64_t nbl_cache_hash(void *data, size_t size);
+
+char *nbl_cache_path(char *cacheDir, char *path);
+
+void nbl_cache_write(NblCacheWriter *writer, void *data, size_t size);
+void nbl_cache_write_varint(NblCacheWriter *writer, uint64_t value);
+void nbl_cache_write_string(NblCacheWriter *writer, char *string);
+void nbl_cache_write_token(NblCacheWriter *writer, NblToken *token);
+void nbl_cache_write_arguments(NblCacheWriter *writer, NblList *arguments);
+void nbl_cache_write_value(NblCacheWriter *writer, NblValue *value);
+void nbl_cache_write_node(NblCacheWriter *writer, NblNode *node);
+void nbl_cache_write_nodes(NblCacheWriter *writer, NblList *nodes);
+
+void nbl_cache_read(NblCacheReader *reader, void *data, size_t size);
+uint64_t nbl_cache_read_varint(NblCacheReader *reader);
+char *nbl_cache_read_string(NblCacheReader *reader);
+NblToken *nbl_cache_read_token(NblCacheReader *reader);
+NblList *nbl_cache_read_arguments(NblCacheReader *reader);
+NblValue *nbl_cache_read_value(NblCacheReader *reader);
+NblNode *nbl_cache_read_node(NblCacheReader *reader);
+NblList *nbl_cache_read_nodes(NblCacheReader *reader);
+
+uint8_t *nbl_cache_map(char *path, size_t *size);
+
+void nbl_cache_unmap(uint8_t *data, size_t size);
+
+bool nbl_cache_write_file(char *path, void *header, size_t headerSize, NblCacheWriter *writer);
+
+bool nbl_cache_save(char *cachePath, char *text, NblNode *node);
+
+NblNode *nbl_cache_load(char *cachePath, char *path, char *text);
+
+NblNode *nbl_cache_parse(NblInterpreter *interpreter, char *path, char *text, bool included);
+
 // Standard library
 NblMap *nbl_std_env(void);
 
@@ -553,6 +824,24 @@ NblVariable *nbl_variable_new(NblValueType type, bool mutable, NblValue *value);
 
 void nbl_variable_free(NblVariable *variable);
 
+// Builtin variables have no value until their first lookup, so embedders must look up the variables of an env with
+// nbl_std_env_get instead of nbl_map_get, which gives a variable with a NULL value for a builtin that isn't made yet
+NblVariable *nbl_std_env_get(NblMap *env, char *key);
+
+typedef struct NblInclude {
+    NblNode *node;
+    int64_t modifiedTime;
+    int64_t fileSize;
+    bool included;
+    bool kept;  // Included before the mark of the context, so a reset keeps it included
+} NblInclude;
+
+NblInclude *nbl_include_new(NblNode *node, int64_t modifiedTime, int64_t fileSize);
+
+void nbl_include_free(NblInclude *include);
+
+char *nbl_include_path(NblToken *token, char *path);
+
 typedef struct NblExceptionScope {
     NblValue *exceptionValue;
 } NblExceptionScope;
@@ -581,41 +870,591 @@ typedef struct NblScope {
     NblBlockScope *block;
 } NblScope;
 
-typedef struct NblInterpreter {
+typedef struct NblWorker NblWorker;  // Forward define
+typedef struct NblLoop NblLoop;  // Forward define
+typedef struct NblCoroutine NblCoroutine;  // Forward define
+typedef struct NblProfiler NblProfiler;  // Forward define
+typedef struct NblProfilerFrame NblProfilerFrame;  // Forward define
+typedef struct NblCounters NblCounters;  // Forward define
+
+// The bytes that are charged to an interpreter. Values, lists, maps and typed arrays point to the memory they are charged
+// to, so freeing them gives their bytes back to it, whichever eval, host call or thread frees them. The memory outlives
+// its interpreter until the last allocation that points to it is freed. The living values are also counted per type with
+// the bytes of their strings for Memory.stats()
+struct NblMemory {
+    int64_t bytes;
+    int64_t peak;
+    int64_t allocations;
+    int64_t values[NBL_VALUE_TYPES];
+    int64_t stringBytes;
+    bool detached;
+};
+
+// Limits to run scripts that are not trusted, zero is no limit. The memory is the bytes of the values, strings, arrays,
+// objects and typed array buffers that the scripts of a context made while they ran and that are still alive, the steps
+// are the loop iterations and calls of one eval and the time is in milliseconds per eval. Going over a limit throws an
+// exception, which no catch can stop when fatal is set. Otherwise the script can catch it and gets an eighth more of
+// every limit to clean up, going over again is fatal
+typedef struct NblLimits {
+    int64_t memory;
+    int64_t steps;
+    int64_t time;
+    bool fatal;
+} NblLimits;
+
+// All mutable state lives in the context and its interpreter, so different contexts can run on different threads.
+// A context and the values it creates may only be used by one thread at a time
+struct NblInterpreter {
     NblMap *env;
-} NblInterpreter;
+    size_t envMark;  // The globals before this index are kept by a reset of the context
+    int64_t randomSeed;
+    NblMap *includes;
+    int64_t includeHits;
+    int64_t includeMisses;
+    bool cache;
+    char *cacheDir;
+    int32_t threads;
+    NblWorker *worker;
+    NblLoop *loop;
+    NblCoroutine *coroutine;
+    NblProfiler *profiler;
+    NblCounters *counters;
+    bool memoryStats;  // Memory.stats() was called, so the values are counted from then on
+    NblLimits limits;
+    bool limited;
+    bool exceeded;
+    bool aborted;
+    int64_t steps;
+    NblMemory *memory;
+    int64_t maxSteps;
+    int64_t maxMemory;
+    int64_t deadline;
+    NblInterpreter *parent;  // A parallel isolate also stops when the interpreter it runs for is interrupted
+#ifdef NBL_THREADS
+    atomic_bool interrupted;
+#else
+    volatile sig_atomic_t interrupted;
+#endif
+};
+
+// Loops and calls stop the eval when the context is interrupted or has limits that it goes over
+#define nbl_interpreter_checks(interpreter) ((interpreter)->limited || (interpreter)->interrupted || (interpreter)->parent != NULL)
 
 struct NblContext {
     int32_t refs;
-    NblMap *env;
+    NblMap *env;  // Look up variables with nbl_std_env_get, the builtins have no value until then
+    NblInterpreter *interpreter;
     NblScope *scope;
     NblNode *node;
 };
 
 NblVariable *nbl_block_scope_get(NblBlockScope *block, char *key);
 
+// A program is parsed once and can be run many times, in the same context or in other contexts. Like a context it may
+// only be used by one thread at a time
+typedef struct NblProgram {
+    int32_t refs;
+    NblNode *node;
+} NblProgram;
+
+NblProgram *nbl_program_new(char *path, char *text);
+
+NblProgram *nbl_program_new_file(char *path);
+
+NblProgram *nbl_program_ref(NblProgram *program);
+
+void nbl_program_free(NblProgram *program);
+
 NblContext *nbl_context_new(void);
 
+NblContext *nbl_context_new_isolate(NblContext *context);
+
 NblValue *nbl_context_eval_text(NblContext *context, char *text);
 
 NblValue *nbl_context_eval_text_statement(NblContext *context, char *text);
 
 NblValue *nbl_context_eval_file(NblContext *context, char *path);
 
+NblValue *nbl_context_eval_stream(NblContext *context, char *path, FILE *file);
+
+NblValue *nbl_context_run(NblContext *context, NblProgram *program);
+
+void nbl_context_set(NblContext *context, char *key, NblValue *value);
+
+void nbl_context_bind(NblContext *context, char *name, NblBinding *bindings, size_t size);
+
+void nbl_context_mark(NblContext *context);
+
+void nbl_context_reset(NblContext *context);
+
+void nbl_context_print_stats(NblContext *context, FILE *file);
+
+int64_t nbl_context_snapshot(NblContext *context, FILE *file);
+
+void nbl_context_memory_stats(NblContext *context, int64_t *values, int64_t *bytes);
+
+// A context file holds the variables of a context, every value they reach and the parsed includes
+#define NBL_CONTEXT_MAGIC 0x534c424e  // "NBLS" in little endian
+#define NBL_CONTEXT_VERSION 4
+
+typedef struct NblContextHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fingerprint;
+    uint64_t dataHash;
+    uint64_t dataSize;
+} NblContextHeader;
+
+bool nbl_context_save(NblContext *context, char *path);
+
+NblContext *nbl_context_load(char *path);
+
+void nbl_context_set_limits(NblContext *context, NblLimits limits);
+
+void nbl_context_interrupt(NblContext *context);
+
 NblContext *nbl_context_ref(NblContext *context);
 
 void nbl_context_free(NblContext *context);
 
-NblValue *nbl_interpreter(NblMap *env, NblNode *node);
+NblInterpreter *nbl_interpreter_new(NblMap *env);
+
+void nbl_interpreter_free(NblInterpreter *interpreter);
+
+typedef struct NblPreloader {
+    NblInterpreter *interpreter;
+    NblList *paths;
+    NblInclude **includes;
+#ifdef NBL_THREADS
+    atomic_size_t next;
+#else
+    size_t next;
+#endif
+} NblPreloader;
+
+void nbl_interpreter_preload(NblInterpreter *interpreter, NblNode *node);
+
+void nbl_interpreter_preload_find(NblInterpreter *interpreter, NblNode *node, NblList *paths);
+
+int nbl_interpreter_preload_worker(void *data);
+
+NblValue *nbl_interpreter(NblContext *context, NblNode *node);
+
+void nbl_interpreter_print_exception(NblValue *exception);
 
 NblValue *nbl_type_error_exception(NblValueType expected, NblValueType got);
 
 NblValue *nbl_interpreter_call(NblContext *context, NblValue *callValue, NblValue *this, NblList *arguments);
 
+void nbl_interpreter_arguments_free(NblList *arguments, bool typed);
+
+NblValue *nbl_interpreter_call_typed(NblContext *context, NblValue *native, NblList *arguments);
+
+NblValue *nbl_interpreter_call_function(NblContext *context, NblValue *function, NblValue *this, NblList *arguments);
+
 NblValue *nbl_interpreter_throw(NblContext *context, NblValue *exception);
 
+NblInterpreter *nbl_interpreter_limits_start(NblInterpreter *interpreter);
+
+void nbl_interpreter_limits_end(NblInterpreter *owner);
+
+bool nbl_interpreter_interrupted(NblInterpreter *interpreter);
+
+bool nbl_interpreter_stopped(NblInterpreter *interpreter, NblScope *scope, NblNode *node);
+
+NblValue *nbl_interpreter_throw_limit(NblContext *context, char *error, bool fatal);
+
 NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, NblNode *node);
 
+NblValue *nbl_interpreter_get(NblInterpreter *interpreter, NblScope *scope, NblNode *node, NblValue *containerValue);
+
+// Worker
+#ifdef NBL_THREADS
+typedef struct NblChannel {
+    mtx_t mutex;
+    cnd_t condition;
+    NblList *messages;
+    size_t position;
+    bool closed;
+} NblChannel;
+
+NblChannel *nbl_channel_new(void);
+
+void nbl_channel_send(NblChannel *channel, NblValue *message);
+
+void nbl_channel_wait(NblChannel *channel);
+
+NblValue *nbl_channel_receive(NblChannel *channel, NblInterpreter *interpreter);
+
+void nbl_channel_close(NblChannel *channel);
+
+void nbl_channel_free(NblChannel *channel);
+
+// A worker runs a function or a file in its own context on its own thread. The function, its arguments, the
+// messages and the result are deep copied, so the two contexts never share a value
+struct NblWorker {
+    NblNative native;
+    NblContext *context;
+    NblValue *function;
+    NblList *arguments;
+    thrd_t thread;
+    NblChannel *inbox;
+    NblChannel *outbox;
+    bool joined;
+    NblValue *result;
+    char *error;
+};
+
+NblWorker *nbl_worker_new(NblContext *context, NblValue *function, NblList *arguments);
+
+int nbl_worker_run(void *data);
+
+void nbl_worker_interrupt(NblWorker *worker);
+
+bool nbl_worker_join(NblWorker *worker, NblInterpreter *interpreter);
+
+void nbl_worker_free(NblWorker *worker);
+#endif
+
+// Parallel
+typedef enum NblParallelType {
+    NBL_PARALLEL_MAP,
+    NBL_PARALLEL_FILTER,
+    NBL_PARALLEL_REDUCE
+} NblParallelType;
+
+// The items are split in chunks that the threads take one by one, so a thread that is done early takes more chunks
+typedef struct NblParallel {
+    NblParallelType type;
+    NblValue **items;
+    NblValue **results;
+    size_t size;
+    size_t chunkSize;
+    size_t chunksSize;
+#ifdef NBL_THREADS
+    atomic_size_t next;
+    atomic_bool failed;
+#else
+    size_t next;
+    bool failed;
+#endif
+} NblParallel;
+
+typedef struct NblParallelWorker {
+    NblParallel *parallel;
+    NblContext *context;
+    NblValue *function;
+    char *error;
+} NblParallelWorker;
+
+char *nbl_parallel_run(NblContext *context, NblParallel *parallel, NblValue *function);
+
+int nbl_parallel_worker(void *data);
+
+// Async
+// A coroutine runs an async function or a generator on a stack of its own on the thread of its context, resuming it
+// switches to that stack until the coroutine suspends again. The interpreter evaluates the tree recursively, so the
+// frames of a suspended function are kept on that stack instead of in a frame that can be resumed. The pages of the
+// stack are only used when they are touched
+#define NBL_COROUTINE_STACK_SIZE (8 << 20)
+
+struct NblCoroutine {
+    NblInterpreter *interpreter;
+    NblValue *function;
+    NblValue *this;
+    NblList *arguments;
+    NblValue *task;
+#ifdef _WIN32
+    LPVOID fiber;
+    LPVOID caller;
+#else
+    void *stack;
+    ucontext_t context;
+    ucontext_t caller;
+#endif
+    int64_t allocations;
+    int64_t children;
+    bool running;
+    bool started;
+    bool done;
+    bool cancelled;
+    NblValue *transfer;
+    NblValue *returnValue;
+    NblValue *exception;
+    NblCoroutine *previous;
+    NblProfilerFrame *profilerFrame;
+};
+
+NblCoroutine *nbl_coroutine_new(NblInterpreter *interpreter, NblValue *function, NblValue *this, NblList *arguments);
+
+void nbl_coroutine_resume(NblCoroutine *coroutine, NblValue *transfer);
+
+bool nbl_coroutine_start(NblCoroutine *coroutine);
+
+void nbl_coroutine_switch(NblCoroutine *coroutine);
+
+void nbl_coroutine_run(NblCoroutine *coroutine);
+
+bool nbl_coroutine_suspend(NblCoroutine *coroutine);
+
+void nbl_coroutine_finish(NblCoroutine *coroutine);
+
+void nbl_coroutine_cancel(NblCoroutine *coroutine);
+
+void nbl_coroutine_free(NblCoroutine *coroutine);
+
+typedef struct NblGenerator {
+    NblNative native;
+    NblCoroutine *coroutine;
+} NblGenerator;
+
+void nbl_generator_free(NblGenerator *generator);
+
+typedef struct NblTask {
+    NblNative native;
+    bool done;
+    bool awaited;
+    NblValue *result;
+    NblValue *exception;
+    NblList *waiters;
+    NblCoroutine *coroutine;
+} NblTask;
+
+NblValue *nbl_task_new(NblContext *context);
+
+NblTask *nbl_task_get(NblValue *value);
+
+void nbl_task_resolve(NblInterpreter *interpreter, NblValue *task, NblValue *result, NblValue *exception);
+
+void nbl_task_free(NblTask *task);
+
+typedef struct NblTimer {
+    int64_t time;
+    NblValue *task;
+} NblTimer;
+
+#ifndef _WIN32
+typedef struct NblReader {
+    int fd;
+    FILE *pipe;
+    NblValue *task;
+    char *buffer;
+    size_t size;
+    size_t capacity;
+} NblReader;
+#endif
+
+// The event loop of a context runs the tasks of async functions that are ready and waits with poll for timers and
+// for files and pipes that can be read
+struct NblLoop {
+    NblList *ready;
+    size_t readyPosition;
+    NblList *timers;
+    NblList *readers;
+    NblList *coroutines;
+};
+
+NblLoop *nbl_loop_get(NblInterpreter *interpreter);
+
+bool nbl_loop_run(NblInterpreter *interpreter, NblTask *until);
+
+void nbl_loop_wait(NblInterpreter *interpreter);
+
+void nbl_loop_free(NblLoop *loop);
+
+NblValue *nbl_interpreter_call_coroutine(NblContext *context, NblValue *function, NblValue *this, NblList *arguments);
+
+NblValue *nbl_interpreter_await(NblContext *context, NblValue *value);
+
+NblValue *nbl_interpreter_yield(NblContext *context, NblValue *value);
+
+// Range
+// A range is iterated lazily by for in loops and by its next method, so it uses no memory for its numbers
+typedef struct NblRange {
+    NblNative native;
+    int64_t start;
+    int64_t end;
+    int64_t step;
+    int64_t current;
+} NblRange;
+
+NblValue *nbl_range_new(NblContext *context, int64_t start, int64_t end, int64_t step);
+
+NblRange *nbl_range_get(NblValue *value);
+
+bool nbl_range_has(NblRange *range, int64_t number);
+
+void nbl_range_free(NblRange *range);
+
+// Iterators
+NblValue *nbl_iterator_get_next(NblValue *iterator);
+
+bool nbl_iterator_next(NblContext *context, NblValue *iterator, NblValue *next, NblValue **value);
+
+// Stream
+// A stream pulls the items of its source one at a time through all its stages, so no arrays are made between the stages
+typedef enum NblStreamStageType {
+    NBL_STREAM_MAP,
+    NBL_STREAM_FILTER,
+    NBL_STREAM_SKIP,
+    NBL_STREAM_TAKE,
+} NblStreamStageType;
+
+typedef struct NblStreamStage {
+    NblStreamStageType type;
+    NblValue *function;
+    int64_t count;
+    int64_t seen;
+} NblStreamStage;
+
+typedef struct NblStream {
+    NblNative native;
+    NblValue *source;
+    NblValue *next;
+    size_t position;
+    int64_t current;
+    bool done;
+    NblStreamStage *stages;
+    size_t stagesSize;
+} NblStream;
+
+NblStream *nbl_stream_new(NblContext *context, NblValue *source);
+
+NblValue *nbl_stream_new_value(NblContext *context, NblStream *stream);
+
+NblStream *nbl_stream_get(NblValue *value);
+
+NblStream *nbl_stream_add_stage(NblStream *stream, NblStreamStageType type, NblValue *function, int64_t count);
+
+bool nbl_stream_next(NblContext *context, NblStream *stream, NblValue **value);
+
+void nbl_stream_free(NblStream *stream);
+
+// Typed arrays
+// Typed arrays keep their numbers unboxed in one buffer, indexing and for in loops read and write the buffer directly
+typedef struct NblTypedArray {
+    NblNative native;
+    NblMemory *memory;
+    NblValueType type;
+    size_t size;
+    union {
+        int64_t *integers;
+        double *floats;
+    };
+} NblTypedArray;
+
+NblTypedArray *nbl_typed_array_new(NblValueType type, size_t size);
+
+NblValue *nbl_typed_array_new_value(NblContext *context, NblTypedArray *typedArray);
+
+NblTypedArray *nbl_typed_array_get(NblValue *value);
+
+NblValue *nbl_typed_array_get_item(NblTypedArray *typedArray, size_t index);
+
+bool nbl_typed_array_set_item(NblTypedArray *typedArray, size_t index, NblValue *value);
+
+void nbl_typed_array_free(NblTypedArray *typedArray);
+
+// Bulk numeric kernels, they use AVX2 vectors when the CPU has them, SSE2 vectors when not and plain loops without SIMD
+typedef enum NblBulkOperation {
+    NBL_BULK_SUM,
+    NBL_BULK_MIN,
+    NBL_BULK_MAX,
+    NBL_BULK_DOT,
+    NBL_BULK_ADD,
+    NBL_BULK_MUL,
+    NBL_BULK_SCALE,
+} NblBulkOperation;
+
+double nbl_floats_reduce(NblBulkOperation operation, double *a, double *b, size_t size);
+
+void nbl_floats_map(NblBulkOperation operation, double *result, double *a, double *b, double factor, size_t size);
+
+int64_t nbl_integers_reduce(NblBulkOperation operation, int64_t *a, int64_t *b, size_t size);
+
+void nbl_integers_map(NblBulkOperation operation, int64_t *result, int64_t *a, int64_t *b, int64_t factor, size_t size);
+
+#ifdef NBL_SIMD
+// The vector loops return how many items they did, the plain loops do the rest
+NBL_AVX2 size_t nbl_floats_reduce_avx2(NblBulkOperation operation, double *a, double *b, size_t size, double *result);
+
+NBL_AVX2 size_t nbl_floats_map_avx2(NblBulkOperation operation, double *result, double *a, double *b, double factor, size_t size);
+
+NBL_AVX2 size_t nbl_integers_sum_avx2(int64_t *a, size_t size, int64_t *result);
+
+NBL_AVX2 size_t nbl_integers_add_avx2(int64_t *result, int64_t *a, int64_t *b, size_t size);
+#endif
+
+// Profiler
+// A sampling profiler: a SIGPROF timer counts ticks and the interpreter takes a sample at the next node it runs, so
+// the signal handler does nothing else. The timer is for the whole process, so only one profiler can run at a time
+extern volatile sig_atomic_t nbl_profiler_ticks;
+
+// Every call pushes a frame that lives on the C stack, node is the node that runs in the frame
+struct NblProfilerFrame {
+    NblProfilerFrame *parent;
+    NblValue *function;
+    NblNode *callNode;
+    NblNode *node;
+};
+
+typedef struct NblProfilerCount {
+    int64_t self;
+    int64_t total;
+} NblProfilerCount;
+
+// The samples are counted per folded stack, per function and per source line
+struct NblProfiler {
+    int32_t interval;
+    NblProfilerFrame root;
+    NblProfilerFrame *frame;
+    int64_t samples;
+    NblMap *stacks;
+    NblMap *functions;
+    NblMap *lines;
+};
+
+NblProfiler *nbl_profiler_new(int32_t interval);
+
+bool nbl_profiler_start(NblProfiler *profiler);
+
+void nbl_profiler_stop(NblProfiler *profiler);
+
+void nbl_profiler_push(NblProfiler *profiler, NblProfilerFrame *frame, NblValue *function, NblNode *callNode);
+
+void nbl_profiler_pop(NblProfiler *profiler, NblProfilerFrame *frame);
+
+char *nbl_profiler_frame_name(NblProfilerFrame *frame);
+
+void nbl_profiler_sample(NblProfiler *profiler);
+
+void nbl_profiler_print(NblProfiler *profiler, FILE *file);
+
+void nbl_profiler_print_folded(NblProfiler *profiler, FILE *file);
+
+void nbl_profiler_free(NblProfiler *profiler);
+
+// Counters
+// Deterministic counters for regression tests: executed nodes and the values they allocated themselves per node type,
+// calls per function by the place it is defined, native calls and thrown exceptions
+struct NblCounters {
+    int64_t nodes[NBL_NODE_TYPES];
+    int64_t allocations[NBL_NODE_TYPES];
+    NblMap *calls;
+    int64_t nativeCalls;
+    int64_t exceptions;
+};
+
+NblCounters *nbl_counters_new(void);
+
+NblValue *nbl_counters_node(NblInterpreter *interpreter, NblScope *scope, NblNode *node);
+
+void nbl_counters_call(NblCounters *counters, NblValue *function);
+
+void nbl_counters_print(NblCounters *counters, FILE *file);
+
+void nbl_counters_free(NblCounters *counters);
+
 #endif
 
 #if defined(NBL_IMPLEMENTATION) && !defined(NBL_CODE)
@@ -633,10 +1472,8 @@ char *strndup(const char *str, size_t size) {
 }
 
 // Utils
-int64_t nbl_random_seed;
-
-double nbl_random_random(void) {
-    double x = sin(nbl_random_seed++ * 10000);
+double nbl_random_random(int64_t *seed) {
+    double x = sin((*seed)++ * 10000);
     return x - floor(x);
 }
 
@@ -655,7 +1492,7 @@ int64_t nbl_time_ms(void) {
 #else
     struct timeval time;
     gettimeofday(&time, NULL);
-    return time.tv_sec * 1000 + time.tv_usec;
+    return (int64_t)time.tv_sec * 1000 + time.tv_usec / 1000;
 #endif
 }
 
@@ -672,24 +1509,74 @@ char *nbl_file_read(char *path) {
     return buffer;
 }
 
-void nbl_print_error(NblToken *token, char *fmt, ...) {
-    fprintf(stderr, "%s:%d:%d ERROR: ", token->source->path, token->line, token->column);
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
-    va_end(args);
-
-    // Seek to the right line in text
-    char *c = token->source->text;
-    for (int32_t i = 0; i < token->line - 1; i++) {
-        while (*c != '\n' && *c != '\r') c++;
-        if (*c == '\r') c++;
-        c++;
+bool nbl_file_stat(char *path, int64_t *modifiedTime, int64_t *fileSize) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) return false;
+    *modifiedTime = ((int64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    *fileSize = ((int64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+#else
+    struct stat fileStat;
+    if (stat(path, &fileStat) == -1) return false;
+    *modifiedTime = fileStat.st_mtime;
+    *fileSize = fileStat.st_size;
+#endif
+    return true;
+}
+
+char *nbl_path_normalize(char *path) {
+    // Removes empty and . segments and resolves .. segments without touching the file system
+    char *normalized = malloc(strlen(path) + 2);
+    size_t size = 0;
+    if (path[0] == '/') normalized[size++] = '/';
+    size_t start = size;
+    char *c = path;
+    while (*c != '\0') {
+        while (*c == '/') c++;
+        char *segment = c;
+        while (*c != '/' && *c != '\0') c++;
+        size_t segmentSize = c - segment;
+        if (segmentSize == 0 || (segmentSize == 1 && segment[0] == '.')) continue;
+
+        if (segmentSize == 2 && segment[0] == '.' && segment[1] == '.') {
+            size_t lastSegment = size;
+            while (lastSegment > start && normalized[lastSegment - 1] != '/') lastSegment--;
+            if (lastSegment < size && !(size - lastSegment == 2 && normalized[lastSegment] == '.' && normalized[lastSegment + 1] == '.')) {
+                size = lastSegment > start ? lastSegment - 1 : start;
+                continue;
+            }
+            if (start > 0) continue;
+        }
+
+        if (size > start) normalized[size++] = '/';
+        memcpy(&normalized[size], segment, segmentSize);
+        size += segmentSize;
     }
-    char *lineStart = c;
-    while (*c != '\n' && *c != '\r' && *c != '\0') c++;
-    int32_t lineLength = c - lineStart;
+    if (size == 0) normalized[size++] = '.';
+    normalized[size] = '\0';
+    return normalized;
+}
+
+int32_t nbl_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    return systemInfo.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+#endif
+}
+
+void nbl_print_error(NblToken *token, char *fmt, ...) {
+    fprintf(stderr, "%s:%d:%d ERROR: ", token->source->path, token->line, token->column);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
 
+    size_t lineLength;
+    char *lineStart = nbl_source_line(token->source, token->line, &lineLength);
     fprintf(stderr, "\n%4d | ", token->line);
     fwrite(lineStart, 1, lineLength, stderr);
     fprintf(stderr, "\n     | ");
@@ -697,14 +1584,62 @@ void nbl_print_error(NblToken *token, char *fmt, ...) {
     fprintf(stderr, "^\n");
 }
 
+// Memory
+// The interpreter that runs on this thread, the allocations of its scripts are charged to its memory: values, strings,
+// the buffers of lists, maps and typed arrays. It only does that when it has a memory limit or collects stats or its
+// scripts asked for Memory.stats(), so other scripts don't pay for it
+#ifdef NBL_THREADS
+static _Thread_local NblInterpreter *nbl_memory_owner = NULL;
+#else
+static NblInterpreter *nbl_memory_owner = NULL;
+#endif
+
+#define nbl_memory_counted(interpreter) ((interpreter)->limits.memory > 0 || (interpreter)->counters != NULL || (interpreter)->memoryStats)
+
+static void nbl_memory_count(NblMemory *memory, int64_t size) {
+    memory->bytes += size;
+    if (memory->bytes > memory->peak) memory->peak = memory->bytes;
+}
+
+static NblMemory *nbl_memory_charge(int64_t size) {
+    // Charges a new allocation to the interpreter that runs on this thread, returns the memory the allocation points to
+    if (nbl_memory_owner == NULL) return NULL;
+    NblMemory *memory = nbl_memory_owner->memory;
+    memory->allocations++;
+    nbl_memory_count(memory, size);
+    return memory;
+}
+
+static void nbl_memory_grow(NblMemory **memory, int64_t size, int64_t growth) {
+    // An allocation that was made when no interpreter was counted is charged with its size when it grows while one is,
+    // so a script can't go over its limit by filling a list or object of the host
+    if (*memory == NULL) *memory = nbl_memory_charge(size);
+    if (*memory != NULL) nbl_memory_count(*memory, growth);
+}
+
+static void nbl_memory_release(NblMemory *memory, int64_t size) {
+    memory->allocations--;
+    nbl_memory_count(memory, -size);
+    if (memory->detached && memory->allocations == 0) free(memory);
+}
+
+static bool nbl_memory_available(int64_t size) {
+    // Allocation sites that can throw ask this before they allocate, so one big string or buffer can't go over the
+    // memory limit. Making the exception of a limit turns the limits off, so that doesn't hit the limit again
+    NblInterpreter *owner = nbl_memory_owner;
+    return owner == NULL || owner->limits.memory == 0 || !owner->limited || owner->memory->bytes + size <= owner->maxMemory;
+}
+
 // List
 NblList *nbl_list_new(void) { return nbl_list_new_with_capacity(8); }
 
 NblList *nbl_list_new_with_capacity(size_t capacity) {
     NblList *list = malloc(sizeof(NblList));
     list->refs = 1;
-    list->items = malloc(sizeof(void *) * capacity);
-    list->capacity = capacity;
+    list->capacity = MAX(capacity, 1);
+    list->items = malloc(sizeof(void *) * list->capacity);
+    list->memory = nbl_memory_charge(sizeof(NblList) + sizeof(void *) * list->capacity);
+    list->start = 0;
     list->size = 0;
     return list;
 }
@@ -714,33 +1649,81 @@ NblList *nbl_list_ref(NblList *list) {
     return list;
 }
 
+static size_t nbl_list_slot(NblList *list, size_t index) {
+    size_t slot = list->start + index;
+    return slot >= list->capacity ? slot - list->capacity : slot;
+}
+
+static void nbl_list_grow(NblList *list, size_t capacity) {
+    // The items that wrapped around are moved behind the old capacity, so they stay in order
+    size_t oldCapacity = list->capacity;
+    while (list->capacity < capacity) list->capacity *= 2;
+    if (list->capacity == oldCapacity) return;
+    list->items = realloc(list->items, sizeof(void *) * list->capacity);
+    nbl_memory_grow(&list->memory, sizeof(NblList) + sizeof(void *) * oldCapacity, sizeof(void *) * (list->capacity - oldCapacity));
+    if (list->start + list->size > oldCapacity) {
+        memcpy(&list->items[oldCapacity], list->items, sizeof(void *) * (list->start + list->size - oldCapacity));
+    }
+}
+
 void *nbl_list_get(NblList *list, size_t index) {
     if (index < list->size) {
-        return list->items[index];
+        return list->items[nbl_list_slot(list, index)];
     }
     return NULL;
 }
 
 void nbl_list_set(NblList *list, size_t index, void *item) {
-    if (index > list->capacity) {
-        while (index > list->capacity) list->capacity *= 2;
-        list->items = realloc(list->items, sizeof(void *) * list->capacity);
-    }
-    if (index > list->size) {
-        for (size_t i = list->size; i < index - 1; i++) {
-            list->items[i] = NULL;
+    if (index >= list->size) {
+        nbl_list_grow(list, index + 1);
+        for (size_t i = list->size; i < index; i++) {
+            list->items[nbl_list_slot(list, i)] = NULL;
         }
         list->size = index + 1;
     }
-    list->items[index] = item;
+    list->items[nbl_list_slot(list, index)] = item;
 }
 
 void nbl_list_add(NblList *list, void *item) {
-    if (list->size == list->capacity) {
-        list->capacity *= 2;
-        list->items = realloc(list->items, sizeof(void *) * list->capacity);
+    if (list->size == list->capacity) nbl_list_grow(list, list->capacity * 2);
+    list->items[nbl_list_slot(list, list->size++)] = item;
+}
+
+void *nbl_list_pop(NblList *list) {
+    if (list->size == 0) return NULL;
+    return list->items[nbl_list_slot(list, --list->size)];
+}
+
+void nbl_list_unshift(NblList *list, void *item) {
+    if (list->size == list->capacity) nbl_list_grow(list, list->capacity * 2);
+    list->start = list->start == 0 ? list->capacity - 1 : list->start - 1;
+    list->items[list->start] = item;
+    list->size++;
+}
+
+void *nbl_list_shift(NblList *list) {
+    if (list->size == 0) return NULL;
+    void *item = list->items[list->start];
+    list->start = nbl_list_slot(list, 1);
+    list->size--;
+    return item;
+}
+
+void **nbl_list_items(NblList *list) {
+    // Moves the items to the start of the buffer, for code that works on all items at once
+    if (list->start == 0) return list->items;
+    if (list->start + list->size <= list->capacity) {
+        memmove(list->items, &list->items[list->start], sizeof(void *) * list->size);
+    } else {
+        void **items = malloc(sizeof(void *) * list->capacity);
+        size_t headSize = list->capacity - list->start;
+        memcpy(items, &list->items[list->start], sizeof(void *) * headSize);
+        memcpy(&items[headSize], list->items, sizeof(void *) * (list->size - headSize));
+        free(list->items);
+        list->items = items;
     }
-    list->items[list->size++] = item;
+    list->start = 0;
+    return list->items;
 }
 
 char *nbl_list_to_string(NblList *list) {
@@ -762,11 +1745,11 @@ void nbl_list_free(NblList *list, NblListFreeFunc *freeFunc) {
 
     if (freeFunc != NULL) {
         for (size_t i = 0; i < list->size; i++) {
-            if (list->items[i] != NULL) {
-                freeFunc(list->items[i]);
-            }
+            void *item = list->items[nbl_list_slot(list, i)];
+            if (item != NULL) freeFunc(item);
         }
     }
+    if (list->memory != NULL) nbl_memory_release(list->memory, sizeof(NblList) + sizeof(void *) * list->capacity);
     free(list->items);
     free(list);
 }
@@ -781,6 +1764,7 @@ NblMap *nbl_map_new_with_capacity(size_t capacity) {
     map->values = malloc(sizeof(void *) * capacity);
     map->capacity = capacity;
     map->size = 0;
+    map->memory = nbl_memory_charge(sizeof(NblMap) + (sizeof(char *) + sizeof(void *)) * capacity);
     return map;
 }
 
@@ -806,7 +1790,9 @@ void nbl_map_set(NblMap *map, char *key, void *item) {
         }
     }
 
+    int64_t growth = strlen(key) + 1;
     if (map->size == map->capacity) {
+        growth += (sizeof(char *) + sizeof(void *)) * map->capacity;
         map->capacity *= 2;
         map->keys = realloc(map->keys, sizeof(char *) * map->capacity);
         map->values = realloc(map->values, sizeof(void *) * map->capacity);
@@ -814,12 +1800,20 @@ void nbl_map_set(NblMap *map, char *key, void *item) {
     map->keys[map->size] = strdup(key);
     map->values[map->size] = item;
     map->size++;
+    if (map->memory != NULL || nbl_memory_owner != NULL) nbl_memory_grow(&map->memory, nbl_map_bytes(map) - growth, growth);
+}
+
+int64_t nbl_map_bytes(NblMap *map) {
+    int64_t size = sizeof(NblMap) + (sizeof(char *) + sizeof(void *)) * map->capacity;
+    for (size_t i = 0; i < map->size; i++) size += strlen(map->keys[i]) + 1;
+    return size;
 }
 
 void nbl_map_free(NblMap *map, NblMapFreeFunc *freeFunc) {
     map->refs--;
     if (map->refs > 0) return;
 
+    if (map->memory != NULL) nbl_memory_release(map->memory, nbl_map_bytes(map));
     for (size_t i = 0; i < map->size; i++) {
         free(map->keys[i]);
         if (freeFunc != NULL) {
@@ -836,7 +1830,11 @@ NblSource *nbl_source_new(char *path, char *text) {
     NblSource *source = malloc(sizeof(NblSource));
     source->refs = 1;
     source->path = strdup(path);
-    source->text = strdup(text);
+    size_t textSize = strlen(text);
+    source->text = malloc(textSize + 1 + NBL_SOURCE_PADDING);
+    memcpy(source->text, text, textSize);
+    memset(source->text + textSize, '\0', 1 + NBL_SOURCE_PADDING);
+    source->firstLine = 1;
 
     // Reverse loop over path to find basename
     char *c = source->path + strlen(source->path);
@@ -847,6 +1845,21 @@ NblSource *nbl_source_new(char *path, char *text) {
     return source;
 }
 
+char *nbl_source_line(NblSource *source, int32_t line, size_t *size) {
+    // Seek to the right line in text, a line that is not in the text is empty
+    char *c = source->text;
+    for (int32_t i = source->firstLine; i < line && *c != '\0'; i++) {
+        while (*c != '\n' && *c != '\r' && *c != '\0') c++;
+        if (*c == '\r' && *(c + 1) == '\n') c++;
+        if (*c != '\0') c++;
+    }
+    if (line < source->firstLine) c += strlen(c);
+    char *lineStart = c;
+    while (*c != '\n' && *c != '\r' && *c != '\0') c++;
+    *size = c - lineStart;
+    return lineStart;
+}
+
 NblSource *nbl_source_ref(NblSource *source) {
     source->refs++;
     return source;
@@ -993,6 +2006,10 @@ char *nbl_token_type_to_string(NblTokenType type) {
     if (type == NBL_TOKEN_CATCH) return "catch";
     if (type == NBL_TOKEN_FINALLY) return "finally";
     if (type == NBL_TOKEN_INCLUDE) return "include";
+    if (type == NBL_TOKEN_INCLUDE_ONCE) return "include_once";
+    if (type == NBL_TOKEN_ASYNC) return "async";
+    if (type == NBL_TOKEN_AWAIT) return "await";
+    if (type == NBL_TOKEN_YIELD) return "yield";
     return NULL;
 }
 
@@ -1024,107 +2041,270 @@ int64_t nbl_string_to_int(char *string) {
 
 double nbl_string_to_float(char *string) { return strtod(string, NULL); }
 
-NblList *nbl_lexer(char *path, char *text) {
-    NblKeyword keywords[] = {{"instanceof", NBL_TOKEN_INSTANCEOF},
-                             {"any", NBL_TOKEN_TYPE_ANY},
-                             {"null", NBL_TOKEN_NULL},
-                             {"bool", NBL_TOKEN_TYPE_BOOL},
-                             {"true", NBL_TOKEN_TRUE},
-                             {"false", NBL_TOKEN_FALSE},
-                             {"int", NBL_TOKEN_TYPE_INT},
-                             {"float", NBL_TOKEN_TYPE_FLOAT},
-                             {"string", NBL_TOKEN_TYPE_STRING},
-                             {"array", NBL_TOKEN_TYPE_ARRAY},
-                             {"object", NBL_TOKEN_TYPE_OBJECT},
-                             {"class", NBL_TOKEN_CLASS},
-                             {"extends", NBL_TOKEN_EXTENDS},
-                             {"abstract", NBL_TOKEN_ABSTRACT},
-                             {"instance", NBL_TOKEN_TYPE_INSTANCE},
-                             {"function", NBL_TOKEN_TYPE_FUNCTION},
-                             {"fn", NBL_TOKEN_FUNCTION},
-
-                             {"const", NBL_TOKEN_CONST},
-                             {"let", NBL_TOKEN_LET},
-                             {"if", NBL_TOKEN_IF},
-                             {"else", NBL_TOKEN_ELSE},
-                             {"loop", NBL_TOKEN_LOOP},
-                             {"while", NBL_TOKEN_WHILE},
-                             {"do", NBL_TOKEN_DO},
-                             {"for", NBL_TOKEN_FOR},
-                             {"in", NBL_TOKEN_IN},
-                             {"continue", NBL_TOKEN_CONTINUE},
-                             {"break", NBL_TOKEN_BREAK},
-                             {"return", NBL_TOKEN_RETURN},
-                             {"throw", NBL_TOKEN_THROW},
-                             {"try", NBL_TOKEN_TRY},
-                             {"catch", NBL_TOKEN_CATCH},
-                             {"finally", NBL_TOKEN_FINALLY},
-                             {"include", NBL_TOKEN_INCLUDE}};
-
-    NblSource *source = nbl_source_new(path, text);
-    NblList *tokens = nbl_list_new_with_capacity(512);
-    char *c = text;
-    int32_t line = 1;
-    char *lineStart = c;
-    while (*c != '\0') {
-        int32_t column = c - lineStart + 1;
+// Character classes of the lexer, indexed by unsigned character
+static const uint8_t nbl_lexer_classes[256] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  2,  0,  0,  2,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     1,  0,  0,  0, 24,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    20, 20, 20, 20, 20, 20, 20, 20, 20, 20,  0,  0,  0,  0,  0,  0,
+     0, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+    24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,  0,  0,  0,  0, 24,
+     0, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+    24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+};
 
-        // Comments
-        if (*c == '#') {
-            while (*c != '\n' && *c != '\r') c++;
-            continue;
-        }
-        if (*c == '/' && *(c + 1) == '/') {
-            while (*c != '\n' && *c != '\r') c++;
-            continue;
+// Single character syntax tokens, indexed by unsigned character
+static const uint8_t nbl_lexer_syntax[256] = {
+    ['('] = NBL_TOKEN_LPAREN,   ['}'] = NBL_TOKEN_RCURLY,   [')'] = NBL_TOKEN_RPAREN,    ['{'] = NBL_TOKEN_LCURLY, ['['] = NBL_TOKEN_LBRACKET,
+    [']'] = NBL_TOKEN_RBRACKET, ['?'] = NBL_TOKEN_QUESTION, [';'] = NBL_TOKEN_SEMICOLON, [':'] = NBL_TOKEN_COLON,  [','] = NBL_TOKEN_COMMA,
+    ['.'] = NBL_TOKEN_POINT,    ['~'] = NBL_TOKEN_NOT};
+
+// Perfect hash table of all keywords, see nbl_lexer_keyword for the hash function
+static const NblKeyword nbl_lexer_keywords[128] = {
+    [0] = {"else", NBL_TOKEN_ELSE},
+    [8] = {"function", NBL_TOKEN_TYPE_FUNCTION},
+    [13] = {"for", NBL_TOKEN_FOR},
+    [14] = {"finally", NBL_TOKEN_FINALLY},
+    [15] = {"true", NBL_TOKEN_TRUE},
+    [17] = {"async", NBL_TOKEN_ASYNC},
+    [18] = {"bool", NBL_TOKEN_TYPE_BOOL},
+    [21] = {"abstract", NBL_TOKEN_ABSTRACT},
+    [22] = {"int", NBL_TOKEN_TYPE_INT},
+    [25] = {"let", NBL_TOKEN_LET},
+    [28] = {"false", NBL_TOKEN_FALSE},
+    [29] = {"any", NBL_TOKEN_TYPE_ANY},
+    [30] = {"null", NBL_TOKEN_NULL},
+    [34] = {"catch", NBL_TOKEN_CATCH},
+    [40] = {"loop", NBL_TOKEN_LOOP},
+    [41] = {"instanceof", NBL_TOKEN_INSTANCEOF},
+    [42] = {"break", NBL_TOKEN_BREAK},
+    [44] = {"yield", NBL_TOKEN_YIELD},
+    [45] = {"while", NBL_TOKEN_WHILE},
+    [48] = {"try", NBL_TOKEN_TRY},
+    [67] = {"class", NBL_TOKEN_CLASS},
+    [68] = {"await", NBL_TOKEN_AWAIT},
+    [70] = {"const", NBL_TOKEN_CONST},
+    [73] = {"float", NBL_TOKEN_TYPE_FLOAT},
+    [74] = {"string", NBL_TOKEN_TYPE_STRING},
+    [81] = {"if", NBL_TOKEN_IF},
+    [83] = {"array", NBL_TOKEN_TYPE_ARRAY},
+    [85] = {"include", NBL_TOKEN_INCLUDE},
+    [92] = {"include_once", NBL_TOKEN_INCLUDE_ONCE},
+    [94] = {"return", NBL_TOKEN_RETURN},
+    [96] = {"throw", NBL_TOKEN_THROW},
+    [102] = {"fn", NBL_TOKEN_FUNCTION},
+    [103] = {"do", NBL_TOKEN_DO},
+    [105] = {"in", NBL_TOKEN_IN},
+    [106] = {"continue", NBL_TOKEN_CONTINUE},
+    [109] = {"object", NBL_TOKEN_TYPE_OBJECT},
+    [112] = {"instance", NBL_TOKEN_TYPE_INSTANCE},
+    [123] = {"extends", NBL_TOKEN_EXTENDS},
+};
+
+NblTokenType nbl_lexer_keyword(char *string, size_t size) {
+    const NblKeyword *keyword = &nbl_lexer_keywords[((uint8_t)string[0] + (uint8_t)string[size - 1] * 3 + size * 27) & 127];
+    if (keyword->keyword != NULL && !strncmp(string, keyword->keyword, size) && keyword->keyword[size] == '\0') {
+        return keyword->type;
+    }
+    return NBL_TOKEN_KEYWORD;
+}
+
+#ifdef NBL_SIMD
+// Source texts are padded with NBL_SOURCE_PADDING zero bytes so vector loads never read out of bounds
+char *nbl_lexer_find(char *c, char a, char b, char d) {
+    NblVector va = nbl_vector_set1(a), vb = nbl_vector_set1(b), vd = nbl_vector_set1(d), zero = nbl_vector_set1('\0');
+    for (;;) {
+        NblVector chunk = nbl_vector_load(c);
+        uint32_t mask = nbl_vector_mask(nbl_vector_or(nbl_vector_or(nbl_vector_eq(chunk, va), nbl_vector_eq(chunk, vb)),
+                                                      nbl_vector_or(nbl_vector_eq(chunk, vd), nbl_vector_eq(chunk, zero))));
+        if (mask != 0) return c + __builtin_ctz(mask);
+        c += NBL_VECTOR_SIZE;
+    }
+}
+
+char *nbl_lexer_skip_spaces(char *c) {
+    NblVector space = nbl_vector_set1(' '), tab = nbl_vector_set1('\t');
+    for (;;) {
+        NblVector chunk = nbl_vector_load(c);
+        uint32_t mask = ~nbl_vector_mask(nbl_vector_or(nbl_vector_eq(chunk, space), nbl_vector_eq(chunk, tab))) & NBL_VECTOR_MASK;
+        if (mask != 0) return c + __builtin_ctz(mask);
+        c += NBL_VECTOR_SIZE;
+    }
+}
+
+char *nbl_lexer_skip_ident(char *c) {
+    NblVector lowerStart = nbl_vector_set1('a' - 1), lowerEnd = nbl_vector_set1('z' + 1);
+    NblVector digitStart = nbl_vector_set1('0' - 1), digitEnd = nbl_vector_set1('9' + 1);
+    NblVector lowerBit = nbl_vector_set1(0x20), underscore = nbl_vector_set1('_'), dollar = nbl_vector_set1('$');
+    for (;;) {
+        NblVector chunk = nbl_vector_load(c);
+        NblVector lower = nbl_vector_or(chunk, lowerBit);
+        NblVector alpha = nbl_vector_and(nbl_vector_gt(lower, lowerStart), nbl_vector_gt(lowerEnd, lower));
+        NblVector digit = nbl_vector_and(nbl_vector_gt(chunk, digitStart), nbl_vector_gt(digitEnd, chunk));
+        NblVector ident = nbl_vector_or(nbl_vector_or(alpha, digit), nbl_vector_or(nbl_vector_eq(chunk, underscore), nbl_vector_eq(chunk, dollar)));
+        uint32_t mask = ~nbl_vector_mask(ident) & NBL_VECTOR_MASK;
+        if (mask != 0) return c + __builtin_ctz(mask);
+        c += NBL_VECTOR_SIZE;
+    }
+}
+#else
+char *nbl_lexer_find(char *c, char a, char b, char d) {
+    while (*c != a && *c != b && *c != d && *c != '\0') c++;
+    return c;
+}
+
+char *nbl_lexer_skip_spaces(char *c) {
+    while (nbl_lexer_classes[(uint8_t)*c] & NBL_CHAR_SPACE) c++;
+    return c;
+}
+
+char *nbl_lexer_skip_ident(char *c) {
+    while (nbl_lexer_classes[(uint8_t)*c] & NBL_CHAR_IDENT) c++;
+    return c;
+}
+#endif
+
+NblLexer *nbl_lexer_new(char *path, char *text) {
+    NblLexer *lexer = malloc(sizeof(NblLexer));
+    lexer->source = nbl_source_new(path, text);
+    lexer->file = NULL;
+    lexer->size = strlen(text);
+    lexer->capacity = lexer->size;
+    lexer->position = 0;
+    lexer->line = 1;
+    lexer->lineStart = 0;
+    return lexer;
+}
+
+NblLexer *nbl_lexer_new_file(char *path, FILE *file) {
+    NblLexer *lexer = nbl_lexer_new(path, "");
+    lexer->file = file;
+    return lexer;
+}
+
+bool nbl_lexer_fill(NblLexer *lexer) {
+    if (lexer->file == NULL) return false;
+
+    // The lines before the current line are lexed, so only the current line is copied to the new source
+    if (lexer->lineStart >= NBL_LEXER_DROP_SIZE) {
+        NblSource *source = nbl_source_new(lexer->source->path, lexer->source->text + lexer->lineStart);
+        source->firstLine = lexer->line;
+        nbl_source_free(lexer->source);
+        lexer->source = source;
+        lexer->size -= lexer->lineStart;
+        lexer->capacity = lexer->size;
+        lexer->position -= lexer->lineStart;
+        lexer->lineStart = 0;
+    }
+
+    // Read one whole line so only multi line comments and strings can be split between fills
+    char buffer[1024];
+    bool filled = false;
+    while (fgets(buffer, sizeof(buffer), lexer->file) != NULL) {
+        size_t bufferSize = strlen(buffer);
+        if (lexer->size + bufferSize > lexer->capacity) {
+            while (lexer->size + bufferSize > lexer->capacity) lexer->capacity = MAX(lexer->capacity * 2, 1024);
+            lexer->source->text = realloc(lexer->source->text, lexer->capacity + 1 + NBL_SOURCE_PADDING);
         }
-        if (*c == '/' && *(c + 1) == '*') {
-            c += 2;
-            while (*c != '*' || *(c + 1) != '/') {
-                if (*c == '\n' || *c == '\r') {
-                    if (*c == '\r') c++;
-                    c++;
-                    line++;
-                    lineStart = c;
-                    continue;
-                }
-                c++;
-            }
-            c += 2;
-            continue;
+        memcpy(lexer->source->text + lexer->size, buffer, bufferSize);
+        lexer->size += bufferSize;
+        memset(lexer->source->text + lexer->size, '\0', 1 + NBL_SOURCE_PADDING);
+        filled = true;
+        if (buffer[bufferSize - 1] == '\n') break;
+    }
+    return filled;
+}
+
+#define nbl_lexer_token(type, size)                                     \
+    {                                                                   \
+        lexer->position = c + (size) - source->text;                    \
+        return nbl_token_new(type, source, lexer->line, column); \
+    }
+
+NblToken *nbl_lexer_next(NblLexer *lexer) {
+    for (;;) {
+        // A fill can move the lexer to a new source
+        NblSource *source = lexer->source;
+        char *c = source->text + lexer->position;
+        if (*c == '\0') {
+            if (nbl_lexer_fill(lexer)) continue;
+            return nbl_token_new(NBL_TOKEN_EOF, source, lexer->line, lexer->position - lexer->lineStart);
         }
+        uint8_t charClass = nbl_lexer_classes[(uint8_t)*c];
 
-        // Integers
-        if (*c == '0' && *(c + 1) == 'b') {
-            c += 2;
-            nbl_list_add(tokens, nbl_token_new_int(NBL_TOKEN_INT, source, line, column, strtol(c, &c, 2)));
+        // Whitespace
+        if (charClass & NBL_CHAR_SPACE) {
+            lexer->position = nbl_lexer_skip_spaces(c) - source->text;
             continue;
         }
-        if (*c == '0' && (isdigit(*(c + 1)) || *(c + 1) == 'o')) {
-            if (*(c + 1) == 'o') c++;
+        if (charClass & NBL_CHAR_NEWLINE) {
+            if (*c == '\r' && *(c + 1) == '\n') c++;
             c++;
-            nbl_list_add(tokens, nbl_token_new_int(NBL_TOKEN_INT, source, line, column, strtol(c, &c, 8)));
+            lexer->line++;
+            lexer->position = lexer->lineStart = c - source->text;
             continue;
         }
-        if (*c == '0' && *(c + 1) == 'x') {
-            c += 2;
-            nbl_list_add(tokens, nbl_token_new_int(NBL_TOKEN_INT, source, line, column, strtol(c, &c, 16)));
-            continue;
+
+        int32_t column = lexer->position - lexer->lineStart + 1;
+
+        // Keywords
+        if (charClass & NBL_CHAR_IDENT_START) {
+            char *ptr = c;
+            c = nbl_lexer_skip_ident(c);
+            size_t size = c - ptr;
+            lexer->position = c - source->text;
+            NblTokenType type = nbl_lexer_keyword(ptr, size);
+            if (type != NBL_TOKEN_KEYWORD) {
+                return nbl_token_new(type, source, lexer->line, column);
+            }
+            return nbl_token_new_string(NBL_TOKEN_KEYWORD, source, lexer->line, column, strndup(ptr, size));
         }
 
-        if (isdigit(*c)) {
-            char *start = c;
-            bool isFloat = false;
-            while (isdigit(*c) || *c == '.') {
-                if (*c == '.') isFloat = true;
+        // Integers
+        if (charClass & NBL_CHAR_DIGIT) {
+            NblToken *token;
+            if (*c == '0' && *(c + 1) == 'b') {
+                c += 2;
+                token = nbl_token_new_int(NBL_TOKEN_INT, source, lexer->line, column, strtol(c, &c, 2));
+            } else if (*c == '0' && ((nbl_lexer_classes[(uint8_t) * (c + 1)] & NBL_CHAR_DIGIT) || *(c + 1) == 'o')) {
+                if (*(c + 1) == 'o') c++;
                 c++;
-            }
-            if (isFloat) {
-                nbl_list_add(tokens, nbl_token_new_float(source, line, column, strtod(start, &c)));
+                token = nbl_token_new_int(NBL_TOKEN_INT, source, lexer->line, column, strtol(c, &c, 8));
+            } else if (*c == '0' && *(c + 1) == 'x') {
+                c += 2;
+                token = nbl_token_new_int(NBL_TOKEN_INT, source, lexer->line, column, strtol(c, &c, 16));
             } else {
-                nbl_list_add(tokens, nbl_token_new_int(NBL_TOKEN_INT, source, line, column, strtol(start, &c, 10)));
+                char *start = c;
+                bool isFloat = false;
+                while ((nbl_lexer_classes[(uint8_t)*c] & NBL_CHAR_DIGIT) || *c == '.') {
+                    if (*c == '.') isFloat = true;
+                    c++;
+                }
+                if ((*c == 'e' || *c == 'E') && ((nbl_lexer_classes[(uint8_t) * (c + 1)] & NBL_CHAR_DIGIT) ||
+                                                 ((*(c + 1) == '+' || *(c + 1) == '-') && (nbl_lexer_classes[(uint8_t) * (c + 2)] & NBL_CHAR_DIGIT)))) {
+                    isFloat = true;
+                }
+                if (isFloat) {
+                    token = nbl_token_new_float(source, lexer->line, column, strtod(start, &c));
+                } else {
+                    token = nbl_token_new_int(NBL_TOKEN_INT, source, lexer->line, column, strtol(start, &c, 10));
+                }
             }
-            continue;
+            lexer->position = c - source->text;
+            return token;
+        }
+
+        // Syntax
+        if (nbl_lexer_syntax[(uint8_t)*c] != NBL_TOKEN_EOF) {
+            nbl_lexer_token(nbl_lexer_syntax[(uint8_t)*c], 1);
         }
 
         // Strings
@@ -1132,9 +2312,15 @@ NblList *nbl_lexer(char *path, char *text) {
             char endChar = *c;
             c++;
             char *ptr = c;
-            while (*c != endChar) c++;
+            for (;;) {
+                c = nbl_lexer_find(c, endChar, '\\', endChar);
+                if (*c != '\\' || *(c + 1) == '\0') break;
+                c += 2;
+            }
+            if (*c == '\0' && nbl_lexer_fill(lexer)) continue;
             size_t size = c - ptr;
-            c++;
+            if (*c != '\0') c++;
+            lexer->position = c - source->text;
 
             char *string = malloc(size + 1);
             int32_t strpos = 0;
@@ -1166,289 +2352,113 @@ NblList *nbl_lexer(char *path, char *text) {
                 }
             }
             string[strpos] = '\0';
-            nbl_list_add(tokens, nbl_token_new_string(NBL_TOKEN_STRING, source, line, column, string));
-            continue;
-        }
-
-        // Keywords
-        if (isalpha(*c) || *c == '_' || *c == '$') {
-            char *ptr = c;
-            while (isalnum(*c) || *c == '_' || *c == '$') c++;
-            size_t size = c - ptr;
-
-            bool found = false;
-            for (size_t i = 0; i < sizeof(keywords) / sizeof(NblKeyword); i++) {
-                NblKeyword *keyword = &keywords[i];
-                size_t keywordSize = strlen(keyword->keyword);
-                if (!memcmp(ptr, keyword->keyword, keywordSize) && size == keywordSize) {
-                    nbl_list_add(tokens, nbl_token_new(keyword->type, source, line, column));
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                nbl_list_add(tokens, nbl_token_new_string(NBL_TOKEN_KEYWORD, source, line, column, strndup(ptr, size)));
-            }
-            continue;
-        }
-
-        // Syntax
-        if (*c == '(') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_LPAREN, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == ')') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_RPAREN, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '{') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_LCURLY, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '}') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_RCURLY, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '[') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_LBRACKET, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == ']') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_RBRACKET, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '?') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_QUESTION, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == ';') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_SEMICOLON, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == ':') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_COLON, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == ',') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_COMMA, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '.') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_POINT, source, line, column));
-            c++;
-            continue;
+            return nbl_token_new_string(NBL_TOKEN_STRING, source, lexer->line, column, string);
         }
 
-        // Operators
-        if (*c == '=') {
-            if (*(c + 1) == '>') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_FAT_ARROW, source, line, column));
-                c += 2;
-                continue;
-            }
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_EQ, source, line, column));
-                c += 2;
+        // Comments and operators
+        switch (*c) {
+            case '#':
+                lexer->position = nbl_lexer_find(c, '\n', '\r', '\n') - source->text;
                 continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '+') {
-            if (*(c + 1) == '+') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_INC, source, line, column));
-                c += 2;
-                continue;
-            }
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_ADD, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ADD, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '-') {
-            if (*(c + 1) == '-') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_DEC, source, line, column));
-                c += 2;
-                continue;
-            }
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_SUB, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_SUB, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '*') {
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_MUL, source, line, column));
-                c += 2;
-                continue;
-            }
-            if (*(c + 1) == '*') {
-                if (*(c + 2) == '=') {
-                    nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_EXP, source, line, column));
-                    c += 3;
+            case '/':
+                if (*(c + 1) == '/') {
+                    lexer->position = nbl_lexer_find(c, '\n', '\r', '\n') - source->text;
                     continue;
                 }
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_EXP, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_MUL, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '/') {
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_DIV, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_DIV, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '%') {
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_MOD, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_MOD, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '^') {
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_XOR, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_XOR, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '~') {
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_NOT, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '<') {
-            if (*(c + 1) == '<') {
-                if (*(c + 2) == '=') {
-                    nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_SHL, source, line, column));
-                    c += 3;
+                if (*(c + 1) == '*') {
+                    // Find the comment end first so an incomplete comment can be read further
+                    char *end = c + 2;
+                    for (;;) {
+                        end = nbl_lexer_find(end, '*', '*', '*');
+                        if (*end == '\0' || *(end + 1) == '/') break;
+                        end++;
+                    }
+                    if (*end == '\0' && nbl_lexer_fill(lexer)) continue;
+
+                    for (;;) {
+                        c = nbl_lexer_find(c, '\n', '\r', '\n');
+                        if (c >= end) break;
+                        if (*c == '\r' && *(c + 1) == '\n') c++;
+                        c++;
+                        lexer->line++;
+                        lexer->lineStart = c - source->text;
+                    }
+                    lexer->position = (*end != '\0' ? end + 2 : end) - source->text;
                     continue;
                 }
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_SHL, source, line, column));
-                c += 2;
-                continue;
-            }
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_LTEQ, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_LT, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '>') {
-            if (*(c + 1) == '>') {
-                if (*(c + 2) == '=') {
-                    nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_SHR, source, line, column));
-                    c += 3;
-                    continue;
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_DIV, 2);
+                nbl_lexer_token(NBL_TOKEN_DIV, 1);
+            case '=':
+                if (*(c + 1) == '>') nbl_lexer_token(NBL_TOKEN_FAT_ARROW, 2);
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_EQ, 2);
+                nbl_lexer_token(NBL_TOKEN_ASSIGN, 1);
+            case '+':
+                if (*(c + 1) == '+') nbl_lexer_token(NBL_TOKEN_INC, 2);
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_ADD, 2);
+                nbl_lexer_token(NBL_TOKEN_ADD, 1);
+            case '-':
+                if (*(c + 1) == '-') nbl_lexer_token(NBL_TOKEN_DEC, 2);
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_SUB, 2);
+                nbl_lexer_token(NBL_TOKEN_SUB, 1);
+            case '*':
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_MUL, 2);
+                if (*(c + 1) == '*') {
+                    if (*(c + 2) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_EXP, 3);
+                    nbl_lexer_token(NBL_TOKEN_EXP, 2);
                 }
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_SHR, source, line, column));
-                c += 2;
-                continue;
-            }
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_GTEQ, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_GT, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '!') {
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_NEQ, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_LOGICAL_NOT, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '|') {
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_OR, source, line, column));
-                c += 2;
-                continue;
-            }
-            if (*(c + 1) == '|') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_LOGICAL_OR, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_OR, source, line, column));
-            c++;
-            continue;
-        }
-        if (*c == '&') {
-            if (*(c + 1) == '=') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_ASSIGN_AND, source, line, column));
-                c += 2;
-                continue;
-            }
-            if (*(c + 1) == '&') {
-                nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_LOGICAL_AND, source, line, column));
-                c += 2;
-                continue;
-            }
-            nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_AND, source, line, column));
-            c++;
-            continue;
+                nbl_lexer_token(NBL_TOKEN_MUL, 1);
+            case '%':
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_MOD, 2);
+                nbl_lexer_token(NBL_TOKEN_MOD, 1);
+            case '^':
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_XOR, 2);
+                nbl_lexer_token(NBL_TOKEN_XOR, 1);
+            case '<':
+                if (*(c + 1) == '<') {
+                    if (*(c + 2) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_SHL, 3);
+                    nbl_lexer_token(NBL_TOKEN_SHL, 2);
+                }
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_LTEQ, 2);
+                nbl_lexer_token(NBL_TOKEN_LT, 1);
+            case '>':
+                if (*(c + 1) == '>') {
+                    if (*(c + 2) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_SHR, 3);
+                    nbl_lexer_token(NBL_TOKEN_SHR, 2);
+                }
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_GTEQ, 2);
+                nbl_lexer_token(NBL_TOKEN_GT, 1);
+            case '!':
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_NEQ, 2);
+                nbl_lexer_token(NBL_TOKEN_LOGICAL_NOT, 1);
+            case '|':
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_OR, 2);
+                if (*(c + 1) == '|') nbl_lexer_token(NBL_TOKEN_LOGICAL_OR, 2);
+                nbl_lexer_token(NBL_TOKEN_OR, 1);
+            case '&':
+                if (*(c + 1) == '=') nbl_lexer_token(NBL_TOKEN_ASSIGN_AND, 2);
+                if (*(c + 1) == '&') nbl_lexer_token(NBL_TOKEN_LOGICAL_AND, 2);
+                nbl_lexer_token(NBL_TOKEN_AND, 1);
         }
 
-        // Whitespace
-        if (*c == ' ' || *c == '\t') {
-            c++;
-            continue;
-        }
-        if (*c == '\n' || *c == '\r') {
-            if (*c == '\r') c++;
-            c++;
-            line++;
-            lineStart = c;
-            continue;
-        }
+        lexer->position++;
+        return nbl_token_new_int(NBL_TOKEN_UNKNOWN, source, lexer->line, column, *c);
+    }
+}
 
-        nbl_list_add(tokens, nbl_token_new_int(NBL_TOKEN_UNKNOWN, source, line, column, *c));
-        c++;
+void nbl_lexer_free(NblLexer *lexer) {
+    nbl_source_free(lexer->source);
+    free(lexer);
+}
+
+NblList *nbl_lexer(char *path, char *text) {
+    NblLexer *lexer = nbl_lexer_new(path, text);
+    NblList *tokens = nbl_list_new_with_capacity(512);
+    for (;;) {
+        NblToken *token = nbl_lexer_next(lexer);
+        nbl_list_add(tokens, token);
+        if (token->type == NBL_TOKEN_EOF) break;
     }
-    nbl_list_add(tokens, nbl_token_new(NBL_TOKEN_EOF, source, line, c - lineStart));
-    nbl_source_free(source);
+    nbl_lexer_free(lexer);
     return tokens;
 }
 
@@ -1469,13 +2479,64 @@ void nbl_argument_free(NblArgument *argument) {
     free(argument);
 }
 
+// Values are counted per thread, so the counters of a context can see what a node allocated, the children are the
+// values that the nodes under the counted node allocated
+#ifdef NBL_THREADS
+static _Thread_local int64_t nbl_value_allocations = 0;
+static _Thread_local int64_t nbl_counters_children = 0;
+#else
+static int64_t nbl_value_allocations = 0;
+static int64_t nbl_counters_children = 0;
+#endif
+
 NblValue *nbl_value_new(NblValueType type) {
+    nbl_value_allocations++;
     NblValue *value = malloc(sizeof(NblValue));
     value->refs = 1;
     value->type = type;
+    value->memory = nbl_memory_charge(sizeof(NblValue));
+    if (value->memory != NULL) value->memory->values[type]++;
     return value;
 }
 
+void nbl_value_retype(NblValue *value, NblValueType type) {
+    // Types change in place, so that goes through here to keep the counts per type right
+    if (value->memory != NULL) {
+        value->memory->values[value->type]--;
+        value->memory->values[type]++;
+    }
+    value->type = type;
+}
+
+void nbl_value_set_string(NblValue *value, char *string) {
+    // Takes the string of a cleared string value
+    value->string = string;
+    if (string != NULL && (value->memory != NULL || nbl_memory_owner != NULL)) {
+        int64_t size = strlen(string) + 1;
+        if (value->memory == NULL) {
+            nbl_memory_grow(&value->memory, sizeof(NblValue), size);
+            value->memory->values[value->type]++;
+        } else {
+            nbl_memory_count(value->memory, size);
+        }
+        value->memory->stringBytes += size;
+    }
+}
+
+int64_t nbl_value_size(NblValue *value) {
+    // The bytes of the value and the memory it owns itself, not the values it references
+    int64_t size = sizeof(NblValue);
+    if (value->type == NBL_VALUE_STRING && value->string != NULL) size += strlen(value->string) + 1;
+    if (value->type == NBL_VALUE_ARRAY) size += sizeof(NblList) + value->array->capacity * sizeof(void *);
+    if (value->type == NBL_VALUE_OBJECT || value->type == NBL_VALUE_CLASS || value->type == NBL_VALUE_INSTANCE) {
+        size += sizeof(NblMap) + value->object->capacity * (sizeof(char *) + sizeof(void *));
+        for (size_t i = 0; i < value->object->size; i++) size += strlen(value->object->keys[i]) + 1;
+    }
+    NblTypedArray *typedArray = nbl_typed_array_get(value);
+    if (typedArray != NULL) size += sizeof(NblTypedArray) + typedArray->size * sizeof(int64_t);
+    return size;
+}
+
 NblValue *nbl_value_new_null(void) { return nbl_value_new(NBL_VALUE_NULL); }
 
 NblValue *nbl_value_new_bool(bool boolean) {
@@ -1498,7 +2559,7 @@ NblValue *nbl_value_new_float(double floating) {
 
 NblValue *nbl_value_new_string(char *string) {
     NblValue *value = nbl_value_new(NBL_VALUE_STRING);
-    value->string = strdup(string);
+    nbl_value_set_string(value, strdup(string));
     return value;
 }
 
@@ -1535,6 +2596,7 @@ NblValue *nbl_value_new_instance(NblMap *object, NblValue *instanceClass) {
     NblValue *value = nbl_value_new(NBL_VALUE_INSTANCE);
     value->object = object;
     value->instanceClass = instanceClass;
+    value->native = NULL;
     return value;
 }
 
@@ -1542,6 +2604,8 @@ NblValue *nbl_value_new_function(NblList *args, NblValueType returnType, NblNode
     NblValue *value = nbl_value_new(NBL_VALUE_FUNCTION);
     value->arguments = args;
     value->returnType = returnType;
+    value->async = false;
+    value->generator = false;
     value->functionNode = functionNode;
     return value;
 }
@@ -1551,10 +2615,43 @@ NblValue *nbl_value_new_native_function(NblList *args, NblValueType returnType,
     NblValue *value = nbl_value_new(NBL_VALUE_NATIVE_FUNCTION);
     value->arguments = args;
     value->returnType = returnType;
+    value->async = false;
+    value->generator = false;
+    value->signature = NBL_SIGNATURE_VALUES;
     value->nativeFunc = nativeFunc;
     return value;
 }
 
+NblValue *nbl_value_new_native_typed(NblSignature signature, NblTypedFunc *typedFunc) {
+    // The arguments and return type come from the signature, so the call node checks them like for other natives
+    static NblValueType types[][NBL_SIGNATURE_ARGUMENTS + 1] = {
+        [NBL_SIGNATURE_FLOAT_FLOAT] = {NBL_VALUE_FLOAT, NBL_VALUE_FLOAT, NBL_VALUE_NULL},
+        [NBL_SIGNATURE_FLOAT_FLOAT_FLOAT] = {NBL_VALUE_FLOAT, NBL_VALUE_FLOAT, NBL_VALUE_FLOAT},
+        [NBL_SIGNATURE_INT_INT] = {NBL_VALUE_INT, NBL_VALUE_INT, NBL_VALUE_NULL},
+        [NBL_SIGNATURE_INT_INT_INT] = {NBL_VALUE_INT, NBL_VALUE_INT, NBL_VALUE_INT},
+        [NBL_SIGNATURE_INT_STRING] = {NBL_VALUE_INT, NBL_VALUE_STRING, NBL_VALUE_NULL},
+        [NBL_SIGNATURE_STRING_STRING] = {NBL_VALUE_STRING, NBL_VALUE_STRING, NBL_VALUE_NULL},
+    };
+    static char *names[NBL_SIGNATURE_ARGUMENTS] = {"x", "y"};
+    if (signature == NBL_SIGNATURE_VALUES) {
+        return nbl_value_new_native_function(nbl_list_new(), NBL_VALUE_ANY, (NblValue * (*)(NblContext *, NblValue *, NblList *)) typedFunc);
+    }
+    NblList *arguments = nbl_list_new_with_capacity(NBL_SIGNATURE_ARGUMENTS);
+    for (size_t i = 0; i < NBL_SIGNATURE_ARGUMENTS && types[signature][i + 1] != NBL_VALUE_NULL; i++) {
+        nbl_list_add(arguments, nbl_argument_new(names[i], types[signature][i + 1], NULL));
+    }
+    NblValue *value = nbl_value_new_native_function(arguments, types[signature][0], NULL);
+    value->signature = signature;
+    value->typedFunc = typedFunc;
+    return value;
+}
+
+void nbl_module_bind(NblMap *module, NblBinding *bindings, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        nbl_map_set(module, bindings[i].name, nbl_value_new_native_typed(bindings[i].signature, bindings[i].function));
+    }
+}
+
 char *nbl_value_type_to_string(NblValueType type) {
     if (type == NBL_VALUE_ANY) return "any";
     if (type == NBL_VALUE_NULL) return "null";
@@ -1623,7 +2720,7 @@ char *nbl_value_to_string(NblValue *value) {
     }
     if (value->type == NBL_VALUE_FUNCTION || value->type == NBL_VALUE_NATIVE_FUNCTION) {
         NblList *sb = nbl_list_new();
-        nbl_list_add(sb, "fn (");
+        nbl_list_add(sb, value->async ? "async fn (" : "fn (");
         for (size_t i = 0; i < value->arguments->size; i++) {
             NblArgument *argument = nbl_list_get(value->arguments, i);
             nbl_list_add(sb, argument->name);
@@ -1682,6 +2779,18 @@ bool nbl_value_class_instanceof(NblValue *instance, NblValue *class) {
     return false;
 }
 
+bool nbl_value_equals(NblValue *a, NblValue *b) {
+    // Like the == operator but arrays, objects, functions, classes and instances are only equal to themselves
+    if (a->type == NBL_VALUE_NULL || b->type == NBL_VALUE_NULL) return a->type == b->type;
+    if (a->type == NBL_VALUE_BOOL && b->type == NBL_VALUE_BOOL) return a->boolean == b->boolean;
+    if (a->type == NBL_VALUE_INT && b->type == NBL_VALUE_INT) return a->integer == b->integer;
+    if (a->type == NBL_VALUE_FLOAT && b->type == NBL_VALUE_FLOAT) return a->floating == b->floating;
+    if (a->type == NBL_VALUE_INT && b->type == NBL_VALUE_FLOAT) return a->integer == b->floating;
+    if (a->type == NBL_VALUE_FLOAT && b->type == NBL_VALUE_INT) return a->floating == b->integer;
+    if (a->type == NBL_VALUE_STRING && b->type == NBL_VALUE_STRING) return !strcmp(a->string, b->string);
+    return a == b;
+}
+
 NblValue *nbl_value_ref(NblValue *value) {
     value->refs++;
     return value;
@@ -1696,8 +2805,82 @@ NblValue *nbl_value_retrieve(NblValue *value) {
     return nbl_value_ref(value);
 }
 
+static NblValue *nbl_value_deep_copy(NblValue *value) {
+    // Returns NULL for values that can't be copied, like classes, instances and native functions
+    if (value->type == NBL_VALUE_ARRAY) {
+        NblList *items = nbl_list_new_with_capacity(value->array->capacity);
+        for (size_t i = 0; i < value->array->size; i++) {
+            NblValue *item = nbl_list_get(value->array, i);
+            NblValue *itemCopy = item != NULL ? nbl_value_deep_copy(item) : NULL;
+            if (item != NULL && itemCopy == NULL) {
+                nbl_list_free(items, (NblListFreeFunc *)nbl_value_free);
+                return NULL;
+            }
+            nbl_list_add(items, itemCopy);
+        }
+        return nbl_value_new_array(items);
+    }
+    if (value->type == NBL_VALUE_OBJECT) {
+        NblMap *object = nbl_map_new_with_capacity(value->object->capacity);
+        for (size_t i = 0; i < value->object->size; i++) {
+            NblValue *itemCopy = nbl_value_deep_copy(value->object->values[i]);
+            if (itemCopy == NULL) {
+                nbl_map_free(object, (NblMapFreeFunc *)nbl_value_free);
+                return NULL;
+            }
+            nbl_map_set(object, value->object->keys[i], itemCopy);
+        }
+        return nbl_value_new_object(object);
+    }
+    if (value->type == NBL_VALUE_FUNCTION) {
+        // Functions are copied with their nodes by writing and reading them in the cache format
+        NblToken *token = value->functionNode->token;
+        if (token == NULL) return NULL;
+        NblCacheWriter writer = {.data = malloc(256), .size = 0, .capacity = 256, .lastToken = NULL, .failed = false};
+        nbl_cache_write_value(&writer, value);
+        NblValue *copy = NULL;
+        if (!writer.failed) {
+            NblCacheReader reader = {.data = writer.data,
+                                     .size = writer.size,
+                                     .position = 0,
+                                     .source = nbl_source_new(token->source->path, token->source->text),
+                                     .lastToken = NULL,
+                                     .failed = false};
+            reader.source->firstLine = token->source->firstLine;
+            copy = nbl_cache_read_value(&reader);
+            if (reader.lastToken != NULL) nbl_token_free(reader.lastToken);
+            nbl_source_free(reader.source);
+            if (reader.failed) {
+                nbl_value_free(copy);
+                copy = NULL;
+            }
+        }
+        free(writer.data);
+        return copy;
+    }
+    if (value->type == NBL_VALUE_CLASS || value->type == NBL_VALUE_INSTANCE || value->type == NBL_VALUE_NATIVE_FUNCTION) {
+        return NULL;
+    }
+    return nbl_value_retrieve(value);
+}
+
+NblValue *nbl_value_copy(NblValue *value) {
+    // Deep copy that shares nothing with the original, so it can be given to another context on another thread. The
+    // copy is charged to no interpreter, because the thread that frees it doesn't run the interpreter of this thread
+    NblInterpreter *owner = nbl_memory_owner;
+    nbl_memory_owner = NULL;
+    NblValue *copy = nbl_value_deep_copy(value);
+    nbl_memory_owner = owner;
+    return copy;
+}
+
 void nbl_value_clear(NblValue *value) {
-    if (value->type == NBL_VALUE_STRING) {
+    if (value->type == NBL_VALUE_STRING && value->string != NULL) {
+        if (value->memory != NULL) {
+            int64_t size = strlen(value->string) + 1;
+            nbl_memory_count(value->memory, -size);
+            value->memory->stringBytes -= size;
+        }
         free(value->string);
     }
     if (value->type == NBL_VALUE_ARRAY) {
@@ -1708,6 +2891,9 @@ void nbl_value_clear(NblValue *value) {
         if ((value->type == NBL_VALUE_CLASS || value->type == NBL_VALUE_INSTANCE) && value->parentClass != NULL) {
             nbl_value_free(value->parentClass);
         }
+        if (value->type == NBL_VALUE_INSTANCE && value->native != NULL) {
+            value->native->free(value->native);
+        }
     }
     if (value->type == NBL_VALUE_FUNCTION || value->type == NBL_VALUE_NATIVE_FUNCTION) {
         nbl_list_free(value->arguments, (NblListFreeFunc *)nbl_argument_free);
@@ -1721,6 +2907,10 @@ void nbl_value_free(NblValue *value) {
     value->refs--;
     if (value->refs > 0) return;
     nbl_value_clear(value);
+    if (value->memory != NULL) {
+        value->memory->values[value->type]--;
+        nbl_memory_release(value->memory, sizeof(NblValue));
+    }
     free(value);
 }
 
@@ -1729,9 +2919,7 @@ NblNode *nbl_node_new(NblNodeType type, NblToken *token) {
     NblNode *node = malloc(sizeof(NblNode));
     node->refs = 1;
     node->type = type;
-    if (token != NULL) {
-        node->token = nbl_token_ref(token);
-    }
+    node->token = token != NULL ? nbl_token_ref(token) : NULL;
     return node;
 }
 
@@ -1773,6 +2961,16 @@ NblNode *nbl_node_new_multiple(NblNodeType type, NblToken *token) {
     return node;
 }
 
+char *nbl_node_type_to_string(NblNodeType type) {
+    static char *names[NBL_NODE_TYPES] = {
+        "program", "nodes", "block", "if", "try", "tenary", "loop", "while", "dowhile", "for", "forin", "continue", "break", "return",
+        "throw", "include", "include_once", "await", "yield", "value", "array", "object", "class", "call", "neg", "inc_pre", "dec_pre",
+        "inc_post", "dec_post", "not", "logical_not", "cast", "variable", "const_assign", "let_assign", "assign", "get", "add", "sub",
+        "mul", "exp", "div", "mod", "and", "xor", "or", "shl", "shr", "instanceof", "eq", "neq", "lt", "lteq", "gt", "gteq",
+        "logical_and", "logical_or"};
+    return names[type];
+}
+
 NblNode *nbl_node_ref(NblNode *node) {
     node->refs++;
     return node;
@@ -1800,10 +2998,10 @@ void nbl_node_free(NblNode *node) {
             nbl_node_free(node->parentClass);
         }
     }
-    if ((node->type >= NBL_NODE_RETURN && node->type <= NBL_NODE_INCLUDE) || (node->type >= NBL_NODE_NEG && node->type <= NBL_NODE_CAST)) {
+    if ((node->type >= NBL_NODE_RETURN && node->type <= NBL_NODE_YIELD) || (node->type >= NBL_NODE_NEG && node->type <= NBL_NODE_CAST)) {
         nbl_node_free(node->unary);
     }
-    if (node->type >= NBL_NODE_GET && node->type <= NBL_NODE_LOGICAL_OR) {
+    if (node->type >= NBL_NODE_CONST_ASSIGN && node->type <= NBL_NODE_LOGICAL_OR) {
         nbl_node_free(node->lhs);
         nbl_node_free(node->rhs);
     }
@@ -1821,12 +3019,33 @@ void nbl_node_free(NblNode *node) {
 }
 
 NblNode *nbl_parser(NblList *tokens, bool included) {
-    NblParser nbl_parser = {.tokens = tokens, .position = 0};
+    NblParser nbl_parser = {.lexer = NULL, .tokens = tokens, .position = 0, .yielded = false};
     return nbl_parser_program(&nbl_parser, included);
 }
 
-#define current() ((NblToken *)nbl_list_get(nbl_parser->tokens, nbl_parser->position))
-#define next(pos) ((NblToken *)nbl_list_get(nbl_parser->tokens, nbl_parser->position + 1 + pos))
+NblToken *nbl_parser_token(NblParser *nbl_parser, int32_t offset) {
+    size_t index = nbl_parser->position + offset;
+    if (nbl_parser->lexer != NULL) {
+        while (index >= nbl_parser->tokens->size) {
+            nbl_list_add(nbl_parser->tokens, nbl_lexer_next(nbl_parser->lexer));
+        }
+    } else if (index >= nbl_parser->tokens->size) {
+        index = nbl_parser->tokens->size - 1;
+    }
+    return nbl_list_get(nbl_parser->tokens, index);
+}
+
+void nbl_parser_release(NblParser *nbl_parser) {
+    // Free all tokens before the current position when the parser pulls its tokens from a lexer
+    if (nbl_parser->lexer == NULL) return;
+    for (int32_t i = 0; i < nbl_parser->position; i++) {
+        nbl_token_free(nbl_list_shift(nbl_parser->tokens));
+    }
+    nbl_parser->position = 0;
+}
+
+#define current() nbl_parser_token(nbl_parser, 0)
+#define next(pos) nbl_parser_token(nbl_parser, 1 + pos)
 
 void nbl_parser_eat(NblParser *nbl_parser, NblTokenType type) {
     if (current()->type == type) {
@@ -1853,6 +3072,7 @@ NblNode *nbl_parser_program(NblParser *nbl_parser, bool included) {
     while (current()->type != NBL_TOKEN_EOF) {
         NblNode *node = nbl_parser_statement(nbl_parser);
         if (node != NULL) nbl_list_add(programNode->nodes, node);
+        nbl_parser_release(nbl_parser);
     }
     return programNode;
 }
@@ -1961,7 +3181,7 @@ NblNode *nbl_parser_statement(NblParser *nbl_parser) {
         NblToken *token = current();
         nbl_parser_eat(nbl_parser, NBL_TOKEN_FOR);
         nbl_parser_eat(nbl_parser, NBL_TOKEN_LPAREN);
-        NblNode *declarations;
+        NblNode *declarations = NULL;
         if (current()->type != NBL_TOKEN_SEMICOLON) {
             declarations = nbl_parser_declarations(nbl_parser);
         }
@@ -2037,15 +3257,27 @@ NblNode *nbl_parser_statement(NblParser *nbl_parser) {
         nbl_parser_eat(nbl_parser, NBL_TOKEN_SEMICOLON);
         return node;
     }
+    if (current()->type == NBL_TOKEN_INCLUDE_ONCE) {
+        NblToken *token = current();
+        nbl_parser_eat(nbl_parser, NBL_TOKEN_INCLUDE_ONCE);
+        NblNode *node = nbl_node_new_unary(NBL_NODE_INCLUDE_ONCE, token, nbl_parser_tenary(nbl_parser));
+        nbl_parser_eat(nbl_parser, NBL_TOKEN_SEMICOLON);
+        return node;
+    }
 
-    if (current()->type == NBL_TOKEN_FUNCTION) {
+    if (current()->type == NBL_TOKEN_FUNCTION || (current()->type == NBL_TOKEN_ASYNC && next(0)->type == NBL_TOKEN_FUNCTION && next(1)->type == NBL_TOKEN_KEYWORD)) {
         NblToken *functionToken = current();
+        bool async = false;
+        if (current()->type == NBL_TOKEN_ASYNC) {
+            async = true;
+            nbl_parser_eat(nbl_parser, NBL_TOKEN_ASYNC);
+        }
         nbl_parser_eat(nbl_parser, NBL_TOKEN_FUNCTION);
         NblToken *nameToken = current();
         char *name = current()->string;
         nbl_parser_eat(nbl_parser, NBL_TOKEN_KEYWORD);
         NblNode *node = nbl_node_new_operation(NBL_NODE_CONST_ASSIGN, functionToken, nbl_node_new_string(NBL_NODE_VARIABLE, nameToken, name),
-                                           nbl_parser_function(nbl_parser, functionToken));
+                                           nbl_parser_function(nbl_parser, functionToken, async));
         node->declarationType = NBL_VALUE_FUNCTION;
         return node;
     }
@@ -2413,6 +3645,22 @@ NblNode *nbl_parser_unary(NblParser *nbl_parser) {
         nbl_parser_eat(nbl_parser, NBL_TOKEN_LOGICAL_NOT);
         return nbl_node_new_unary(NBL_NODE_LOGICAL_NOT, token, nbl_parser_unary(nbl_parser));
     }
+    if (current()->type == NBL_TOKEN_AWAIT) {
+        NblToken *token = current();
+        nbl_parser_eat(nbl_parser, NBL_TOKEN_AWAIT);
+        return nbl_node_new_unary(NBL_NODE_AWAIT, token, nbl_parser_unary(nbl_parser));
+    }
+    if (current()->type == NBL_TOKEN_YIELD) {
+        // A yield marks the function around it as a generator, without a value it yields null
+        NblToken *token = current();
+        nbl_parser_eat(nbl_parser, NBL_TOKEN_YIELD);
+        nbl_parser->yielded = true;
+        if (current()->type == NBL_TOKEN_SEMICOLON || current()->type == NBL_TOKEN_RPAREN || current()->type == NBL_TOKEN_RBRACKET ||
+            current()->type == NBL_TOKEN_RCURLY || current()->type == NBL_TOKEN_COMMA) {
+            return nbl_node_new_unary(NBL_NODE_YIELD, token, nbl_node_new_value(token, nbl_value_new_null()));
+        }
+        return nbl_node_new_unary(NBL_NODE_YIELD, token, nbl_parser_tenary(nbl_parser));
+    }
     if (current()->type == NBL_TOKEN_LPAREN && nbl_token_type_is_type(next(0)->type) && next(1)->type == NBL_TOKEN_RPAREN) {
         NblToken *token = current();
         nbl_parser_eat(nbl_parser, NBL_TOKEN_LPAREN);
@@ -2486,12 +3734,17 @@ NblNode *nbl_parser_primary(NblParser *nbl_parser) {
         node->object = nbl_map_new();
         nbl_parser_eat(nbl_parser, NBL_TOKEN_LCURLY);
         while (current()->type != NBL_TOKEN_RCURLY) {
-            if (current()->type == NBL_TOKEN_FUNCTION) {
+            if (current()->type == NBL_TOKEN_FUNCTION || current()->type == NBL_TOKEN_ASYNC) {
                 NblToken *functionToken = current();
+                bool async = false;
+                if (current()->type == NBL_TOKEN_ASYNC) {
+                    async = true;
+                    nbl_parser_eat(nbl_parser, NBL_TOKEN_ASYNC);
+                }
                 nbl_parser_eat(nbl_parser, NBL_TOKEN_FUNCTION);
                 char *keyName = current()->string;
                 nbl_parser_eat(nbl_parser, NBL_TOKEN_KEYWORD);
-                nbl_map_set(node->object, keyName, nbl_parser_function(nbl_parser, functionToken));
+                nbl_map_set(node->object, keyName, nbl_parser_function(nbl_parser, functionToken, async));
                 continue;
             }
 
@@ -2513,10 +3766,15 @@ NblNode *nbl_parser_primary(NblParser *nbl_parser) {
         nbl_parser_eat(nbl_parser, NBL_TOKEN_RCURLY);
         return nbl_parser_primary_suffix(nbl_parser, node);
     }
-    if (current()->type == NBL_TOKEN_FUNCTION) {
+    if (current()->type == NBL_TOKEN_FUNCTION || current()->type == NBL_TOKEN_ASYNC) {
         NblToken *functionToken = current();
+        bool async = false;
+        if (current()->type == NBL_TOKEN_ASYNC) {
+            async = true;
+            nbl_parser_eat(nbl_parser, NBL_TOKEN_ASYNC);
+        }
         nbl_parser_eat(nbl_parser, NBL_TOKEN_FUNCTION);
-        return nbl_parser_primary_suffix(nbl_parser, nbl_parser_function(nbl_parser, functionToken));
+        return nbl_parser_primary_suffix(nbl_parser, nbl_parser_function(nbl_parser, functionToken, async));
     }
     if (current()->type == NBL_TOKEN_ABSTRACT || current()->type == NBL_TOKEN_CLASS) {
         NblToken *classToken = current();
@@ -2578,7 +3836,7 @@ NblNode *nbl_parser_primary_suffix(NblParser *nbl_parser, NblNode *node) {
     return node;
 }
 
-NblNode *nbl_parser_function(NblParser *nbl_parser, NblToken *token) {
+NblNode *nbl_parser_function(NblParser *nbl_parser, NblToken *token, bool async) {
     NblList *arguments = nbl_list_new();
     nbl_parser_eat(nbl_parser, NBL_TOKEN_LPAREN);
     while (current()->type != NBL_TOKEN_RPAREN) {
@@ -2597,12 +3855,27 @@ NblNode *nbl_parser_function(NblParser *nbl_parser, NblToken *token) {
         returnType = nbl_parser_eat_type(nbl_parser);
     }
 
+    // A function with a yield in its own body is a generator
+    bool yielded = nbl_parser->yielded;
+    nbl_parser->yielded = false;
+    NblNode *functionNode;
     if (current()->type == NBL_TOKEN_FAT_ARROW) {
         NblToken *fatArrowToken = current();
         nbl_parser_eat(nbl_parser, NBL_TOKEN_FAT_ARROW);
-        return nbl_node_new_value(token, nbl_value_new_function(arguments, returnType, nbl_node_new_unary(NBL_NODE_RETURN, fatArrowToken, nbl_parser_tenary(nbl_parser))));
+        functionNode = nbl_node_new_unary(NBL_NODE_RETURN, fatArrowToken, nbl_parser_tenary(nbl_parser));
+    } else {
+        functionNode = nbl_parser_block(nbl_parser);
+    }
+    if (async && nbl_parser->yielded) {
+        nbl_print_error(token, "Async functions can't yield");
+        exit(EXIT_FAILURE);
     }
-    return nbl_node_new_value(token, nbl_value_new_function(arguments, returnType, nbl_parser_block(nbl_parser)));
+
+    NblValue *function = nbl_value_new_function(arguments, returnType, functionNode);
+    function->async = async;
+    function->generator = nbl_parser->yielded;
+    nbl_parser->yielded = yielded;
+    return nbl_node_new_value(token, function);
 }
 
 NblNode *nbl_parser_class(NblParser *nbl_parser, NblToken *token, bool abstract) {
@@ -2615,12 +3888,17 @@ NblNode *nbl_parser_class(NblParser *nbl_parser, NblToken *token, bool abstract)
     NblMap *object = nbl_map_new();
     nbl_parser_eat(nbl_parser, NBL_TOKEN_LCURLY);
     while (current()->type != NBL_TOKEN_RCURLY) {
-        if (current()->type == NBL_TOKEN_FUNCTION) {
+        if (current()->type == NBL_TOKEN_FUNCTION || current()->type == NBL_TOKEN_ASYNC) {
             NblToken *functionToken = current();
+            bool async = false;
+            if (current()->type == NBL_TOKEN_ASYNC) {
+                async = true;
+                nbl_parser_eat(nbl_parser, NBL_TOKEN_ASYNC);
+            }
             nbl_parser_eat(nbl_parser, NBL_TOKEN_FUNCTION);
             char *keyName = current()->string;
             nbl_parser_eat(nbl_parser, NBL_TOKEN_KEYWORD);
-            nbl_map_set(object, keyName, nbl_parser_function(nbl_parser, functionToken));
+            nbl_map_set(object, keyName, nbl_parser_function(nbl_parser, functionToken, async));
             continue;
         }
 
@@ -2660,120 +3938,520 @@ NblArgument *nbl_parser_argument(NblParser *nbl_parser) {
     return nbl_argument_new(name, type, defaultNode);
 }
 
-// Standard library
-
-// Math
-static NblValue *env_math_abs(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    if (x->type == NBL_VALUE_INT) {
-        return nbl_value_new_int(x->integer < 0 ? -x->integer : x->integer);
+// Cache
+uint64_t nbl_cache_hash(void *data, size_t size) {
+    // FNV-1a
+    uint8_t *bytes = data;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
     }
-    if (x->type == NBL_VALUE_FLOAT) {
-        return nbl_value_new_float(x->floating < 0 ? -x->floating : x->floating);
-    }
-    return nbl_value_new_null();
+    return hash;
 }
-static NblValue *env_math_sin(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(sin(x->floating));
+
+char *nbl_cache_path(char *cacheDir, char *path) {
+    // Without a cache dir the cache file is written next to the source: script.nbl -> script.nblc
+    if (cacheDir == NULL) {
+        size_t pathSize = strlen(path);
+        char *cachePath = malloc(pathSize + 2);
+        memcpy(cachePath, path, pathSize);
+        cachePath[pathSize] = 'c';
+        cachePath[pathSize + 1] = '\0';
+        return cachePath;
+    }
+    char *cachePath = malloc(strlen(cacheDir) + 24);
+    sprintf(cachePath, "%s/%016" PRIx64 ".nblc", cacheDir, nbl_cache_hash(path, strlen(path)));
+    return cachePath;
 }
-static NblValue *env_math_cos(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(cos(x->floating));
+
+void nbl_cache_write(NblCacheWriter *writer, void *data, size_t size) {
+    if (writer->size + size > writer->capacity) {
+        while (writer->size + size > writer->capacity) writer->capacity *= 2;
+        writer->data = realloc(writer->data, writer->capacity);
+    }
+    memcpy(writer->data + writer->size, data, size);
+    writer->size += size;
 }
-static NblValue *env_math_tan(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(tan(x->floating));
+
+void nbl_cache_write_varint(NblCacheWriter *writer, uint64_t value) {
+    // LEB128: seven bits per byte, the high bit is set when more bytes follow
+    while (value >= 0x80) {
+        uint8_t byte = (value & 0x7f) | 0x80;
+        nbl_cache_write(writer, &byte, sizeof(uint8_t));
+        value >>= 7;
+    }
+    uint8_t byte = value;
+    nbl_cache_write(writer, &byte, sizeof(uint8_t));
 }
-static NblValue *env_math_asin(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(asin(x->floating));
+
+void nbl_cache_write_string(NblCacheWriter *writer, char *string) {
+    size_t size = strlen(string);
+    nbl_cache_write_varint(writer, size);
+    nbl_cache_write(writer, string, size);
 }
-static NblValue *env_math_acos(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(acos(x->floating));
+
+void nbl_cache_write_token(NblCacheWriter *writer, NblToken *token) {
+    // After parsing tokens are only used for error locations, so their payload is not stored. Parent and child
+    // nodes often share a token, so the same token as the previous one is stored as a zero byte and no token, like in
+    // the default arguments of natives, as a one byte, else the line is stored as a zigzag encoded difference with
+    // the previous token
+    if (token == writer->lastToken) {
+        nbl_cache_write_varint(writer, 0);
+        return;
+    }
+    if (token == NULL) {
+        nbl_cache_write_varint(writer, 1);
+        return;
+    }
+    int64_t lineDelta = (int64_t)token->line - (writer->lastToken != NULL ? writer->lastToken->line : 0);
+    nbl_cache_write_varint(writer, token->type + 2);
+    nbl_cache_write_varint(writer, ((uint64_t)lineDelta << 1) ^ (uint64_t)(lineDelta >> 63));
+    nbl_cache_write_varint(writer, token->column);
+    writer->lastToken = token;
 }
-static NblValue *env_math_atan(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(atan(x->floating));
+
+void nbl_cache_write_arguments(NblCacheWriter *writer, NblList *arguments) {
+    nbl_cache_write_varint(writer, arguments->size);
+    nbl_list_foreach(arguments, NblArgument * argument, {
+        int32_t argumentType = argument->type;
+        nbl_cache_write_string(writer, argument->name);
+        nbl_cache_write(writer, &argumentType, sizeof(int32_t));
+        nbl_cache_write_node(writer, argument->defaultNode);
+    });
 }
-static NblValue *env_math_atan2(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *y = nbl_list_get(values, 0);
-    NblValue *x = nbl_list_get(values, 1);
-    return nbl_value_new_float(atan2(y->floating, x->floating));
+
+void nbl_cache_write_value(NblCacheWriter *writer, NblValue *value) {
+    uint8_t type = value->type;
+    nbl_cache_write(writer, &type, sizeof(uint8_t));
+    if (value->type == NBL_VALUE_BOOL) {
+        uint8_t boolean = value->boolean;
+        nbl_cache_write(writer, &boolean, sizeof(uint8_t));
+    } else if (value->type == NBL_VALUE_INT || value->type == NBL_VALUE_FLOAT) {
+        nbl_cache_write(writer, &value->integer, sizeof(int64_t));
+    } else if (value->type == NBL_VALUE_STRING) {
+        nbl_cache_write_string(writer, value->string);
+    } else if (value->type == NBL_VALUE_FUNCTION) {
+        nbl_cache_write_arguments(writer, value->arguments);
+        int32_t returnType = value->returnType;
+        nbl_cache_write(writer, &returnType, sizeof(int32_t));
+        uint8_t flags = (value->async ? 1 : 0) | (value->generator ? 2 : 0);
+        nbl_cache_write(writer, &flags, sizeof(uint8_t));
+        nbl_cache_write_node(writer, value->functionNode);
+    } else if (value->type != NBL_VALUE_NULL) {
+        // Other values are created at runtime and can't be stored
+        writer->failed = true;
+    }
+}
+
+void nbl_cache_write_node(NblCacheWriter *writer, NblNode *node) {
+    uint8_t type = node != NULL ? node->type : UINT8_MAX;
+    nbl_cache_write(writer, &type, sizeof(uint8_t));
+    if (node == NULL) return;
+
+    nbl_cache_write_token(writer, node->token);
+    if (node->type == NBL_NODE_VALUE) {
+        nbl_cache_write_value(writer, node->value);
+    }
+    if (node->type == NBL_NODE_VARIABLE) {
+        nbl_cache_write_string(writer, node->string);
+    }
+    if (node->type == NBL_NODE_ARRAY) {
+        nbl_cache_write_nodes(writer, node->array);
+    }
+    if (node->type == NBL_NODE_OBJECT || node->type == NBL_NODE_CLASS) {
+        nbl_cache_write_varint(writer, node->object->size);
+        nbl_map_foreach(node->object, char *key, NblNode *child, {
+            nbl_cache_write_string(writer, key);
+            nbl_cache_write_node(writer, child);
+        });
+        if (node->type == NBL_NODE_CLASS) {
+            uint8_t abstract = node->abstract;
+            nbl_cache_write_node(writer, node->parentClass);
+            nbl_cache_write(writer, &abstract, sizeof(uint8_t));
+        }
+    }
+    if ((node->type >= NBL_NODE_RETURN && node->type <= NBL_NODE_YIELD) || (node->type >= NBL_NODE_NEG && node->type <= NBL_NODE_CAST)) {
+        if (node->type == NBL_NODE_CAST) {
+            int32_t castType = node->castType;
+            nbl_cache_write(writer, &castType, sizeof(int32_t));
+        }
+        nbl_cache_write_node(writer, node->unary);
+    }
+    if (node->type >= NBL_NODE_CONST_ASSIGN && node->type <= NBL_NODE_LOGICAL_OR) {
+        if (node->type == NBL_NODE_CONST_ASSIGN || node->type == NBL_NODE_LET_ASSIGN) {
+            int32_t declarationType = node->declarationType;
+            nbl_cache_write(writer, &declarationType, sizeof(int32_t));
+        }
+        nbl_cache_write_node(writer, node->lhs);
+        nbl_cache_write_node(writer, node->rhs);
+    }
+    if (node->type >= NBL_NODE_IF && node->type <= NBL_NODE_FORIN) {
+        nbl_cache_write_node(writer, node->condition);
+        nbl_cache_write_node(writer, node->thenBlock);
+        nbl_cache_write_node(writer, node->elseBlock);
+        if (node->type == NBL_NODE_TRY) nbl_cache_write_node(writer, node->finallyBlock);
+    }
+    if ((node->type >= NBL_NODE_PROGRAM && node->type <= NBL_NODE_BLOCK) || node->type == NBL_NODE_CALL) {
+        if (node->type == NBL_NODE_CALL) nbl_cache_write_node(writer, node->function);
+        nbl_cache_write_nodes(writer, node->nodes);
+    }
 }
-static NblValue *env_math_pow(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    NblValue *y = nbl_list_get(values, 1);
-    return nbl_value_new_float(pow(x->floating, y->floating));
+
+void nbl_cache_write_nodes(NblCacheWriter *writer, NblList *nodes) {
+    nbl_cache_write_varint(writer, nodes->size);
+    nbl_list_foreach(nodes, NblNode * child, { nbl_cache_write_node(writer, child); });
 }
-static NblValue *env_math_sqrt(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(sqrt(x->floating));
+
+void nbl_cache_read(NblCacheReader *reader, void *data, size_t size) {
+    // Reading past the end marks the reader as failed and yields zeros, so the node tree stays consistent and can be freed
+    if (reader->failed || size > reader->size - reader->position) {
+        reader->failed = true;
+        memset(data, 0, size);
+        return;
+    }
+    memcpy(data, reader->data + reader->position, size);
+    reader->position += size;
 }
-static NblValue *env_math_floor(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(floor(x->floating));
+
+uint64_t nbl_cache_read_varint(NblCacheReader *reader) {
+    uint64_t value = 0;
+    for (int32_t shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+        nbl_cache_read(reader, &byte, sizeof(uint8_t));
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) break;
+    }
+    return value;
 }
-static NblValue *env_math_ceil(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(ceil(x->floating));
+
+char *nbl_cache_read_string(NblCacheReader *reader) {
+    uint64_t size = nbl_cache_read_varint(reader);
+    if (size > reader->size - reader->position) {
+        reader->failed = true;
+        size = 0;
+    }
+    char *string = strndup((char *)reader->data + reader->position, size);
+    reader->position += size;
+    return string;
 }
-static NblValue *env_math_round(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(round(x->floating));
+
+NblToken *nbl_cache_read_token(NblCacheReader *reader) {
+    uint64_t type = nbl_cache_read_varint(reader);
+    if (type == 0) return reader->lastToken != NULL ? nbl_token_ref(reader->lastToken) : NULL;
+    if (type == 1) return NULL;
+    uint64_t lineDelta = nbl_cache_read_varint(reader);
+    int32_t line = (reader->lastToken != NULL ? reader->lastToken->line : 0) + (int32_t)((lineDelta >> 1) ^ -(lineDelta & 1));
+    int32_t column = nbl_cache_read_varint(reader);
+    NblToken *token = nbl_token_new(type - 2, reader->source, line, column);
+    token->string = NULL;
+    if (reader->lastToken != NULL) nbl_token_free(reader->lastToken);
+    reader->lastToken = nbl_token_ref(token);
+    return token;
 }
-static NblValue *env_math_min(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *first = nbl_list_get(values, 0);
-    int64_t minInteger;
-    double minFloating;
-    if (first->type == NBL_VALUE_INT) {
-        minInteger = first->integer;
-        minFloating = first->integer;
+
+NblList *nbl_cache_read_arguments(NblCacheReader *reader) {
+    uint64_t argumentsSize = nbl_cache_read_varint(reader);
+    NblList *arguments = nbl_list_new();
+    for (uint64_t i = 0; i < argumentsSize && !reader->failed; i++) {
+        char *name = nbl_cache_read_string(reader);
+        int32_t argumentType;
+        nbl_cache_read(reader, &argumentType, sizeof(int32_t));
+        nbl_list_add(arguments, nbl_argument_new(name, argumentType, nbl_cache_read_node(reader)));
+        free(name);
+    }
+    return arguments;
+}
+
+NblValue *nbl_cache_read_value(NblCacheReader *reader) {
+    uint8_t type;
+    nbl_cache_read(reader, &type, sizeof(uint8_t));
+    if (type == NBL_VALUE_BOOL) {
+        uint8_t boolean;
+        nbl_cache_read(reader, &boolean, sizeof(uint8_t));
+        return nbl_value_new_bool(boolean);
+    }
+    if (type == NBL_VALUE_INT || type == NBL_VALUE_FLOAT) {
+        NblValue *value = nbl_value_new(type);
+        nbl_cache_read(reader, &value->integer, sizeof(int64_t));
+        return value;
     }
-    if (first->type == NBL_VALUE_FLOAT) {
-        minInteger = first->floating;
-        minFloating = first->floating;
+    if (type == NBL_VALUE_STRING) {
+        NblValue *value = nbl_value_new(NBL_VALUE_STRING);
+        nbl_value_set_string(value, nbl_cache_read_string(reader));
+        return value;
     }
+    if (type == NBL_VALUE_FUNCTION) {
+        NblList *arguments = nbl_cache_read_arguments(reader);
+        int32_t returnType;
+        nbl_cache_read(reader, &returnType, sizeof(int32_t));
+        uint8_t flags = 0;
+        nbl_cache_read(reader, &flags, sizeof(uint8_t));
+        NblValue *function = nbl_value_new_function(arguments, returnType, nbl_cache_read_node(reader));
+        function->async = (flags & 1) != 0;
+        function->generator = (flags & 2) != 0;
+        return function;
+    }
+    if (type != NBL_VALUE_NULL) reader->failed = true;
+    return nbl_value_new_null();
+}
 
-    bool onlyInteger = true;
-    nbl_list_foreach(values, NblValue * value, {
-        if (value->type != NBL_VALUE_INT) onlyInteger = false;
-        if (onlyInteger) {
-            if (value->type == NBL_VALUE_INT) {
-                minInteger = MIN(minInteger, value->integer);
-            }
-            if (value->type == NBL_VALUE_FLOAT) {
-                minInteger = MIN(minInteger, value->floating);
-            }
+NblNode *nbl_cache_read_node(NblCacheReader *reader) {
+    uint8_t type;
+    nbl_cache_read(reader, &type, sizeof(uint8_t));
+    if (type == UINT8_MAX) return NULL;
+    if (type > NBL_NODE_LOGICAL_OR) {
+        reader->failed = true;
+        type = NBL_NODE_PROGRAM;
+    }
+
+    NblToken *token = nbl_cache_read_token(reader);
+    NblNode *node = nbl_node_new(type, token);
+    if (token != NULL) nbl_token_free(token);
+    if (node->type == NBL_NODE_VALUE) {
+        node->value = nbl_cache_read_value(reader);
+    }
+    if (node->type == NBL_NODE_VARIABLE) {
+        node->string = nbl_cache_read_string(reader);
+    }
+    if (node->type == NBL_NODE_ARRAY) {
+        node->array = nbl_cache_read_nodes(reader);
+    }
+    if (node->type == NBL_NODE_OBJECT || node->type == NBL_NODE_CLASS) {
+        uint64_t objectSize = nbl_cache_read_varint(reader);
+        node->object = nbl_map_new();
+        for (uint64_t i = 0; i < objectSize && !reader->failed; i++) {
+            char *key = nbl_cache_read_string(reader);
+            nbl_map_set(node->object, key, nbl_cache_read_node(reader));
+            free(key);
+        }
+        if (node->type == NBL_NODE_CLASS) {
+            uint8_t abstract;
+            node->parentClass = nbl_cache_read_node(reader);
+            nbl_cache_read(reader, &abstract, sizeof(uint8_t));
+            node->abstract = abstract;
+        }
+    }
+    if ((node->type >= NBL_NODE_RETURN && node->type <= NBL_NODE_YIELD) || (node->type >= NBL_NODE_NEG && node->type <= NBL_NODE_CAST)) {
+        if (node->type == NBL_NODE_CAST) {
+            int32_t castType;
+            nbl_cache_read(reader, &castType, sizeof(int32_t));
+            node->castType = castType;
+        }
+        node->unary = nbl_cache_read_node(reader);
+    }
+    if (node->type >= NBL_NODE_CONST_ASSIGN && node->type <= NBL_NODE_LOGICAL_OR) {
+        if (node->type == NBL_NODE_CONST_ASSIGN || node->type == NBL_NODE_LET_ASSIGN) {
+            int32_t declarationType;
+            nbl_cache_read(reader, &declarationType, sizeof(int32_t));
+            node->declarationType = declarationType;
+        }
+        node->lhs = nbl_cache_read_node(reader);
+        node->rhs = nbl_cache_read_node(reader);
+    }
+    if (node->type >= NBL_NODE_IF && node->type <= NBL_NODE_FORIN) {
+        node->condition = nbl_cache_read_node(reader);
+        node->thenBlock = nbl_cache_read_node(reader);
+        node->elseBlock = nbl_cache_read_node(reader);
+        if (node->type == NBL_NODE_TRY) node->finallyBlock = nbl_cache_read_node(reader);
+    }
+    if ((node->type >= NBL_NODE_PROGRAM && node->type <= NBL_NODE_BLOCK) || node->type == NBL_NODE_CALL) {
+        if (node->type == NBL_NODE_CALL) node->function = nbl_cache_read_node(reader);
+        node->nodes = nbl_cache_read_nodes(reader);
+    }
+    return node;
+}
+
+NblList *nbl_cache_read_nodes(NblCacheReader *reader) {
+    uint64_t size = nbl_cache_read_varint(reader);
+    NblList *nodes = nbl_list_new();
+    for (uint64_t i = 0; i < size && !reader->failed; i++) {
+        nbl_list_add(nodes, nbl_cache_read_node(reader));
+    }
+    return nodes;
+}
+
+bool nbl_cache_save(char *cachePath, char *text, NblNode *node) {
+    size_t textSize = strlen(text);
+    NblCacheWriter writer = {.data = malloc(textSize + 64), .size = 0, .capacity = textSize + 64, .lastToken = NULL, .failed = false};
+    nbl_cache_write_node(&writer, node);
+    if (writer.failed) {
+        free(writer.data);
+        return false;
+    }
+    NblCacheHeader header = {.magic = NBL_CACHE_MAGIC,
+                             .version = NBL_CACHE_VERSION,
+                             .textHash = nbl_cache_hash(text, textSize),
+                             .textSize = textSize,
+                             .dataHash = nbl_cache_hash(writer.data, writer.size),
+                             .dataSize = writer.size};
+    bool written = nbl_cache_write_file(cachePath, &header, sizeof(NblCacheHeader), &writer);
+    free(writer.data);
+    return written;
+}
+
+uint8_t *nbl_cache_map(char *path, size_t *size) {
+    // Maps a file into memory, so it can be read without copying it first
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = malloc(*size);
+    *size = fread(data, 1, *size, file);
+    fclose(file);
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == -1 || fileStat.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    *size = fileStat.st_size;
+    uint8_t *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return data != MAP_FAILED ? data : NULL;
+#endif
+}
+
+void nbl_cache_unmap(uint8_t *data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+bool nbl_cache_write_file(char *path, void *header, size_t headerSize, NblCacheWriter *writer) {
+    // Write to a temporary file and rename it so other processes never read a half written file
+    char *tempPath = malloc(strlen(path) + 24);
+#ifdef _WIN32
+    sprintf(tempPath, "%s.%lu.tmp", path, (unsigned long)GetCurrentProcessId());
+#else
+    sprintf(tempPath, "%s.%ld.tmp", path, (long)getpid());
+#endif
+    bool written = false;
+    FILE *file = fopen(tempPath, "wb");
+    if (file != NULL) {
+        written = fwrite(header, headerSize, 1, file) == 1 && fwrite(writer->data, 1, writer->size, file) == writer->size;
+        written = fclose(file) == 0 && written;
+#ifdef _WIN32
+        if (written) remove(path);
+#endif
+        if (written) written = rename(tempPath, path) == 0;
+        if (!written) remove(tempPath);
+    }
+    free(tempPath);
+    return written;
+}
+
+NblNode *nbl_cache_load(char *cachePath, char *path, char *text) {
+    // Map the cache file into memory and build the nodes straight from the mapping
+    size_t size;
+    uint8_t *data = nbl_cache_map(cachePath, &size);
+    if (data == NULL) return NULL;
+
+    // The cache file is only used when it is written by this version for exactly this source text
+    NblNode *node = NULL;
+    if (size >= sizeof(NblCacheHeader)) {
+        NblCacheHeader header;
+        memcpy(&header, data, sizeof(NblCacheHeader));
+        size_t textSize = strlen(text);
+        if (header.magic == NBL_CACHE_MAGIC && header.version == NBL_CACHE_VERSION && header.textSize == textSize &&
+            header.dataSize == size - sizeof(NblCacheHeader) && header.textHash == nbl_cache_hash(text, textSize) &&
+            header.dataHash == nbl_cache_hash(data + sizeof(NblCacheHeader), header.dataSize)) {
+            NblCacheReader reader = {.data = data + sizeof(NblCacheHeader),
+                                     .size = header.dataSize,
+                                     .position = 0,
+                                     .source = nbl_source_new(path, text),
+                                     .lastToken = NULL,
+                                     .failed = false};
+            node = nbl_cache_read_node(&reader);
+            if (reader.lastToken != NULL) nbl_token_free(reader.lastToken);
+            nbl_source_free(reader.source);
+            if (node != NULL && (reader.failed || reader.position != reader.size)) {
+                nbl_node_free(node);
+                node = NULL;
+            }
+        }
+    }
+
+    nbl_cache_unmap(data, size);
+    return node;
+}
+
+NblNode *nbl_cache_parse(NblInterpreter *interpreter, char *path, char *text, bool included) {
+    char *cachePath = interpreter->cache ? nbl_cache_path(interpreter->cacheDir, path) : NULL;
+    NblNode *node = cachePath != NULL ? nbl_cache_load(cachePath, path, text) : NULL;
+    if (node == NULL) {
+        NblList *tokens = nbl_lexer(path, text);
+        node = nbl_parser(tokens, included);
+        nbl_list_free(tokens, (NblListFreeFunc *)nbl_token_free);
+        if (cachePath != NULL) nbl_cache_save(cachePath, text, node);
+    }
+    if (cachePath != NULL) free(cachePath);
+
+    // The same file can be run and included, which only changes the type of the root node
+    node->type = included ? NBL_NODE_NODES : NBL_NODE_PROGRAM;
+    return node;
+}
+
+// Standard library
+
+// Math
+static NblValue *env_math_abs(NblContext *context, NblValue *this, NblList *values) {
+    (void)context;
+    (void)this;
+    NblValue *x = nbl_list_get(values, 0);
+    if (x->type == NBL_VALUE_INT) {
+        return nbl_value_new_int(x->integer < 0 ? -x->integer : x->integer);
+    }
+    if (x->type == NBL_VALUE_FLOAT) {
+        return nbl_value_new_float(x->floating < 0 ? -x->floating : x->floating);
+    }
+    return nbl_value_new_null();
+}
+static double env_math_sin(double x) { return sin(x); }
+static double env_math_cos(double x) { return cos(x); }
+static double env_math_tan(double x) { return tan(x); }
+static double env_math_asin(double x) { return asin(x); }
+static double env_math_acos(double x) { return acos(x); }
+static double env_math_atan(double x) { return atan(x); }
+static double env_math_atan2(double y, double x) { return atan2(y, x); }
+static double env_math_pow(double x, double y) { return pow(x, y); }
+static double env_math_sqrt(double x) { return sqrt(x); }
+static double env_math_floor(double x) { return floor(x); }
+static double env_math_ceil(double x) { return ceil(x); }
+static double env_math_round(double x) { return round(x); }
+static NblValue *env_math_min(NblContext *context, NblValue *this, NblList *values) {
+    (void)context;
+    (void)this;
+    NblValue *first = nbl_list_get(values, 0);
+    int64_t minInteger = 0;
+    double minFloating = 0;
+    if (first->type == NBL_VALUE_INT) {
+        minInteger = first->integer;
+        minFloating = first->integer;
+    }
+    if (first->type == NBL_VALUE_FLOAT) {
+        minInteger = first->floating;
+        minFloating = first->floating;
+    }
+
+    bool onlyInteger = true;
+    nbl_list_foreach(values, NblValue * value, {
+        if (value->type != NBL_VALUE_INT) onlyInteger = false;
+        if (onlyInteger) {
+            if (value->type == NBL_VALUE_INT) {
+                minInteger = MIN(minInteger, value->integer);
+            }
+            if (value->type == NBL_VALUE_FLOAT) {
+                minInteger = MIN(minInteger, value->floating);
+            }
         }
         if (value->type == NBL_VALUE_INT) {
             minFloating = MIN(minFloating, value->integer);
@@ -2788,8 +4466,8 @@ static NblValue *env_math_max(NblContext *context, NblValue *this, NblList *valu
     (void)context;
     (void)this;
     NblValue *first = nbl_list_get(values, 0);
-    int64_t maxInteger;
-    double maxFloating;
+    int64_t maxInteger = 0;
+    double maxFloating = 0;
     if (first->type == NBL_VALUE_INT) {
         maxInteger = first->integer;
         maxFloating = first->integer;
@@ -2819,23 +4497,12 @@ static NblValue *env_math_max(NblContext *context, NblValue *this, NblList *valu
     });
     return onlyInteger ? nbl_value_new_int(maxInteger) : nbl_value_new_float(maxFloating);
 }
-static NblValue *env_math_exp(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(exp(x->floating));
-}
-static NblValue *env_math_log(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
-    (void)this;
-    NblValue *x = nbl_list_get(values, 0);
-    return nbl_value_new_float(log(x->floating));
-}
+static double env_math_exp(double x) { return exp(x); }
+static double env_math_log(double x) { return log(x); }
 static NblValue *env_math_random(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
     (void)this;
     (void)values;
-    return nbl_value_new_float(nbl_random_random());
+    return nbl_value_new_float(nbl_random_random(&context->interpreter->randomSeed));
 }
 
 // Exception
@@ -2843,7 +4510,12 @@ static NblValue *env_exception_constructor(NblContext *context, NblValue *this,
     NblValue *error = nbl_list_get(values, 0);
     nbl_map_set(this->object, "error", nbl_value_retrieve(error));
     nbl_map_set(this->object, "path", nbl_value_new_string(context->node->token->source->path));
-    nbl_map_set(this->object, "text", nbl_value_new_string(context->node->token->source->text));
+    // Only the line of the exception is kept, that is all an uncatched exception prints
+    size_t lineSize;
+    char *line = nbl_source_line(context->node->token->source, context->node->token->line, &lineSize);
+    NblValue *text = nbl_value_new(NBL_VALUE_STRING);
+    nbl_value_set_string(text, strndup(line, lineSize));
+    nbl_map_set(this->object, "text", text);
     nbl_map_set(this->object, "line", nbl_value_new_int(context->node->token->line));
     nbl_map_set(this->object, "column", nbl_value_new_int(context->node->token->column));
     return nbl_value_new_null();
@@ -2880,11 +4552,33 @@ static NblValue *env_array_length(NblContext *context, NblValue *this, NblList *
     (void)values;
     return nbl_value_new_int(this->array->size);
 }
+static bool env_array_available(NblList *array, size_t count) {
+    // An array that has to grow for the added items doubles, which must fit in the memory limit
+    return array->size + count <= array->capacity || nbl_memory_available((int64_t)sizeof(void *) * MAX(array->capacity, count));
+}
 static NblValue *env_array_push(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
+    if (!env_array_available(this->array, values->size)) return nbl_interpreter_throw_limit(context, "Memory limit exceeded", false);
     nbl_list_foreach(values, NblValue * value, { nbl_list_add(this->array, nbl_value_retrieve(value)); });
     return nbl_value_new_int(this->array->size);
 }
+static NblValue *env_array_pop(NblContext *context, NblValue *this, NblList *values) {
+    (void)context;
+    (void)values;
+    NblValue *value = nbl_list_pop(this->array);
+    return value != NULL ? value : nbl_value_new_null();
+}
+static NblValue *env_array_shift(NblContext *context, NblValue *this, NblList *values) {
+    (void)context;
+    (void)values;
+    NblValue *value = nbl_list_shift(this->array);
+    return value != NULL ? value : nbl_value_new_null();
+}
+static NblValue *env_array_unshift(NblContext *context, NblValue *this, NblList *values) {
+    // The values are added from the last to the first so they keep their order at the front
+    if (!env_array_available(this->array, values->size)) return nbl_interpreter_throw_limit(context, "Memory limit exceeded", false);
+    for (size_t i = values->size; i > 0; i--) nbl_list_unshift(this->array, nbl_value_retrieve(nbl_list_get(values, i - 1)));
+    return nbl_value_new_int(this->array->size);
+}
 static NblValue *env_array_foreach(NblContext *context, NblValue *this, NblList *values) {
     NblValue *function = nbl_list_get(values, 0);
     nbl_list_foreach(this->array, NblValue * value, {
@@ -2897,6 +4591,10 @@ static NblValue *env_array_foreach(NblContext *context, NblValue *this, NblList
     });
     return nbl_value_new_null();
 }
+static NblValue *env_array_stream(NblContext *context, NblValue *this, NblList *values) {
+    (void)values;
+    return nbl_stream_new_value(context, nbl_stream_new(context, this));
+}
 static NblValue *env_array_map(NblContext *context, NblValue *this, NblList *values) {
     NblValue *function = nbl_list_get(values, 0);
     NblList *items = nbl_list_new();
@@ -2924,7 +4622,7 @@ static NblValue *env_array_filter(NblContext *context, NblValue *this, NblList *
                                      nbl_value_new_string_format("Array filter condition type is not a bool it is: %s", nbl_value_type_to_string(returnValue->type)));
         }
         if (returnValue->boolean) {
-            nbl_list_add(items, value);
+            nbl_list_add(items, nbl_value_retrieve(value));
         }
         nbl_value_free(returnValue);
         nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
@@ -2954,6 +4652,318 @@ static NblValue *env_array_find(NblContext *context, NblValue *this, NblList *va
     return nbl_value_new_null();
 }
 
+static NblValue *env_array_reduce(NblContext *context, NblValue *this, NblList *values) {
+    NblValue *function = nbl_list_get(values, 0);
+    NblValue *accumulator = nbl_value_retrieve(nbl_list_get(values, 1));
+    nbl_list_foreach(this->array, NblValue * value, {
+        NblList *arguments = nbl_list_new();
+        nbl_list_add(arguments, accumulator);
+        nbl_list_add(arguments, nbl_value_retrieve(value));
+        nbl_list_add(arguments, nbl_value_new_int(index));
+        nbl_list_add(arguments, nbl_value_ref(this));
+        accumulator = nbl_interpreter_call(context, function, NULL, arguments);
+        nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+        if (context->scope->exception->exceptionValue != NULL) break;
+    });
+    return accumulator;
+}
+static int64_t env_array_find_index(NblList *array, NblValue *search) {
+    for (size_t i = 0; i < array->size; i++) {
+        NblValue *value = nbl_list_get(array, i);
+        if (value != NULL ? nbl_value_equals(value, search) : search->type == NBL_VALUE_NULL) return i;
+    }
+    return -1;
+}
+static NblValue *env_array_index_of(NblContext *context, NblValue *this, NblList *values) {
+    (void)context;
+    return nbl_value_new_int(env_array_find_index(this->array, nbl_list_get(values, 0)));
+}
+static NblValue *env_array_includes(NblContext *context, NblValue *this, NblList *values) {
+    (void)context;
+    return nbl_value_new_bool(env_array_find_index(this->array, nbl_list_get(values, 0)) != -1);
+}
+
+static size_t env_array_clamp_index(int64_t index, size_t size) {
+    // Negative indexes count from the end
+    if (index < 0) index += size;
+    if (index < 0) return 0;
+    return MIN((size_t)index, size);
+}
+
+static NblValue *env_array_slice(NblContext *context, NblValue *this, NblList *values) {
+    NblValue *startValue = nbl_list_get(values, 0);
+    NblValue *endValue = nbl_list_get(values, 1);
+    if (endValue->type != NBL_VALUE_NULL && endValue->type != NBL_VALUE_INT) {
+        return nbl_interpreter_throw(context, nbl_type_error_exception(NBL_VALUE_INT, endValue->type));
+    }
+    size_t start = env_array_clamp_index(startValue->integer, this->array->size);
+    size_t end = endValue->type == NBL_VALUE_INT ? env_array_clamp_index(endValue->integer, this->array->size) : this->array->size;
+    NblList *items = nbl_list_new_with_capacity(MAX(end > start ? end - start : 0, 1));
+    for (size_t i = start; i < end; i++) {
+        NblValue *value = nbl_list_get(this->array, i);
+        nbl_list_add(items, value != NULL ? nbl_value_retrieve(value) : nbl_value_new_null());
+    }
+    return nbl_value_new_array(items);
+}
+
+static NblValue *env_array_splice(NblContext *context, NblValue *this, NblList *values) {
+    // Removes deleteCount items from start and inserts the other arguments there, returns the removed items
+    NblValue *startValue = nbl_list_get(values, 0);
+    NblValue *deleteCountValue = nbl_list_get(values, 1);
+    if (deleteCountValue->type != NBL_VALUE_NULL && deleteCountValue->type != NBL_VALUE_INT) {
+        return nbl_interpreter_throw(context, nbl_type_error_exception(NBL_VALUE_INT, deleteCountValue->type));
+    }
+    NblList *array = this->array;
+    size_t start = env_array_clamp_index(startValue->integer, array->size);
+    size_t deleteCount = array->size - start;
+    if (deleteCountValue->type == NBL_VALUE_INT) deleteCount = deleteCountValue->integer > 0 ? MIN((size_t)deleteCountValue->integer, deleteCount) : 0;
+    size_t insertCount = values->size > 2 ? values->size - 2 : 0;
+
+    NblList *removed = nbl_list_new_with_capacity(MAX(deleteCount, 1));
+    for (size_t i = 0; i < deleteCount; i++) {
+        NblValue *value = nbl_list_get(array, start + i);
+        nbl_list_add(removed, value != NULL ? value : nbl_value_new_null());
+    }
+    size_t newSize = array->size - deleteCount + insertCount;
+    nbl_list_grow(array, newSize);
+    void **items = nbl_list_items(array);
+    memmove(&items[start + insertCount], &items[start + deleteCount], sizeof(void *) * (array->size - start - deleteCount));
+    for (size_t i = 0; i < insertCount; i++) {
+        items[start + i] = nbl_value_retrieve(nbl_list_get(values, i + 2));
+    }
+    array->size = newSize;
+    return nbl_value_new_array(removed);
+}
+
+static NblValue *env_array_join(NblContext *context, NblValue *this, NblList *values) {
+    // The length of the result is counted first so it is allocated once
+    char *separator = ((NblValue *)nbl_list_get(values, 0))->string;
+    size_t separatorSize = strlen(separator);
+    size_t size = this->array->size;
+    char **strings = malloc(sizeof(char *) * MAX(size, 1));
+    size_t length = size > 0 ? (size - 1) * separatorSize : 0;
+    for (size_t i = 0; i < size; i++) {
+        NblValue *value = nbl_list_get(this->array, i);
+        strings[i] = value == NULL ? NULL : (value->type == NBL_VALUE_STRING ? value->string : nbl_value_to_string(value));
+        if (strings[i] != NULL) length += strlen(strings[i]);
+    }
+    if (!nbl_memory_available(length)) {
+        for (size_t i = 0; i < size; i++) {
+            NblValue *value = nbl_list_get(this->array, i);
+            if (strings[i] != NULL && value->type != NBL_VALUE_STRING) free(strings[i]);
+        }
+        free(strings);
+        return nbl_interpreter_throw_limit(context, "Memory limit exceeded", false);
+    }
+    char *result = malloc(length + 1);
+    char *c = result;
+    for (size_t i = 0; i < size; i++) {
+        if (i > 0) {
+            memcpy(c, separator, separatorSize);
+            c += separatorSize;
+        }
+        if (strings[i] == NULL) continue;
+        size_t stringSize = strlen(strings[i]);
+        memcpy(c, strings[i], stringSize);
+        c += stringSize;
+        NblValue *value = nbl_list_get(this->array, i);
+        if (value->type != NBL_VALUE_STRING) free(strings[i]);
+    }
+    *c = '\0';
+    free(strings);
+    NblValue *string = nbl_value_new_string(result);
+    free(result);
+    return string;
+}
+
+static NblValue *env_array_reverse(NblContext *context, NblValue *this, NblList *values) {
+    (void)context;
+    (void)values;
+    NblList *array = this->array;
+    void **items = nbl_list_items(array);
+    for (size_t i = 0; i < array->size / 2; i++) {
+        void *item = items[i];
+        items[i] = items[array->size - 1 - i];
+        items[array->size - 1 - i] = item;
+    }
+    return nbl_value_ref(this);
+}
+
+static int env_array_compare(NblContext *context, NblValue *comparator, NblValue *a, NblValue *b) {
+    // Without a comparator numbers and strings are sorted from low to high, when it throws the result is zero
+    if (comparator->type == NBL_VALUE_NULL) {
+        if ((a->type == NBL_VALUE_INT || a->type == NBL_VALUE_FLOAT) && (b->type == NBL_VALUE_INT || b->type == NBL_VALUE_FLOAT)) {
+            if (a->type == NBL_VALUE_INT && b->type == NBL_VALUE_INT) return (a->integer > b->integer) - (a->integer < b->integer);
+            double x = a->type == NBL_VALUE_INT ? a->integer : a->floating, y = b->type == NBL_VALUE_INT ? b->integer : b->floating;
+            return (x > y) - (x < y);
+        }
+        if (a->type == NBL_VALUE_STRING && b->type == NBL_VALUE_STRING) return strcmp(a->string, b->string);
+        nbl_value_free(nbl_interpreter_throw(context, nbl_value_new_string_format("Can't compare %s with %s without a comparator",
+                                                                                   nbl_value_type_to_string(a->type), nbl_value_type_to_string(b->type))));
+        return 0;
+    }
+
+    NblList *arguments = nbl_list_new();
+    nbl_list_add(arguments, nbl_value_retrieve(a));
+    nbl_list_add(arguments, nbl_value_retrieve(b));
+    NblValue *result = nbl_interpreter_call(context, comparator, NULL, arguments);
+    nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+    int order = 0;
+    if (result->type == NBL_VALUE_INT) {
+        order = (result->integer > 0) - (result->integer < 0);
+    } else if (result->type == NBL_VALUE_FLOAT) {
+        order = (result->floating > 0) - (result->floating < 0);
+    } else if (context->scope->exception->exceptionValue == NULL) {
+        nbl_value_free(nbl_interpreter_throw(context, nbl_value_new_string_format("Array sort comparator result is not a number it is: %s",
+                                                                                   nbl_value_type_to_string(result->type))));
+    }
+    nbl_value_free(result);
+    return order;
+}
+
+static bool env_array_less(NblContext *context, NblValue *comparator, NblValue *a, NblValue *b) {
+    // After the comparator has thrown nothing is less anymore, so the sort ends without calling it again
+    if (context->scope->exception->exceptionValue != NULL) return false;
+    return env_array_compare(context, comparator, a, b) < 0;
+}
+
+static NblValue **env_array_merge_sort(NblContext *context, NblValue *comparator, NblValue **items, NblValue **buffer, size_t size) {
+    // Stable bottom up merge sort where runs of 16 items are insertion sorted first, returns items or buffer
+    // depending on which one has the sorted items. Both always hold all items, also when the comparator throws
+    for (size_t start = 0; start < size; start += 16) {
+        size_t end = MIN(start + 16, size);
+        for (size_t i = start + 1; i < end; i++) {
+            NblValue *item = items[i];
+            size_t j = i;
+            for (; j > start && env_array_less(context, comparator, item, items[j - 1]); j--) items[j] = items[j - 1];
+            items[j] = item;
+        }
+    }
+    for (size_t width = 16; width < size && context->scope->exception->exceptionValue == NULL; width *= 2) {
+        for (size_t start = 0; start < size; start += width * 2) {
+            size_t middle = MIN(start + width, size), end = MIN(start + width * 2, size);
+            size_t i = start, j = middle, k = start;
+            while (i < middle && j < end) buffer[k++] = env_array_less(context, comparator, items[j], items[i]) ? items[j++] : items[i++];
+            while (i < middle) buffer[k++] = items[i++];
+            while (j < end) buffer[k++] = items[j++];
+        }
+        NblValue **swap = items;
+        items = buffer;
+        buffer = swap;
+    }
+    return items;
+}
+
+static NblValue *env_array_sort(NblContext *context, NblValue *this, NblList *values) {
+    // Sorts a copy of the items so the array stays whole when the comparator throws or changes the array
+    NblValue *comparator = nbl_list_get(values, 0);
+    if (comparator->type != NBL_VALUE_NULL && comparator->type != NBL_VALUE_FUNCTION && comparator->type != NBL_VALUE_NATIVE_FUNCTION) {
+        return nbl_interpreter_throw(context, nbl_type_error_exception(NBL_VALUE_FUNCTION, comparator->type));
+    }
+    NblList *array = this->array;
+    size_t size = array->size;
+    NblValue **items = malloc(sizeof(NblValue *) * MAX(size, 1));
+    NblValue **buffer = malloc(sizeof(NblValue *) * MAX(size, 1));
+    for (size_t i = 0; i < size; i++) {
+        if (nbl_list_get(array, i) == NULL) nbl_list_set(array, i, nbl_value_new_null());
+        items[i] = nbl_value_ref(nbl_list_get(array, i));
+    }
+    NblValue **sorted = env_array_merge_sort(context, comparator, items, buffer, size);
+    if (context->scope->exception->exceptionValue == NULL && array->size == size) {
+        memcpy(nbl_list_items(array), sorted, sizeof(NblValue *) * size);
+    } else if (context->scope->exception->exceptionValue == NULL) {
+        nbl_value_free(nbl_interpreter_throw(context, nbl_value_new_string("Array changed while sorting")));
+    }
+    for (size_t i = 0; i < size; i++) nbl_value_free(sorted[i]);
+    free(items);
+    free(buffer);
+    return nbl_value_ref(this);
+}
+
+static NblValue *env_array_parallel(NblContext *context, NblValue *this, NblList *values, NblParallelType type) {
+    // The items are copied so the threads can run the function in their own context, the function only gets the
+    // item and its index and must not depend on the variables of the script
+    NblValue *function = nbl_list_get(values, 0);
+    NblValue *chunkSize = nbl_list_get(values, type == NBL_PARALLEL_REDUCE ? 2 : 1);
+    size_t size = this->array->size;
+    NblParallel parallel = {.type = type,
+                            .items = calloc(MAX(size, 1), sizeof(NblValue *)),
+                            .results = calloc(MAX(size, 1), sizeof(NblValue *)),
+                            .size = size,
+                            .chunkSize = chunkSize->integer > 0 ? chunkSize->integer : 0,
+                            .chunksSize = 0,
+                            .next = 0,
+                            .failed = false};
+    char *error = NULL;
+    for (size_t i = 0; i < size && error == NULL; i++) {
+        NblValue *item = nbl_list_get(this->array, i);
+        parallel.items[i] = item != NULL ? nbl_value_copy(item) : nbl_value_new_null();
+        if (parallel.items[i] == NULL) {
+            char buffer[255];
+            sprintf(buffer, "Can't copy a value of type %s to a parallel thread", nbl_value_type_to_string(item->type));
+            error = strdup(buffer);
+        }
+    }
+    if (error == NULL) error = nbl_parallel_run(context, &parallel, function);
+
+    NblValue *returnValue = NULL;
+    if (error == NULL && type == NBL_PARALLEL_MAP) {
+        NblList *items = nbl_list_new_with_capacity(MAX(size, 1));
+        for (size_t i = 0; i < size; i++) {
+            nbl_list_add(items, parallel.results[i]);
+            parallel.results[i] = NULL;
+        }
+        returnValue = nbl_value_new_array(items);
+    }
+    if (error == NULL && type == NBL_PARALLEL_FILTER) {
+        NblList *items = nbl_list_new();
+        for (size_t i = 0; i < size; i++) {
+            if (parallel.results[i]->boolean) nbl_list_add(items, nbl_value_retrieve(nbl_list_get(this->array, i)));
+        }
+        returnValue = nbl_value_new_array(items);
+    }
+    if (error == NULL && type == NBL_PARALLEL_REDUCE) {
+        // The results of the chunks are combined in order on the calling thread
+        returnValue = nbl_value_retrieve(nbl_list_get(values, 1));
+        for (size_t i = 0; i < parallel.chunksSize && context->scope->exception->exceptionValue == NULL; i++) {
+            NblList *arguments = nbl_list_new();
+            nbl_list_add(arguments, returnValue);
+            nbl_list_add(arguments, parallel.results[i]);
+            nbl_list_add(arguments, nbl_value_new_int(i * parallel.chunkSize));
+            parallel.results[i] = NULL;
+            returnValue = nbl_interpreter_call(context, function, NULL, arguments);
+            nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+        }
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        if (parallel.items[i] != NULL) nbl_value_free(parallel.items[i]);
+        if (parallel.results[i] != NULL) nbl_value_free(parallel.results[i]);
+    }
+    free(parallel.items);
+    free(parallel.results);
+    if (error != NULL && nbl_interpreter_interrupted(context->interpreter) && nbl_interpreter_stopped(context->interpreter, context->scope, context->node)) {
+        // The isolates stopped at the interrupt of this context, which is handled here
+        free(error);
+        return nbl_value_new_null();
+    }
+    if (error != NULL) {
+        NblValue *exception = nbl_value_new_string(error);
+        free(error);
+        return nbl_interpreter_throw(context, exception);
+    }
+    return returnValue;
+}
+static NblValue *env_array_parallel_map(NblContext *context, NblValue *this, NblList *values) {
+    return env_array_parallel(context, this, values, NBL_PARALLEL_MAP);
+}
+static NblValue *env_array_parallel_filter(NblContext *context, NblValue *this, NblList *values) {
+    return env_array_parallel(context, this, values, NBL_PARALLEL_FILTER);
+}
+static NblValue *env_array_parallel_reduce(NblContext *context, NblValue *this, NblList *values) {
+    return env_array_parallel(context, this, values, NBL_PARALLEL_REDUCE);
+}
+
 // Object
 static NblValue *env_object_constructor(NblContext *context, NblValue *this, NblList *values) {
     (void)context;
@@ -2996,109 +5006,852 @@ static NblValue *env_date_now(NblContext *context, NblValue *this, NblList *valu
     return nbl_value_new_int(nbl_time_ms());
 }
 
-// Root
-static NblValue *env_type(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
+// Memory
+static NblValue *env_memory_stats(NblContext *context, NblValue *this, NblList *values) {
+    // The living values of the context and their bytes, in total and per type. The first call starts the counting
     (void)this;
-    NblValue *value = nbl_list_get(values, 0);
-    return nbl_value_new_string(nbl_value_type_to_string(value->type));
+    (void)values;
+    int64_t counts[NBL_VALUE_TYPES];
+    int64_t bytes[NBL_VALUE_TYPES];
+    nbl_context_memory_stats(context, counts, bytes);
+    if (nbl_memory_owner == NULL) nbl_memory_owner = context->interpreter;
+    NblMap *types = nbl_map_new();
+    int64_t totalCount = 0;
+    int64_t totalBytes = 0;
+    for (int32_t i = NBL_VALUE_NULL; i < NBL_VALUE_TYPES; i++) {
+        // Native functions have the same type name as functions and are counted together
+        NblValue *type = nbl_map_get(types, nbl_value_type_to_string(i));
+        if (type != NULL) {
+            ((NblValue *)nbl_map_get(type->object, "count"))->integer += counts[i];
+            ((NblValue *)nbl_map_get(type->object, "bytes"))->integer += bytes[i];
+        } else {
+            NblMap *typeStats = nbl_map_new();
+            nbl_map_set(typeStats, "count", nbl_value_new_int(counts[i]));
+            nbl_map_set(typeStats, "bytes", nbl_value_new_int(bytes[i]));
+            nbl_map_set(types, nbl_value_type_to_string(i), nbl_value_new_object(typeStats));
+        }
+        totalCount += counts[i];
+        totalBytes += bytes[i];
+    }
+    NblMap *stats = nbl_map_new();
+    nbl_map_set(stats, "count", nbl_value_new_int(totalCount));
+    nbl_map_set(stats, "bytes", nbl_value_new_int(totalBytes));
+    nbl_map_set(stats, "types", nbl_value_new_object(types));
+    return nbl_value_new_object(stats);
 }
 
-static NblValue *env_assert(NblContext *context, NblValue *this, NblList *values) {
-    (void)context;
+static NblValue *env_memory_snapshot(NblContext *context, NblValue *this, NblList *values) {
     (void)this;
-    NblValue *assertion = nbl_list_get(values, 0);
-    if (!assertion->boolean) {
-        return nbl_interpreter_throw(context, nbl_value_new_string("Assertion failed"));
-    }
-    return nbl_value_new_null();
+    char *path = ((NblValue *)nbl_list_get(values, 0))->string;
+    FILE *file = fopen(path, "w");
+    if (file == NULL) return nbl_interpreter_throw(context, nbl_value_new_string_format("Can't write snapshot to: %s", path));
+    int64_t size = nbl_context_snapshot(context, file);
+    fclose(file);
+    return nbl_value_new_int(size);
 }
 
-NblMap *nbl_std_env(void) {
-    NblMap *env = nbl_map_new();
-
-    NblList *empty_args = nbl_list_new();
+// Worker
+static NblValue *env_worker_constructor(NblContext *context, NblValue *this, NblList *values) {
+#ifdef NBL_THREADS
+    // A worker runs a function or a file, the other values are copied and given as arguments
+    NblValue *function = nbl_list_get(values, 0);
+    if (function == NULL || (function->type != NBL_VALUE_FUNCTION && function->type != NBL_VALUE_STRING)) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Worker needs a function or a path"));
+    }
+    NblValue *functionCopy;
+    if (function->type == NBL_VALUE_STRING) {
+        char *path = nbl_include_path(context->node->token, function->string);
+        int64_t modifiedTime, fileSize;
+        if (!nbl_file_stat(path, &modifiedTime, &fileSize)) {
+            NblValue *exception = nbl_value_new_string_format("Can't read worker file: %s", path);
+            free(path);
+            return nbl_interpreter_throw(context, exception);
+        }
+        functionCopy = nbl_value_new_string(path);
+        free(path);
+    } else {
+        for (size_t i = 0; i < function->arguments->size; i++) {
+            NblArgument *argument = nbl_list_get(function->arguments, i);
+            NblValue *value = nbl_list_get(values, i + 1);
+            if (value == NULL && argument->defaultNode == NULL) {
+                return nbl_interpreter_throw(context, nbl_value_new_string("Not all function arguments are given"));
+            }
+            if (value != NULL && argument->type != NBL_VALUE_ANY && value->type != argument->type) {
+                return nbl_interpreter_throw(context, nbl_type_error_exception(argument->type, value->type));
+            }
+        }
+        functionCopy = nbl_value_copy(function);
+        if (functionCopy == NULL) {
+            return nbl_interpreter_throw(context, nbl_value_new_string("Can't copy the worker function"));
+        }
+    }
 
-    // Math
-    NblMap *math = nbl_map_new();
-    nbl_map_set(env, "Math", nbl_variable_new(NBL_VALUE_OBJECT, false, nbl_value_new_object(math)));
-    nbl_map_set(math, "E", nbl_value_new_float(M_E));
-    nbl_map_set(math, "LN2", nbl_value_new_float(M_LN2));
-    nbl_map_set(math, "LN10", nbl_value_new_float(M_LN10));
-    nbl_map_set(math, "LOG2E", nbl_value_new_float(M_LOG2E));
-    nbl_map_set(math, "LOG10E", nbl_value_new_float(M_LOG10E));
-    nbl_map_set(math, "PI", nbl_value_new_float(M_PI));
-    nbl_map_set(math, "SQRT1_2", nbl_value_new_float(M_SQRT1_2));
-    nbl_map_set(math, "SQRT2", nbl_value_new_float(M_SQRT2));
+    NblList *arguments = nbl_list_new_with_capacity(values->capacity);
+    for (size_t i = 1; i < values->size; i++) {
+        NblValue *value = nbl_list_get(values, i);
+        NblValue *valueCopy = nbl_value_copy(value);
+        if (valueCopy == NULL) {
+            nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+            nbl_value_free(functionCopy);
+            return nbl_interpreter_throw(context,
+                                         nbl_value_new_string_format("Can't send a value of type %s to a worker", nbl_value_type_to_string(value->type)));
+        }
+        nbl_list_add(arguments, valueCopy);
+    }
 
-    NblList *math_float_args = nbl_list_new();
-    nbl_list_add(math_float_args, nbl_argument_new("x", NBL_VALUE_FLOAT, NULL));
-    NblList *math_float_float_args = nbl_list_new();
-    nbl_list_add(math_float_float_args, nbl_argument_new("x", NBL_VALUE_FLOAT, NULL));
-    nbl_list_add(math_float_float_args, nbl_argument_new("y", NBL_VALUE_FLOAT, NULL));
-    NblList *math_float_float_reverse_args = nbl_list_new();
-    nbl_list_add(math_float_float_reverse_args, nbl_argument_new("y", NBL_VALUE_FLOAT, NULL));
-    nbl_list_add(math_float_float_reverse_args, nbl_argument_new("x", NBL_VALUE_FLOAT, NULL));
-    nbl_map_set(math, "abs", nbl_value_new_native_function(math_float_args, NBL_VALUE_ANY, env_math_abs));
-    nbl_map_set(math, "sin", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_sin));
-    nbl_map_set(math, "cos", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_cos));
-    nbl_map_set(math, "tan", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_tan));
-    nbl_map_set(math, "asin", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_asin));
-    nbl_map_set(math, "acos", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_acos));
-    nbl_map_set(math, "atan", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_atan));
-    nbl_map_set(math, "atan2", nbl_value_new_native_function(math_float_float_reverse_args, NBL_VALUE_FLOAT, env_math_atan2));
-    nbl_map_set(math, "pow", nbl_value_new_native_function(math_float_float_args, NBL_VALUE_FLOAT, env_math_pow));
-    nbl_map_set(math, "sqrt", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_sqrt));
-    nbl_map_set(math, "floor", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_floor));
-    nbl_map_set(math, "ceil", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_ceil));
-    nbl_map_set(math, "round", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_round));
-    nbl_map_set(math, "min", nbl_value_new_native_function(empty_args, NBL_VALUE_ANY, env_math_min));
-    nbl_map_set(math, "max", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ANY, env_math_max));
-    nbl_map_set(math, "exp", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_exp));
-    nbl_map_set(math, "log", nbl_value_new_native_function(nbl_list_ref(math_float_args), NBL_VALUE_FLOAT, env_math_log));
-    nbl_random_seed = nbl_time_ms();
-    nbl_map_set(math, "random", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_FLOAT, env_math_random));
+    NblWorker *worker = nbl_worker_new(context, functionCopy, arguments);
+    if (worker == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Can't start worker thread"));
+    }
+    this->native = &worker->native;
+    return nbl_value_new_null();
+#else
+    (void)this;
+    (void)values;
+    return nbl_interpreter_throw(context, nbl_value_new_string("Workers are not supported on this platform"));
+#endif
+}
 
-    // Exception
-    NblMap *exception = nbl_map_new();
-    NblList *exception_constructor_args = nbl_list_new();
-    nbl_list_add(exception_constructor_args, nbl_argument_new("error", NBL_VALUE_STRING, NULL));
-    nbl_map_set(env, "Exception", nbl_variable_new(NBL_VALUE_CLASS, false, nbl_value_new_class(exception, NULL, false)));
-    nbl_map_set(exception, "constructor", nbl_value_new_native_function(exception_constructor_args, NBL_VALUE_ANY, env_exception_constructor));
+#ifdef NBL_THREADS
+static NblChannel *env_worker_channel(NblContext *context, NblValue *this, bool sending) {
+    // On a worker instance the channels go to the worker, called on the class inside a worker they go to the parent
+    if (this != NULL) {
+        NblWorker *worker = (NblWorker *)this->native;
+        if (worker == NULL) {
+            nbl_value_free(nbl_interpreter_throw(context, nbl_value_new_string("Worker is not started")));
+            return NULL;
+        }
+        return sending ? worker->inbox : worker->outbox;
+    }
+    NblWorker *worker = context->interpreter->worker;
+    if (worker == NULL) {
+        nbl_value_free(nbl_interpreter_throw(context, nbl_value_new_string("Not running in a worker")));
+        return NULL;
+    }
+    return sending ? worker->outbox : worker->inbox;
+}
+static NblValue *env_worker_send(NblContext *context, NblValue *this, NblList *values) {
+    NblChannel *channel = env_worker_channel(context, this, true);
+    if (channel == NULL) return nbl_value_new_null();
+    NblValue *message = nbl_list_get(values, 0);
+    NblValue *messageCopy = nbl_value_copy(message);
+    if (messageCopy == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string_format("Can't send a value of type %s to a worker", nbl_value_type_to_string(message->type)));
+    }
+    nbl_channel_send(channel, messageCopy);
+    return nbl_value_new_null();
+}
+static NblValue *env_worker_receive(NblContext *context, NblValue *this, NblList *values) {
+    (void)values;
+    NblChannel *channel = env_worker_channel(context, this, false);
+    if (channel == NULL) return nbl_value_new_null();
+    NblValue *message = nbl_channel_receive(channel, context->interpreter);
+    if (message == NULL && nbl_interpreter_interrupted(context->interpreter)) {
+        // The interrupt is passed on to the worker that is waited for
+        if (this != NULL) nbl_worker_interrupt((NblWorker *)this->native);
+        nbl_interpreter_stopped(context->interpreter, context->scope, context->node);
+    }
+    return message != NULL ? message : nbl_value_new_null();
+}
+static NblValue *env_worker_join(NblContext *context, NblValue *this, NblList *values) {
+    (void)values;
+    if (this == NULL || this->native == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Worker is not started"));
+    }
+    NblWorker *worker = (NblWorker *)this->native;
+    if (!nbl_worker_join(worker, context->interpreter)) {
+        nbl_interpreter_stopped(context->interpreter, context->scope, context->node);
+        return nbl_value_new_null();
+    }
+    if (worker->error != NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string_format("Worker exception: %s", worker->error));
+    }
+    return nbl_value_retrieve(worker->result);
+}
+#endif
 
-    // String
-    NblMap *string = nbl_map_new();
-    nbl_map_set(env, "String", nbl_variable_new(NBL_VALUE_CLASS, false, nbl_value_new_class(string, NULL, false)));
-    nbl_map_set(string, "constructor", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_STRING, env_string_constructor));
-    nbl_map_set(string, "length", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_INT, env_string_length));
+// Task
+static NblValue *env_task_sleep(NblContext *context, NblValue *this, NblList *values) {
+    (void)this;
+    NblValue *ms = nbl_list_get(values, 0);
+    NblValue *task = nbl_task_new(context);
+    NblTimer *timer = malloc(sizeof(NblTimer));
+    timer->time = nbl_time_ms() + MAX(ms->integer, 0);
+    timer->task = nbl_value_ref(task);
+    nbl_list_add(nbl_loop_get(context->interpreter)->timers, timer);
+    return task;
+}
+
+#ifndef _WIN32
+static NblValue *env_task_reader(NblContext *context, int fd, FILE *pipe) {
+    // The task is resolved with everything that is read from the file descriptor
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    NblValue *task = nbl_task_new(context);
+    NblReader *reader = malloc(sizeof(NblReader));
+    reader->fd = fd;
+    reader->pipe = pipe;
+    reader->task = nbl_value_ref(task);
+    reader->capacity = 1024;
+    reader->buffer = malloc(reader->capacity);
+    reader->size = 0;
+    nbl_list_add(nbl_loop_get(context->interpreter)->readers, reader);
+    return task;
+}
+
+static NblValue *env_task_exec(NblContext *context, NblValue *this, NblList *values) {
+    (void)this;
+    NblValue *command = nbl_list_get(values, 0);
+    fflush(stdout);
+    FILE *pipe = popen(command->string, "r");
+    if (pipe == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string_format("Can't run command: %s", command->string));
+    }
+    return env_task_reader(context, fileno(pipe), pipe);
+}
 
-    // Array
-    NblMap *array = nbl_map_new();
+static NblValue *env_task_read_file(NblContext *context, NblValue *this, NblList *values) {
+    (void)this;
+    NblValue *path = nbl_list_get(values, 0);
+    int fd = open(path->string, O_RDONLY);
+    if (fd == -1) {
+        return nbl_interpreter_throw(context, nbl_value_new_string_format("Can't read file: %s", path->string));
+    }
+    return env_task_reader(context, fd, NULL);
+}
+#endif
+
+// Generator
+static NblValue *env_generator_next(NblContext *context, NblValue *this, NblList *values) {
+    // Runs the generator until the next yield and returns { value, done }, the value is given to the yield
+    NblGenerator *generator = this != NULL ? (NblGenerator *)this->native : NULL;
+    if (generator == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Generator is not started"));
+    }
+    NblCoroutine *coroutine = generator->coroutine;
+    if (coroutine->running) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Generator is already running"));
+    }
+    NblValue *value;
+    if (!coroutine->done) {
+        // For in loops call next without arguments
+        NblValue *given = nbl_list_get(values, 0);
+        nbl_coroutine_resume(coroutine, given != NULL ? nbl_value_retrieve(given) : nbl_value_new_null());
+        if (coroutine->exception != NULL) {
+            NblValue *exception = coroutine->exception;
+            coroutine->exception = NULL;
+            return nbl_interpreter_throw(context, exception);
+        }
+        value = coroutine->done ? coroutine->returnValue : coroutine->transfer;
+        coroutine->returnValue = NULL;
+        coroutine->transfer = NULL;
+    } else {
+        value = nbl_value_new_null();
+    }
+    NblMap *result = nbl_map_new();
+    nbl_map_set(result, "value", value != NULL ? value : nbl_value_new_null());
+    nbl_map_set(result, "done", nbl_value_new_bool(coroutine->done));
+    return nbl_value_new_object(result);
+}
+
+// Range
+static NblValue *env_range_next(NblContext *context, NblValue *this, NblList *values) {
+    (void)values;
+    NblRange *range = this != NULL ? nbl_range_get(this) : NULL;
+    if (range == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Range is not created with range()"));
+    }
+    NblMap *result = nbl_map_new();
+    bool done = !nbl_range_has(range, range->current);
+    nbl_map_set(result, "value", done ? nbl_value_new_null() : nbl_value_new_int(range->current));
+    nbl_map_set(result, "done", nbl_value_new_bool(done));
+    if (!done) range->current += range->step;
+    return nbl_value_new_object(result);
+}
+
+// Stream
+static NblValue *env_stream_constructor(NblContext *context, NblValue *this, NblList *values) {
+    NblStream *stream = nbl_stream_new(context, nbl_list_get(values, 0));
+    if (stream == NULL) return nbl_value_new_null();
+    this->native = &stream->native;
+    return nbl_value_new_null();
+}
+
+static NblValue *env_stream_add_stage(NblContext *context, NblValue *this, NblList *values, NblStreamStageType type) {
+    NblStream *stream = nbl_stream_get(this);
+    if (stream == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Stream is not created with Stream()"));
+    }
+    NblValue *value = nbl_list_get(values, 0);
+    if (type == NBL_STREAM_SKIP || type == NBL_STREAM_TAKE) {
+        return nbl_stream_new_value(context, nbl_stream_add_stage(stream, type, NULL, value->integer));
+    }
+    return nbl_stream_new_value(context, nbl_stream_add_stage(stream, type, value, 0));
+}
+static NblValue *env_stream_map(NblContext *context, NblValue *this, NblList *values) { return env_stream_add_stage(context, this, values, NBL_STREAM_MAP); }
+static NblValue *env_stream_filter(NblContext *context, NblValue *this, NblList *values) {
+    return env_stream_add_stage(context, this, values, NBL_STREAM_FILTER);
+}
+static NblValue *env_stream_skip(NblContext *context, NblValue *this, NblList *values) { return env_stream_add_stage(context, this, values, NBL_STREAM_SKIP); }
+static NblValue *env_stream_take(NblContext *context, NblValue *this, NblList *values) { return env_stream_add_stage(context, this, values, NBL_STREAM_TAKE); }
+
+static NblValue *env_stream_next(NblContext *context, NblValue *this, NblList *values) {
+    (void)values;
+    NblStream *stream = nbl_stream_get(this);
+    if (stream == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Stream is not created with Stream()"));
+    }
+    NblValue *value;
+    bool done = !nbl_stream_next(context, stream, &value);
+    if (context->scope->exception->exceptionValue != NULL) return nbl_value_new_null();
+    NblMap *result = nbl_map_new();
+    nbl_map_set(result, "value", done ? nbl_value_new_null() : value);
+    nbl_map_set(result, "done", nbl_value_new_bool(done));
+    return nbl_value_new_object(result);
+}
+
+static NblValue *env_stream_to_array(NblContext *context, NblValue *this, NblList *values) {
+    (void)values;
+    NblStream *stream = nbl_stream_get(this);
+    if (stream == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Stream is not created with Stream()"));
+    }
+    NblList *items = nbl_list_new();
+    NblValue *value;
+    while (nbl_stream_next(context, stream, &value)) nbl_list_add(items, value);
+    return nbl_value_new_array(items);
+}
+
+static NblValue *env_stream_foreach(NblContext *context, NblValue *this, NblList *values) {
+    NblStream *stream = nbl_stream_get(this);
+    if (stream == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Stream is not created with Stream()"));
+    }
+    NblValue *function = nbl_list_get(values, 0);
+    NblValue *value;
+    while (nbl_stream_next(context, stream, &value)) {
+        NblList *arguments = nbl_list_new();
+        nbl_list_add(arguments, value);
+        nbl_value_free(nbl_interpreter_call(context, function, NULL, arguments));
+        nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+        if (context->scope->exception->exceptionValue != NULL) break;
+    }
+    return nbl_value_new_null();
+}
+
+static NblValue *env_stream_reduce(NblContext *context, NblValue *this, NblList *values) {
+    NblStream *stream = nbl_stream_get(this);
+    if (stream == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Stream is not created with Stream()"));
+    }
+    NblValue *function = nbl_list_get(values, 0);
+    NblValue *accumulator = nbl_value_retrieve(nbl_list_get(values, 1));
+    NblValue *value;
+    while (nbl_stream_next(context, stream, &value)) {
+        NblList *arguments = nbl_list_new();
+        nbl_list_add(arguments, accumulator);
+        nbl_list_add(arguments, value);
+        accumulator = nbl_interpreter_call(context, function, NULL, arguments);
+        nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+        if (context->scope->exception->exceptionValue != NULL) break;
+    }
+    return accumulator;
+}
+
+static NblValue *env_stream_count(NblContext *context, NblValue *this, NblList *values) {
+    (void)values;
+    NblStream *stream = nbl_stream_get(this);
+    if (stream == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Stream is not created with Stream()"));
+    }
+    int64_t count = 0;
+    NblValue *value;
+    while (nbl_stream_next(context, stream, &value)) {
+        nbl_value_free(value);
+        count++;
+    }
+    return nbl_value_new_int(count);
+}
+
+// Typed arrays
+static NblValue *env_typed_array_constructor(NblContext *context, NblValue *this, NblList *values, NblValueType type) {
+    // A typed array is made with a size and is filled with zeros, or is made from an array of numbers
+    NblValue *sizeOrItems = nbl_list_get(values, 0);
+    NblTypedArray *typedArray;
+    if (sizeOrItems->type == NBL_VALUE_INT) {
+        if (sizeOrItems->integer < 0) {
+            return nbl_interpreter_throw(context, nbl_value_new_string("Typed array size can't be negative"));
+        }
+        if (sizeOrItems->integer > INT64_MAX / (int64_t)sizeof(int64_t)) {
+            return nbl_interpreter_throw(context, nbl_value_new_string("Typed array size is too large"));
+        }
+        if (!nbl_memory_available(sizeOrItems->integer * (int64_t)sizeof(int64_t))) {
+            return nbl_interpreter_throw_limit(context, "Memory limit exceeded", false);
+        }
+        typedArray = nbl_typed_array_new(type, sizeOrItems->integer);
+        if (typedArray == NULL) return nbl_interpreter_throw(context, nbl_value_new_string("Typed array is too large for the memory"));
+    } else if (sizeOrItems->type == NBL_VALUE_ARRAY) {
+        if (!nbl_memory_available(sizeOrItems->array->size * (int64_t)sizeof(int64_t))) {
+            return nbl_interpreter_throw_limit(context, "Memory limit exceeded", false);
+        }
+        typedArray = nbl_typed_array_new(type, sizeOrItems->array->size);
+        if (typedArray == NULL) return nbl_interpreter_throw(context, nbl_value_new_string("Typed array is too large for the memory"));
+        for (size_t i = 0; i < sizeOrItems->array->size; i++) {
+            NblValue *item = nbl_list_get(sizeOrItems->array, i);
+            if (item == NULL || !nbl_typed_array_set_item(typedArray, i, item)) {
+                nbl_typed_array_free(typedArray);
+                return nbl_interpreter_throw(context, nbl_type_error_exception(type, item != NULL ? item->type : NBL_VALUE_NULL));
+            }
+        }
+    } else {
+        return nbl_interpreter_throw(context, nbl_value_new_string_format("Typed array needs a size or an array it is: %s", nbl_value_type_to_string(sizeOrItems->type)));
+    }
+    this->native = &typedArray->native;
+    return nbl_value_new_null();
+}
+static NblValue *env_int64_array_constructor(NblContext *context, NblValue *this, NblList *values) {
+    return env_typed_array_constructor(context, this, values, NBL_VALUE_INT);
+}
+static NblValue *env_float64_array_constructor(NblContext *context, NblValue *this, NblList *values) {
+    return env_typed_array_constructor(context, this, values, NBL_VALUE_FLOAT);
+}
+
+static NblValue *env_typed_array_length(NblContext *context, NblValue *this, NblList *values) {
+    (void)values;
+    NblTypedArray *typedArray = nbl_typed_array_get(this);
+    if (typedArray == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Typed array is not constructed"));
+    }
+    return nbl_value_new_int(typedArray->size);
+}
+
+static NblValue *env_typed_array_to_array(NblContext *context, NblValue *this, NblList *values) {
+    (void)values;
+    NblTypedArray *typedArray = nbl_typed_array_get(this);
+    if (typedArray == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Typed array is not constructed"));
+    }
+    NblList *items = nbl_list_new_with_capacity(MAX(typedArray->size, 1));
+    for (size_t i = 0; i < typedArray->size; i++) nbl_list_add(items, nbl_typed_array_get_item(typedArray, i));
+    return nbl_value_new_array(items);
+}
+
+static NblTypedArray *env_typed_array_other(NblContext *context, NblTypedArray *typedArray, NblValue *value) {
+    // Bulk operations with two typed arrays need arrays of the same type and size
+    NblTypedArray *other = nbl_typed_array_get(value);
+    if (other == NULL || other->type != typedArray->type || other->size != typedArray->size) {
+        nbl_value_free(nbl_interpreter_throw(context, nbl_value_new_string("Typed arrays are not of the same type and size")));
+        return NULL;
+    }
+    return other;
+}
+
+static NblValue *env_typed_array_reduce(NblContext *context, NblValue *this, NblList *values, NblBulkOperation operation) {
+    NblTypedArray *typedArray = nbl_typed_array_get(this);
+    if (typedArray == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Typed array is not constructed"));
+    }
+    NblTypedArray *other = NULL;
+    if (operation == NBL_BULK_DOT) {
+        other = env_typed_array_other(context, typedArray, nbl_list_get(values, 0));
+        if (other == NULL) return nbl_value_new_null();
+    }
+    if ((operation == NBL_BULK_MIN || operation == NBL_BULK_MAX) && typedArray->size == 0) {
+        return nbl_value_new_null();
+    }
+    if (typedArray->type == NBL_VALUE_INT) {
+        return nbl_value_new_int(nbl_integers_reduce(operation, typedArray->integers, other != NULL ? other->integers : NULL, typedArray->size));
+    }
+    return nbl_value_new_float(nbl_floats_reduce(operation, typedArray->floats, other != NULL ? other->floats : NULL, typedArray->size));
+}
+static NblValue *env_typed_array_sum(NblContext *context, NblValue *this, NblList *values) { return env_typed_array_reduce(context, this, values, NBL_BULK_SUM); }
+static NblValue *env_typed_array_min(NblContext *context, NblValue *this, NblList *values) { return env_typed_array_reduce(context, this, values, NBL_BULK_MIN); }
+static NblValue *env_typed_array_max(NblContext *context, NblValue *this, NblList *values) { return env_typed_array_reduce(context, this, values, NBL_BULK_MAX); }
+static NblValue *env_typed_array_dot(NblContext *context, NblValue *this, NblList *values) { return env_typed_array_reduce(context, this, values, NBL_BULK_DOT); }
+
+static NblValue *env_typed_array_map(NblContext *context, NblValue *this, NblList *values, NblBulkOperation operation) {
+    // Returns a new typed array, add and mul go item by item with another typed array and scale multiplies by a number
+    NblTypedArray *typedArray = nbl_typed_array_get(this);
+    if (typedArray == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Typed array is not constructed"));
+    }
+    NblValue *value = nbl_list_get(values, 0);
+    NblTypedArray *other = NULL;
+    if (operation == NBL_BULK_SCALE) {
+        if (value->type != NBL_VALUE_INT && (typedArray->type == NBL_VALUE_INT || value->type != NBL_VALUE_FLOAT)) {
+            return nbl_interpreter_throw(context, nbl_type_error_exception(typedArray->type, value->type));
+        }
+    } else {
+        other = env_typed_array_other(context, typedArray, value);
+        if (other == NULL) return nbl_value_new_null();
+    }
+    if (!nbl_memory_available(typedArray->size * (int64_t)sizeof(int64_t))) {
+        return nbl_interpreter_throw_limit(context, "Memory limit exceeded", false);
+    }
+    NblTypedArray *result = nbl_typed_array_new(typedArray->type, typedArray->size);
+    if (result == NULL) return nbl_interpreter_throw(context, nbl_value_new_string("Typed array is too large for the memory"));
+    if (typedArray->type == NBL_VALUE_INT) {
+        nbl_integers_map(operation, result->integers, typedArray->integers, other != NULL ? other->integers : NULL, value->integer, typedArray->size);
+    } else {
+        nbl_floats_map(operation, result->floats, typedArray->floats, other != NULL ? other->floats : NULL,
+                       value->type == NBL_VALUE_INT ? (double)value->integer : value->floating, typedArray->size);
+    }
+    return nbl_typed_array_new_value(context, result);
+}
+static NblValue *env_typed_array_add(NblContext *context, NblValue *this, NblList *values) { return env_typed_array_map(context, this, values, NBL_BULK_ADD); }
+static NblValue *env_typed_array_mul(NblContext *context, NblValue *this, NblList *values) { return env_typed_array_map(context, this, values, NBL_BULK_MUL); }
+static NblValue *env_typed_array_scale(NblContext *context, NblValue *this, NblList *values) { return env_typed_array_map(context, this, values, NBL_BULK_SCALE); }
+
+static int env_typed_array_compare_integers(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+static int env_typed_array_compare_floats(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+static NblValue *env_typed_array_sort(NblContext *context, NblValue *this, NblList *values) {
+    // Sorts the numbers from low to high in place
+    (void)values;
+    NblTypedArray *typedArray = nbl_typed_array_get(this);
+    if (typedArray == NULL) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Typed array is not constructed"));
+    }
+    if (typedArray->type == NBL_VALUE_INT) {
+        qsort(typedArray->integers, typedArray->size, sizeof(int64_t), env_typed_array_compare_integers);
+    } else {
+        qsort(typedArray->floats, typedArray->size, sizeof(double), env_typed_array_compare_floats);
+    }
+    return nbl_value_ref(this);
+}
+
+// Root
+static NblValue *env_range(NblContext *context, NblValue *this, NblList *values) {
+    // With one argument the range goes from zero to the argument, floats are rounded down
+    (void)this;
+    int64_t numbers[3] = {0, 0, 1};
+    for (size_t i = 0; i < 3; i++) {
+        NblValue *value = nbl_list_get(values, i);
+        if (value == NULL || value->type == NBL_VALUE_NULL) continue;
+        if (value->type != NBL_VALUE_INT && value->type != NBL_VALUE_FLOAT) {
+            return nbl_interpreter_throw(context, nbl_type_error_exception(NBL_VALUE_INT, value->type));
+        }
+        numbers[i] = value->type == NBL_VALUE_INT ? value->integer : (int64_t)floor(value->floating);
+    }
+    if (((NblValue *)nbl_list_get(values, 1))->type == NBL_VALUE_NULL) {
+        numbers[1] = numbers[0];
+        numbers[0] = 0;
+    }
+    if (numbers[2] == 0) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Range step can't be zero"));
+    }
+    return nbl_range_new(context, numbers[0], numbers[1], numbers[2]);
+}
+
+static NblValue *env_type(NblContext *context, NblValue *this, NblList *values) {
+    (void)context;
+    (void)this;
+    NblValue *value = nbl_list_get(values, 0);
+    return nbl_value_new_string(nbl_value_type_to_string(value->type));
+}
+
+static NblValue *env_assert(NblContext *context, NblValue *this, NblList *values) {
+    (void)context;
+    (void)this;
+    NblValue *assertion = nbl_list_get(values, 0);
+    if (!assertion->boolean) {
+        return nbl_interpreter_throw(context, nbl_value_new_string("Assertion failed"));
+    }
+    return nbl_value_new_null();
+}
+
+// The builtin classes and modules are made on the first lookup of their variable, so a context that doesn't use
+// them doesn't pay for them. Every builder makes its own argument lists, because the builders run independently
+static NblValue *nbl_std_math(void) {
+    NblMap *math = nbl_map_new();
+    nbl_map_set(math, "E", nbl_value_new_float(M_E));
+    nbl_map_set(math, "LN2", nbl_value_new_float(M_LN2));
+    nbl_map_set(math, "LN10", nbl_value_new_float(M_LN10));
+    nbl_map_set(math, "LOG2E", nbl_value_new_float(M_LOG2E));
+    nbl_map_set(math, "LOG10E", nbl_value_new_float(M_LOG10E));
+    nbl_map_set(math, "PI", nbl_value_new_float(M_PI));
+    nbl_map_set(math, "SQRT1_2", nbl_value_new_float(M_SQRT1_2));
+    nbl_map_set(math, "SQRT2", nbl_value_new_float(M_SQRT2));
+
+    NblList *empty_args = nbl_list_new();
+    NblList *math_float_args = nbl_list_new();
+    nbl_list_add(math_float_args, nbl_argument_new("x", NBL_VALUE_FLOAT, NULL));
+    nbl_map_set(math, "abs", nbl_value_new_native_function(math_float_args, NBL_VALUE_ANY, env_math_abs));
+    nbl_map_set(math, "min", nbl_value_new_native_function(empty_args, NBL_VALUE_ANY, env_math_min));
+    nbl_map_set(math, "max", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ANY, env_math_max));
+    static NblBinding math_bindings[] = {
+        {"sin", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_sin},
+        {"cos", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_cos},
+        {"tan", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_tan},
+        {"asin", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_asin},
+        {"acos", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_acos},
+        {"atan", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_atan},
+        {"atan2", NBL_SIGNATURE_FLOAT_FLOAT_FLOAT, (NblTypedFunc *)env_math_atan2},
+        {"pow", NBL_SIGNATURE_FLOAT_FLOAT_FLOAT, (NblTypedFunc *)env_math_pow},
+        {"sqrt", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_sqrt},
+        {"floor", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_floor},
+        {"ceil", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_ceil},
+        {"round", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_round},
+        {"exp", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_exp},
+        {"log", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_log},
+    };
+    nbl_module_bind(math, math_bindings, sizeof(math_bindings) / sizeof(NblBinding));
+    nbl_map_set(math, "random", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_FLOAT, env_math_random));
+    return nbl_value_new_object(math);
+}
+
+static NblValue *nbl_std_exception(void) {
+    NblMap *exception = nbl_map_new();
+    NblList *exception_constructor_args = nbl_list_new();
+    nbl_list_add(exception_constructor_args, nbl_argument_new("error", NBL_VALUE_STRING, NULL));
+    nbl_map_set(exception, "constructor", nbl_value_new_native_function(exception_constructor_args, NBL_VALUE_ANY, env_exception_constructor));
+    return nbl_value_new_class(exception, NULL, false);
+}
+
+static NblValue *nbl_std_string(void) {
+    NblMap *string = nbl_map_new();
+    NblList *empty_args = nbl_list_new();
+    nbl_map_set(string, "constructor", nbl_value_new_native_function(empty_args, NBL_VALUE_STRING, env_string_constructor));
+    nbl_map_set(string, "length", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_INT, env_string_length));
+    return nbl_value_new_class(string, NULL, false);
+}
+
+static NblValue *nbl_std_array(void) {
+    NblMap *array = nbl_map_new();
+    NblList *empty_args = nbl_list_new();
     NblList *array_function_args = nbl_list_new();
     nbl_list_add(array_function_args, nbl_argument_new("function", NBL_VALUE_FUNCTION, NULL));
-    nbl_map_set(env, "Array", nbl_variable_new(NBL_VALUE_CLASS, false, nbl_value_new_class(array, NULL, false)));
-    nbl_map_set(array, "constructor", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ARRAY, env_array_constructor));
+    nbl_map_set(array, "constructor", nbl_value_new_native_function(empty_args, NBL_VALUE_ARRAY, env_array_constructor));
     nbl_map_set(array, "length", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_INT, env_array_length));
     nbl_map_set(array, "push", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_INT, env_array_push));
+    nbl_map_set(array, "pop", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ANY, env_array_pop));
+    nbl_map_set(array, "shift", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ANY, env_array_shift));
+    nbl_map_set(array, "unshift", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_INT, env_array_unshift));
     nbl_map_set(array, "foreach", nbl_value_new_native_function(array_function_args, NBL_VALUE_NULL, env_array_foreach));
     nbl_map_set(array, "map", nbl_value_new_native_function(nbl_list_ref(array_function_args), NBL_VALUE_ARRAY, env_array_map));
     nbl_map_set(array, "filter", nbl_value_new_native_function(nbl_list_ref(array_function_args), NBL_VALUE_ARRAY, env_array_filter));
     nbl_map_set(array, "find", nbl_value_new_native_function(nbl_list_ref(array_function_args), NBL_VALUE_ANY, env_array_find));
-
-    // Object
+    nbl_map_set(array, "stream", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_INSTANCE, env_array_stream));
+    NblList *array_reduce_args = nbl_list_new();
+    nbl_list_add(array_reduce_args, nbl_argument_new("function", NBL_VALUE_FUNCTION, NULL));
+    nbl_list_add(array_reduce_args, nbl_argument_new("initial", NBL_VALUE_ANY, NULL));
+    nbl_map_set(array, "reduce", nbl_value_new_native_function(array_reduce_args, NBL_VALUE_ANY, env_array_reduce));
+    NblList *array_value_args = nbl_list_new();
+    nbl_list_add(array_value_args, nbl_argument_new("value", NBL_VALUE_ANY, NULL));
+    nbl_map_set(array, "indexOf", nbl_value_new_native_function(array_value_args, NBL_VALUE_INT, env_array_index_of));
+    nbl_map_set(array, "includes", nbl_value_new_native_function(nbl_list_ref(array_value_args), NBL_VALUE_BOOL, env_array_includes));
+    NblList *array_slice_args = nbl_list_new();
+    nbl_list_add(array_slice_args, nbl_argument_new("start", NBL_VALUE_INT, nbl_node_new_value(NULL, nbl_value_new_int(0))));
+    nbl_list_add(array_slice_args, nbl_argument_new("end", NBL_VALUE_ANY, nbl_node_new_value(NULL, nbl_value_new_null())));
+    nbl_map_set(array, "slice", nbl_value_new_native_function(array_slice_args, NBL_VALUE_ARRAY, env_array_slice));
+    NblList *array_splice_args = nbl_list_new();
+    nbl_list_add(array_splice_args, nbl_argument_new("start", NBL_VALUE_INT, NULL));
+    nbl_list_add(array_splice_args, nbl_argument_new("deleteCount", NBL_VALUE_ANY, nbl_node_new_value(NULL, nbl_value_new_null())));
+    nbl_map_set(array, "splice", nbl_value_new_native_function(array_splice_args, NBL_VALUE_ARRAY, env_array_splice));
+    NblList *array_join_args = nbl_list_new();
+    nbl_list_add(array_join_args, nbl_argument_new("separator", NBL_VALUE_STRING, nbl_node_new_value(NULL, nbl_value_new_string(","))));
+    nbl_map_set(array, "join", nbl_value_new_native_function(array_join_args, NBL_VALUE_STRING, env_array_join));
+    nbl_map_set(array, "reverse", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ARRAY, env_array_reverse));
+    NblList *array_sort_args = nbl_list_new();
+    nbl_list_add(array_sort_args, nbl_argument_new("comparator", NBL_VALUE_ANY, nbl_node_new_value(NULL, nbl_value_new_null())));
+    nbl_map_set(array, "sort", nbl_value_new_native_function(array_sort_args, NBL_VALUE_ARRAY, env_array_sort));
+    NblList *array_parallel_args = nbl_list_new();
+    nbl_list_add(array_parallel_args, nbl_argument_new("function", NBL_VALUE_FUNCTION, NULL));
+    nbl_list_add(array_parallel_args, nbl_argument_new("chunkSize", NBL_VALUE_INT, nbl_node_new_value(NULL, nbl_value_new_int(0))));
+    nbl_map_set(array, "parallelMap", nbl_value_new_native_function(array_parallel_args, NBL_VALUE_ARRAY, env_array_parallel_map));
+    nbl_map_set(array, "parallelFilter", nbl_value_new_native_function(nbl_list_ref(array_parallel_args), NBL_VALUE_ARRAY, env_array_parallel_filter));
+    NblList *array_parallel_reduce_args = nbl_list_new();
+    nbl_list_add(array_parallel_reduce_args, nbl_argument_new("function", NBL_VALUE_FUNCTION, NULL));
+    nbl_list_add(array_parallel_reduce_args, nbl_argument_new("initial", NBL_VALUE_ANY, NULL));
+    nbl_list_add(array_parallel_reduce_args, nbl_argument_new("chunkSize", NBL_VALUE_INT, nbl_node_new_value(NULL, nbl_value_new_int(0))));
+    nbl_map_set(array, "parallelReduce", nbl_value_new_native_function(array_parallel_reduce_args, NBL_VALUE_ANY, env_array_parallel_reduce));
+    return nbl_value_new_class(array, NULL, false);
+}
+
+static NblValue *nbl_std_object(void) {
     NblMap *object = nbl_map_new();
-    nbl_map_set(env, "Object", nbl_variable_new(NBL_VALUE_CLASS, false, nbl_value_new_class(object, NULL, false)));
-    nbl_map_set(object, "constructor", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_OBJECT, env_object_constructor));
+    NblList *empty_args = nbl_list_new();
+    nbl_map_set(object, "constructor", nbl_value_new_native_function(empty_args, NBL_VALUE_OBJECT, env_object_constructor));
     nbl_map_set(object, "length", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_INT, env_object_length));
     nbl_map_set(object, "keys", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ARRAY, env_object_keys));
     nbl_map_set(object, "values", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ARRAY, env_object_values));
+    return nbl_value_new_class(object, NULL, false);
+}
 
-    // Date
+static NblValue *nbl_std_date(void) {
     NblMap *date = nbl_map_new();
-    nbl_map_set(env, "Date", nbl_variable_new(NBL_VALUE_CLASS, false, nbl_value_new_class(date, NULL, false)));
-    nbl_map_set(date, "now", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_INT, env_date_now));
+    nbl_map_set(date, "now", nbl_value_new_native_function(nbl_list_new(), NBL_VALUE_INT, env_date_now));
+    return nbl_value_new_class(date, NULL, false);
+}
+
+static NblValue *nbl_std_memory(void) {
+    NblMap *memory = nbl_map_new();
+    nbl_map_set(memory, "stats", nbl_value_new_native_function(nbl_list_new(), NBL_VALUE_OBJECT, env_memory_stats));
+    NblList *memory_snapshot_args = nbl_list_new();
+    nbl_list_add(memory_snapshot_args, nbl_argument_new("path", NBL_VALUE_STRING, NULL));
+    nbl_map_set(memory, "snapshot", nbl_value_new_native_function(memory_snapshot_args, NBL_VALUE_INT, env_memory_snapshot));
+    return nbl_value_new_object(memory);
+}
+
+static NblValue *nbl_std_worker(void) {
+    NblMap *worker = nbl_map_new();
+    NblList *empty_args = nbl_list_new();
+    nbl_map_set(worker, "constructor", nbl_value_new_native_function(empty_args, NBL_VALUE_ANY, env_worker_constructor));
+#ifdef NBL_THREADS
+    NblList *worker_send_args = nbl_list_new();
+    nbl_list_add(worker_send_args, nbl_argument_new("message", NBL_VALUE_ANY, NULL));
+    nbl_map_set(worker, "send", nbl_value_new_native_function(worker_send_args, NBL_VALUE_NULL, env_worker_send));
+    nbl_map_set(worker, "receive", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ANY, env_worker_receive));
+    nbl_map_set(worker, "join", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ANY, env_worker_join));
+#endif
+    return nbl_value_new_class(worker, NULL, false);
+}
+
+static NblValue *nbl_std_task(void) {
+    NblMap *task = nbl_map_new();
+    NblList *task_sleep_args = nbl_list_new();
+    nbl_list_add(task_sleep_args, nbl_argument_new("ms", NBL_VALUE_INT, NULL));
+    nbl_map_set(task, "sleep", nbl_value_new_native_function(task_sleep_args, NBL_VALUE_INSTANCE, env_task_sleep));
+#ifndef _WIN32
+    NblList *task_exec_args = nbl_list_new();
+    nbl_list_add(task_exec_args, nbl_argument_new("command", NBL_VALUE_STRING, NULL));
+    nbl_map_set(task, "exec", nbl_value_new_native_function(task_exec_args, NBL_VALUE_INSTANCE, env_task_exec));
+    NblList *task_read_file_args = nbl_list_new();
+    nbl_list_add(task_read_file_args, nbl_argument_new("path", NBL_VALUE_STRING, NULL));
+    nbl_map_set(task, "readFile", nbl_value_new_native_function(task_read_file_args, NBL_VALUE_INSTANCE, env_task_read_file));
+#endif
+    return nbl_value_new_class(task, NULL, false);
+}
+
+static NblValue *nbl_std_generator(void) {
+    NblMap *generator = nbl_map_new();
+    NblList *generator_next_args = nbl_list_new();
+    nbl_list_add(generator_next_args, nbl_argument_new("value", NBL_VALUE_ANY, nbl_node_new_value(NULL, nbl_value_new_null())));
+    nbl_map_set(generator, "next", nbl_value_new_native_function(generator_next_args, NBL_VALUE_OBJECT, env_generator_next));
+    return nbl_value_new_class(generator, NULL, false);
+}
+
+static NblValue *nbl_std_range(void) {
+    NblMap *range = nbl_map_new();
+    nbl_map_set(range, "next", nbl_value_new_native_function(nbl_list_new(), NBL_VALUE_OBJECT, env_range_next));
+    return nbl_value_new_class(range, NULL, false);
+}
+
+static NblValue *nbl_std_stream(void) {
+    NblMap *stream = nbl_map_new();
+    NblList *empty_args = nbl_list_new();
+    NblList *stream_function_args = nbl_list_new();
+    nbl_list_add(stream_function_args, nbl_argument_new("function", NBL_VALUE_FUNCTION, NULL));
+    NblList *stream_constructor_args = nbl_list_new();
+    nbl_list_add(stream_constructor_args, nbl_argument_new("source", NBL_VALUE_ANY, NULL));
+    nbl_map_set(stream, "constructor", nbl_value_new_native_function(stream_constructor_args, NBL_VALUE_ANY, env_stream_constructor));
+    nbl_map_set(stream, "map", nbl_value_new_native_function(stream_function_args, NBL_VALUE_INSTANCE, env_stream_map));
+    nbl_map_set(stream, "filter", nbl_value_new_native_function(nbl_list_ref(stream_function_args), NBL_VALUE_INSTANCE, env_stream_filter));
+    NblList *stream_count_args = nbl_list_new();
+    nbl_list_add(stream_count_args, nbl_argument_new("count", NBL_VALUE_INT, NULL));
+    nbl_map_set(stream, "skip", nbl_value_new_native_function(stream_count_args, NBL_VALUE_INSTANCE, env_stream_skip));
+    nbl_map_set(stream, "take", nbl_value_new_native_function(nbl_list_ref(stream_count_args), NBL_VALUE_INSTANCE, env_stream_take));
+    nbl_map_set(stream, "next", nbl_value_new_native_function(empty_args, NBL_VALUE_OBJECT, env_stream_next));
+    nbl_map_set(stream, "toArray", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ARRAY, env_stream_to_array));
+    nbl_map_set(stream, "foreach", nbl_value_new_native_function(nbl_list_ref(stream_function_args), NBL_VALUE_NULL, env_stream_foreach));
+    NblList *stream_reduce_args = nbl_list_new();
+    nbl_list_add(stream_reduce_args, nbl_argument_new("function", NBL_VALUE_FUNCTION, NULL));
+    nbl_list_add(stream_reduce_args, nbl_argument_new("initial", NBL_VALUE_ANY, NULL));
+    nbl_map_set(stream, "reduce", nbl_value_new_native_function(stream_reduce_args, NBL_VALUE_ANY, env_stream_reduce));
+    nbl_map_set(stream, "count", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_INT, env_stream_count));
+    return nbl_value_new_class(stream, NULL, false);
+}
+
+static NblValue *nbl_std_typed_array(NblValueType itemType) {
+    NblMap *typed_array = nbl_map_new();
+    NblList *empty_args = nbl_list_new();
+    NblList *typed_array_constructor_args = nbl_list_new();
+    nbl_list_add(typed_array_constructor_args, nbl_argument_new("sizeOrItems", NBL_VALUE_ANY, NULL));
+    nbl_map_set(typed_array, "constructor",
+                nbl_value_new_native_function(typed_array_constructor_args, NBL_VALUE_ANY,
+                                              itemType == NBL_VALUE_INT ? env_int64_array_constructor : env_float64_array_constructor));
+    nbl_map_set(typed_array, "length", nbl_value_new_native_function(empty_args, NBL_VALUE_INT, env_typed_array_length));
+    nbl_map_set(typed_array, "toArray", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ARRAY, env_typed_array_to_array));
+    NblList *typed_array_other_args = nbl_list_new();
+    nbl_list_add(typed_array_other_args, nbl_argument_new("other", NBL_VALUE_INSTANCE, NULL));
+    NblList *typed_array_scale_args = nbl_list_new();
+    nbl_list_add(typed_array_scale_args, nbl_argument_new("factor", NBL_VALUE_ANY, NULL));
+    nbl_map_set(typed_array, "sum", nbl_value_new_native_function(nbl_list_ref(empty_args), itemType, env_typed_array_sum));
+    nbl_map_set(typed_array, "min", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ANY, env_typed_array_min));
+    nbl_map_set(typed_array, "max", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_ANY, env_typed_array_max));
+    nbl_map_set(typed_array, "dot", nbl_value_new_native_function(typed_array_other_args, itemType, env_typed_array_dot));
+    nbl_map_set(typed_array, "add", nbl_value_new_native_function(nbl_list_ref(typed_array_other_args), NBL_VALUE_INSTANCE, env_typed_array_add));
+    nbl_map_set(typed_array, "mul", nbl_value_new_native_function(nbl_list_ref(typed_array_other_args), NBL_VALUE_INSTANCE, env_typed_array_mul));
+    nbl_map_set(typed_array, "scale", nbl_value_new_native_function(typed_array_scale_args, NBL_VALUE_INSTANCE, env_typed_array_scale));
+    nbl_map_set(typed_array, "sort", nbl_value_new_native_function(nbl_list_ref(empty_args), NBL_VALUE_INSTANCE, env_typed_array_sort));
+    return nbl_value_new_class(typed_array, NULL, false);
+}
+
+static NblValue *nbl_std_int64_array(void) { return nbl_std_typed_array(NBL_VALUE_INT); }
+
+static NblValue *nbl_std_float64_array(void) { return nbl_std_typed_array(NBL_VALUE_FLOAT); }
+
+typedef struct NblStdBuiltin {
+    char *name;
+    NblValueType type;
+    NblValue *(*make)(void);
+} NblStdBuiltin;
+
+static NblStdBuiltin nbl_std_builtins[] = {
+    {"Math", NBL_VALUE_OBJECT, nbl_std_math},
+    {"Exception", NBL_VALUE_CLASS, nbl_std_exception},
+    {"String", NBL_VALUE_CLASS, nbl_std_string},
+    {"Array", NBL_VALUE_CLASS, nbl_std_array},
+    {"Object", NBL_VALUE_CLASS, nbl_std_object},
+    {"Date", NBL_VALUE_CLASS, nbl_std_date},
+    {"Memory", NBL_VALUE_OBJECT, nbl_std_memory},
+    {"Worker", NBL_VALUE_CLASS, nbl_std_worker},
+    {"Task", NBL_VALUE_CLASS, nbl_std_task},
+    {"Generator", NBL_VALUE_CLASS, nbl_std_generator},
+    {"Range", NBL_VALUE_CLASS, nbl_std_range},
+    {"Stream", NBL_VALUE_CLASS, nbl_std_stream},
+    {"Int64Array", NBL_VALUE_CLASS, nbl_std_int64_array},
+    {"Float64Array", NBL_VALUE_CLASS, nbl_std_float64_array},
+};
+
+#define NBL_STD_BUILTINS_SIZE (sizeof(nbl_std_builtins) / sizeof(NblStdBuiltin))
+
+static NblStdBuiltin *nbl_std_builtin(char *key) {
+    for (size_t i = 0; i < NBL_STD_BUILTINS_SIZE; i++) {
+        if (!strcmp(nbl_std_builtins[i].name, key)) return &nbl_std_builtins[i];
+    }
+    return NULL;
+}
+
+NblVariable *nbl_std_env_get(NblMap *env, char *key) {
+    // Gets a variable of an env and makes its value when it is a builtin that wasn't looked up before
+    NblVariable *variable = nbl_map_get(env, key);
+    if (variable != NULL && variable->value == NULL) {
+        // Embedders can also add a variable without a value, which isn't a builtin and is null
+        NblStdBuiltin *builtin = nbl_std_builtin(key);
+        variable->value = builtin != NULL ? builtin->make() : nbl_value_new_null();
+    }
+    return variable;
+}
+
+NblMap *nbl_std_env(void) {
+    // The builtins get a variable without a value, which is made by nbl_std_env_get on their first lookup
+    NblMap *env = nbl_map_new_with_capacity(NBL_STD_BUILTINS_SIZE + 8);
+    for (size_t i = 0; i < NBL_STD_BUILTINS_SIZE; i++) {
+        nbl_map_set(env, nbl_std_builtins[i].name, nbl_variable_new(nbl_std_builtins[i].type, false, NULL));
+    }
 
     // Root
+    NblList *range_args = nbl_list_new();
+    nbl_list_add(range_args, nbl_argument_new("start", NBL_VALUE_ANY, NULL));
+    nbl_list_add(range_args, nbl_argument_new("end", NBL_VALUE_ANY, nbl_node_new_value(NULL, nbl_value_new_null())));
+    nbl_list_add(range_args, nbl_argument_new("step", NBL_VALUE_ANY, nbl_node_new_value(NULL, nbl_value_new_int(1))));
+    nbl_map_set(env, "range", nbl_variable_new(NBL_VALUE_NATIVE_FUNCTION, false, nbl_value_new_native_function(range_args, NBL_VALUE_ANY, env_range)));
+
     NblList *type_args = nbl_list_new();
     nbl_list_add(type_args, nbl_argument_new("value", NBL_VALUE_ANY, NULL));
     nbl_map_set(env, "type", nbl_variable_new(NBL_VALUE_NATIVE_FUNCTION, false, nbl_value_new_native_function(type_args, NBL_VALUE_ANY, env_type)));
@@ -3120,29 +5873,125 @@ NblVariable *nbl_variable_new(NblValueType type, bool mutable, NblValue *value)
 }
 
 void nbl_variable_free(NblVariable *variable) {
-    nbl_value_free(variable->value);
+    if (variable->value != NULL) nbl_value_free(variable->value);
     free(variable);
 }
 
+NblInclude *nbl_include_new(NblNode *node, int64_t modifiedTime, int64_t fileSize) {
+    NblInclude *include = malloc(sizeof(NblInclude));
+    include->node = node;
+    include->modifiedTime = modifiedTime;
+    include->fileSize = fileSize;
+    include->included = false;
+    include->kept = false;
+    return include;
+}
+
+void nbl_include_free(NblInclude *include) {
+    nbl_node_free(include->node);
+    free(include);
+}
+
+char *nbl_include_path(NblToken *token, char *path) {
+    // Included paths are relative to the file that includes them
+    char *dirname = token->source->dirname;
+    char *includePath = malloc(strlen(dirname) + strlen(path) + 2);
+    if (strlen(dirname) > 0) {
+        sprintf(includePath, "%s/%s", dirname, path);
+    } else {
+        strcpy(includePath, path);
+    }
+    char *canonicalPath = nbl_path_normalize(includePath);
+    free(includePath);
+    return canonicalPath;
+}
+
 NblVariable *nbl_block_scope_get(NblBlockScope *block, char *key) {
-    NblVariable *variable = nbl_map_get(block->env, key);
+    NblVariable *variable = nbl_std_env_get(block->env, key);
     if (variable == NULL && block->parentBlock != NULL) {
         return nbl_block_scope_get(block->parentBlock, key);
     }
     return variable;
 }
 
+NblProgram *nbl_program_new(char *path, char *text) {
+    NblList *tokens = nbl_lexer(path, text);
+    NblProgram *program = malloc(sizeof(NblProgram));
+    program->refs = 1;
+    program->node = nbl_parser(tokens, false);
+    nbl_list_free(tokens, (NblListFreeFunc *)nbl_token_free);
+    return program;
+}
+
+NblProgram *nbl_program_new_file(char *path) {
+    char *text = nbl_file_read(path);
+    if (text == NULL) return NULL;
+    NblProgram *program = nbl_program_new(path, text);
+    free(text);
+    return program;
+}
+
+NblProgram *nbl_program_ref(NblProgram *program) {
+    program->refs++;
+    return program;
+}
+
+void nbl_program_free(NblProgram *program) {
+    program->refs--;
+    if (program->refs > 0) return;
+
+    nbl_node_free(program->node);
+    free(program);
+}
+
 NblContext *nbl_context_new(void) {
+    // A context is charged to no interpreter, not even when a script makes it, because it can run on another thread
+    NblInterpreter *owner = nbl_memory_owner;
+    nbl_memory_owner = NULL;
     NblContext *context = malloc(sizeof(NblContext));
     context->refs = 1;
     context->env = nbl_std_env();
+    context->interpreter = nbl_interpreter_new(context->env);
+    nbl_memory_owner = owner;
     return context;
 }
 
+NblContext *nbl_context_new_isolate(NblContext *context) {
+    // A new context with the same settings and natives as the given context, that shares no values with it
+    NblInterpreter *owner = nbl_memory_owner;
+    nbl_memory_owner = NULL;
+    NblContext *isolate = nbl_context_new();
+    isolate->interpreter->cache = context->interpreter->cache;
+    isolate->interpreter->cacheDir = context->interpreter->cacheDir != NULL ? strdup(context->interpreter->cacheDir) : NULL;
+    isolate->interpreter->threads = context->interpreter->threads;
+    nbl_context_set_limits(isolate, context->interpreter->limits);
+
+    // Natives that the embedder added to the env, like print, are copied to the env of the isolate
+    NblMap *env = context->env;
+    for (size_t i = 0; i < env->size; i++) {
+        NblVariable *variable = env->values[i];
+        if (variable->value == NULL || variable->value->type != NBL_VALUE_NATIVE_FUNCTION || nbl_map_get(isolate->env, env->keys[i]) != NULL) continue;
+        NblList *arguments = nbl_list_new();
+        for (size_t j = 0; j < variable->value->arguments->size; j++) {
+            NblArgument *argument = nbl_list_get(variable->value->arguments, j);
+            NblValue *defaultValue = argument->defaultNode != NULL && argument->defaultNode->type == NBL_NODE_VALUE
+                                         ? nbl_value_copy(argument->defaultNode->value)
+                                         : NULL;
+            nbl_list_add(arguments, nbl_argument_new(argument->name, argument->type, defaultValue != NULL ? nbl_node_new_value(NULL, defaultValue) : NULL));
+        }
+        NblValue *native = nbl_value_new_native_function(arguments, variable->value->returnType, variable->value->nativeFunc);
+        native->signature = variable->value->signature;
+        nbl_map_set(isolate->env, env->keys[i], nbl_variable_new(variable->type, variable->mutable, native));
+    }
+    nbl_context_mark(isolate);
+    nbl_memory_owner = owner;
+    return isolate;
+}
+
 NblValue *nbl_context_eval_text(NblContext *context, char *text) {
     NblList *tokens = nbl_lexer("text", text);
     NblNode *node = nbl_parser(tokens, false);
-    NblValue *returnValue = nbl_interpreter(context->env, node);
+    NblValue *returnValue = nbl_interpreter(context, node);
     nbl_node_free(node);
     nbl_list_free(tokens, (NblListFreeFunc *)nbl_token_free);
     return returnValue;
@@ -3150,10 +5999,10 @@ NblValue *nbl_context_eval_text(NblContext *context, char *text) {
 
 NblValue *nbl_context_eval_text_statement(NblContext *context, char *text) {
     NblList *tokens = nbl_lexer("text", text);
-    NblParser parser = {.tokens = tokens, .position = 0};
+    NblParser parser = {.lexer = NULL, .tokens = tokens, .position = 0, .yielded = false};
     NblNode *node = nbl_parser_statement(&parser);
     if (node == NULL) return NULL;
-    NblValue *returnValue = nbl_interpreter(context->env, node);
+    NblValue *returnValue = nbl_interpreter(context, node);
     nbl_node_free(node);
     nbl_list_free(tokens, (NblListFreeFunc *)nbl_token_free);
     return returnValue;
@@ -3165,61 +6014,940 @@ NblValue *nbl_context_eval_file(NblContext *context, char *path) {
         fprintf(stderr, "Can't read file: %s\n", path);
         exit(EXIT_FAILURE);
     }
-    NblList *tokens = nbl_lexer(path, text);
-    NblNode *node = nbl_parser(tokens, false);
-    NblValue *returnValue = nbl_interpreter(context->env, node);
-    nbl_node_free(node);
-    nbl_list_free(tokens, (NblListFreeFunc *)nbl_token_free);
+    NblNode *node = nbl_cache_parse(context->interpreter, path, text, false);
     free(text);
+    nbl_interpreter_preload(context->interpreter, node);
+    NblValue *returnValue = nbl_interpreter(context, node);
+    nbl_node_free(node);
     return returnValue;
 }
 
-NblContext *nbl_context_ref(NblContext *context) {
-    context->refs++;
-    return context;
-}
-
-void nbl_context_free(NblContext *context) {
-    context->refs--;
-    if (context->refs > 0) return;
-
-    nbl_map_free(context->env, (NblMapFreeFunc *)nbl_variable_free);
-    free(context);
-}
-
-NblValue *nbl_interpreter(NblMap *env, NblNode *node) {
-    NblInterpreter interpreter = {.env = env};
+NblValue *nbl_context_eval_stream(NblContext *context, char *path, FILE *file) {
+    // Parse and run one statement at a time so only the tokens of the current statement are in memory
+    NblLexer *lexer = nbl_lexer_new_file(path, file);
+    NblParser parser = {.lexer = lexer, .tokens = nbl_list_new(), .position = 0, .yielded = false};
     NblScope scope = {.exception = &(NblExceptionScope){.exceptionValue = NULL},
                       .function = &(NblFunctionScope){.returnValue = NULL},
                       .loop = &(NblLoopScope){.inLoop = false, .isContinuing = false, .isBreaking = false},
-                      .block = &(NblBlockScope){.parentBlock = NULL, .env = env}};
-    NblValue *returnValue = nbl_interpreter_node(&interpreter, &scope, node);
+                      .block = &(NblBlockScope){.parentBlock = NULL, .env = context->env}};
+    NblInterpreter *owner = nbl_interpreter_limits_start(context->interpreter);
+    while (nbl_parser_token(&parser, 0)->type != NBL_TOKEN_EOF) {
+        NblNode *node = nbl_parser_statement(&parser);
+        nbl_parser_release(&parser);
+        if (node == NULL) continue;
+        NblValue *nodeValue = nbl_interpreter_node(context->interpreter, &scope, node);
+        if (nodeValue != NULL) nbl_value_free(nodeValue);
+        nbl_node_free(node);
+        if (scope.exception->exceptionValue != NULL || scope.function->returnValue != NULL) break;
+    }
+    nbl_list_free(parser.tokens, (NblListFreeFunc *)nbl_token_free);
+    nbl_lexer_free(lexer);
+
     if (scope.exception->exceptionValue != NULL) {
-        NblValue *path = nbl_value_class_get(scope.exception->exceptionValue, "path");
-        NblValue *text = nbl_value_class_get(scope.exception->exceptionValue, "text");
-        NblValue *line = nbl_value_class_get(scope.exception->exceptionValue, "line");
-        NblValue *column = nbl_value_class_get(scope.exception->exceptionValue, "column");
-        NblToken *token = nbl_token_new(NBL_TOKEN_THROW, nbl_source_new(path->string, text->string), line->integer, column->integer);
-        NblValue *error = nbl_value_class_get(scope.exception->exceptionValue, "error");
-        nbl_print_error(token, "Uncatched exception: %s", error->string);
-        nbl_token_free(token);
-    }
-    if (returnValue != NULL) {
-        return returnValue;
+        nbl_interpreter_print_exception(scope.exception->exceptionValue);
+        nbl_value_free(scope.exception->exceptionValue);
+    } else if (!nbl_loop_run(context->interpreter, NULL)) {
+        // The tasks that are left stop at an interrupt, which is handled with that
+        context->interpreter->interrupted = false;
     }
+    nbl_interpreter_limits_end(owner);
     if (scope.function->returnValue != NULL) {
         return scope.function->returnValue;
-    } else {
-        return nbl_value_new_null();
     }
+    return nbl_value_new_null();
 }
 
-NblValue *nbl_type_error_exception(NblValueType expected, NblValueType got) {
-    return nbl_value_new_string_format("Unexpected type: '%s' expected '%s'", nbl_value_type_to_string(got), nbl_value_type_to_string(expected));
+NblValue *nbl_context_run(NblContext *context, NblProgram *program) {
+    // Runs a program without lexing and parsing it again, its includes are parsed once per context
+    nbl_interpreter_preload(context->interpreter, program->node);
+    return nbl_interpreter(context, program->node);
 }
 
-#define interpreter_statement_in_try(interpreter, scope, node, cleanup)   \
-    {                                                                     \
+void nbl_context_print_stats(NblContext *context, FILE *file) {
+    fprintf(file, "{\"includeHits\": %" PRIi64 ", \"includeMisses\": %" PRIi64, context->interpreter->includeHits,
+            context->interpreter->includeMisses);
+    if (context->interpreter->counters != NULL) {
+        fprintf(file, ", \"memoryPeak\": %" PRIi64, context->interpreter->memory->peak);
+        nbl_counters_print(context->interpreter->counters, file);
+    }
+    fprintf(file, "}\n");
+}
+
+// The values of a snapshot get an id in the order they are found, a hash table from value to id finds the values
+// that are already written
+typedef struct NblSnapshot {
+    NblValue **values;
+    int64_t *ids;
+    size_t capacity;
+    NblList *queue;
+} NblSnapshot;
+
+static int64_t nbl_snapshot_id(NblSnapshot *snapshot, NblValue *value) {
+    if (snapshot->queue->size * 2 >= snapshot->capacity) {
+        NblValue **values = snapshot->values;
+        int64_t *ids = snapshot->ids;
+        size_t capacity = snapshot->capacity;
+        snapshot->capacity *= 2;
+        snapshot->values = calloc(snapshot->capacity, sizeof(NblValue *));
+        snapshot->ids = malloc(sizeof(int64_t) * snapshot->capacity);
+        for (size_t i = 0; i < capacity; i++) {
+            if (values[i] == NULL) continue;
+            size_t slot = ((uintptr_t)values[i] >> 4) & (snapshot->capacity - 1);
+            while (snapshot->values[slot] != NULL) slot = (slot + 1) & (snapshot->capacity - 1);
+            snapshot->values[slot] = values[i];
+            snapshot->ids[slot] = ids[i];
+        }
+        free(values);
+        free(ids);
+    }
+    size_t slot = ((uintptr_t)value >> 4) & (snapshot->capacity - 1);
+    while (snapshot->values[slot] != NULL) {
+        if (snapshot->values[slot] == value) return snapshot->ids[slot];
+        slot = (slot + 1) & (snapshot->capacity - 1);
+    }
+    snapshot->values[slot] = value;
+    nbl_list_add(snapshot->queue, value);
+    snapshot->ids[slot] = snapshot->queue->size;
+    return snapshot->ids[slot];
+}
+
+static void nbl_snapshot_walk(NblSnapshot *snapshot) {
+    // Gives every value that the queued values reach an id, breadth first, so the ids are in the order of the queue
+    for (size_t i = 0; i < snapshot->queue->size; i++) {
+        NblValue *value = nbl_list_get(snapshot->queue, i);
+        if (value->type == NBL_VALUE_ARRAY) {
+            nbl_list_foreach(value->array, NblValue * item, {
+                if (item != NULL) nbl_snapshot_id(snapshot, item);
+            });
+        }
+        if (value->type == NBL_VALUE_OBJECT || value->type == NBL_VALUE_CLASS || value->type == NBL_VALUE_INSTANCE) {
+            for (size_t j = 0; j < value->object->size; j++) nbl_snapshot_id(snapshot, value->object->values[j]);
+            if (value->type != NBL_VALUE_OBJECT && value->parentClass != NULL) nbl_snapshot_id(snapshot, value->parentClass);
+        }
+    }
+}
+
+static void nbl_snapshot_print_key(FILE *file, char *key) {
+    fputc('"', file);
+    for (char *c = key; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char)*c < ' ') {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void nbl_snapshot_print_roots(NblSnapshot *snapshot, FILE *file, NblMap *env, bool *first) {
+    nbl_map_foreach(env, char *key, NblVariable *variable, {
+        if (variable->value == NULL) continue;
+        fprintf(file, "%s{\"name\": ", *first ? "" : ", ");
+        nbl_snapshot_print_key(file, key);
+        fprintf(file, ", \"id\": %" PRIi64 "}", nbl_snapshot_id(snapshot, variable->value));
+        *first = false;
+    });
+}
+
+int64_t nbl_context_snapshot(NblContext *context, FILE *file) {
+    // Writes every value that can be reached from the variables of the context once as JSON, with its own size and
+    // the ids of the values it references, so leaks and bloat can be found by their size and by what holds them
+    NblSnapshot snapshot = {.values = calloc(64, sizeof(NblValue *)), .ids = malloc(sizeof(int64_t) * 64), .capacity = 64, .queue = nbl_list_new()};
+    fprintf(file, "{\"roots\": [");
+    bool first = true;
+    bool globals = false;
+    for (NblBlockScope *block = context->scope != NULL ? context->scope->block : NULL; block != NULL; block = block->parentBlock) {
+        nbl_snapshot_print_roots(&snapshot, file, block->env, &first);
+        if (block->env == context->env) globals = true;
+    }
+    if (!globals) nbl_snapshot_print_roots(&snapshot, file, context->env, &first);
+
+    nbl_snapshot_walk(&snapshot);
+
+    fprintf(file, "], \"values\": [");
+    int64_t totalSize = 0;
+    for (size_t i = 0; i < snapshot.queue->size; i++) {
+        NblValue *value = nbl_list_get(snapshot.queue, i);
+        int64_t size = nbl_value_size(value);
+        totalSize += size;
+        fprintf(file, "%s{\"id\": %zu, \"type\": \"%s\", \"size\": %" PRIi64 ", \"refs\": %d", i > 0 ? ", " : "", i + 1,
+                nbl_value_type_to_string(value->type), size, value->refs);
+        if (value->type == NBL_VALUE_ARRAY) {
+            fprintf(file, ", \"items\": [");
+            for (size_t j = 0; j < value->array->size; j++) {
+                NblValue *item = nbl_list_get(value->array, j);
+                fprintf(file, j > 0 ? ", %" PRIi64 : "%" PRIi64, item != NULL ? nbl_snapshot_id(&snapshot, item) : 0);
+            }
+            fprintf(file, "]");
+        }
+        if (value->type == NBL_VALUE_OBJECT || value->type == NBL_VALUE_CLASS || value->type == NBL_VALUE_INSTANCE) {
+            fprintf(file, ", \"members\": {");
+            nbl_map_foreach(value->object, char *key, NblValue *member, {
+                if (index > 0) fprintf(file, ", ");
+                nbl_snapshot_print_key(file, key);
+                fprintf(file, ": %" PRIi64, nbl_snapshot_id(&snapshot, member));
+            });
+            fprintf(file, "}");
+            if (value->type != NBL_VALUE_OBJECT && value->parentClass != NULL) {
+                fprintf(file, ", \"class\": %" PRIi64, nbl_snapshot_id(&snapshot, value->parentClass));
+            }
+        }
+        fprintf(file, "}");
+    }
+    fprintf(file, "], \"size\": %" PRIi64 "}\n", totalSize);
+
+    int64_t size = snapshot.queue->size;
+    free(snapshot.values);
+    free(snapshot.ids);
+    nbl_list_free(snapshot.queue, NULL);
+    return size;
+}
+
+void nbl_context_memory_stats(NblContext *context, int64_t *values, int64_t *bytes) {
+    // The values that the scripts of the context made and that are still alive per type, with the bytes of the values
+    // and their strings. Asking for the stats turns the counting on, so the values made before that are not counted
+    NblMemory *memory = context->interpreter->memory;
+    context->interpreter->memoryStats = true;
+    for (int32_t i = 0; i < NBL_VALUE_TYPES; i++) {
+        values[i] = memory->values[i];
+        bytes[i] = memory->values[i] * (int64_t)sizeof(NblValue);
+    }
+    bytes[NBL_VALUE_STRING] += memory->stringBytes;
+}
+
+// The natives of the library, a saved context refers to them by their index, so new natives are added at the end
+static NblBinding nbl_std_natives[] = {
+    {"Math.abs", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_math_abs},
+    {"Math.min", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_math_min},
+    {"Math.max", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_math_max},
+    {"Math.sin", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_sin},
+    {"Math.cos", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_cos},
+    {"Math.tan", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_tan},
+    {"Math.asin", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_asin},
+    {"Math.acos", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_acos},
+    {"Math.atan", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_atan},
+    {"Math.atan2", NBL_SIGNATURE_FLOAT_FLOAT_FLOAT, (NblTypedFunc *)env_math_atan2},
+    {"Math.pow", NBL_SIGNATURE_FLOAT_FLOAT_FLOAT, (NblTypedFunc *)env_math_pow},
+    {"Math.sqrt", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_sqrt},
+    {"Math.floor", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_floor},
+    {"Math.ceil", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_ceil},
+    {"Math.round", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_round},
+    {"Math.exp", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_exp},
+    {"Math.log", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)env_math_log},
+    {"Math.random", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_math_random},
+    {"Exception.constructor", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_exception_constructor},
+    {"String.constructor", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_string_constructor},
+    {"String.length", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_string_length},
+    {"Array.constructor", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_constructor},
+    {"Array.length", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_length},
+    {"Array.push", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_push},
+    {"Array.pop", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_pop},
+    {"Array.shift", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_shift},
+    {"Array.unshift", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_unshift},
+    {"Array.foreach", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_foreach},
+    {"Array.map", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_map},
+    {"Array.filter", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_filter},
+    {"Array.find", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_find},
+    {"Array.stream", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_stream},
+    {"Array.reduce", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_reduce},
+    {"Array.indexOf", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_index_of},
+    {"Array.includes", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_includes},
+    {"Array.slice", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_slice},
+    {"Array.splice", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_splice},
+    {"Array.join", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_join},
+    {"Array.reverse", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_reverse},
+    {"Array.sort", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_sort},
+    {"Array.parallelMap", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_parallel_map},
+    {"Array.parallelFilter", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_parallel_filter},
+    {"Array.parallelReduce", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_array_parallel_reduce},
+    {"Object.constructor", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_object_constructor},
+    {"Object.length", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_object_length},
+    {"Object.keys", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_object_keys},
+    {"Object.values", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_object_values},
+    {"Date.now", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_date_now},
+    {"Memory.stats", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_memory_stats},
+    {"Memory.snapshot", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_memory_snapshot},
+    {"Worker.constructor", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_worker_constructor},
+#ifdef NBL_THREADS
+    {"Worker.send", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_worker_send},
+    {"Worker.receive", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_worker_receive},
+    {"Worker.join", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_worker_join},
+#endif
+    {"Task.sleep", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_task_sleep},
+    {"Task.exec", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_task_exec},
+    {"Task.readFile", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_task_read_file},
+    {"Generator.next", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_generator_next},
+    {"Range.next", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_range_next},
+    {"Stream.constructor", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_stream_constructor},
+    {"Stream.map", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_stream_map},
+    {"Stream.filter", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_stream_filter},
+    {"Stream.skip", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_stream_skip},
+    {"Stream.take", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_stream_take},
+    {"Stream.next", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_stream_next},
+    {"Stream.toArray", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_stream_to_array},
+    {"Stream.foreach", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_stream_foreach},
+    {"Stream.reduce", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_stream_reduce},
+    {"Stream.count", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_stream_count},
+    {"Int64Array.constructor", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_int64_array_constructor},
+    {"Float64Array.constructor", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_float64_array_constructor},
+    {"TypedArray.length", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_typed_array_length},
+    {"TypedArray.toArray", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_typed_array_to_array},
+    {"TypedArray.sum", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_typed_array_sum},
+    {"TypedArray.min", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_typed_array_min},
+    {"TypedArray.max", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_typed_array_max},
+    {"TypedArray.dot", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_typed_array_dot},
+    {"TypedArray.add", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_typed_array_add},
+    {"TypedArray.mul", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_typed_array_mul},
+    {"TypedArray.scale", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_typed_array_scale},
+    {"TypedArray.sort", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_typed_array_sort},
+    {"range", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_range},
+    {"type", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_type},
+    {"assert", NBL_SIGNATURE_VALUES, (NblTypedFunc *)env_assert},
+};
+
+static NblBinding *nbl_registered_natives = NULL;
+static size_t nbl_registered_natives_size = 0;
+
+void nbl_native_register(NblBinding *bindings, size_t size) {
+    nbl_registered_natives = realloc(nbl_registered_natives, sizeof(NblBinding) * (nbl_registered_natives_size + size));
+    memcpy(&nbl_registered_natives[nbl_registered_natives_size], bindings, sizeof(NblBinding) * size);
+    nbl_registered_natives_size += size;
+}
+
+#define NBL_STD_NATIVES_SIZE (sizeof(nbl_std_natives) / sizeof(NblBinding))
+
+static NblBinding *nbl_native_get(uint64_t index) {
+    // Returns NULL for an index that isn't in the table, like one from a damaged file
+    if (index < NBL_STD_NATIVES_SIZE) return &nbl_std_natives[index];
+    if (index - NBL_STD_NATIVES_SIZE < nbl_registered_natives_size) return &nbl_registered_natives[index - NBL_STD_NATIVES_SIZE];
+    return NULL;
+}
+
+static int64_t nbl_native_index(NblValue *native) {
+    // Returns -1 for a native that isn't in the table, which can't be saved
+    NblTypedFunc *function = native->signature == NBL_SIGNATURE_VALUES ? (NblTypedFunc *)native->nativeFunc : native->typedFunc;
+    for (uint64_t i = 0; i < NBL_STD_NATIVES_SIZE + nbl_registered_natives_size; i++) {
+        NblBinding *binding = nbl_native_get(i);
+        if (binding->function == function && binding->signature == native->signature) return i;
+    }
+    return -1;
+}
+
+static uint64_t nbl_context_fingerprint(void) {
+    // A context file only loads in a program that has the same natives in the same order, which is known by their
+    // names and signatures
+    uint64_t fingerprint[] = {NBL_CACHE_VERSION, 0};
+    for (uint64_t i = 0; i < NBL_STD_NATIVES_SIZE + nbl_registered_natives_size; i++) {
+        NblBinding *binding = nbl_native_get(i);
+        fingerprint[1] = fingerprint[1] * 31 + nbl_cache_hash(binding->name, strlen(binding->name)) + binding->signature;
+    }
+    return nbl_cache_hash(fingerprint, sizeof(fingerprint));
+}
+
+static uint64_t nbl_context_source(NblList *sources, NblNode *node) {
+    // Sources are stored once and nodes refer to them by index, zero is no source
+    if (node == NULL || node->token == NULL) return 0;
+    for (size_t i = 0; i < sources->size; i++) {
+        if (nbl_list_get(sources, i) == node->token->source) return i + 1;
+    }
+    nbl_list_add(sources, node->token->source);
+    return sources->size;
+}
+
+static void nbl_context_write_value(NblCacheWriter *writer, NblSnapshot *snapshot, NblList *sources, NblValue *value) {
+    uint8_t type = value->type;
+    nbl_cache_write(writer, &type, sizeof(uint8_t));
+    if (value->type == NBL_VALUE_ARRAY) {
+        nbl_cache_write_varint(writer, value->array->size);
+        nbl_list_foreach(value->array, NblValue * item, { nbl_cache_write_varint(writer, item != NULL ? nbl_snapshot_id(snapshot, item) : 0); });
+    } else if (value->type == NBL_VALUE_OBJECT || value->type == NBL_VALUE_CLASS || value->type == NBL_VALUE_INSTANCE) {
+        nbl_cache_write_varint(writer, value->object->size);
+        nbl_map_foreach(value->object, char *key, NblValue *member, {
+            nbl_cache_write_string(writer, key);
+            nbl_cache_write_varint(writer, nbl_snapshot_id(snapshot, member));
+        });
+        if (value->type == NBL_VALUE_CLASS) {
+            uint8_t abstract = value->abstract;
+            nbl_cache_write(writer, &abstract, sizeof(uint8_t));
+        }
+        if (value->type != NBL_VALUE_OBJECT) {
+            nbl_cache_write_varint(writer, value->parentClass != NULL ? nbl_snapshot_id(snapshot, value->parentClass) : 0);
+        }
+        // The native data of instances, like the thread of a worker, can't be stored
+        if (value->type == NBL_VALUE_INSTANCE && value->native != NULL) writer->failed = true;
+    } else if (value->type == NBL_VALUE_NATIVE_FUNCTION) {
+        // Natives are stored by their index in the table, typed natives get their arguments from their signature
+        int64_t nativeIndex = nbl_native_index(value);
+        if (nativeIndex == -1) {
+            writer->failed = true;
+            return;
+        }
+        nbl_cache_write_varint(writer, nativeIndex);
+        if (value->signature == NBL_SIGNATURE_VALUES) {
+            // The default arguments of natives have no source, so they are read without one
+            nbl_list_foreach(value->arguments, NblArgument * argument, {
+                if (argument->defaultNode != NULL && argument->defaultNode->token != NULL) writer->failed = true;
+            });
+            writer->lastToken = NULL;
+            nbl_cache_write_arguments(writer, value->arguments);
+            int32_t returnType = value->returnType;
+            nbl_cache_write(writer, &returnType, sizeof(int32_t));
+        }
+    } else {
+        if (value->type == NBL_VALUE_FUNCTION) {
+            nbl_cache_write_varint(writer, nbl_context_source(sources, value->functionNode));
+            writer->lastToken = NULL;
+        }
+        nbl_cache_write_value(writer, value);
+    }
+}
+
+bool nbl_context_save(NblContext *context, char *path) {
+    // Stores the global variables of the context with every value they reach and the parsed includes, so a program
+    // can start from a context that already ran its initialization. Values are stored by their snapshot id, so values
+    // that are shared or reference each other are restored the same way. Instances with native data can't be stored
+    NblSnapshot snapshot = {.values = calloc(64, sizeof(NblValue *)), .ids = malloc(sizeof(int64_t) * 64), .capacity = 64, .queue = nbl_list_new()};
+    NblMap *env = context->env;
+    NblMap *includes = context->interpreter->includes;
+    // Builtins that were never looked up are stored without a value, so they are made again after the load
+    for (size_t i = 0; i < env->size; i++) {
+        NblVariable *variable = env->values[i];
+        if (variable->value != NULL) nbl_snapshot_id(&snapshot, variable->value);
+    }
+    nbl_snapshot_walk(&snapshot);
+    NblList *sources = nbl_list_new();
+    nbl_list_foreach(snapshot.queue, NblValue * value, {
+        if (value->type == NBL_VALUE_FUNCTION) nbl_context_source(sources, value->functionNode);
+    });
+    for (size_t i = 0; i < includes->size; i++) nbl_context_source(sources, ((NblInclude *)includes->values[i])->node);
+
+    // The sources come first, then all values, which can refer to values that come after them, then the variables
+    // and the includes
+    NblCacheWriter writer = {.data = malloc(4096), .size = 0, .capacity = 4096, .lastToken = NULL, .failed = false};
+    nbl_cache_write_varint(&writer, sources->size);
+    nbl_list_foreach(sources, NblSource * source, {
+        nbl_cache_write_string(&writer, source->path);
+        nbl_cache_write_string(&writer, source->text);
+        nbl_cache_write_varint(&writer, source->firstLine);
+    });
+    nbl_cache_write_varint(&writer, snapshot.queue->size);
+    for (size_t i = 0; i < snapshot.queue->size && !writer.failed; i++) {
+        nbl_context_write_value(&writer, &snapshot, sources, nbl_list_get(snapshot.queue, i));
+    }
+    nbl_cache_write_varint(&writer, env->size);
+    nbl_map_foreach(env, char *key, NblVariable *variable, {
+        int32_t type = variable->type;
+        uint8_t mutable = variable->mutable;
+        nbl_cache_write_string(&writer, key);
+        nbl_cache_write(&writer, &type, sizeof(int32_t));
+        nbl_cache_write(&writer, &mutable, sizeof(uint8_t));
+        nbl_cache_write_varint(&writer, variable->value != NULL ? nbl_snapshot_id(&snapshot, variable->value) : 0);
+    });
+    nbl_cache_write_varint(&writer, includes->size);
+    nbl_map_foreach(includes, char *key, NblInclude *include, {
+        uint8_t included = include->included;
+        nbl_cache_write_string(&writer, key);
+        nbl_cache_write(&writer, &include->modifiedTime, sizeof(int64_t));
+        nbl_cache_write(&writer, &include->fileSize, sizeof(int64_t));
+        nbl_cache_write(&writer, &included, sizeof(uint8_t));
+        nbl_cache_write_varint(&writer, nbl_context_source(sources, include->node));
+        writer.lastToken = NULL;
+        nbl_cache_write_node(&writer, include->node);
+    });
+
+    bool written = false;
+    if (!writer.failed) {
+        NblContextHeader header = {.magic = NBL_CONTEXT_MAGIC,
+                                   .version = NBL_CONTEXT_VERSION,
+                                   .fingerprint = nbl_context_fingerprint(),
+                                   .dataHash = nbl_cache_hash(writer.data, writer.size),
+                                   .dataSize = writer.size};
+        written = nbl_cache_write_file(path, &header, sizeof(NblContextHeader), &writer);
+    }
+    free(writer.data);
+    nbl_list_free(sources, NULL);
+    free(snapshot.values);
+    free(snapshot.ids);
+    nbl_list_free(snapshot.queue, NULL);
+    return written;
+}
+
+static NblValue *nbl_context_read_id(NblCacheReader *reader, NblValue **values, uint64_t valuesSize) {
+    uint64_t id = nbl_cache_read_varint(reader);
+    if (id == 0) return NULL;
+    if (id > valuesSize) {
+        reader->failed = true;
+        return NULL;
+    }
+    values[id - 1]->refs++;
+    return values[id - 1];
+}
+
+static NblSource *nbl_context_read_source(NblCacheReader *reader, NblList *sources) {
+    uint64_t index = nbl_cache_read_varint(reader);
+    if (index > sources->size) {
+        reader->failed = true;
+        return NULL;
+    }
+    if (reader->lastToken != NULL) nbl_token_free(reader->lastToken);
+    reader->lastToken = NULL;
+    return index > 0 ? nbl_list_get(sources, index - 1) : NULL;
+}
+
+static void nbl_context_move_value(NblValue *value, NblValue *from) {
+    // Moves a new value into a value that is already referenced by other values, each keeps the memory it is charged to
+    int32_t refs = value->refs;
+    NblMemory *memory = value->memory;
+    nbl_value_retype(value, from->type);
+    *value = *from;
+    value->refs = refs;
+    value->memory = memory;
+    nbl_value_retype(from, NBL_VALUE_NULL);
+    nbl_value_free(from);
+}
+
+static void nbl_context_read_value(NblCacheReader *reader, NblList *sources, NblValue **values, uint64_t valuesSize, NblValue *value) {
+    uint8_t type = UINT8_MAX;
+    nbl_cache_read(reader, &type, sizeof(uint8_t));
+    if (type == NBL_VALUE_BOOL || type == NBL_VALUE_INT || type == NBL_VALUE_FLOAT || type == NBL_VALUE_STRING) {
+        // Leaves are stored like in the cache, which repeats the type, but they are read in place
+        nbl_cache_read(reader, &type, sizeof(uint8_t));
+        if (type == NBL_VALUE_BOOL) {
+            uint8_t boolean = 0;
+            nbl_cache_read(reader, &boolean, sizeof(uint8_t));
+            value->boolean = boolean;
+        } else if (type == NBL_VALUE_INT || type == NBL_VALUE_FLOAT) {
+            nbl_cache_read(reader, &value->integer, sizeof(int64_t));
+        } else if (type == NBL_VALUE_STRING) {
+            nbl_value_set_string(value, nbl_cache_read_string(reader));
+        } else {
+            reader->failed = true;
+            return;
+        }
+        nbl_value_retype(value, type);
+    } else if (type == NBL_VALUE_ARRAY) {
+        uint64_t size = nbl_cache_read_varint(reader);
+        if (size > reader->size - reader->position) {
+            reader->failed = true;
+            size = 0;
+        }
+        value->array = nbl_list_new_with_capacity(size);
+        nbl_value_retype(value, NBL_VALUE_ARRAY);
+        for (uint64_t i = 0; i < size && !reader->failed; i++) {
+            nbl_list_add(value->array, nbl_context_read_id(reader, values, valuesSize));
+        }
+    } else if (type == NBL_VALUE_OBJECT || type == NBL_VALUE_CLASS || type == NBL_VALUE_INSTANCE) {
+        uint64_t size = nbl_cache_read_varint(reader);
+        if (size > reader->size - reader->position) {
+            reader->failed = true;
+            size = 0;
+        }
+        value->object = nbl_map_new_with_capacity(size > 0 ? size : 1);
+        value->parentClass = NULL;
+        value->native = NULL;
+        nbl_value_retype(value, type);
+        // The keys of a saved object are unique, so the read keys are taken by the map as they are
+        NblMap *object = value->object;
+        for (uint64_t i = 0; i < size && !reader->failed; i++) {
+            char *key = nbl_cache_read_string(reader);
+            NblValue *member = nbl_context_read_id(reader, values, valuesSize);
+            if (member == NULL) {
+                reader->failed = true;
+                free(key);
+                break;
+            }
+            if (object->memory != NULL) nbl_memory_count(object->memory, strlen(key) + 1);
+            object->keys[object->size] = key;
+            object->values[object->size++] = member;
+        }
+        if (type == NBL_VALUE_CLASS) {
+            uint8_t abstract = 0;
+            nbl_cache_read(reader, &abstract, sizeof(uint8_t));
+            value->abstract = abstract;
+        }
+        if (type != NBL_VALUE_OBJECT) value->parentClass = nbl_context_read_id(reader, values, valuesSize);
+    } else if (type == NBL_VALUE_NATIVE_FUNCTION) {
+        // A native that isn't in the table is never called, the file isn't loaded
+        NblBinding *binding = nbl_native_get(nbl_cache_read_varint(reader));
+        if (binding == NULL) {
+            reader->failed = true;
+            return;
+        }
+        if (binding->signature != NBL_SIGNATURE_VALUES) {
+            nbl_context_move_value(value, nbl_value_new_native_typed(binding->signature, binding->function));
+            return;
+        }
+        if (reader->lastToken != NULL) nbl_token_free(reader->lastToken);
+        reader->lastToken = NULL;
+        NblList *arguments = nbl_cache_read_arguments(reader);
+        int32_t returnType = NBL_VALUE_ANY;
+        nbl_cache_read(reader, &returnType, sizeof(int32_t));
+        nbl_context_move_value(value, nbl_value_new_native_function(arguments, returnType,
+                                                                    (NblValue * (*)(NblContext *, NblValue *, NblList *)) binding->function));
+    } else {
+        if (type == NBL_VALUE_FUNCTION) {
+            reader->source = nbl_context_read_source(reader, sources);
+            if (reader->source == NULL) reader->failed = true;
+        }
+        if (reader->failed) return;
+        nbl_context_move_value(value, nbl_cache_read_value(reader));
+    }
+}
+
+NblContext *nbl_context_load(char *path) {
+    // Restores a context that is saved by nbl_context_save without building the standard library or running any
+    // script. The file is mapped into memory and all values are made in one pass over it. Returns NULL when the file
+    // is missing or damaged or was saved by another build
+    size_t size;
+    uint8_t *data = nbl_cache_map(path, &size);
+    if (data == NULL) return NULL;
+    NblContextHeader header = {0};
+    if (size >= sizeof(NblContextHeader)) memcpy(&header, data, sizeof(NblContextHeader));
+    if (header.magic != NBL_CONTEXT_MAGIC || header.version != NBL_CONTEXT_VERSION || header.fingerprint != nbl_context_fingerprint() ||
+        header.dataSize != size - sizeof(NblContextHeader) || header.dataHash != nbl_cache_hash(data + sizeof(NblContextHeader), header.dataSize)) {
+        nbl_cache_unmap(data, size);
+        return NULL;
+    }
+    NblCacheReader reader = {.data = data + sizeof(NblContextHeader),
+                             .size = header.dataSize,
+                             .position = 0,
+                             .source = NULL,
+                             .lastToken = NULL,
+                             .failed = false};
+
+    NblList *sources = nbl_list_new();
+    uint64_t sourcesSize = nbl_cache_read_varint(&reader);
+    for (uint64_t i = 0; i < sourcesSize && !reader.failed; i++) {
+        char *sourcePath = nbl_cache_read_string(&reader);
+        char *text = nbl_cache_read_string(&reader);
+        NblSource *source = nbl_source_new(sourcePath, text);
+        source->firstLine = nbl_cache_read_varint(&reader);
+        nbl_list_add(sources, source);
+        free(sourcePath);
+        free(text);
+    }
+
+    // Every value is made empty first, so values can refer to values that are read after them
+    uint64_t valuesSize = nbl_cache_read_varint(&reader);
+    if (valuesSize > reader.size - reader.position) {
+        reader.failed = true;
+        valuesSize = 0;
+    }
+    NblValue **values = malloc(sizeof(NblValue *) * (valuesSize + 1));
+    for (uint64_t i = 0; i < valuesSize; i++) {
+        values[i] = nbl_value_new(NBL_VALUE_NULL);
+        values[i]->refs = 0;
+    }
+    for (uint64_t i = 0; i < valuesSize && !reader.failed; i++) {
+        nbl_context_read_value(&reader, sources, values, valuesSize, values[i]);
+    }
+
+    NblMap *env = nbl_map_new();
+    uint64_t envSize = nbl_cache_read_varint(&reader);
+    for (uint64_t i = 0; i < envSize && !reader.failed; i++) {
+        char *key = nbl_cache_read_string(&reader);
+        int32_t type = NBL_VALUE_ANY;
+        nbl_cache_read(&reader, &type, sizeof(int32_t));
+        uint8_t mutable = 0;
+        nbl_cache_read(&reader, &mutable, sizeof(uint8_t));
+        NblValue *value = nbl_context_read_id(&reader, values, valuesSize);
+        NblVariable *variable = nbl_variable_new(type, mutable, value);
+        nbl_map_set(env, key, variable);
+        if (value == NULL && nbl_std_builtin(key) == NULL) reader.failed = true;
+        free(key);
+    }
+
+    NblContext *context = malloc(sizeof(NblContext));
+    context->refs = 1;
+    context->env = env;
+    context->interpreter = nbl_interpreter_new(env);
+    uint64_t includesSize = nbl_cache_read_varint(&reader);
+    for (uint64_t i = 0; i < includesSize && !reader.failed; i++) {
+        char *includePath = nbl_cache_read_string(&reader);
+        int64_t modifiedTime = 0;
+        nbl_cache_read(&reader, &modifiedTime, sizeof(int64_t));
+        int64_t fileSize = 0;
+        nbl_cache_read(&reader, &fileSize, sizeof(int64_t));
+        uint8_t included = 0;
+        nbl_cache_read(&reader, &included, sizeof(uint8_t));
+        reader.source = nbl_context_read_source(&reader, sources);
+        NblNode *node = reader.source != NULL ? nbl_cache_read_node(&reader) : NULL;
+        if (node != NULL) {
+            NblInclude *include = nbl_include_new(node, modifiedTime, fileSize);
+            include->included = included;
+            nbl_map_set(context->interpreter->includes, includePath, include);
+        } else {
+            reader.failed = true;
+        }
+        free(includePath);
+    }
+    if (reader.lastToken != NULL) nbl_token_free(reader.lastToken);
+    nbl_list_free(sources, (NblListFreeFunc *)nbl_source_free);
+    nbl_cache_unmap(data, size);
+    nbl_context_mark(context);
+
+    if (reader.failed || reader.position != reader.size) {
+        // The values reference each other, so their links are dropped first and then every value is freed once
+        for (uint64_t i = 0; i < valuesSize; i++) {
+            NblValue *value = values[i];
+            if (value->type == NBL_VALUE_ARRAY) nbl_list_free(value->array, NULL);
+            if (value->type == NBL_VALUE_OBJECT || value->type == NBL_VALUE_CLASS || value->type == NBL_VALUE_INSTANCE) {
+                nbl_map_free(value->object, NULL);
+            }
+            if (value->type == NBL_VALUE_ARRAY || value->type == NBL_VALUE_OBJECT || value->type == NBL_VALUE_CLASS ||
+                value->type == NBL_VALUE_INSTANCE) {
+                nbl_value_retype(value, NBL_VALUE_NULL);
+            }
+            value->refs = 1;
+            nbl_value_free(value);
+        }
+        nbl_map_free(env, free);
+        nbl_interpreter_free(context->interpreter);
+        free(context);
+        context = NULL;
+    }
+    free(values);
+    return context;
+}
+
+void nbl_context_set_limits(NblContext *context, NblLimits limits) {
+    // Workers and parallel functions get the same limits in their own contexts
+    context->interpreter->limits = limits;
+    context->interpreter->limited = limits.memory > 0 || limits.steps > 0 || limits.time > 0;
+}
+
+void nbl_context_interrupt(NblContext *context) {
+    // Stops the eval that runs in the context at its next loop iteration, call or wait with an Interrupted exception,
+    // or the next eval when none runs. It can be called from any thread and from signal handlers
+    context->interpreter->interrupted = true;
+}
+
+void nbl_context_set(NblContext *context, char *key, NblValue *value) {
+    // Sets a global constant, like an input of a program, the context takes the value
+    NblVariable *variable = nbl_map_get(context->env, key);
+    if (variable != NULL) {
+        if (variable->value != NULL) nbl_value_free(variable->value);
+        variable->type = value->type;
+        variable->value = value;
+        return;
+    }
+    nbl_map_set(context->env, key, nbl_variable_new(value->type, false, value));
+}
+
+void nbl_context_bind(NblContext *context, char *name, NblBinding *bindings, size_t size) {
+    // Binds typed natives to a global object, which is made when the module isn't there yet
+    NblVariable *variable = nbl_std_env_get(context->env, name);
+    if (variable == NULL || variable->value->type != NBL_VALUE_OBJECT) {
+        nbl_context_set(context, name, nbl_value_new_object(nbl_map_new()));
+        variable = nbl_map_get(context->env, name);
+    }
+    nbl_module_bind(variable->value->object, bindings, size);
+}
+
+void nbl_context_mark(NblContext *context) {
+    // The globals and includes that the context has now are kept by nbl_context_reset, a new context is marked after
+    // its standard library is made, so embedders that add natives mark it again
+    NblInterpreter *interpreter = context->interpreter;
+    interpreter->envMark = context->env->size;
+    for (size_t i = 0; i < interpreter->includes->size; i++) {
+        NblInclude *include = interpreter->includes->values[i];
+        include->kept = include->included;
+    }
+}
+
+void nbl_context_reset(NblContext *context) {
+    // Removes the globals that were declared after the mark, so the context can run the next program like a new
+    // one without making the standard library again. The parsed includes stay, but include_once includes them again.
+    // Values of the kept globals that a program changed in place stay changed
+    NblInterpreter *interpreter = context->interpreter;
+    NblMap *env = context->env;
+    while (env->size > interpreter->envMark) {
+        env->size--;
+        if (env->memory != NULL) nbl_memory_count(env->memory, -(int64_t)(strlen(env->keys[env->size]) + 1));
+        free(env->keys[env->size]);
+        nbl_variable_free(env->values[env->size]);
+    }
+    for (size_t i = 0; i < interpreter->includes->size; i++) {
+        NblInclude *include = interpreter->includes->values[i];
+        include->included = include->kept;
+    }
+}
+
+NblContext *nbl_context_ref(NblContext *context) {
+    context->refs++;
+    return context;
+}
+
+void nbl_context_free(NblContext *context) {
+    context->refs--;
+    if (context->refs > 0) return;
+
+    nbl_interpreter_free(context->interpreter);
+    nbl_map_free(context->env, (NblMapFreeFunc *)nbl_variable_free);
+    free(context);
+}
+
+NblInterpreter *nbl_interpreter_new(NblMap *env) {
+    NblInterpreter *interpreter = malloc(sizeof(NblInterpreter));
+    interpreter->env = env;
+    interpreter->envMark = env->size;
+    interpreter->randomSeed = nbl_time_ms() ^ (int64_t)((uintptr_t)interpreter & 0xffffff);
+    interpreter->includes = nbl_map_new();
+    interpreter->includeHits = 0;
+    interpreter->includeMisses = 0;
+    interpreter->cache = false;
+    interpreter->cacheDir = NULL;
+    interpreter->threads = 0;
+    interpreter->worker = NULL;
+    interpreter->loop = NULL;
+    interpreter->coroutine = NULL;
+    interpreter->profiler = NULL;
+    interpreter->counters = NULL;
+    interpreter->memoryStats = false;
+    interpreter->limits = (NblLimits){.memory = 0, .steps = 0, .time = 0, .fatal = false};
+    interpreter->limited = false;
+    interpreter->exceeded = false;
+    interpreter->aborted = false;
+    interpreter->steps = 0;
+    interpreter->memory = calloc(1, sizeof(NblMemory));
+    interpreter->maxSteps = 0;
+    interpreter->maxMemory = 0;
+    interpreter->deadline = 0;
+    interpreter->parent = NULL;
+    interpreter->interrupted = false;
+    return interpreter;
+}
+
+void nbl_interpreter_free(NblInterpreter *interpreter) {
+    // The loop is freed first, so the coroutines it cancels can still use the env
+    if (interpreter->loop != NULL) nbl_loop_free(interpreter->loop);
+    nbl_map_free(interpreter->includes, (NblMapFreeFunc *)nbl_include_free);
+    if (interpreter->cacheDir != NULL) free(interpreter->cacheDir);
+    if (interpreter->profiler != NULL) nbl_profiler_free(interpreter->profiler);
+    if (interpreter->counters != NULL) nbl_counters_free(interpreter->counters);
+    // Values of the interpreter that are still alive give their bytes back to its memory, the last one frees it
+    interpreter->memory->detached = true;
+    if (interpreter->memory->allocations == 0) free(interpreter->memory);
+    free(interpreter);
+}
+
+void nbl_interpreter_preload(NblInterpreter *interpreter, NblNode *node) {
+    // Parse the include graph before running, level by level with the files of one level parsed in parallel.
+    // Only static includes at the top level are followed, because those are always run
+    NblList *paths = nbl_list_new();
+    nbl_interpreter_preload_find(interpreter, node, paths);
+    while (paths->size > 0) {
+        NblPreloader preloader = {.interpreter = interpreter, .paths = paths, .includes = calloc(paths->size, sizeof(NblInclude *)), .next = 0};
+#ifdef NBL_THREADS
+        size_t threadsSize = interpreter->threads > 0 ? interpreter->threads : nbl_cpu_count();
+        if (threadsSize > paths->size) threadsSize = paths->size;
+        thrd_t *threads = malloc(sizeof(thrd_t) * threadsSize);
+        size_t startedSize = 0;
+        for (size_t i = 1; i < threadsSize; i++) {
+            if (thrd_create(&threads[startedSize], nbl_interpreter_preload_worker, &preloader) == thrd_success) startedSize++;
+        }
+        nbl_interpreter_preload_worker(&preloader);
+        for (size_t i = 0; i < startedSize; i++) thrd_join(threads[i], NULL);
+        free(threads);
+#else
+        nbl_interpreter_preload_worker(&preloader);
+#endif
+
+        for (size_t i = 0; i < paths->size; i++) {
+            if (preloader.includes[i] == NULL) continue;
+            interpreter->includeMisses++;
+            nbl_map_set(interpreter->includes, nbl_list_get(paths, i), preloader.includes[i]);
+        }
+        NblList *nextPaths = nbl_list_new();
+        for (size_t i = 0; i < paths->size; i++) {
+            if (preloader.includes[i] != NULL) nbl_interpreter_preload_find(interpreter, preloader.includes[i]->node, nextPaths);
+        }
+        free(preloader.includes);
+        nbl_list_free(paths, (NblListFreeFunc *)free);
+        paths = nextPaths;
+    }
+    nbl_list_free(paths, (NblListFreeFunc *)free);
+}
+
+void nbl_interpreter_preload_find(NblInterpreter *interpreter, NblNode *node, NblList *paths) {
+    nbl_list_foreach(node->nodes, NblNode * child, {
+        if ((child->type == NBL_NODE_INCLUDE || child->type == NBL_NODE_INCLUDE_ONCE) && child->unary->type == NBL_NODE_VALUE &&
+            child->unary->value->type == NBL_VALUE_STRING) {
+            char *path = nbl_include_path(child->token, child->unary->value->string);
+            bool found = nbl_map_get(interpreter->includes, path) != NULL;
+            for (size_t i = 0; i < paths->size && !found; i++) found = !strcmp(nbl_list_get(paths, i), path);
+            if (found) {
+                free(path);
+            } else {
+                nbl_list_add(paths, path);
+            }
+        }
+    });
+}
+
+int nbl_interpreter_preload_worker(void *data) {
+    NblPreloader *preloader = data;
+    for (;;) {
+        size_t index = preloader->next++;
+        if (index >= preloader->paths->size) break;
+        char *path = nbl_list_get(preloader->paths, index);
+        int64_t modifiedTime, fileSize;
+        if (!nbl_file_stat(path, &modifiedTime, &fileSize)) continue;
+        char *text = nbl_file_read(path);
+        if (text == NULL) continue;
+        preloader->includes[index] = nbl_include_new(nbl_cache_parse(preloader->interpreter, path, text, true), modifiedTime, fileSize);
+        free(text);
+    }
+    return 0;
+}
+
+NblValue *nbl_interpreter(NblContext *context, NblNode *node) {
+    NblScope scope = {.exception = &(NblExceptionScope){.exceptionValue = NULL},
+                      .function = &(NblFunctionScope){.returnValue = NULL},
+                      .loop = &(NblLoopScope){.inLoop = false, .isContinuing = false, .isBreaking = false},
+                      .block = &(NblBlockScope){.parentBlock = NULL, .env = context->env}};
+    NblInterpreter *owner = nbl_interpreter_limits_start(context->interpreter);
+    NblValue *returnValue = nbl_interpreter_node(context->interpreter, &scope, node);
+    if (scope.exception->exceptionValue != NULL) {
+        nbl_interpreter_print_exception(scope.exception->exceptionValue);
+        nbl_value_free(scope.exception->exceptionValue);
+    } else if (!nbl_loop_run(context->interpreter, NULL)) {
+        // Tasks that are not awaited by the script run when it is done, until an interrupt, which is handled with that
+        context->interpreter->interrupted = false;
+    }
+    nbl_interpreter_limits_end(owner);
+    if (returnValue != NULL) {
+        return returnValue;
+    }
+    if (scope.function->returnValue != NULL) {
+        return scope.function->returnValue;
+    } else {
+        return nbl_value_new_null();
+    }
+}
+
+void nbl_interpreter_print_exception(NblValue *exception) {
+    NblValue *path = nbl_value_class_get(exception, "path");
+    NblValue *text = nbl_value_class_get(exception, "text");
+    NblValue *line = nbl_value_class_get(exception, "line");
+    NblValue *column = nbl_value_class_get(exception, "column");
+    NblSource *source = nbl_source_new(path->string, text->string);
+    source->firstLine = line->integer;
+    NblToken *token = nbl_token_new(NBL_TOKEN_THROW, source, line->integer, column->integer);
+    nbl_source_free(source);
+    NblValue *error = nbl_value_class_get(exception, "error");
+    nbl_print_error(token, "Uncatched exception: %s", error->string);
+    nbl_token_free(token);
+}
+
+NblValue *nbl_type_error_exception(NblValueType expected, NblValueType got) {
+    return nbl_value_new_string_format("Unexpected type: '%s' expected '%s'", nbl_value_type_to_string(got), nbl_value_type_to_string(expected));
+}
+
+#define interpreter_statement_in_try(interpreter, scope, node, cleanup)   \
+    {                                                                     \
         NblValue *nodeValue = nbl_interpreter_node(interpreter, scope, node); \
         if (nodeValue != NULL) nbl_value_free(nodeValue);                     \
         if ((scope)->function->returnValue != NULL) {                     \
@@ -3251,43 +6979,27 @@ NblValue *nbl_type_error_exception(NblValueType expected, NblValueType got) {
     }
 
 NblValue *nbl_interpreter_call(NblContext *context, NblValue *callValue, NblValue *this, NblList *arguments) {
-    if (callValue->type == NBL_VALUE_FUNCTION) {
-        NblScope functionScope = {.exception = context->scope->exception,
-                                  .function = &(NblFunctionScope){.returnValue = NULL},
-                                  .loop = &(NblLoopScope){.inLoop = false, .isContinuing = false, .isBreaking = false},
-                                  .block = &(NblBlockScope){.parentBlock = context->scope->block, .env = nbl_map_new()}};
-        if (this != NULL) {
-            if (this->instanceClass->parentClass != NULL) {
-                nbl_map_set(functionScope.block->env, "super",
-                        nbl_variable_new(NBL_VALUE_INSTANCE, false, nbl_value_new_instance(nbl_map_ref(this->object), nbl_value_ref(this->instanceClass->parentClass))));
-            }
-            nbl_map_set(functionScope.block->env, "this", nbl_variable_new(NBL_VALUE_INSTANCE, false, nbl_value_ref(this)));
-        }
-        nbl_map_set(functionScope.block->env, "arguments", nbl_variable_new(NBL_VALUE_ARRAY, false, nbl_value_new_array(nbl_list_ref(arguments))));
-        for (size_t i = 0; i < callValue->arguments->size; i++) {
-            NblArgument *argument = nbl_list_get(callValue->arguments, i);
-            nbl_map_set(functionScope.block->env, argument->name, nbl_variable_new(argument->type, true, nbl_value_ref(nbl_list_get(arguments, i))));
-        }
-        NblInterpreter interpreter = {.env = context->env};
-        nbl_interpreter_node(&interpreter, &functionScope, callValue->functionNode);
-        nbl_map_free(functionScope.block->env, (NblMapFreeFunc *)nbl_variable_free);
-        if (callValue->returnType != NBL_VALUE_ANY && context->scope->exception->exceptionValue == NULL &&
-            functionScope.function->returnValue->type != callValue->returnType) {
-            NblValueType returnValueType = functionScope.function->returnValue->type;
-            nbl_value_free(functionScope.function->returnValue);
-            return nbl_interpreter_throw(context, nbl_type_error_exception(callValue->returnType, returnValueType));
-        }
-
-        if (functionScope.function->returnValue != NULL) {
-            return functionScope.function->returnValue;
-        }
+    if (nbl_interpreter_checks(context->interpreter) && nbl_interpreter_stopped(context->interpreter, context->scope, context->node)) {
         return nbl_value_new_null();
     }
+    if (callValue->type == NBL_VALUE_FUNCTION && (callValue->async || callValue->generator)) {
+        return nbl_interpreter_call_coroutine(context, callValue, this, arguments);
+    }
+    if (callValue->type == NBL_VALUE_FUNCTION) {
+        return nbl_interpreter_call_function(context, callValue, this, arguments);
+    }
 
     if (callValue->type == NBL_VALUE_NATIVE_FUNCTION) {
-        NblValue *returnValue = callValue->nativeFunc(context, this, arguments);
+        NblProfilerFrame frame;
+        if (context->interpreter->profiler != NULL) nbl_profiler_push(context->interpreter->profiler, &frame, callValue, context->node);
+        if (context->interpreter->counters != NULL) context->interpreter->counters->nativeCalls++;
+        NblValue *returnValue = callValue->signature != NBL_SIGNATURE_VALUES ? nbl_interpreter_call_typed(context, callValue, arguments)
+                                                                             : callValue->nativeFunc(context, this, arguments);
+        if (context->interpreter->profiler != NULL) nbl_profiler_pop(context->interpreter->profiler, &frame);
         if (callValue->returnType != NBL_VALUE_ANY && context->scope->exception->exceptionValue == NULL && returnValue->type != callValue->returnType) {
-            return nbl_interpreter_throw(context, nbl_type_error_exception(callValue->returnType, returnValue->type));
+            NblValueType returnType = returnValue->type;
+            nbl_value_free(returnValue);
+            return nbl_interpreter_throw(context, nbl_type_error_exception(callValue->returnType, returnType));
         }
         return returnValue;
     }
@@ -3296,8 +7008,10 @@ NblValue *nbl_interpreter_call(NblContext *context, NblValue *callValue, NblValu
         NblValue *instance = nbl_value_new_instance(nbl_map_new(), nbl_value_ref(callValue));
         NblValue *constructorFunction = nbl_value_class_get(callValue, "constructor");
         if (constructorFunction != NULL) {
+            // An instance whose constructor threw is never returned
+            NblValue *pendingException = context->scope->exception->exceptionValue;
             NblValue *newReturnValue = nbl_interpreter_call(context, constructorFunction, instance, arguments);
-            if (newReturnValue->type == NBL_VALUE_NULL) {
+            if (newReturnValue->type == NBL_VALUE_NULL && context->scope->exception->exceptionValue == pendingException) {
                 nbl_value_free(newReturnValue);
             } else {
                 nbl_value_free(instance);
@@ -3309,9 +7023,89 @@ NblValue *nbl_interpreter_call(NblContext *context, NblValue *callValue, NblValu
     return NULL;
 }
 
+void nbl_interpreter_arguments_free(NblList *arguments, bool typed) {
+    // The arguments of a typed native are on the stack, so only their values are freed
+    if (!typed) {
+        nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+        return;
+    }
+    for (size_t i = 0; i < arguments->size; i++) {
+        if (arguments->items[i] != NULL) nbl_value_free(arguments->items[i]);
+    }
+}
+
+NblValue *nbl_interpreter_call_typed(NblContext *context, NblValue *native, NblList *arguments) {
+    // Natives can call a typed native with values that the call node didn't check, so the types are checked here
+    for (size_t i = 0; i < native->arguments->size; i++) {
+        NblArgument *argument = nbl_list_get(native->arguments, i);
+        NblValue *value = nbl_list_get(arguments, i);
+        if (value == NULL || value->type != argument->type) {
+            return nbl_interpreter_throw(context, nbl_type_error_exception(argument->type, value != NULL ? value->type : NBL_VALUE_NULL));
+        }
+    }
+    NblValue *x = nbl_list_get(arguments, 0);
+    NblValue *y = nbl_list_get(arguments, 1);
+    if (native->signature == NBL_SIGNATURE_FLOAT_FLOAT) return nbl_value_new_float(((double (*)(double))native->typedFunc)(x->floating));
+    if (native->signature == NBL_SIGNATURE_FLOAT_FLOAT_FLOAT) {
+        return nbl_value_new_float(((double (*)(double, double))native->typedFunc)(x->floating, y->floating));
+    }
+    if (native->signature == NBL_SIGNATURE_INT_INT) return nbl_value_new_int(((int64_t (*)(int64_t))native->typedFunc)(x->integer));
+    if (native->signature == NBL_SIGNATURE_INT_INT_INT) {
+        return nbl_value_new_int(((int64_t (*)(int64_t, int64_t))native->typedFunc)(x->integer, y->integer));
+    }
+    if (native->signature == NBL_SIGNATURE_INT_STRING) return nbl_value_new_int(((int64_t (*)(char *))native->typedFunc)(x->string));
+    if (native->signature == NBL_SIGNATURE_STRING_STRING) {
+        char *string = ((char *(*)(char *))native->typedFunc)(x->string);
+        if (string == NULL) return nbl_value_new_null();
+        NblValue *value = nbl_value_new(NBL_VALUE_STRING);
+        nbl_value_set_string(value, string);
+        return value;
+    }
+    return nbl_value_new_null();
+}
+
+NblValue *nbl_interpreter_call_function(NblContext *context, NblValue *function, NblValue *this, NblList *arguments) {
+    NblScope functionScope = {.exception = context->scope->exception,
+                              .function = &(NblFunctionScope){.returnValue = NULL},
+                              .loop = &(NblLoopScope){.inLoop = false, .isContinuing = false, .isBreaking = false},
+                              .block = &(NblBlockScope){.parentBlock = context->scope->block, .env = nbl_map_new()}};
+    if (this != NULL) {
+        // Objects, strings and arrays are also given as this but only instances have a class
+        if (this->type == NBL_VALUE_INSTANCE && this->instanceClass->parentClass != NULL) {
+            nbl_map_set(functionScope.block->env, "super",
+                    nbl_variable_new(NBL_VALUE_INSTANCE, false, nbl_value_new_instance(nbl_map_ref(this->object), nbl_value_ref(this->instanceClass->parentClass))));
+        }
+        nbl_map_set(functionScope.block->env, "this", nbl_variable_new(this->type, false, nbl_value_ref(this)));
+    }
+    nbl_map_set(functionScope.block->env, "arguments", nbl_variable_new(NBL_VALUE_ARRAY, false, nbl_value_new_array(nbl_list_ref(arguments))));
+    for (size_t i = 0; i < function->arguments->size; i++) {
+        NblArgument *argument = nbl_list_get(function->arguments, i);
+        // Natives can call a function with less arguments than it has, the missing arguments are null
+        NblValue *value = nbl_list_get(arguments, i);
+        nbl_map_set(functionScope.block->env, argument->name, nbl_variable_new(argument->type, true, value != NULL ? nbl_value_ref(value) : nbl_value_new_null()));
+    }
+    NblProfilerFrame frame;
+    if (context->interpreter->profiler != NULL) nbl_profiler_push(context->interpreter->profiler, &frame, function, context->node);
+    if (context->interpreter->counters != NULL) nbl_counters_call(context->interpreter->counters, function);
+    nbl_interpreter_node(context->interpreter, &functionScope, function->functionNode);
+    if (context->interpreter->profiler != NULL) nbl_profiler_pop(context->interpreter->profiler, &frame);
+    nbl_map_free(functionScope.block->env, (NblMapFreeFunc *)nbl_variable_free);
+    if (function->returnType != NBL_VALUE_ANY && context->scope->exception->exceptionValue == NULL &&
+        functionScope.function->returnValue->type != function->returnType) {
+        NblValueType returnValueType = functionScope.function->returnValue->type;
+        nbl_value_free(functionScope.function->returnValue);
+        return nbl_interpreter_throw(context, nbl_type_error_exception(function->returnType, returnValueType));
+    }
+
+    if (functionScope.function->returnValue != NULL) {
+        return functionScope.function->returnValue;
+    }
+    return nbl_value_new_null();
+}
+
 NblValue *nbl_interpreter_throw(NblContext *context, NblValue *exception) {
     if (exception->type == NBL_VALUE_STRING) {
-        NblValue *exceptionClass = ((NblVariable *)nbl_map_get(context->env, "Exception"))->value;
+        NblValue *exceptionClass = nbl_std_env_get(context->env, "Exception")->value;
         NblList *arguments = nbl_list_new();
         nbl_list_add(arguments, exception);
         exception = nbl_interpreter_call(context, exceptionClass, NULL, arguments);
@@ -3321,10 +7115,184 @@ NblValue *nbl_interpreter_throw(NblContext *context, NblValue *exception) {
         return nbl_interpreter_throw(context, nbl_type_error_exception(NBL_VALUE_INSTANCE, exception->type));
     }
     context->scope->exception->exceptionValue = exception;
+    if (context->interpreter->counters != NULL) context->interpreter->counters->exceptions++;
     return nbl_value_new_null();
 }
 
-NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, NblNode *node) {
+NblInterpreter *nbl_interpreter_limits_start(NblInterpreter *interpreter) {
+    // Starts the budget of an eval, returns the interpreter whose memory was counted on this thread before.
+    // An interrupt that came before the eval stops it, an interrupt is only cleared by the eval that handled it
+    NblInterpreter *owner = nbl_memory_owner;
+    interpreter->exceeded = false;
+    interpreter->aborted = false;
+    interpreter->steps = 0;
+    interpreter->maxSteps = interpreter->limits.steps;
+    interpreter->maxMemory = interpreter->limits.memory;
+    interpreter->deadline = nbl_time_ms() + interpreter->limits.time;
+    nbl_memory_owner = nbl_memory_counted(interpreter) ? interpreter : NULL;
+    return owner;
+}
+
+void nbl_interpreter_limits_end(NblInterpreter *owner) { nbl_memory_owner = owner; }
+
+bool nbl_interpreter_interrupted(NblInterpreter *interpreter) {
+    for (; interpreter != NULL; interpreter = interpreter->parent) {
+        if (interpreter->interrupted) return true;
+    }
+    return false;
+}
+
+bool nbl_interpreter_stopped(NblInterpreter *interpreter, NblScope *scope, NblNode *node) {
+    // Checked at loop iterations and calls, throws and returns true when the context is interrupted or went over one
+    // of its limits. The clock is only read every 1024 steps
+    if (scope->exception->exceptionValue != NULL) return false;
+    NblLimits *limits = &interpreter->limits;
+    bool fatal = false;
+    char *error = NULL;
+    if (nbl_interpreter_interrupted(interpreter)) {
+        // An interrupt can't be catched, so the host always gets its eval back. The interrupt of a parent is cleared
+        // by the eval of the parent
+        interpreter->interrupted = false;
+        error = "Interrupted";
+        fatal = true;
+    } else if (interpreter->limited) {
+        interpreter->steps++;
+        if (limits->memory > 0 && interpreter->memory->bytes > interpreter->maxMemory) {
+            error = "Memory limit exceeded";
+        } else if (limits->steps > 0 && interpreter->steps > interpreter->maxSteps) {
+            error = "Step limit exceeded";
+        } else if (limits->time > 0 && (interpreter->steps & 1023) == 0 && nbl_time_ms() > interpreter->deadline) {
+            error = "Time limit exceeded";
+        }
+    }
+    if (error == NULL) return false;
+    NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
+    nbl_value_free(nbl_interpreter_throw_limit(&context, error, fatal));
+    return true;
+}
+
+NblValue *nbl_interpreter_throw_limit(NblContext *context, char *error, bool fatal) {
+    // Throws going over a limit, the script can catch that once and then gets an eighth more of every limit
+    NblInterpreter *interpreter = context->interpreter;
+    NblLimits *limits = &interpreter->limits;
+    fatal = fatal || limits->fatal || interpreter->exceeded;
+
+    // Making the exception calls its class, which must not hit the limit or the interrupt of a parent again
+    bool limited = interpreter->limited;
+    NblInterpreter *parent = interpreter->parent;
+    interpreter->limited = false;
+    interpreter->parent = NULL;
+    NblValue *returnValue = nbl_interpreter_throw(context, nbl_value_new_string(error));
+    interpreter->limited = limited;
+    interpreter->parent = parent;
+    if (fatal) {
+        interpreter->aborted = true;
+    } else {
+        interpreter->exceeded = true;
+        interpreter->maxSteps += limits->steps / 8;
+        interpreter->maxMemory += limits->memory / 8;
+        interpreter->deadline += limits->time / 8;
+    }
+    return returnValue;
+}
+
+NblValue *nbl_interpreter_get(NblInterpreter *interpreter, NblScope *scope, NblNode *node, NblValue *containerValue) {
+    // Gets an item or member of the already evaluated lhs of a get node, calls use it so the lhs is evaluated only once
+    if (scope->exception->exceptionValue != NULL) return containerValue;
+    if (containerValue->type != NBL_VALUE_STRING && containerValue->type != NBL_VALUE_ARRAY && containerValue->type != NBL_VALUE_OBJECT &&
+        containerValue->type != NBL_VALUE_CLASS && containerValue->type != NBL_VALUE_INSTANCE) {
+        NblValueType containerValueType = containerValue->type;
+        nbl_value_free(containerValue);
+        NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
+        return nbl_interpreter_throw(&context, nbl_value_new_string_format("NblVariable is not a string, array, object, class or instance it is: %s",
+                                                                   nbl_value_type_to_string(containerValueType)));
+    }
+
+    NblValue *indexOrKey = nbl_interpreter_node(interpreter, scope, node->rhs);
+    NblValue *returnValue = NULL;
+    if (containerValue->type == NBL_VALUE_STRING) {
+        if (indexOrKey->type == NBL_VALUE_STRING) {
+            NblValue *stringClass = nbl_std_env_get(interpreter->env, "String")->value;
+            NblValue *stringClassItem = nbl_map_get(stringClass->object, indexOrKey->string);
+            if (stringClassItem != NULL) returnValue = nbl_value_retrieve(stringClassItem);
+        }
+        if (returnValue == NULL) {
+            if (indexOrKey->type != NBL_VALUE_INT) {
+                NblValueType indexOrKeyType = indexOrKey->type;
+                nbl_value_free(indexOrKey);
+                nbl_value_free(containerValue);
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->rhs};
+                return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_INT, indexOrKeyType));
+            }
+            if (indexOrKey->integer >= 0 && indexOrKey->integer <= (int64_t)strlen(containerValue->string)) {
+                char character[] = {containerValue->string[indexOrKey->integer], '\0'};
+                returnValue = nbl_value_new_string(character);
+            } else {
+                returnValue = nbl_value_new_null();
+            }
+        }
+    }
+    if (containerValue->type == NBL_VALUE_ARRAY) {
+        if (indexOrKey->type == NBL_VALUE_STRING) {
+            NblValue *arrayClass = nbl_std_env_get(interpreter->env, "Array")->value;
+            NblValue *arrayClassItem = nbl_map_get(arrayClass->object, indexOrKey->string);
+            if (arrayClassItem != NULL) returnValue = nbl_value_retrieve(arrayClassItem);
+        }
+        if (returnValue == NULL) {
+            if (indexOrKey->type != NBL_VALUE_INT) {
+                NblValueType indexOrKeyType = indexOrKey->type;
+                nbl_value_free(indexOrKey);
+                nbl_value_free(containerValue);
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->rhs};
+                return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_INT, indexOrKeyType));
+            }
+            NblValue *value = nbl_list_get(containerValue->array, indexOrKey->integer);
+            returnValue = value != NULL ? nbl_value_retrieve(value) : nbl_value_new_null();
+        }
+    }
+    if (containerValue->type == NBL_VALUE_INSTANCE && indexOrKey->type == NBL_VALUE_INT) {
+        NblTypedArray *typedArray = nbl_typed_array_get(containerValue);
+        if (typedArray != NULL) returnValue = nbl_typed_array_get_item(typedArray, indexOrKey->integer);
+    }
+    if (containerValue->type == NBL_VALUE_OBJECT || containerValue->type == NBL_VALUE_CLASS || containerValue->type == NBL_VALUE_INSTANCE) {
+        if (containerValue->type == NBL_VALUE_OBJECT && indexOrKey->type == NBL_VALUE_STRING) {
+            NblValue *objectClass = nbl_std_env_get(interpreter->env, "Object")->value;
+            NblValue *objectClassItem = nbl_map_get(objectClass->object, indexOrKey->string);
+            if (objectClassItem != NULL) returnValue = nbl_value_retrieve(objectClassItem);
+        }
+        if (returnValue == NULL) {
+            if (indexOrKey->type != NBL_VALUE_STRING) {
+                NblValueType indexOrKeyType = indexOrKey->type;
+                nbl_value_free(indexOrKey);
+                nbl_value_free(containerValue);
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->rhs};
+                return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_STRING, indexOrKeyType));
+            }
+            NblValue *value;
+            if (containerValue->type == NBL_VALUE_INSTANCE) {
+                value = nbl_value_class_get(containerValue, indexOrKey->string);
+            } else {
+                value = nbl_map_get(containerValue->object, indexOrKey->string);
+            }
+            if (value == NULL) {
+                char *indexOrKeyString = strdup(indexOrKey->string);
+                nbl_value_free(indexOrKey);
+                nbl_value_free(containerValue);
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
+                NblValue *exception = nbl_value_new_string_format("Can't find %s in object", indexOrKeyString);
+                free(indexOrKeyString);
+                return nbl_interpreter_throw(&context, exception);
+            }
+            returnValue = nbl_value_retrieve(value);
+        }
+    }
+
+    nbl_value_free(indexOrKey);
+    nbl_value_free(containerValue);
+    return returnValue;
+}
+
+static NblValue *nbl_interpreter_eval(NblInterpreter *interpreter, NblScope *scope, NblNode *node) {
     if (node->type == NBL_NODE_PROGRAM) {
         nbl_list_foreach(node->nodes, NblNode * child, { interpreter_statement(interpreter, scope, child, {}); });
         return NULL;
@@ -3348,7 +7316,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         if (condition->type != NBL_VALUE_BOOL) {
             NblValueType conditionType = condition->type;
             nbl_value_free(condition);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->condition};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->condition};
             return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_BOOL, conditionType));
         }
         if (condition->boolean) {
@@ -3364,7 +7332,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         if (condition->type != NBL_VALUE_BOOL) {
             NblValueType conditionType = condition->type;
             nbl_value_free(condition);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->condition};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->condition};
             return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_BOOL, conditionType));
         }
         if (condition->boolean) {
@@ -3378,6 +7346,11 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         NblScope tryScope = {
             .exception = &(NblExceptionScope){.exceptionValue = NULL}, .function = scope->function, .loop = scope->loop, .block = scope->block};
         interpreter_statement_in_try(interpreter, &tryScope, node->tryBlock, {});
+        if (tryScope.exception->exceptionValue != NULL && interpreter->aborted) {
+            // A fatal limit exception goes past every catch and finally
+            scope->exception->exceptionValue = tryScope.exception->exceptionValue;
+            return NULL;
+        }
         if (tryScope.exception->exceptionValue != NULL) {
             NblScope catchScope = {.exception = scope->exception,
                                    .function = scope->function,
@@ -3408,6 +7381,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (loopScope.loop->isBreaking) {
                 break;
             }
+            if (nbl_interpreter_checks(interpreter) && nbl_interpreter_stopped(interpreter, scope, node)) return NULL;
         }
         return NULL;
     }
@@ -3421,7 +7395,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (condition->type != NBL_VALUE_BOOL) {
                 NblValueType conditionType = condition->type;
                 nbl_value_free(condition);
-                NblContext context = {.env = interpreter->env, .scope = scope, .node = node->condition};
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->condition};
                 return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_BOOL, conditionType));
             }
             if (!condition->boolean) {
@@ -3437,6 +7411,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (loopScope.loop->isBreaking) {
                 break;
             }
+            if (nbl_interpreter_checks(interpreter) && nbl_interpreter_stopped(interpreter, scope, node)) return NULL;
         }
         return NULL;
     }
@@ -3453,12 +7428,13 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (loopScope.loop->isBreaking) {
                 break;
             }
+            if (nbl_interpreter_checks(interpreter) && nbl_interpreter_stopped(interpreter, scope, node)) return NULL;
 
             NblValue *condition = nbl_interpreter_node(interpreter, scope, node->condition);
             if (condition->type != NBL_VALUE_BOOL) {
                 NblValueType conditionType = condition->type;
                 nbl_value_free(condition);
-                NblContext context = {.env = interpreter->env, .scope = scope, .node = node->condition};
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->condition};
                 return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_BOOL, conditionType));
             }
             if (!condition->boolean) {
@@ -3479,7 +7455,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (condition->type != NBL_VALUE_BOOL) {
                 NblValueType conditionType = condition->type;
                 nbl_value_free(condition);
-                NblContext context = {.env = interpreter->env, .scope = scope, .node = node->condition};
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->condition};
                 return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_BOOL, conditionType));
             }
             if (!condition->boolean) {
@@ -3495,6 +7471,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (loopScope.loop->isBreaking) {
                 break;
             }
+            if (nbl_interpreter_checks(interpreter) && nbl_interpreter_stopped(interpreter, scope, node)) return NULL;
 
             interpreter_statement(interpreter, &loopScope, node->incrementBlock, {});
         }
@@ -3506,37 +7483,53 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             iterator->type != NBL_VALUE_CLASS && iterator->type != NBL_VALUE_INSTANCE) {
             NblValueType iteratorType = iterator->type;
             nbl_value_free(iterator);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->iterator};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->iterator};
             return nbl_interpreter_throw(&context, nbl_value_new_string_format("NblVariable is not a string, array, object, class or instance it is: %s",
                                                                        nbl_value_type_to_string(iteratorType)));
         }
 
+        // Ranges count without allocating and objects and instances with a next function are iterated lazily
+        NblRange *range = nbl_range_get(iterator);
+        int64_t number = range != NULL ? range->start : 0;
+        NblTypedArray *typedArray = nbl_typed_array_get(iterator);
+        NblValue *next = range == NULL && typedArray == NULL ? nbl_iterator_get_next(iterator) : NULL;
+        if (next != NULL) nbl_value_ref(next);
+
         NblScope loopScope = {.exception = scope->exception,
                               .function = scope->function,
                               .loop = &(NblLoopScope){.inLoop = true, .isContinuing = false, .isBreaking = false},
                               .block = &(NblBlockScope){.parentBlock = scope->block, .env = nbl_map_new()}};
-        size_t size;
+        size_t size = SIZE_MAX;
         if (iterator->type == NBL_VALUE_STRING) {
             size = strlen(iterator->string);
         }
         if (iterator->type == NBL_VALUE_ARRAY) {
             size = iterator->array->size;
         }
-        if (iterator->type == NBL_VALUE_OBJECT || iterator->type == NBL_VALUE_CLASS || iterator->type == NBL_VALUE_INSTANCE) {
+        if (typedArray != NULL) {
+            size = typedArray->size;
+        } else if (range == NULL && next == NULL && (iterator->type == NBL_VALUE_OBJECT || iterator->type == NBL_VALUE_CLASS || iterator->type == NBL_VALUE_INSTANCE)) {
             size = iterator->object->size;
         }
 
         for (size_t i = 0; i < size; i++) {
             NblValue *iteratorValue;
-            if (iterator->type == NBL_VALUE_STRING) {
+            if (range != NULL) {
+                if (!nbl_range_has(range, number)) break;
+                iteratorValue = nbl_value_new_int(number);
+                number += range->step;
+            } else if (next != NULL) {
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->iterator};
+                if (!nbl_iterator_next(&context, iterator, next, &iteratorValue)) break;
+            } else if (typedArray != NULL) {
+                iteratorValue = nbl_typed_array_get_item(typedArray, i);
+            } else if (iterator->type == NBL_VALUE_STRING) {
                 char character[] = {iterator->string[i], '\0'};
                 iteratorValue = nbl_value_new_string(character);
-            }
-            if (iterator->type == NBL_VALUE_ARRAY) {
+            } else if (iterator->type == NBL_VALUE_ARRAY) {
                 NblValue *value = nbl_list_get(iterator->array, i);
                 iteratorValue = value != NULL ? nbl_value_retrieve(value) : nbl_value_new_null();
-            }
-            if (iterator->type == NBL_VALUE_OBJECT || iterator->type == NBL_VALUE_CLASS || iterator->type == NBL_VALUE_INSTANCE) {
+            } else {
                 iteratorValue = nbl_value_new_string(iterator->object->keys[i]);
             }
             NblVariable *previousVariable = nbl_map_get(loopScope.block->env, node->forinVariable->lhs->string);
@@ -3548,21 +7541,28 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                         nbl_variable_new(node->forinVariable->declarationType, node->forinVariable->type == NBL_NODE_LET_ASSIGN, iteratorValue));
             }
 
-            interpreter_statement_in_loop(interpreter, &loopScope, node->thenBlock, {});
+            // Leave through the cleanup below on return and exceptions, a lazy iterator holds a reference to its next function
+            NblValue *nodeValue = nbl_interpreter_node(interpreter, &loopScope, node->thenBlock);
+            if (nodeValue != NULL) nbl_value_free(nodeValue);
+            if (scope->function->returnValue != NULL || scope->exception->exceptionValue != NULL) {
+                break;
+            }
             if (loopScope.loop->isContinuing) {
                 loopScope.loop->isContinuing = false;
             }
             if (loopScope.loop->isBreaking) {
                 break;
             }
+            if (nbl_interpreter_checks(interpreter) && nbl_interpreter_stopped(interpreter, scope, node)) break;
         }
+        if (next != NULL) nbl_value_free(next);
         nbl_map_free(loopScope.block->env, (NblMapFreeFunc *)nbl_variable_free);
         nbl_value_free(iterator);
         return NULL;
     }
     if (node->type == NBL_NODE_CONTINUE) {
         if (!scope->loop->inLoop) {
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
             return nbl_interpreter_throw(&context, nbl_value_new_string("Continue not in a loop"));
         }
         scope->loop->isContinuing = true;
@@ -3570,7 +7570,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
     }
     if (node->type == NBL_NODE_BREAK) {
         if (!scope->loop->inLoop) {
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
             return nbl_interpreter_throw(&context, nbl_value_new_string("Break not in a loop"));
         }
         scope->loop->isBreaking = true;
@@ -3581,40 +7581,55 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         return NULL;
     }
     if (node->type == NBL_NODE_THROW) {
-        NblContext context = {.env = interpreter->env, .scope = scope, .node = node->unary};
+        NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->unary};
         return nbl_interpreter_throw(&context, nbl_interpreter_node(interpreter, scope, node->unary));
     }
-    if (node->type == NBL_NODE_INCLUDE) {
+    if (node->type == NBL_NODE_AWAIT || node->type == NBL_NODE_YIELD) {
+        NblValue *value = nbl_interpreter_node(interpreter, scope, node->unary);
+        if (scope->exception->exceptionValue != NULL) return value;
+        NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
+        return node->type == NBL_NODE_AWAIT ? nbl_interpreter_await(&context, value) : nbl_interpreter_yield(&context, value);
+    }
+    if (node->type == NBL_NODE_INCLUDE || node->type == NBL_NODE_INCLUDE_ONCE) {
         NblValue *pathValue = nbl_interpreter_node(interpreter, scope, node->unary);
         if (pathValue->type != NBL_VALUE_STRING) {
             NblValueType pathValueType = pathValue->type;
             nbl_value_free(pathValue);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->unary};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->unary};
             return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_STRING, pathValueType));
         }
-        char includePath[255];
-        if (strlen(node->token->source->dirname) > 0) {
-            sprintf(includePath, "%s/%s", node->token->source->dirname, pathValue->string);
-        } else {
-            strcpy(includePath, pathValue->string);
-        }
+        // Included files are parsed once per context, the nodes are reused as long as the file is not modified
+        char *canonicalPath = nbl_include_path(node->token, pathValue->string);
         nbl_value_free(pathValue);
-        char *includeText = nbl_file_read(includePath);
-        if (includeText == NULL) {
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->unary};
-            return nbl_interpreter_throw(&context, nbl_value_new_string_format("Can't read file: %s", includePath));
+        NblInclude *include = nbl_map_get(interpreter->includes, canonicalPath);
+        if (include != NULL && include->included && node->type == NBL_NODE_INCLUDE_ONCE) {
+            free(canonicalPath);
+            return NULL;
         }
-
-        NblList *tokens = nbl_lexer(includePath, includeText);
-        NblNode *includeNode = nbl_parser(tokens, true);
-        interpreter_statement(interpreter, scope, includeNode, {
-            nbl_node_free(includeNode);
-            nbl_list_free(tokens, (NblListFreeFunc *)nbl_token_free);
+        int64_t modifiedTime = 0, fileSize = 0;
+        nbl_file_stat(canonicalPath, &modifiedTime, &fileSize);
+        if (include != NULL && include->modifiedTime == modifiedTime && include->fileSize == fileSize) {
+            interpreter->includeHits++;
+        } else {
+            interpreter->includeMisses++;
+            char *includeText = nbl_file_read(canonicalPath);
+            if (includeText == NULL) {
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->unary};
+                NblValue *exception = nbl_value_new_string_format("Can't read file: %s", canonicalPath);
+                free(canonicalPath);
+                return nbl_interpreter_throw(&context, exception);
+            }
+            if (include != NULL) nbl_include_free(include);
+            include = nbl_include_new(nbl_cache_parse(interpreter, canonicalPath, includeText, true), modifiedTime, fileSize);
+            nbl_map_set(interpreter->includes, canonicalPath, include);
             free(includeText);
-        });
+        }
+        free(canonicalPath);
+
+        include->included = true;
+        NblNode *includeNode = nbl_node_ref(include->node);
+        interpreter_statement(interpreter, scope, includeNode, { nbl_node_free(includeNode); });
         nbl_node_free(includeNode);
-        nbl_list_free(tokens, (NblListFreeFunc *)nbl_token_free);
-        free(includeText);
         return NULL;
     }
 
@@ -3642,13 +7657,13 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         NblValue *rhs = nbl_interpreter_node(interpreter, scope, node->rhs);
         if (nbl_map_get(scope->block->env, node->lhs->string) != NULL) {
             nbl_value_free(rhs);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->lhs};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->lhs};
             return nbl_interpreter_throw(&context, nbl_value_new_string_format("Can't redeclare variable: '%s'", node->lhs->string));
         }
         if (node->declarationType != NBL_VALUE_ANY && node->declarationType != rhs->type) {
             NblValueType rhsType = rhs->type;
             nbl_value_free(rhs);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
             return nbl_interpreter_throw(&context, nbl_value_new_string_format("Unexpected variable type: '%s' needed '%s'", nbl_value_type_to_string(rhsType),
                                                                        nbl_value_type_to_string(node->declarationType)));
         }
@@ -3664,32 +7679,65 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                 NblValueType containerValueType = containerValue->type;
                 nbl_value_free(rhs);
                 nbl_value_free(containerValue);
-                NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
                 return nbl_interpreter_throw(&context, nbl_value_new_string_format("NblVariable is not an array, object, class or instance it is: %s",
                                                                            nbl_value_type_to_string(containerValueType)));
             }
 
             NblValue *indexOrKey = nbl_interpreter_node(interpreter, scope, node->lhs->rhs);
+            NblTypedArray *typedArray = indexOrKey->type == NBL_VALUE_INT ? nbl_typed_array_get(containerValue) : NULL;
+            if (typedArray != NULL) {
+                NblValue *exception = NULL;
+                if (indexOrKey->integer < 0 || indexOrKey->integer >= (int64_t)typedArray->size) {
+                    exception = nbl_value_new_string("Typed array index is out of range");
+                } else if (!nbl_typed_array_set_item(typedArray, indexOrKey->integer, rhs)) {
+                    exception = nbl_type_error_exception(typedArray->type, rhs->type);
+                }
+                nbl_value_free(indexOrKey);
+                nbl_value_free(containerValue);
+                if (exception != NULL) {
+                    nbl_value_free(rhs);
+                    NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->rhs};
+                    return nbl_interpreter_throw(&context, exception);
+                }
+                return rhs;
+            }
             if (containerValue->type == NBL_VALUE_ARRAY) {
                 if (indexOrKey->type != NBL_VALUE_INT) {
                     NblValueType indexOrKeyType = indexOrKey->type;
                     nbl_value_free(rhs);
                     nbl_value_free(containerValue);
                     nbl_value_free(indexOrKey);
-                    NblContext context = {.env = interpreter->env, .scope = scope, .node = node->rhs};
+                    NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->rhs};
                     return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_INT, indexOrKeyType));
                 }
-                NblValue *previousValue = nbl_list_get(containerValue->array, indexOrKey->integer);
-                if (previousValue != NULL) nbl_value_free(previousValue);
-                nbl_list_set(containerValue->array, indexOrKey->integer, nbl_value_retrieve(rhs));
-            }
-            if (containerValue->type == NBL_VALUE_OBJECT || containerValue->type == NBL_VALUE_CLASS || containerValue->type == NBL_VALUE_INSTANCE) {
-                if (indexOrKey->type != NBL_VALUE_STRING) {
-                    NblValueType indexOrKeyType = indexOrKey->type;
+                if (indexOrKey->integer < 0) {
                     nbl_value_free(rhs);
                     nbl_value_free(containerValue);
                     nbl_value_free(indexOrKey);
-                    NblContext context = {.env = interpreter->env, .scope = scope, .node = node->rhs};
+                    NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->lhs};
+                    return nbl_interpreter_throw(&context, nbl_value_new_string("Array index can't be negative"));
+                }
+                // A store past the end fills the gap with nulls, so the array grows to the index
+                size_t size = containerValue->array->size;
+                if ((size_t)indexOrKey->integer >= size && !env_array_available(containerValue->array, indexOrKey->integer + 1 - size)) {
+                    nbl_value_free(rhs);
+                    nbl_value_free(containerValue);
+                    nbl_value_free(indexOrKey);
+                    NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->lhs};
+                    return nbl_interpreter_throw_limit(&context, "Memory limit exceeded", false);
+                }
+                NblValue *previousValue = nbl_list_get(containerValue->array, indexOrKey->integer);
+                if (previousValue != NULL) nbl_value_free(previousValue);
+                nbl_list_set(containerValue->array, indexOrKey->integer, nbl_value_retrieve(rhs));
+            }
+            if (containerValue->type == NBL_VALUE_OBJECT || containerValue->type == NBL_VALUE_CLASS || containerValue->type == NBL_VALUE_INSTANCE) {
+                if (indexOrKey->type != NBL_VALUE_STRING) {
+                    NblValueType indexOrKeyType = indexOrKey->type;
+                    nbl_value_free(rhs);
+                    nbl_value_free(containerValue);
+                    nbl_value_free(indexOrKey);
+                    NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->rhs};
                     return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_STRING, indexOrKeyType));
                 }
                 NblValue *previousValue = nbl_map_get(containerValue->object, indexOrKey->string);
@@ -3703,24 +7751,24 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
 
         if (node->lhs->type != NBL_NODE_VARIABLE) {
             nbl_value_free(rhs);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->lhs};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->lhs};
             return nbl_interpreter_throw(&context, nbl_value_new_string_format("Is not a variable"));
         }
         NblVariable *variable = nbl_block_scope_get(scope->block, node->lhs->string);
         if (variable == NULL) {
             nbl_value_free(rhs);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->lhs};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->lhs};
             return nbl_interpreter_throw(&context, nbl_value_new_string_format("NblVariable: '%s' is not declared", node->lhs->string));
         }
         if (!variable->mutable) {
             nbl_value_free(rhs);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->lhs};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->lhs};
             return nbl_interpreter_throw(&context, nbl_value_new_string_format("Can't mutate const variable: '%s'", node->lhs->string));
         }
         if (variable->type != NBL_VALUE_ANY && variable->type != rhs->type) {
             NblValueType rhsType = rhs->type;
             nbl_value_free(rhs);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->lhs};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->lhs};
             return nbl_interpreter_throw(&context, nbl_type_error_exception(variable->type, rhsType));
         }
         nbl_value_free(variable->value);
@@ -3731,118 +7779,33 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
     if (node->type == NBL_NODE_VARIABLE) {
         NblVariable *variable = nbl_block_scope_get(scope->block, node->string);
         if (variable == NULL) {
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
             return nbl_interpreter_throw(&context, nbl_value_new_string_format("Can't find variable: '%s'", node->string));
         }
         return nbl_value_retrieve(variable->value);
     }
     if (node->type == NBL_NODE_GET) {
-        NblValue *containerValue = nbl_interpreter_node(interpreter, scope, node->lhs);
-        if (containerValue->type != NBL_VALUE_STRING && containerValue->type != NBL_VALUE_ARRAY && containerValue->type != NBL_VALUE_OBJECT &&
-            containerValue->type != NBL_VALUE_CLASS && containerValue->type != NBL_VALUE_INSTANCE) {
-            NblValueType containerValueType = containerValue->type;
-            nbl_value_free(containerValue);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
-            return nbl_interpreter_throw(&context, nbl_value_new_string_format("NblVariable is not a string, array, object, class or instance it is: %s",
-                                                                       nbl_value_type_to_string(containerValueType)));
-        }
-
-        NblValue *indexOrKey = nbl_interpreter_node(interpreter, scope, node->rhs);
-        NblValue *returnValue = NULL;
-        if (containerValue->type == NBL_VALUE_STRING) {
-            if (indexOrKey->type == NBL_VALUE_STRING) {
-                NblValue *stringClass = ((NblVariable *)nbl_map_get(interpreter->env, "String"))->value;
-                NblValue *stringClassItem = nbl_map_get(stringClass->object, indexOrKey->string);
-                if (stringClassItem != NULL) returnValue = nbl_value_retrieve(stringClassItem);
-            }
-            if (returnValue == NULL) {
-                if (indexOrKey->type != NBL_VALUE_INT) {
-                    NblValueType indexOrKeyType = indexOrKey->type;
-                    nbl_value_free(indexOrKey);
-                    nbl_value_free(containerValue);
-                    NblContext context = {.env = interpreter->env, .scope = scope, .node = node->rhs};
-                    return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_INT, indexOrKeyType));
-                }
-                if (indexOrKey->integer >= 0 && indexOrKey->integer <= (int64_t)strlen(containerValue->string)) {
-                    char character[] = {containerValue->string[indexOrKey->integer], '\0'};
-                    returnValue = nbl_value_new_string(character);
-                } else {
-                    returnValue = nbl_value_new_null();
-                }
-            }
-        }
-        if (containerValue->type == NBL_VALUE_ARRAY) {
-            if (indexOrKey->type == NBL_VALUE_STRING) {
-                NblValue *arrayClass = ((NblVariable *)nbl_map_get(interpreter->env, "Array"))->value;
-                NblValue *arrayClassItem = nbl_map_get(arrayClass->object, indexOrKey->string);
-                if (arrayClassItem != NULL) returnValue = nbl_value_retrieve(arrayClassItem);
-            }
-            if (returnValue == NULL) {
-                if (indexOrKey->type != NBL_VALUE_INT) {
-                    NblValueType indexOrKeyType = indexOrKey->type;
-                    nbl_value_free(indexOrKey);
-                    nbl_value_free(containerValue);
-                    NblContext context = {.env = interpreter->env, .scope = scope, .node = node->rhs};
-                    return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_INT, indexOrKeyType));
-                }
-                NblValue *value = nbl_list_get(containerValue->array, indexOrKey->integer);
-                returnValue = value != NULL ? nbl_value_retrieve(value) : nbl_value_new_null();
-            }
-        }
-        if (containerValue->type == NBL_VALUE_OBJECT || containerValue->type == NBL_VALUE_CLASS || containerValue->type == NBL_VALUE_INSTANCE) {
-            if (containerValue->type == NBL_VALUE_OBJECT && indexOrKey->type == NBL_VALUE_STRING) {
-                NblValue *objectClass = ((NblVariable *)nbl_map_get(interpreter->env, "Object"))->value;
-                NblValue *objectClassItem = nbl_map_get(objectClass->object, indexOrKey->string);
-                if (objectClassItem != NULL) returnValue = nbl_value_retrieve(objectClassItem);
-            }
-            if (returnValue == NULL) {
-                if (indexOrKey->type != NBL_VALUE_STRING) {
-                    NblValueType indexOrKeyType = indexOrKey->type;
-                    nbl_value_free(indexOrKey);
-                    nbl_value_free(containerValue);
-                    NblContext context = {.env = interpreter->env, .scope = scope, .node = node->rhs};
-                    return nbl_interpreter_throw(&context, nbl_type_error_exception(NBL_VALUE_STRING, indexOrKeyType));
-                }
-                NblValue *value;
-                if (containerValue->type == NBL_VALUE_INSTANCE) {
-                    value = nbl_value_class_get(containerValue, indexOrKey->string);
-                } else {
-                    value = nbl_map_get(containerValue->object, indexOrKey->string);
-                }
-                if (value == NULL) {
-                    char *indexOrKeyString = strdup(indexOrKey->string);
-                    nbl_value_free(indexOrKey);
-                    nbl_value_free(containerValue);
-                    NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
-                    NblValue *exception = nbl_value_new_string_format("Can't find %s in object", indexOrKeyString);
-                    free(indexOrKeyString);
-                    return nbl_interpreter_throw(&context, exception);
-                }
-                returnValue = nbl_value_retrieve(value);
-            }
-        }
-
-        nbl_value_free(indexOrKey);
-        nbl_value_free(containerValue);
-        return returnValue;
+        return nbl_interpreter_get(interpreter, scope, node, nbl_interpreter_node(interpreter, scope, node->lhs));
     }
     if (node->type == NBL_NODE_CALL) {
         NblValue *thisValue = NULL;
+        NblValue *callValue;
         if (node->function->type == NBL_NODE_GET) {
             NblValue *containerValue = nbl_interpreter_node(interpreter, scope, node->function->lhs);
+            if (scope->exception->exceptionValue != NULL) return containerValue;
             if (containerValue->type == NBL_VALUE_STRING || containerValue->type == NBL_VALUE_ARRAY || containerValue->type == NBL_VALUE_OBJECT ||
                 containerValue->type == NBL_VALUE_INSTANCE) {
-                thisValue = containerValue;
-            } else {
-                nbl_value_free(containerValue);
+                thisValue = nbl_value_ref(containerValue);
             }
+            callValue = nbl_interpreter_get(interpreter, scope, node->function, containerValue);
+        } else {
+            callValue = nbl_interpreter_node(interpreter, scope, node->function);
         }
-        NblValue *callValue = nbl_interpreter_node(interpreter, scope, node->function);
         if (callValue->type != NBL_VALUE_FUNCTION && callValue->type != NBL_VALUE_NATIVE_FUNCTION && callValue->type != NBL_VALUE_CLASS) {
             NblValueType callValueType = callValue->type;
             nbl_value_free(callValue);
             if (thisValue != NULL) nbl_value_free(thisValue);
-            NblContext context = {.env = interpreter->env, .scope = scope, .node = node->function};
+            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->function};
             return nbl_interpreter_throw(&context,
                                      nbl_value_new_string_format("NblVariable is not a function or a class but: %s", nbl_value_type_to_string(callValueType)));
         }
@@ -3852,7 +7815,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (callValue->abstract) {
                 nbl_value_free(callValue);
                 if (thisValue != NULL) nbl_value_free(thisValue);
-                NblContext context = {.env = interpreter->env, .scope = scope, .node = node->function};
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->function};
                 return nbl_interpreter_throw(&context, nbl_value_new_string("Can't construct an abstract class"));
             }
             NblValue *constructorFunction = nbl_value_class_get(callValue, "constructor");
@@ -3860,7 +7823,12 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         } else {
             callArguments = callValue->arguments;
         }
-        NblList *arguments = nbl_list_new_with_capacity(node->nodes->capacity);
+        // Typed natives never keep their arguments, so those are collected in a list on the stack
+        NblValue *typedItems[NBL_SIGNATURE_ARGUMENTS];
+        NblList typedArguments = {.refs = 1, .items = (void **)typedItems, .capacity = NBL_SIGNATURE_ARGUMENTS, .start = 0, .size = 0};
+        bool typed = callValue->type == NBL_VALUE_NATIVE_FUNCTION && callValue->signature != NBL_SIGNATURE_VALUES &&
+                     node->nodes->size <= NBL_SIGNATURE_ARGUMENTS;
+        NblList *arguments = typed ? &typedArguments : nbl_list_new_with_capacity(node->nodes->capacity);
         for (size_t i = 0; i < MAX(callArguments != NULL ? callArguments->size : 0, node->nodes->size); i++) {
             NblArgument *argument = NULL;
             if (callArguments != NULL) {
@@ -3871,20 +7839,20 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                         if (argument->type != NBL_VALUE_ANY && defaultValue->type != argument->type) {
                             NblValueType defaultValueType = defaultValue->type;
                             nbl_value_free(defaultValue);
-                            nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+                            nbl_interpreter_arguments_free(arguments, typed);
                             nbl_value_free(callValue);
                             if (thisValue != NULL) nbl_value_free(thisValue);
-                            NblContext context = {.env = interpreter->env, .scope = scope, .node = argument->defaultNode};
+                            NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = argument->defaultNode};
                             return nbl_interpreter_throw(&context, nbl_type_error_exception(argument->type, defaultValueType));
                         }
                         nbl_list_add(arguments, defaultValue);
                         continue;
                     }
 
-                    nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+                    nbl_interpreter_arguments_free(arguments, typed);
                     nbl_value_free(callValue);
                     if (thisValue != NULL) nbl_value_free(thisValue);
-                    NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
+                    NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
                     return nbl_interpreter_throw(&context, nbl_value_new_string("Not all function arguments are given"));
                 }
             }
@@ -3893,19 +7861,19 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (argument != NULL && argument->type != NBL_VALUE_ANY && nodeValue->type != argument->type) {
                 NblValueType nodeValueType = nodeValue->type;
                 nbl_value_free(nodeValue);
-                nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+                nbl_interpreter_arguments_free(arguments, typed);
                 nbl_value_free(callValue);
                 if (thisValue != NULL) nbl_value_free(thisValue);
-                NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
                 return nbl_interpreter_throw(&context, nbl_type_error_exception(argument->type, nodeValueType));
             }
             nbl_list_add(arguments, nodeValue);
         }
 
-        NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
+        NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
         NblValue *returnValue = nbl_interpreter_call(&context, callValue, thisValue, arguments);
 
-        nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+        nbl_interpreter_arguments_free(arguments, typed);
         nbl_value_free(callValue);
         if (thisValue != NULL) nbl_value_free(thisValue);
         return returnValue;
@@ -3926,13 +7894,13 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         if (node->type == NBL_NODE_INC_PRE || node->type == NBL_NODE_DEC_PRE || node->type == NBL_NODE_INC_POST || node->type == NBL_NODE_DEC_POST) {
             if (node->unary->type != NBL_NODE_VARIABLE) {
                 nbl_value_free(unary);
-                NblContext context = {.env = interpreter->env, .scope = scope, .node = node->lhs};
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->lhs};
                 return nbl_interpreter_throw(&context, nbl_value_new_string_format("Is not a variable"));
             }
             NblVariable *variable = nbl_block_scope_get(scope->block, node->lhs->string);
             if (!variable->mutable) {
                 nbl_value_free(unary);
-                NblContext context = {.env = interpreter->env, .scope = scope, .node = node->lhs};
+                NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node->lhs};
                 return nbl_interpreter_throw(&context, nbl_value_new_string_format("Can't mutate const variable: '%s'", node->lhs->string));
             }
             if (unary->type == NBL_VALUE_INT) {
@@ -3965,25 +7933,25 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         if (node->type == NBL_NODE_CAST) {
             if (node->castType == NBL_VALUE_BOOL) {
                 if (unary->type == NBL_VALUE_NULL) {
-                    unary->type = NBL_VALUE_BOOL;
+                    nbl_value_retype(unary, NBL_VALUE_BOOL);
                     unary->boolean = false;
                     return unary;
                 }
                 if (unary->type == NBL_VALUE_BOOL) return unary;
                 if (unary->type == NBL_VALUE_INT) {
-                    unary->type = NBL_VALUE_BOOL;
+                    nbl_value_retype(unary, NBL_VALUE_BOOL);
                     unary->boolean = unary->integer != 0;
                     return unary;
                 }
                 if (unary->type == NBL_VALUE_FLOAT) {
-                    unary->type = NBL_VALUE_BOOL;
+                    nbl_value_retype(unary, NBL_VALUE_BOOL);
                     unary->boolean = unary->floating != 0.0;
                     return unary;
                 }
                 if (unary->type == NBL_VALUE_STRING) {
                     bool result = !(!strcmp(unary->string, "") || !strcmp(unary->string, "0"));
                     nbl_value_clear(unary);
-                    unary->type = NBL_VALUE_BOOL;
+                    nbl_value_retype(unary, NBL_VALUE_BOOL);
                     unary->boolean = result;
                     return unary;
                 }
@@ -3991,25 +7959,25 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
 
             if (node->castType == NBL_VALUE_INT) {
                 if (unary->type == NBL_VALUE_NULL) {
-                    unary->type = NBL_VALUE_INT;
+                    nbl_value_retype(unary, NBL_VALUE_INT);
                     unary->integer = 0;
                     return unary;
                 }
                 if (unary->type == NBL_VALUE_BOOL) {
-                    unary->type = NBL_VALUE_INT;
+                    nbl_value_retype(unary, NBL_VALUE_INT);
                     unary->integer = unary->boolean;
                     return unary;
                 }
                 if (unary->type == NBL_VALUE_INT) return unary;
                 if (unary->type == NBL_VALUE_FLOAT) {
-                    unary->type = NBL_VALUE_INT;
+                    nbl_value_retype(unary, NBL_VALUE_INT);
                     unary->integer = unary->floating;
                     return unary;
                 }
                 if (unary->type == NBL_VALUE_STRING) {
                     int64_t result = nbl_string_to_int(unary->string);
                     nbl_value_clear(unary);
-                    unary->type = NBL_VALUE_INT;
+                    nbl_value_retype(unary, NBL_VALUE_INT);
                     unary->integer = result;
                     return unary;
                 }
@@ -4017,17 +7985,17 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
 
             if (node->castType == NBL_VALUE_FLOAT) {
                 if (unary->type == NBL_VALUE_NULL) {
-                    unary->type = NBL_VALUE_FLOAT;
+                    nbl_value_retype(unary, NBL_VALUE_FLOAT);
                     unary->floating = 0;
                     return unary;
                 }
                 if (unary->type == NBL_VALUE_BOOL) {
-                    unary->type = NBL_VALUE_FLOAT;
+                    nbl_value_retype(unary, NBL_VALUE_FLOAT);
                     unary->floating = unary->boolean;
                     return unary;
                 }
                 if (unary->type == NBL_VALUE_INT) {
-                    unary->type = NBL_VALUE_FLOAT;
+                    nbl_value_retype(unary, NBL_VALUE_FLOAT);
                     unary->floating = unary->integer;
                     return unary;
                 }
@@ -4035,7 +8003,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                 if (unary->type == NBL_VALUE_STRING) {
                     int64_t result = nbl_string_to_float(unary->string);
                     nbl_value_clear(unary);
-                    unary->type = NBL_VALUE_FLOAT;
+                    nbl_value_retype(unary, NBL_VALUE_FLOAT);
                     unary->floating = result;
                     return unary;
                 }
@@ -4044,14 +8012,14 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (node->castType == NBL_VALUE_STRING) {
                 char *string = nbl_value_to_string(unary);
                 nbl_value_clear(unary);
-                unary->type = NBL_VALUE_STRING;
-                unary->string = string;
+                nbl_value_retype(unary, NBL_VALUE_STRING);
+                nbl_value_set_string(unary, string);
                 return unary;
             }
         }
 
         nbl_value_free(unary);
-        NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
+        NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
         return nbl_interpreter_throw(&context, nbl_value_new_string("Type error"));
     }
 
@@ -4066,30 +8034,37 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating += rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating += rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = lhs->integer + rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
 
             if (lhs->type == NBL_VALUE_STRING && rhs->type == NBL_VALUE_STRING) {
-                char *string = malloc(strlen(lhs->string) + strlen(rhs->string) + 1);
+                size_t size = strlen(lhs->string) + strlen(rhs->string);
+                if (!nbl_memory_available(size)) {
+                    nbl_value_free(lhs);
+                    nbl_value_free(rhs);
+                    NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
+                    return nbl_interpreter_throw_limit(&context, "Memory limit exceeded", false);
+                }
+                char *string = malloc(size + 1);
                 strcpy(string, lhs->string);
                 strcat(string, rhs->string);
                 nbl_value_clear(lhs);
-                lhs->string = string;
+                nbl_value_set_string(lhs, string);
                 nbl_value_free(rhs);
                 return lhs;
             }
@@ -4102,19 +8077,19 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating -= rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating -= rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = lhs->integer - rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4127,19 +8102,19 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating *= rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating *= rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = lhs->integer * rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4152,19 +8127,19 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = pow(lhs->floating, rhs->floating);
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = pow(lhs->floating, rhs->integer);
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = pow(lhs->integer, rhs->floating);
                 nbl_value_free(rhs);
                 return lhs;
@@ -4177,19 +8152,19 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = rhs->integer != 0 ? lhs->floating / rhs->floating : 0;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = rhs->integer != 0 ? lhs->floating / rhs->integer : 0;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = rhs->integer != 0 ? lhs->integer / rhs->floating : 0;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4202,19 +8177,19 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = fmod(lhs->floating, rhs->floating);
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = fmod(lhs->floating, rhs->integer);
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_FLOAT;
+                nbl_value_retype(lhs, NBL_VALUE_FLOAT);
                 lhs->floating = fmod(lhs->integer, rhs->floating);
                 nbl_value_free(rhs);
                 return lhs;
@@ -4269,18 +8244,17 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         if (node->type == NBL_NODE_EQ) {
             if (lhs->type == NBL_VALUE_NULL) {
                 nbl_value_clear(lhs);
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = rhs->type == NBL_VALUE_NULL;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (rhs->type == NBL_VALUE_NULL) {
+                // The lhs can be a shared array, object or instance so it can't be reused for the result
                 bool result = lhs->type == NBL_VALUE_NULL;
-                nbl_value_clear(lhs);
-                lhs->type = NBL_VALUE_BOOL;
-                lhs->boolean = result;
+                nbl_value_free(lhs);
                 nbl_value_free(rhs);
-                return lhs;
+                return nbl_value_new_bool(result);
             }
             if (lhs->type == NBL_VALUE_BOOL && rhs->type == NBL_VALUE_BOOL) {
                 lhs->boolean = lhs->boolean == rhs->boolean;
@@ -4288,25 +8262,25 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer == rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating == rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer == rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating == rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4314,7 +8288,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (lhs->type == NBL_VALUE_STRING && rhs->type == NBL_VALUE_STRING) {
                 bool result = !strcmp(lhs->string, rhs->string);
                 nbl_value_clear(lhs);
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = result;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4323,18 +8297,17 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         if (node->type == NBL_NODE_NEQ) {
             if (lhs->type == NBL_VALUE_NULL) {
                 nbl_value_clear(lhs);
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = rhs->type != NBL_VALUE_NULL;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (rhs->type == NBL_VALUE_NULL) {
+                // The lhs can be a shared array, object or instance so it can't be reused for the result
                 bool result = lhs->type != NBL_VALUE_NULL;
-                nbl_value_clear(lhs);
-                lhs->type = NBL_VALUE_BOOL;
-                lhs->boolean = result;
+                nbl_value_free(lhs);
                 nbl_value_free(rhs);
-                return lhs;
+                return nbl_value_new_bool(result);
             }
             if (lhs->type == NBL_VALUE_BOOL && rhs->type == NBL_VALUE_BOOL) {
                 lhs->boolean = lhs->boolean != rhs->boolean;
@@ -4342,25 +8315,25 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer != rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating != rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer != rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating != rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4368,7 +8341,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
             if (lhs->type == NBL_VALUE_STRING && rhs->type == NBL_VALUE_STRING) {
                 bool result = strcmp(lhs->string, rhs->string);
                 nbl_value_clear(lhs);
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = result;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4377,25 +8350,25 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
 
         if (node->type == NBL_NODE_LT) {
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer < rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating < rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating < rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer < rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4403,25 +8376,25 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         }
         if (node->type == NBL_NODE_LTEQ) {
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer <= rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating <= rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating <= rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer <= rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4429,25 +8402,25 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         }
         if (node->type == NBL_NODE_GT) {
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer > rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating > rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating > rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer > rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4455,25 +8428,25 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
         }
         if (node->type == NBL_NODE_GTEQ) {
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer >= rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating >= rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_FLOAT && rhs->type == NBL_VALUE_INT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->floating >= rhs->integer;
                 nbl_value_free(rhs);
                 return lhs;
             }
             if (lhs->type == NBL_VALUE_INT && rhs->type == NBL_VALUE_FLOAT) {
-                lhs->type = NBL_VALUE_BOOL;
+                nbl_value_retype(lhs, NBL_VALUE_BOOL);
                 lhs->boolean = lhs->integer >= rhs->floating;
                 nbl_value_free(rhs);
                 return lhs;
@@ -4497,7 +8470,7 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
 
         nbl_value_free(lhs);
         nbl_value_free(rhs);
-        NblContext context = {.env = interpreter->env, .scope = scope, .node = node};
+        NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = scope, .node = node};
         return nbl_interpreter_throw(&context, nbl_value_new_string("Type error"));
     }
 
@@ -4505,4 +8478,1521 @@ NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, Nbl
     exit(EXIT_FAILURE);
 }
 
+NblValue *nbl_interpreter_node(NblInterpreter *interpreter, NblScope *scope, NblNode *node) {
+    if (interpreter->profiler != NULL) {
+        if (nbl_profiler_ticks > 0) nbl_profiler_sample(interpreter->profiler);
+        interpreter->profiler->frame->node = node;
+    }
+    if (interpreter->counters != NULL) return nbl_counters_node(interpreter, scope, node);
+    return nbl_interpreter_eval(interpreter, scope, node);
+}
+
+// Worker
+#ifdef NBL_THREADS
+NblChannel *nbl_channel_new(void) {
+    NblChannel *channel = malloc(sizeof(NblChannel));
+    mtx_init(&channel->mutex, mtx_plain);
+    cnd_init(&channel->condition);
+    channel->messages = nbl_list_new();
+    channel->position = 0;
+    channel->closed = false;
+    return channel;
+}
+
+void nbl_channel_send(NblChannel *channel, NblValue *message) {
+    mtx_lock(&channel->mutex);
+    nbl_list_add(channel->messages, message);
+    cnd_signal(&channel->condition);
+    mtx_unlock(&channel->mutex);
+}
+
+void nbl_channel_wait(NblChannel *channel) {
+    // Waits with the mutex locked for a change of the channel, at most 100 ms so the waiting thread sees an interrupt
+    struct timespec until;
+    timespec_get(&until, TIME_UTC);
+    until.tv_nsec += 100000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    cnd_timedwait(&channel->condition, &channel->mutex, &until);
+}
+
+NblValue *nbl_channel_receive(NblChannel *channel, NblInterpreter *interpreter) {
+    // Waits for the next message, returns NULL when the channel is closed and all messages are received or when the
+    // interpreter that waits is interrupted
+    mtx_lock(&channel->mutex);
+    while (channel->position == channel->messages->size && !channel->closed && !nbl_interpreter_interrupted(interpreter)) {
+        nbl_channel_wait(channel);
+    }
+    NblValue *message = NULL;
+    if (channel->position < channel->messages->size) {
+        message = nbl_list_get(channel->messages, channel->position++);
+        if (channel->position == channel->messages->size) {
+            channel->messages->size = 0;
+            channel->position = 0;
+        }
+    }
+    mtx_unlock(&channel->mutex);
+    return message;
+}
+
+void nbl_channel_close(NblChannel *channel) {
+    mtx_lock(&channel->mutex);
+    channel->closed = true;
+    cnd_broadcast(&channel->condition);
+    mtx_unlock(&channel->mutex);
+}
+
+void nbl_channel_free(NblChannel *channel) {
+    for (size_t i = channel->position; i < channel->messages->size; i++) {
+        nbl_value_free(nbl_list_get(channel->messages, i));
+    }
+    nbl_list_free(channel->messages, NULL);
+    cnd_destroy(&channel->condition);
+    mtx_destroy(&channel->mutex);
+    free(channel);
+}
+
+NblWorker *nbl_worker_new(NblContext *context, NblValue *function, NblList *arguments) {
+    NblWorker *worker = malloc(sizeof(NblWorker));
+    worker->native.free = (NblNativeFreeFunc *)nbl_worker_free;
+    worker->context = nbl_context_new_isolate(context);
+    worker->context->interpreter->worker = worker;
+    worker->function = function;
+    worker->arguments = arguments;
+    worker->inbox = nbl_channel_new();
+    worker->outbox = nbl_channel_new();
+    worker->joined = false;
+    worker->result = NULL;
+    worker->error = NULL;
+
+    // From here on the context of the worker is only used by the thread of the worker
+    if (thrd_create(&worker->thread, nbl_worker_run, worker) != thrd_success) {
+        worker->joined = true;
+        nbl_context_free(worker->context);
+        nbl_worker_free(worker);
+        return NULL;
+    }
+    return worker;
+}
+
+int nbl_worker_run(void *data) {
+    NblWorker *worker = data;
+    NblContext *context = worker->context;
+    NblScope scope = {.exception = &(NblExceptionScope){.exceptionValue = NULL},
+                      .function = &(NblFunctionScope){.returnValue = NULL},
+                      .loop = &(NblLoopScope){.inLoop = false, .isContinuing = false, .isBreaking = false},
+                      .block = &(NblBlockScope){.parentBlock = NULL, .env = context->env}};
+    NblInterpreter *owner = nbl_interpreter_limits_start(context->interpreter);
+
+    NblValue *returnValue = NULL;
+    if (worker->function->type == NBL_VALUE_STRING) {
+        char *text = nbl_file_read(worker->function->string);
+        if (text != NULL) {
+            nbl_map_set(context->env, "arguments", nbl_variable_new(NBL_VALUE_ARRAY, false, nbl_value_new_array(nbl_list_ref(worker->arguments))));
+            NblNode *node = nbl_cache_parse(context->interpreter, worker->function->string, text, false);
+            free(text);
+            nbl_interpreter_preload(context->interpreter, node);
+            returnValue = nbl_interpreter_node(context->interpreter, &scope, node);
+            nbl_node_free(node);
+        } else {
+            char buffer[1024];
+            snprintf(buffer, sizeof(buffer), "Can't read file: %s", worker->function->string);
+            worker->error = strdup(buffer);
+        }
+    } else {
+        // Missing arguments are filled with their default values, the parent already checked that they have one
+        NblContext callContext = {.env = context->env, .interpreter = context->interpreter, .scope = &scope, .node = worker->function->functionNode};
+        for (size_t i = worker->arguments->size; i < worker->function->arguments->size && scope.exception->exceptionValue == NULL; i++) {
+            NblArgument *argument = nbl_list_get(worker->function->arguments, i);
+            nbl_list_add(worker->arguments, nbl_interpreter_node(context->interpreter, &scope, argument->defaultNode));
+        }
+        if (scope.exception->exceptionValue == NULL) {
+            returnValue = nbl_interpreter_call(&callContext, worker->function, NULL, worker->arguments);
+        }
+    }
+    if (returnValue == NULL) returnValue = scope.function->returnValue;
+    if (scope.exception->exceptionValue == NULL) nbl_loop_run(context->interpreter, NULL);
+
+    if (scope.exception->exceptionValue != NULL) {
+        NblValue *error = nbl_value_class_get(scope.exception->exceptionValue, "error");
+        worker->error = error != NULL ? nbl_value_to_string(error) : strdup("Unknown exception");
+        nbl_value_free(scope.exception->exceptionValue);
+    } else if (worker->error == NULL) {
+        worker->result = returnValue != NULL ? nbl_value_copy(returnValue) : nbl_value_new_null();
+        if (worker->result == NULL) {
+            char buffer[255];
+            sprintf(buffer, "Can't copy a worker result of type: %s", nbl_value_type_to_string(returnValue->type));
+            worker->error = strdup(buffer);
+        }
+    }
+    if (returnValue != NULL) nbl_value_free(returnValue);
+    nbl_interpreter_limits_end(owner);
+
+    // The context is freed after the outbox is closed, so it can be interrupted while the outbox is open
+    nbl_channel_close(worker->outbox);
+    nbl_context_free(context);
+    return 0;
+}
+
+void nbl_worker_interrupt(NblWorker *worker) {
+    mtx_lock(&worker->outbox->mutex);
+    if (!worker->outbox->closed) nbl_context_interrupt(worker->context);
+    mtx_unlock(&worker->outbox->mutex);
+}
+
+bool nbl_worker_join(NblWorker *worker, NblInterpreter *interpreter) {
+    // Closing the inbox lets a worker that waits for messages stop. Returns false when the interpreter that waits is
+    // interrupted, the interrupt is passed on to the worker, which is joined later
+    if (worker->joined) return true;
+    nbl_channel_close(worker->inbox);
+    mtx_lock(&worker->outbox->mutex);
+    while (!worker->outbox->closed && !nbl_interpreter_interrupted(interpreter)) nbl_channel_wait(worker->outbox);
+    bool closed = worker->outbox->closed;
+    if (!closed) nbl_context_interrupt(worker->context);
+    mtx_unlock(&worker->outbox->mutex);
+    if (!closed) return false;
+    thrd_join(worker->thread, NULL);
+    worker->joined = true;
+    return true;
+}
+
+void nbl_worker_free(NblWorker *worker) {
+    nbl_worker_join(worker, NULL);
+    nbl_value_free(worker->function);
+    nbl_list_free(worker->arguments, (NblListFreeFunc *)nbl_value_free);
+    nbl_channel_free(worker->inbox);
+    nbl_channel_free(worker->outbox);
+    if (worker->result != NULL) nbl_value_free(worker->result);
+    if (worker->error != NULL) free(worker->error);
+    free(worker);
+}
+#endif
+
+// Parallel
+char *nbl_parallel_run(NblContext *context, NblParallel *parallel, NblValue *function) {
+    // Every thread runs its own copy of the function in its own context, the calling thread is the first thread.
+    // Returns the error of the first thread that failed or NULL
+    size_t threadsSize = context->interpreter->threads > 0 ? context->interpreter->threads : nbl_cpu_count();
+#ifndef NBL_THREADS
+    threadsSize = 1;
+#endif
+
+    // By default every thread gets about four chunks, so a thread that is done early can take over work of a slower one
+    if (parallel->chunkSize == 0) parallel->chunkSize = MAX((parallel->size + threadsSize * 4 - 1) / (threadsSize * 4), 1);
+    parallel->chunksSize = (parallel->size + parallel->chunkSize - 1) / parallel->chunkSize;
+    if (threadsSize > parallel->chunksSize) threadsSize = parallel->chunksSize;
+    if (threadsSize == 0) return NULL;
+    NblParallelWorker *workers = malloc(sizeof(NblParallelWorker) * threadsSize);
+    for (size_t i = 0; i < threadsSize; i++) {
+        workers[i].parallel = parallel;
+        workers[i].context = nbl_context_new_isolate(context);
+        workers[i].context->interpreter->parent = context->interpreter;
+        workers[i].function = nbl_value_copy(function);
+        workers[i].error = NULL;
+    }
+    if (workers[0].function == NULL) {
+        workers[0].error = strdup("Can't copy the parallel function");
+        threadsSize = 1;
+    } else {
+#ifdef NBL_THREADS
+        thrd_t *threads = malloc(sizeof(thrd_t) * threadsSize);
+        size_t startedSize = 0;
+        for (size_t i = 1; i < threadsSize; i++) {
+            if (thrd_create(&threads[startedSize], nbl_parallel_worker, &workers[i]) == thrd_success) startedSize++;
+        }
+        nbl_parallel_worker(&workers[0]);
+        for (size_t i = 0; i < startedSize; i++) thrd_join(threads[i], NULL);
+        free(threads);
+#else
+        nbl_parallel_worker(&workers[0]);
+#endif
+    }
+
+    char *error = NULL;
+    for (size_t i = 0; i < threadsSize; i++) {
+        if (workers[i].error != NULL && error == NULL) {
+            error = workers[i].error;
+        } else if (workers[i].error != NULL) {
+            free(workers[i].error);
+        }
+        if (workers[i].function != NULL) nbl_value_free(workers[i].function);
+        nbl_context_free(workers[i].context);
+    }
+    free(workers);
+    return error;
+}
+
+int nbl_parallel_worker(void *data) {
+    NblParallelWorker *worker = data;
+    NblParallel *parallel = worker->parallel;
+    NblScope scope = {.exception = &(NblExceptionScope){.exceptionValue = NULL},
+                      .function = &(NblFunctionScope){.returnValue = NULL},
+                      .loop = &(NblLoopScope){.inLoop = false, .isContinuing = false, .isBreaking = false},
+                      .block = &(NblBlockScope){.parentBlock = NULL, .env = worker->context->env}};
+    NblContext context = {.env = worker->context->env, .interpreter = worker->context->interpreter, .scope = &scope, .node = worker->function->functionNode};
+    NblInterpreter *owner = nbl_interpreter_limits_start(context.interpreter);
+
+    NblList *arguments = nbl_list_new();
+    while (!parallel->failed) {
+        size_t chunk = parallel->next++;
+        if (chunk >= parallel->chunksSize) break;
+        size_t end = MIN((chunk + 1) * parallel->chunkSize, parallel->size);
+        NblValue *accumulator = NULL;
+        for (size_t i = chunk * parallel->chunkSize; i < end && !parallel->failed; i++) {
+            // Every item is only used by the thread of its chunk, so it is moved into the arguments
+            NblValue *item = parallel->items[i];
+            parallel->items[i] = NULL;
+            if (parallel->type == NBL_PARALLEL_REDUCE && accumulator == NULL) {
+                accumulator = item;
+                continue;
+            }
+
+            // The arguments list is reused when the function didn't keep a reference to it
+            if (arguments->refs > 1) {
+                nbl_list_free(arguments, NULL);
+                arguments = nbl_list_new();
+            }
+            if (parallel->type == NBL_PARALLEL_REDUCE) nbl_list_add(arguments, accumulator);
+            nbl_list_add(arguments, item);
+            nbl_list_add(arguments, nbl_value_new_int(i));
+            NblValue *returnValue = nbl_interpreter_call(&context, worker->function, NULL, arguments);
+            for (size_t j = 0; j < arguments->size; j++) nbl_value_free(nbl_list_get(arguments, j));
+            arguments->size = 0;
+            accumulator = NULL;
+
+            if (scope.exception->exceptionValue != NULL) {
+                NblValue *error = nbl_value_class_get(scope.exception->exceptionValue, "error");
+                worker->error = error != NULL ? nbl_value_to_string(error) : strdup("Unknown exception");
+                nbl_value_free(scope.exception->exceptionValue);
+                scope.exception->exceptionValue = NULL;
+                nbl_value_free(returnValue);
+                parallel->failed = true;
+                break;
+            }
+            if (parallel->type == NBL_PARALLEL_FILTER && returnValue->type != NBL_VALUE_BOOL) {
+                char buffer[255];
+                sprintf(buffer, "Array filter condition type is not a bool it is: %s", nbl_value_type_to_string(returnValue->type));
+                worker->error = strdup(buffer);
+                nbl_value_free(returnValue);
+                parallel->failed = true;
+                break;
+            }
+            if (parallel->type == NBL_PARALLEL_REDUCE) {
+                accumulator = returnValue;
+            } else {
+                parallel->results[i] = returnValue;
+            }
+        }
+        if (parallel->type == NBL_PARALLEL_REDUCE) parallel->results[chunk] = accumulator;
+    }
+    nbl_list_free(arguments, NULL);
+    nbl_interpreter_limits_end(owner);
+    return 0;
+}
+
+// Async
+#ifdef NBL_THREADS
+static _Thread_local NblCoroutine *nbl_coroutine_starting = NULL;
+#else
+static NblCoroutine *nbl_coroutine_starting = NULL;
+#endif
+
+NblCoroutine *nbl_coroutine_new(NblInterpreter *interpreter, NblValue *function, NblValue *this, NblList *arguments) {
+    NblCoroutine *coroutine = malloc(sizeof(NblCoroutine));
+    coroutine->interpreter = interpreter;
+    coroutine->function = nbl_value_ref(function);
+    coroutine->this = this != NULL ? nbl_value_ref(this) : NULL;
+    // Natives can reuse their arguments list after the call, so the coroutine keeps its own list
+    coroutine->arguments = nbl_list_new();
+    for (size_t i = 0; i < arguments->size; i++) nbl_list_add(coroutine->arguments, nbl_value_ref(nbl_list_get(arguments, i)));
+    coroutine->task = NULL;
+    coroutine->allocations = 0;
+    coroutine->children = 0;
+    coroutine->running = false;
+    coroutine->started = false;
+    coroutine->done = false;
+    coroutine->cancelled = false;
+    coroutine->transfer = NULL;
+    coroutine->returnValue = NULL;
+    coroutine->exception = NULL;
+    coroutine->previous = NULL;
+    coroutine->profilerFrame = NULL;
+    nbl_list_add(nbl_loop_get(interpreter)->coroutines, coroutine);
+    return coroutine;
+}
+
+void nbl_coroutine_resume(NblCoroutine *coroutine, NblValue *transfer) {
+    // Runs the coroutine until it suspends or is done, the first resume makes its stack
+    NblInterpreter *interpreter = coroutine->interpreter;
+    coroutine->transfer = transfer;
+    coroutine->previous = interpreter->coroutine;
+    interpreter->coroutine = coroutine;
+    // The frames of a coroutine start at the root, because the frames of its first caller can be gone when it resumes
+    NblProfiler *profiler = interpreter->profiler;
+    NblProfilerFrame *profilerFrame = NULL;
+    if (profiler != NULL) {
+        profilerFrame = profiler->frame;
+        profiler->frame = coroutine->profilerFrame != NULL ? coroutine->profilerFrame : &profiler->root;
+    }
+    if (!coroutine->started) coroutine->started = nbl_coroutine_start(coroutine);
+    if (coroutine->started) {
+        coroutine->running = true;
+        nbl_coroutine_switch(coroutine);
+    } else {
+        coroutine->done = true;
+    }
+    interpreter->coroutine = coroutine->previous;
+    if (profiler != NULL) {
+        coroutine->profilerFrame = profiler->frame;
+        profiler->frame = profilerFrame;
+    }
+
+    if (coroutine->done && !coroutine->started) {
+        if (coroutine->transfer != NULL) nbl_value_free(coroutine->transfer);
+        coroutine->transfer = NULL;
+        NblScope scope = {.exception = &(NblExceptionScope){.exceptionValue = NULL},
+                          .function = &(NblFunctionScope){.returnValue = NULL},
+                          .loop = &(NblLoopScope){.inLoop = false, .isContinuing = false, .isBreaking = false},
+                          .block = &(NblBlockScope){.parentBlock = NULL, .env = interpreter->env}};
+        NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = &scope, .node = coroutine->function->functionNode};
+        nbl_value_free(nbl_interpreter_throw(&context, nbl_value_new_string("Can't make coroutine stack")));
+        coroutine->exception = scope.exception->exceptionValue;
+    }
+    if (coroutine->done) nbl_coroutine_finish(coroutine);
+}
+
+#ifdef _WIN32
+static VOID CALLBACK nbl_coroutine_entry(LPVOID data) { nbl_coroutine_run(data); }
+#else
+static void nbl_coroutine_entry(void) { nbl_coroutine_run(nbl_coroutine_starting); }
+#endif
+
+bool nbl_coroutine_start(NblCoroutine *coroutine) {
+#ifdef _WIN32
+    // Only a fiber can switch to another fiber, so the thread of the context becomes one on its first coroutine
+    if (!IsThreadAFiber() && ConvertThreadToFiber(NULL) == NULL) return false;
+    coroutine->fiber = CreateFiber(NBL_COROUTINE_STACK_SIZE, nbl_coroutine_entry, coroutine);
+    return coroutine->fiber != NULL;
+#else
+    // The stack is a private mapping of /dev/zero, its lowest page can't be used so an overflow stops the program
+    int fd = open("/dev/zero", O_RDWR);
+    if (fd == -1) return false;
+    coroutine->stack = mmap(NULL, NBL_COROUTINE_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (coroutine->stack == MAP_FAILED) return false;
+    mprotect(coroutine->stack, sysconf(_SC_PAGESIZE), PROT_NONE);
+    getcontext(&coroutine->context);
+    coroutine->context.uc_stack.ss_sp = coroutine->stack;
+    coroutine->context.uc_stack.ss_size = NBL_COROUTINE_STACK_SIZE;
+    coroutine->context.uc_link = NULL;
+    // Arguments of makecontext are ints, so the coroutine is given to its entry by the thread
+    nbl_coroutine_starting = coroutine;
+    makecontext(&coroutine->context, nbl_coroutine_entry, 0);
+    return true;
+#endif
+}
+
+void nbl_coroutine_switch(NblCoroutine *coroutine) {
+    // Switches to the stack of the coroutine until it suspends, the allocation counts are kept per stack like they
+    // are kept per thread
+    int64_t allocations = nbl_value_allocations;
+    int64_t children = nbl_counters_children;
+    nbl_value_allocations = coroutine->allocations;
+    nbl_counters_children = coroutine->children;
+#ifdef _WIN32
+    coroutine->caller = GetCurrentFiber();
+    SwitchToFiber(coroutine->fiber);
+#else
+    swapcontext(&coroutine->caller, &coroutine->context);
+#endif
+    coroutine->allocations = nbl_value_allocations;
+    coroutine->children = nbl_counters_children;
+    nbl_value_allocations = allocations;
+    nbl_counters_children = children;
+}
+
+static void nbl_coroutine_return(NblCoroutine *coroutine) {
+    // Switches back to the stack that resumed the coroutine
+#ifdef _WIN32
+    SwitchToFiber(coroutine->caller);
+#else
+    swapcontext(&coroutine->context, &coroutine->caller);
+#endif
+}
+
+void nbl_coroutine_run(NblCoroutine *coroutine) {
+    NblInterpreter *interpreter = coroutine->interpreter;
+    // The value of the first resume has no yield to go to
+    if (coroutine->transfer != NULL) nbl_value_free(coroutine->transfer);
+    coroutine->transfer = NULL;
+
+    // The function can be called long after its caller returned, so it only sees the global variables
+    NblScope scope = {.exception = &(NblExceptionScope){.exceptionValue = NULL},
+                      .function = &(NblFunctionScope){.returnValue = NULL},
+                      .loop = &(NblLoopScope){.inLoop = false, .isContinuing = false, .isBreaking = false},
+                      .block = &(NblBlockScope){.parentBlock = NULL, .env = interpreter->env}};
+    NblContext context = {.env = interpreter->env, .interpreter = interpreter, .scope = &scope, .node = coroutine->function->functionNode};
+    NblValue *returnValue = nbl_interpreter_call_function(&context, coroutine->function, coroutine->this, coroutine->arguments);
+    if (scope.exception->exceptionValue != NULL) {
+        nbl_value_free(returnValue);
+        coroutine->exception = scope.exception->exceptionValue;
+    } else {
+        coroutine->returnValue = returnValue;
+    }
+
+    // A coroutine that is done is never resumed, its stack is freed by the stack that resumed it
+    coroutine->done = true;
+    coroutine->running = false;
+    nbl_coroutine_return(coroutine);
+}
+
+bool nbl_coroutine_suspend(NblCoroutine *coroutine) {
+    // Gives control back to the stack that resumed the coroutine, returns false when the coroutine is cancelled
+    if (coroutine->cancelled) return false;
+    coroutine->running = false;
+    nbl_coroutine_return(coroutine);
+    return !coroutine->cancelled;
+}
+
+void nbl_coroutine_finish(NblCoroutine *coroutine) {
+    // A coroutine that is done frees its stack right away and is removed from the coroutines of the loop
+    if (coroutine->started) {
+#ifdef _WIN32
+        DeleteFiber(coroutine->fiber);
+#else
+        munmap(coroutine->stack, NBL_COROUTINE_STACK_SIZE);
+#endif
+    }
+    NblList *coroutines = coroutine->interpreter->loop->coroutines;
+    for (size_t i = 0; i < coroutines->size; i++) {
+        if (nbl_list_get(coroutines, i) == coroutine) {
+            nbl_list_set(coroutines, i, nbl_list_get(coroutines, coroutines->size - 1));
+            coroutines->size--;
+            break;
+        }
+    }
+}
+
+void nbl_coroutine_cancel(NblCoroutine *coroutine) {
+    // A suspended coroutine is resumed with an exception, so its finally blocks run before it stops
+    coroutine->cancelled = true;
+    if (!coroutine->started) {
+        coroutine->done = true;
+        nbl_coroutine_finish(coroutine);
+        return;
+    }
+    while (!coroutine->done) nbl_coroutine_resume(coroutine, NULL);
+}
+
+void nbl_coroutine_free(NblCoroutine *coroutine) {
+    if (!coroutine->done) nbl_coroutine_cancel(coroutine);
+    nbl_value_free(coroutine->function);
+    if (coroutine->this != NULL) nbl_value_free(coroutine->this);
+    nbl_list_free(coroutine->arguments, (NblListFreeFunc *)nbl_value_free);
+    if (coroutine->transfer != NULL) nbl_value_free(coroutine->transfer);
+    if (coroutine->returnValue != NULL) nbl_value_free(coroutine->returnValue);
+    if (coroutine->exception != NULL) nbl_value_free(coroutine->exception);
+    free(coroutine);
+}
+
+void nbl_generator_free(NblGenerator *generator) {
+    nbl_coroutine_free(generator->coroutine);
+    free(generator);
+}
+
+NblValue *nbl_task_new(NblContext *context) {
+    NblTask *task = malloc(sizeof(NblTask));
+    task->native.free = (NblNativeFreeFunc *)nbl_task_free;
+    task->done = false;
+    task->awaited = false;
+    task->result = NULL;
+    task->exception = NULL;
+    task->waiters = nbl_list_new();
+    task->coroutine = NULL;
+    NblValue *taskClass = nbl_std_env_get(context->env, "Task")->value;
+    NblValue *value = nbl_value_new_instance(nbl_map_new(), nbl_value_ref(taskClass));
+    value->native = &task->native;
+    return value;
+}
+
+NblTask *nbl_task_get(NblValue *value) {
+    if (value->type != NBL_VALUE_INSTANCE || value->native == NULL || value->native->free != (NblNativeFreeFunc *)nbl_task_free) return NULL;
+    return (NblTask *)value->native;
+}
+
+void nbl_task_resolve(NblInterpreter *interpreter, NblValue *task, NblValue *result, NblValue *exception) {
+    // The coroutines that wait for the task can run again
+    NblTask *nativeTask = (NblTask *)task->native;
+    nativeTask->done = true;
+    nativeTask->result = result;
+    nativeTask->exception = exception;
+    NblLoop *loop = nbl_loop_get(interpreter);
+    for (size_t i = 0; i < nativeTask->waiters->size; i++) nbl_list_add(loop->ready, nbl_list_get(nativeTask->waiters, i));
+    nativeTask->waiters->size = 0;
+}
+
+void nbl_task_free(NblTask *task) {
+    // A task that failed and was never awaited prints its exception like an uncatched exception
+    if (task->exception != NULL && !task->awaited) nbl_interpreter_print_exception(task->exception);
+    if (task->result != NULL) nbl_value_free(task->result);
+    if (task->exception != NULL) nbl_value_free(task->exception);
+    nbl_list_free(task->waiters, (NblListFreeFunc *)nbl_value_free);
+    if (task->coroutine != NULL) nbl_coroutine_free(task->coroutine);
+    free(task);
+}
+
+NblLoop *nbl_loop_get(NblInterpreter *interpreter) {
+    // The loop is only created when a script uses it
+    if (interpreter->loop == NULL) {
+        NblLoop *loop = malloc(sizeof(NblLoop));
+        loop->ready = nbl_list_new();
+        loop->readyPosition = 0;
+        loop->timers = nbl_list_new();
+        loop->readers = nbl_list_new();
+        loop->coroutines = nbl_list_new();
+        interpreter->loop = loop;
+    }
+    return interpreter->loop;
+}
+
+bool nbl_loop_run(NblInterpreter *interpreter, NblTask *until) {
+    // Runs until the task is done or without a task until there is no work left,
+    // returns false when the task can't be done because there is no work left
+    NblLoop *loop = interpreter->loop;
+    if (loop == NULL) return until == NULL || until->done;
+    for (;;) {
+        if (until != NULL && until->done) return true;
+        if (loop->readyPosition < loop->ready->size) {
+            NblValue *task = nbl_list_get(loop->ready, loop->readyPosition++);
+            if (loop->readyPosition == loop->ready->size) {
+                loop->ready->size = 0;
+                loop->readyPosition = 0;
+            }
+            NblCoroutine *coroutine = ((NblTask *)task->native)->coroutine;
+            if (!coroutine->done) {
+                nbl_coroutine_resume(coroutine, NULL);
+                if (coroutine->done) {
+                    nbl_task_resolve(interpreter, task, coroutine->returnValue, coroutine->exception);
+                    coroutine->returnValue = NULL;
+                    coroutine->exception = NULL;
+                }
+            }
+            nbl_value_free(task);
+            continue;
+        }
+        if (loop->timers->size == 0 && loop->readers->size == 0) return until == NULL;
+        if (nbl_interpreter_interrupted(interpreter)) return false;
+        nbl_loop_wait(interpreter);
+    }
+}
+
+void nbl_loop_wait(NblInterpreter *interpreter) {
+    // Waits until the first timer expires or a reader can read, and resolves the tasks of the timers and readers that are done
+    NblLoop *loop = interpreter->loop;
+    int64_t now = nbl_time_ms();
+    int64_t timeout = -1;
+    for (size_t i = 0; i < loop->timers->size; i++) {
+        NblTimer *timer = nbl_list_get(loop->timers, i);
+        int64_t left = MAX(timer->time - now, 0);
+        if (timeout == -1 || left < timeout) timeout = left;
+    }
+    // Waits are cut in slices, so an interrupt is seen while a script sleeps or reads
+    if (timeout == -1 || timeout > 100) timeout = 100;
+
+#ifdef _WIN32
+    if (timeout > 0) Sleep((DWORD)timeout);
+#else
+    // A loop only has the few readers of its running tasks and each reader is gone after its file is read, so poll is
+    // used instead of epoll, which would need a call to add and to remove every reader and only exists on Linux
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * MAX(loop->readers->size, 1));
+    for (size_t i = 0; i < loop->readers->size; i++) {
+        NblReader *reader = nbl_list_get(loop->readers, i);
+        fds[i].fd = reader->fd;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+    if (poll(fds, loop->readers->size, (int)MIN(timeout, INT32_MAX)) > 0) {
+        size_t readersSize = 0;
+        for (size_t i = 0; i < loop->readers->size; i++) {
+            NblReader *reader = nbl_list_get(loop->readers, i);
+            bool done = false;
+            if (fds[i].revents != 0) {
+                if (reader->capacity - reader->size < 1024) {
+                    reader->capacity *= 2;
+                    reader->buffer = realloc(reader->buffer, reader->capacity);
+                }
+                ssize_t count = read(reader->fd, reader->buffer + reader->size, reader->capacity - reader->size - 1);
+                if (count > 0) {
+                    reader->size += count;
+                } else if (count == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    done = true;
+                }
+            }
+            if (done) {
+                reader->buffer[reader->size] = '\0';
+                if (reader->pipe != NULL) {
+                    pclose(reader->pipe);
+                } else {
+                    close(reader->fd);
+                }
+                nbl_task_resolve(interpreter, reader->task, nbl_value_new_string(reader->buffer), NULL);
+                nbl_value_free(reader->task);
+                free(reader->buffer);
+                free(reader);
+            } else {
+                nbl_list_set(loop->readers, readersSize++, reader);
+            }
+        }
+        loop->readers->size = readersSize;
+    }
+    free(fds);
+#endif
+
+    now = nbl_time_ms();
+    size_t timersSize = 0;
+    for (size_t i = 0; i < loop->timers->size; i++) {
+        NblTimer *timer = nbl_list_get(loop->timers, i);
+        if (timer->time <= now) {
+            nbl_task_resolve(interpreter, timer->task, nbl_value_new_null(), NULL);
+            nbl_value_free(timer->task);
+            free(timer);
+        } else {
+            nbl_list_set(loop->timers, timersSize++, timer);
+        }
+    }
+    loop->timers->size = timersSize;
+}
+
+void nbl_loop_free(NblLoop *loop) {
+    // Coroutines that are still suspended are cancelled, a coroutine removes itself from the list when it is done
+    while (loop->coroutines->size > 0) {
+        nbl_coroutine_cancel(nbl_list_get(loop->coroutines, loop->coroutines->size - 1));
+    }
+    for (size_t i = loop->readyPosition; i < loop->ready->size; i++) nbl_value_free(nbl_list_get(loop->ready, i));
+    nbl_list_free(loop->ready, NULL);
+    nbl_list_foreach(loop->timers, NblTimer * timer, {
+        nbl_value_free(timer->task);
+        free(timer);
+    });
+    nbl_list_free(loop->timers, NULL);
+#ifndef _WIN32
+    nbl_list_foreach(loop->readers, NblReader * reader, {
+        if (reader->pipe != NULL) {
+            pclose(reader->pipe);
+        } else {
+            close(reader->fd);
+        }
+        nbl_value_free(reader->task);
+        free(reader->buffer);
+        free(reader);
+    });
+#endif
+    nbl_list_free(loop->readers, NULL);
+    nbl_list_free(loop->coroutines, NULL);
+    free(loop);
+}
+
+NblValue *nbl_interpreter_call_coroutine(NblContext *context, NblValue *function, NblValue *this, NblList *arguments) {
+    // An async function gives a task that runs on the loop, a generator gives a generator that runs on each next call
+    NblCoroutine *coroutine = nbl_coroutine_new(context->interpreter, function, this, arguments);
+    if (function->generator) {
+        NblGenerator *generator = malloc(sizeof(NblGenerator));
+        generator->native.free = (NblNativeFreeFunc *)nbl_generator_free;
+        generator->coroutine = coroutine;
+        NblValue *generatorClass = nbl_std_env_get(context->env, "Generator")->value;
+        NblValue *value = nbl_value_new_instance(nbl_map_new(), nbl_value_ref(generatorClass));
+        value->native = &generator->native;
+        return value;
+    }
+    NblValue *task = nbl_task_new(context);
+    ((NblTask *)task->native)->coroutine = coroutine;
+    coroutine->task = task;
+    nbl_list_add(nbl_loop_get(context->interpreter)->ready, nbl_value_ref(task));
+    return task;
+}
+
+NblValue *nbl_interpreter_await(NblContext *context, NblValue *value) {
+    // Awaiting a value that is not a task gives the value
+    NblTask *task = nbl_task_get(value);
+    if (task == NULL) return value;
+    if (!task->done) {
+        bool suspended = false;
+        // An async function waits for the task, everywhere else the loop runs until the task is done
+        NblCoroutine *coroutine = context->interpreter->coroutine;
+        if (coroutine != NULL && coroutine->task != NULL) {
+            nbl_list_add(task->waiters, nbl_value_ref(coroutine->task));
+            suspended = true;
+            if (!nbl_coroutine_suspend(coroutine)) {
+                // A cancelled coroutine no longer waits, so a task that awaits itself can be freed
+                for (size_t i = 0; i < task->waiters->size; i++) {
+                    if (nbl_list_get(task->waiters, i) == coroutine->task) {
+                        nbl_list_set(task->waiters, i, nbl_list_get(task->waiters, task->waiters->size - 1));
+                        task->waiters->size--;
+                        nbl_value_free(coroutine->task);
+                        break;
+                    }
+                }
+                nbl_value_free(value);
+                return nbl_interpreter_throw(context, nbl_value_new_string("Task cancelled"));
+            }
+        }
+        if (!suspended && !nbl_loop_run(context->interpreter, task)) {
+            nbl_value_free(value);
+            if (nbl_interpreter_stopped(context->interpreter, context->scope, context->node)) return nbl_value_new_null();
+            return nbl_interpreter_throw(context, nbl_value_new_string("Awaited task never completes"));
+        }
+    }
+    task->awaited = true;
+    NblValue *result = task->exception != NULL ? nbl_interpreter_throw(context, nbl_value_ref(task->exception)) : nbl_value_retrieve(task->result);
+    nbl_value_free(value);
+    return result;
+}
+
+NblValue *nbl_interpreter_yield(NblContext *context, NblValue *value) {
+    // The value goes to the next call of the generator, which gives the value of the yield back
+    NblCoroutine *coroutine = context->interpreter->coroutine;
+    if (coroutine != NULL && coroutine->task == NULL) {
+        coroutine->transfer = value;
+        if (!nbl_coroutine_suspend(coroutine)) {
+            if (coroutine->transfer != NULL) nbl_value_free(coroutine->transfer);
+            coroutine->transfer = NULL;
+            return nbl_interpreter_throw(context, nbl_value_new_string("Generator cancelled"));
+        }
+        NblValue *sent = coroutine->transfer;
+        coroutine->transfer = NULL;
+        return sent != NULL ? sent : nbl_value_new_null();
+    }
+    nbl_value_free(value);
+    return nbl_interpreter_throw(context, nbl_value_new_string("Yield not in a generator"));
+}
+
+// Range
+NblValue *nbl_range_new(NblContext *context, int64_t start, int64_t end, int64_t step) {
+    NblRange *range = malloc(sizeof(NblRange));
+    range->native.free = (NblNativeFreeFunc *)nbl_range_free;
+    range->start = start;
+    range->end = end;
+    range->step = step;
+    range->current = start;
+    NblValue *rangeClass = nbl_std_env_get(context->env, "Range")->value;
+    NblValue *value = nbl_value_new_instance(nbl_map_new(), nbl_value_ref(rangeClass));
+    value->native = &range->native;
+    return value;
+}
+
+NblRange *nbl_range_get(NblValue *value) {
+    if (value->type != NBL_VALUE_INSTANCE || value->native == NULL || value->native->free != (NblNativeFreeFunc *)nbl_range_free) return NULL;
+    return (NblRange *)value->native;
+}
+
+bool nbl_range_has(NblRange *range, int64_t number) { return range->step > 0 ? number < range->end : number > range->end; }
+
+void nbl_range_free(NblRange *range) { free(range); }
+
+// Iterators
+NblValue *nbl_iterator_get_next(NblValue *iterator) {
+    // Objects and instances with a next function can be iterated lazily
+    if (iterator->type != NBL_VALUE_OBJECT && iterator->type != NBL_VALUE_INSTANCE) return NULL;
+    NblValue *next = iterator->type == NBL_VALUE_OBJECT ? nbl_map_get(iterator->object, "next") : nbl_value_class_get(iterator, "next");
+    if (next == NULL || (next->type != NBL_VALUE_FUNCTION && next->type != NBL_VALUE_NATIVE_FUNCTION)) return NULL;
+    return next;
+}
+
+bool nbl_iterator_next(NblContext *context, NblValue *iterator, NblValue *next, NblValue **value) {
+    // Returns false when the iterator is done or has thrown, else value is set to the next value
+    NblList *arguments = nbl_list_new();
+    NblValue *result = nbl_interpreter_call(context, next, iterator, arguments);
+    nbl_list_free(arguments, NULL);
+    if (context->scope->exception->exceptionValue == NULL && result->type != NBL_VALUE_OBJECT) {
+        NblValueType resultType = result->type;
+        nbl_value_free(nbl_interpreter_throw(context, nbl_value_new_string_format("Iterator result is not an object it is: %s", nbl_value_type_to_string(resultType))));
+    }
+    if (context->scope->exception->exceptionValue != NULL) {
+        nbl_value_free(result);
+        return false;
+    }
+    NblValue *done = nbl_map_get(result->object, "done");
+    if (done != NULL && done->type == NBL_VALUE_BOOL && done->boolean) {
+        nbl_value_free(result);
+        return false;
+    }
+    NblValue *nextValue = nbl_map_get(result->object, "value");
+    *value = nextValue != NULL ? nbl_value_retrieve(nextValue) : nbl_value_new_null();
+    nbl_value_free(result);
+    return true;
+}
+
+// Stream
+NblStream *nbl_stream_new(NblContext *context, NblValue *source) {
+    NblRange *range = nbl_range_get(source);
+    NblTypedArray *typedArray = nbl_typed_array_get(source);
+    NblValue *next = range == NULL && typedArray == NULL ? nbl_iterator_get_next(source) : NULL;
+    if (source->type != NBL_VALUE_ARRAY && range == NULL && typedArray == NULL && next == NULL) {
+        nbl_value_free(nbl_interpreter_throw(context, nbl_value_new_string_format("Stream source is not an array, typed array, range or iterator it is: %s",
+                                                                                   nbl_value_type_to_string(source->type))));
+        return NULL;
+    }
+    NblStream *stream = malloc(sizeof(NblStream));
+    stream->native.free = (NblNativeFreeFunc *)nbl_stream_free;
+    stream->source = nbl_value_ref(source);
+    stream->next = next != NULL ? nbl_value_ref(next) : NULL;
+    stream->position = 0;
+    stream->current = range != NULL ? range->start : 0;
+    stream->done = false;
+    stream->stages = NULL;
+    stream->stagesSize = 0;
+    return stream;
+}
+
+NblValue *nbl_stream_new_value(NblContext *context, NblStream *stream) {
+    NblValue *streamClass = nbl_std_env_get(context->env, "Stream")->value;
+    NblValue *value = nbl_value_new_instance(nbl_map_new(), nbl_value_ref(streamClass));
+    value->native = &stream->native;
+    return value;
+}
+
+NblStream *nbl_stream_get(NblValue *value) {
+    if (value->type != NBL_VALUE_INSTANCE || value->native == NULL || value->native->free != (NblNativeFreeFunc *)nbl_stream_free) return NULL;
+    return (NblStream *)value->native;
+}
+
+NblStream *nbl_stream_add_stage(NblStream *stream, NblStreamStageType type, NblValue *function, int64_t count) {
+    // Returns a new stream that continues where the stream is and has one stage more, the stream itself is not changed
+    NblStream *newStream = malloc(sizeof(NblStream));
+    *newStream = *stream;
+    nbl_value_ref(newStream->source);
+    if (newStream->next != NULL) nbl_value_ref(newStream->next);
+    newStream->stagesSize = stream->stagesSize + 1;
+    newStream->stages = malloc(sizeof(NblStreamStage) * newStream->stagesSize);
+    for (size_t i = 0; i < stream->stagesSize; i++) {
+        newStream->stages[i] = stream->stages[i];
+        if (newStream->stages[i].function != NULL) nbl_value_ref(newStream->stages[i].function);
+    }
+    newStream->stages[stream->stagesSize] =
+        (NblStreamStage){.type = type, .function = function != NULL ? nbl_value_ref(function) : NULL, .count = count, .seen = 0};
+    return newStream;
+}
+
+static bool nbl_stream_source_next(NblContext *context, NblStream *stream, NblValue **value) {
+    if (stream->source->type == NBL_VALUE_ARRAY) {
+        if (stream->position >= stream->source->array->size) return false;
+        NblValue *item = nbl_list_get(stream->source->array, stream->position++);
+        *value = item != NULL ? nbl_value_retrieve(item) : nbl_value_new_null();
+        return true;
+    }
+    NblTypedArray *typedArray = nbl_typed_array_get(stream->source);
+    if (typedArray != NULL) {
+        if (stream->position >= typedArray->size) return false;
+        *value = nbl_typed_array_get_item(typedArray, stream->position++);
+        return true;
+    }
+    if (stream->next == NULL) {
+        NblRange *range = nbl_range_get(stream->source);
+        if (!nbl_range_has(range, stream->current)) return false;
+        *value = nbl_value_new_int(stream->current);
+        stream->current += range->step;
+        return true;
+    }
+    return nbl_iterator_next(context, stream->source, stream->next, value);
+}
+
+bool nbl_stream_next(NblContext *context, NblStream *stream, NblValue **value) {
+    // Returns false when the stream is done or a stage has thrown, else value is set to the next item
+    for (;;) {
+        for (size_t i = 0; i < stream->stagesSize && !stream->done; i++) {
+            if (stream->stages[i].type == NBL_STREAM_TAKE && stream->stages[i].seen >= stream->stages[i].count) stream->done = true;
+        }
+        if (stream->done || !nbl_stream_source_next(context, stream, value)) {
+            stream->done = true;
+            return false;
+        }
+
+        bool skipped = false;
+        for (size_t i = 0; i < stream->stagesSize && !skipped; i++) {
+            NblStreamStage *stage = &stream->stages[i];
+            if (stage->type == NBL_STREAM_MAP || stage->type == NBL_STREAM_FILTER) {
+                NblList *arguments = nbl_list_new();
+                nbl_list_add(arguments, nbl_value_retrieve(*value));
+                NblValue *returnValue = nbl_interpreter_call(context, stage->function, NULL, arguments);
+                nbl_list_free(arguments, (NblListFreeFunc *)nbl_value_free);
+                if (context->scope->exception->exceptionValue == NULL && stage->type == NBL_STREAM_FILTER && returnValue->type != NBL_VALUE_BOOL) {
+                    NblValueType returnValueType = returnValue->type;
+                    nbl_value_free(nbl_interpreter_throw(context, nbl_value_new_string_format("Stream filter condition type is not a bool it is: %s",
+                                                                                               nbl_value_type_to_string(returnValueType))));
+                }
+                if (context->scope->exception->exceptionValue != NULL) {
+                    nbl_value_free(returnValue);
+                    nbl_value_free(*value);
+                    stream->done = true;
+                    return false;
+                }
+                if (stage->type == NBL_STREAM_MAP) {
+                    nbl_value_free(*value);
+                    *value = returnValue;
+                } else {
+                    skipped = !returnValue->boolean;
+                    nbl_value_free(returnValue);
+                }
+            }
+            if (stage->type == NBL_STREAM_SKIP && stage->seen < stage->count) {
+                stage->seen++;
+                skipped = true;
+            }
+            if (stage->type == NBL_STREAM_TAKE) {
+                stage->seen++;
+            }
+        }
+        if (!skipped) return true;
+        nbl_value_free(*value);
+    }
+}
+
+void nbl_stream_free(NblStream *stream) {
+    nbl_value_free(stream->source);
+    if (stream->next != NULL) nbl_value_free(stream->next);
+    for (size_t i = 0; i < stream->stagesSize; i++) {
+        if (stream->stages[i].function != NULL) nbl_value_free(stream->stages[i].function);
+    }
+    free(stream->stages);
+    free(stream);
+}
+
+// Typed arrays
+NblTypedArray *nbl_typed_array_new(NblValueType type, size_t size) {
+    // Returns NULL when the numbers don't fit in memory
+    void *items = calloc(MAX(size, 1), sizeof(int64_t));
+    if (items == NULL) return NULL;
+    NblTypedArray *typedArray = malloc(sizeof(NblTypedArray));
+    typedArray->native.free = (NblNativeFreeFunc *)nbl_typed_array_free;
+    typedArray->type = type;
+    typedArray->size = size;
+    typedArray->memory = nbl_memory_charge(sizeof(NblTypedArray) + sizeof(int64_t) * MAX(size, 1));
+    if (type == NBL_VALUE_INT) {
+        typedArray->integers = items;
+    } else {
+        typedArray->floats = items;
+    }
+    return typedArray;
+}
+
+NblValue *nbl_typed_array_new_value(NblContext *context, NblTypedArray *typedArray) {
+    NblValue *typedArrayClass = nbl_std_env_get(context->env, typedArray->type == NBL_VALUE_INT ? "Int64Array" : "Float64Array")->value;
+    NblValue *value = nbl_value_new_instance(nbl_map_new(), nbl_value_ref(typedArrayClass));
+    value->native = &typedArray->native;
+    return value;
+}
+
+NblTypedArray *nbl_typed_array_get(NblValue *value) {
+    if (value->type != NBL_VALUE_INSTANCE || value->native == NULL || value->native->free != (NblNativeFreeFunc *)nbl_typed_array_free) return NULL;
+    return (NblTypedArray *)value->native;
+}
+
+NblValue *nbl_typed_array_get_item(NblTypedArray *typedArray, size_t index) {
+    if (index >= typedArray->size) return nbl_value_new_null();
+    if (typedArray->type == NBL_VALUE_INT) return nbl_value_new_int(typedArray->integers[index]);
+    return nbl_value_new_float(typedArray->floats[index]);
+}
+
+bool nbl_typed_array_set_item(NblTypedArray *typedArray, size_t index, NblValue *value) {
+    // Float arrays also take ints, returns false when the value doesn't fit
+    if (typedArray->type == NBL_VALUE_INT) {
+        if (value->type != NBL_VALUE_INT) return false;
+        typedArray->integers[index] = value->integer;
+        return true;
+    }
+    if (value->type != NBL_VALUE_INT && value->type != NBL_VALUE_FLOAT) return false;
+    typedArray->floats[index] = value->type == NBL_VALUE_INT ? (double)value->integer : value->floating;
+    return true;
+}
+
+void nbl_typed_array_free(NblTypedArray *typedArray) {
+    if (typedArray->memory != NULL) nbl_memory_release(typedArray->memory, sizeof(NblTypedArray) + sizeof(int64_t) * MAX(typedArray->size, 1));
+    if (typedArray->type == NBL_VALUE_INT) {
+        free(typedArray->integers);
+    } else {
+        free(typedArray->floats);
+    }
+    free(typedArray);
+}
+
+// Bulk numeric kernels
+// Every operation has its own loop so the loops stay small, the vector loops leave the rest for the scalar loops
+#ifdef NBL_SIMD
+NBL_AVX2 size_t nbl_floats_reduce_avx2(NblBulkOperation operation, double *a, double *b, size_t size, double *result) {
+    size_t i = 0, end = size - size % 4;
+    __m256d accumulator = operation == NBL_BULK_MIN || operation == NBL_BULK_MAX ? _mm256_loadu_pd(a) : _mm256_setzero_pd();
+    if (operation == NBL_BULK_SUM) {
+        for (; i < end; i += 4) accumulator = _mm256_add_pd(accumulator, _mm256_loadu_pd(&a[i]));
+    }
+    if (operation == NBL_BULK_MIN) {
+        for (; i < end; i += 4) accumulator = _mm256_min_pd(accumulator, _mm256_loadu_pd(&a[i]));
+    }
+    if (operation == NBL_BULK_MAX) {
+        for (; i < end; i += 4) accumulator = _mm256_max_pd(accumulator, _mm256_loadu_pd(&a[i]));
+    }
+    if (operation == NBL_BULK_DOT) {
+        for (; i < end; i += 4) accumulator = _mm256_add_pd(accumulator, _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, accumulator);
+    *result = lanes[0];
+    for (size_t j = 1; j < 4; j++) {
+        if (operation == NBL_BULK_SUM || operation == NBL_BULK_DOT) *result += lanes[j];
+        if (operation == NBL_BULK_MIN) *result = MIN(*result, lanes[j]);
+        if (operation == NBL_BULK_MAX) *result = MAX(*result, lanes[j]);
+    }
+    return i;
+}
+
+NBL_AVX2 size_t nbl_floats_map_avx2(NblBulkOperation operation, double *result, double *a, double *b, double factor, size_t size) {
+    size_t i = 0, end = size - size % 4;
+    if (operation == NBL_BULK_ADD) {
+        for (; i < end; i += 4) _mm256_storeu_pd(&result[i], _mm256_add_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+    }
+    if (operation == NBL_BULK_MUL) {
+        for (; i < end; i += 4) _mm256_storeu_pd(&result[i], _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+    }
+    if (operation == NBL_BULK_SCALE) {
+        __m256d factorVector = _mm256_set1_pd(factor);
+        for (; i < end; i += 4) _mm256_storeu_pd(&result[i], _mm256_mul_pd(_mm256_loadu_pd(&a[i]), factorVector));
+    }
+    return i;
+}
+
+NBL_AVX2 size_t nbl_integers_sum_avx2(int64_t *a, size_t size, int64_t *result) {
+    size_t i = 0, end = size - size % 4;
+    __m256i accumulator = _mm256_setzero_si256();
+    for (; i < end; i += 4) accumulator = _mm256_add_epi64(accumulator, _mm256_loadu_si256((const __m256i *)&a[i]));
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, accumulator);
+    for (size_t j = 0; j < 4; j++) *result += lanes[j];
+    return i;
+}
+
+NBL_AVX2 size_t nbl_integers_add_avx2(int64_t *result, int64_t *a, int64_t *b, size_t size) {
+    size_t i = 0, end = size - size % 4;
+    for (; i < end; i += 4) {
+        _mm256_storeu_si256((__m256i *)&result[i], _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)&a[i]), _mm256_loadu_si256((const __m256i *)&b[i])));
+    }
+    return i;
+}
+#endif
+
+double nbl_floats_reduce(NblBulkOperation operation, double *a, double *b, size_t size) {
+    // Reduces with sum, min, max or dot, min and max need at least one item
+    size_t i = 0;
+    double result = operation == NBL_BULK_MIN || operation == NBL_BULK_MAX ? a[0] : 0;
+#ifdef NBL_SIMD
+    if (size >= 4 && nbl_cpu_avx2()) {
+        i = nbl_floats_reduce_avx2(operation, a, b, size, &result);
+    } else if (size >= NBL_FLOAT_VECTOR_SIZE) {
+        NblFloatVector accumulator = operation == NBL_BULK_MIN || operation == NBL_BULK_MAX ? nbl_float_vector_load(a) : nbl_float_vector_set1(0);
+        size_t end = size - size % NBL_FLOAT_VECTOR_SIZE;
+        if (operation == NBL_BULK_SUM) {
+            for (; i < end; i += NBL_FLOAT_VECTOR_SIZE) accumulator = nbl_float_vector_add(accumulator, nbl_float_vector_load(&a[i]));
+        }
+        if (operation == NBL_BULK_MIN) {
+            for (; i < end; i += NBL_FLOAT_VECTOR_SIZE) accumulator = nbl_float_vector_min(accumulator, nbl_float_vector_load(&a[i]));
+        }
+        if (operation == NBL_BULK_MAX) {
+            for (; i < end; i += NBL_FLOAT_VECTOR_SIZE) accumulator = nbl_float_vector_max(accumulator, nbl_float_vector_load(&a[i]));
+        }
+        if (operation == NBL_BULK_DOT) {
+            for (; i < end; i += NBL_FLOAT_VECTOR_SIZE) {
+                accumulator = nbl_float_vector_add(accumulator, nbl_float_vector_mul(nbl_float_vector_load(&a[i]), nbl_float_vector_load(&b[i])));
+            }
+        }
+        double lanes[NBL_FLOAT_VECTOR_SIZE];
+        nbl_float_vector_store(lanes, accumulator);
+        result = lanes[0];
+        for (size_t j = 1; j < NBL_FLOAT_VECTOR_SIZE; j++) {
+            if (operation == NBL_BULK_SUM || operation == NBL_BULK_DOT) result += lanes[j];
+            if (operation == NBL_BULK_MIN) result = MIN(result, lanes[j]);
+            if (operation == NBL_BULK_MAX) result = MAX(result, lanes[j]);
+        }
+    }
+#endif
+    if (operation == NBL_BULK_SUM) {
+        for (; i < size; i++) result += a[i];
+    }
+    if (operation == NBL_BULK_MIN) {
+        for (; i < size; i++) result = MIN(result, a[i]);
+    }
+    if (operation == NBL_BULK_MAX) {
+        for (; i < size; i++) result = MAX(result, a[i]);
+    }
+    if (operation == NBL_BULK_DOT) {
+        for (; i < size; i++) result += a[i] * b[i];
+    }
+    return result;
+}
+
+void nbl_floats_map(NblBulkOperation operation, double *result, double *a, double *b, double factor, size_t size) {
+    // Adds or multiplies a and b item by item or scales a by factor into result
+    size_t i = 0;
+#ifdef NBL_SIMD
+    size_t end = size - size % NBL_FLOAT_VECTOR_SIZE;
+    if (nbl_cpu_avx2()) {
+        i = nbl_floats_map_avx2(operation, result, a, b, factor, size);
+    } else if (operation == NBL_BULK_ADD) {
+        for (; i < end; i += NBL_FLOAT_VECTOR_SIZE) {
+            nbl_float_vector_store(&result[i], nbl_float_vector_add(nbl_float_vector_load(&a[i]), nbl_float_vector_load(&b[i])));
+        }
+    } else if (operation == NBL_BULK_MUL) {
+        for (; i < end; i += NBL_FLOAT_VECTOR_SIZE) {
+            nbl_float_vector_store(&result[i], nbl_float_vector_mul(nbl_float_vector_load(&a[i]), nbl_float_vector_load(&b[i])));
+        }
+    } else if (operation == NBL_BULK_SCALE) {
+        NblFloatVector factorVector = nbl_float_vector_set1(factor);
+        for (; i < end; i += NBL_FLOAT_VECTOR_SIZE) nbl_float_vector_store(&result[i], nbl_float_vector_mul(nbl_float_vector_load(&a[i]), factorVector));
+    }
+#endif
+    if (operation == NBL_BULK_ADD) {
+        for (; i < size; i++) result[i] = a[i] + b[i];
+    }
+    if (operation == NBL_BULK_MUL) {
+        for (; i < size; i++) result[i] = a[i] * b[i];
+    }
+    if (operation == NBL_BULK_SCALE) {
+        for (; i < size; i++) result[i] = a[i] * factor;
+    }
+}
+
+int64_t nbl_integers_reduce(NblBulkOperation operation, int64_t *a, int64_t *b, size_t size) {
+    // There are no 64-bit integer multiply, min and max vector instructions before AVX-512, so only sum is vectorized
+    size_t i = 0;
+    int64_t result = operation == NBL_BULK_MIN || operation == NBL_BULK_MAX ? a[0] : 0;
+#ifdef NBL_SIMD
+    if (operation == NBL_BULK_SUM && nbl_cpu_avx2()) {
+        i = nbl_integers_sum_avx2(a, size, &result);
+    } else if (operation == NBL_BULK_SUM) {
+        size_t end = size - size % (NBL_VECTOR_SIZE / sizeof(int64_t));
+        NblVector accumulator = nbl_vector_zero();
+        for (; i < end; i += NBL_VECTOR_SIZE / sizeof(int64_t)) accumulator = nbl_vector_add_int(accumulator, nbl_vector_load(&a[i]));
+        int64_t lanes[NBL_VECTOR_SIZE / sizeof(int64_t)];
+        nbl_vector_store(lanes, accumulator);
+        for (size_t j = 0; j < NBL_VECTOR_SIZE / sizeof(int64_t); j++) result += lanes[j];
+    }
+#endif
+    if (operation == NBL_BULK_SUM) {
+        for (; i < size; i++) result += a[i];
+    }
+    if (operation == NBL_BULK_MIN) {
+        for (; i < size; i++) result = MIN(result, a[i]);
+    }
+    if (operation == NBL_BULK_MAX) {
+        for (; i < size; i++) result = MAX(result, a[i]);
+    }
+    if (operation == NBL_BULK_DOT) {
+        for (; i < size; i++) result += a[i] * b[i];
+    }
+    return result;
+}
+
+void nbl_integers_map(NblBulkOperation operation, int64_t *result, int64_t *a, int64_t *b, int64_t factor, size_t size) {
+    size_t i = 0;
+#ifdef NBL_SIMD
+    if (operation == NBL_BULK_ADD && nbl_cpu_avx2()) {
+        i = nbl_integers_add_avx2(result, a, b, size);
+    } else if (operation == NBL_BULK_ADD) {
+        size_t end = size - size % (NBL_VECTOR_SIZE / sizeof(int64_t));
+        for (; i < end; i += NBL_VECTOR_SIZE / sizeof(int64_t)) {
+            nbl_vector_store(&result[i], nbl_vector_add_int(nbl_vector_load(&a[i]), nbl_vector_load(&b[i])));
+        }
+    }
+#endif
+    if (operation == NBL_BULK_ADD) {
+        for (; i < size; i++) result[i] = a[i] + b[i];
+    }
+    if (operation == NBL_BULK_MUL) {
+        for (; i < size; i++) result[i] = a[i] * b[i];
+    }
+    if (operation == NBL_BULK_SCALE) {
+        for (; i < size; i++) result[i] = a[i] * factor;
+    }
+}
+
+// Profiler
+volatile sig_atomic_t nbl_profiler_ticks = 0;
+
+NblProfiler *nbl_profiler_new(int32_t interval) {
+    NblProfiler *profiler = malloc(sizeof(NblProfiler));
+    profiler->interval = interval;
+    profiler->root = (NblProfilerFrame){.parent = NULL, .function = NULL, .callNode = NULL, .node = NULL};
+    profiler->frame = &profiler->root;
+    profiler->samples = 0;
+    profiler->stacks = nbl_map_new();
+    profiler->functions = nbl_map_new();
+    profiler->lines = nbl_map_new();
+    return profiler;
+}
+
+#ifndef _WIN32
+static void nbl_profiler_signal(int number) {
+    // Without sigaction the handler can be reset to the default when it runs, so it is set again first
+    signal(number, nbl_profiler_signal);
+    nbl_profiler_ticks++;
+}
+#endif
+
+bool nbl_profiler_start(NblProfiler *profiler) {
+#ifdef _WIN32
+    (void)profiler;
+    return false;
+#else
+    nbl_profiler_ticks = 0;
+    if (signal(SIGPROF, nbl_profiler_signal) == SIG_ERR) return false;
+    struct itimerval timer;
+    timer.it_interval.tv_sec = profiler->interval / 1000000;
+    timer.it_interval.tv_usec = profiler->interval % 1000000;
+    timer.it_value = timer.it_interval;
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+#endif
+}
+
+void nbl_profiler_stop(NblProfiler *profiler) {
+    (void)profiler;
+#ifndef _WIN32
+    struct itimerval timer = {0};
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+#endif
+    nbl_profiler_ticks = 0;
+}
+
+void nbl_profiler_push(NblProfiler *profiler, NblProfilerFrame *frame, NblValue *function, NblNode *callNode) {
+    if (nbl_profiler_ticks > 0) nbl_profiler_sample(profiler);
+    frame->parent = profiler->frame;
+    frame->function = function;
+    frame->callNode = callNode;
+    frame->node = callNode;
+    profiler->frame = frame;
+}
+
+void nbl_profiler_pop(NblProfiler *profiler, NblProfilerFrame *frame) {
+    if (nbl_profiler_ticks > 0) nbl_profiler_sample(profiler);
+    profiler->frame = frame->parent;
+}
+
+char *nbl_profiler_frame_name(NblProfilerFrame *frame) {
+    // Functions have no name, so the name comes from the call: a variable or the key of an object, class or instance
+    if (frame->function == NULL) return strdup("main");
+    char *name = NULL;
+    bool callerNative = frame->parent != NULL && frame->parent->function != NULL && frame->parent->function->type == NBL_VALUE_NATIVE_FUNCTION;
+    if (frame->callNode != NULL && frame->callNode->type == NBL_NODE_CALL && !callerNative) {
+        NblNode *function = frame->callNode->function;
+        if (function->type == NBL_NODE_VARIABLE) name = function->string;
+        if (function->type == NBL_NODE_GET && function->rhs->type == NBL_NODE_VALUE && function->rhs->value->type == NBL_VALUE_STRING) {
+            name = function->rhs->value->string;
+        }
+    }
+    if (name == NULL) name = "anonymous";
+
+    char buffer[1024];
+    if (frame->function->type == NBL_VALUE_NATIVE_FUNCTION) {
+        snprintf(buffer, sizeof(buffer), "%s [native]", name);
+        return strdup(buffer);
+    }
+    NblToken *token = frame->function->functionNode->token;
+    if (token == NULL) return strdup(name);
+    snprintf(buffer, sizeof(buffer), "%s (%s:%d)", name, token->source->path, token->line);
+    return strdup(buffer);
+}
+
+static char *nbl_profiler_frame_line(NblProfilerFrame *frame) {
+    if (frame->node == NULL || frame->node->token == NULL) return NULL;
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer), "%s:%d", frame->node->token->source->path, frame->node->token->line);
+    return strdup(buffer);
+}
+
+static void nbl_profiler_count(NblMap *map, char *key, int64_t self, int64_t total) {
+    NblProfilerCount *count = nbl_map_get(map, key);
+    if (count == NULL) {
+        count = calloc(1, sizeof(NblProfilerCount));
+        nbl_map_set(map, key, count);
+    }
+    count->self += self;
+    count->total += total;
+}
+
+static void nbl_profiler_count_stack(NblMap *map, NblList *keys, int64_t ticks) {
+    // Self time goes to the top of the stack, total time once to every key on it so recursion is not counted twice
+    NblMap *seen = nbl_map_new();
+    for (size_t i = 0; i < keys->size; i++) {
+        char *key = nbl_list_get(keys, i);
+        if (key == NULL || nbl_map_get(seen, key) != NULL) continue;
+        nbl_map_set(seen, key, key);
+        nbl_profiler_count(map, key, 0, ticks);
+    }
+    char *top = nbl_list_get(keys, keys->size - 1);
+    if (top != NULL) nbl_profiler_count(map, top, ticks, 0);
+    nbl_map_free(seen, NULL);
+}
+
+void nbl_profiler_sample(NblProfiler *profiler) {
+    // All ticks since the last sample go to the stack that runs now
+    int64_t ticks = nbl_profiler_ticks;
+    nbl_profiler_ticks = 0;
+    profiler->samples += ticks;
+
+    NblList *names = nbl_list_new();
+    NblList *lines = nbl_list_new();
+    size_t stackSize = 0;
+    for (NblProfilerFrame *frame = profiler->frame; frame != NULL; frame = frame->parent) {
+        char *name = nbl_profiler_frame_name(frame);
+        stackSize += strlen(name) + 1;
+        nbl_list_unshift(names, name);
+        nbl_list_unshift(lines, nbl_profiler_frame_line(frame));
+    }
+
+    // The folded stack is the names from the root to the top joined by semicolons, like flamegraph tools read it
+    char *stack = malloc(stackSize);
+    char *c = stack;
+    for (size_t i = 0; i < names->size; i++) {
+        char *name = nbl_list_get(names, i);
+        size_t nameSize = strlen(name);
+        memcpy(c, name, nameSize);
+        c += nameSize;
+        *c++ = i != names->size - 1 ? ';' : '\0';
+    }
+    nbl_profiler_count(profiler->stacks, stack, ticks, ticks);
+    free(stack);
+
+    nbl_profiler_count_stack(profiler->functions, names, ticks);
+    nbl_profiler_count_stack(profiler->lines, lines, ticks);
+    nbl_list_free(names, free);
+    nbl_list_free(lines, free);
+}
+
+typedef struct NblProfilerRow {
+    char *key;
+    NblProfilerCount *count;
+} NblProfilerRow;
+
+static int nbl_profiler_row_compare(const void *a, const void *b) {
+    const NblProfilerCount *countA = ((const NblProfilerRow *)a)->count;
+    const NblProfilerCount *countB = ((const NblProfilerRow *)b)->count;
+    if (countA->self != countB->self) return countA->self < countB->self ? 1 : -1;
+    if (countA->total != countB->total) return countA->total < countB->total ? 1 : -1;
+    return 0;
+}
+
+static void nbl_profiler_print_counts(NblProfiler *profiler, FILE *file, char *title, NblMap *map) {
+    // Prints the 20 keys with the most self time
+    NblProfilerRow *rows = malloc(sizeof(NblProfilerRow) * MAX(map->size, 1));
+    for (size_t i = 0; i < map->size; i++) rows[i] = (NblProfilerRow){.key = map->keys[i], .count = map->values[i]};
+    qsort(rows, map->size, sizeof(NblProfilerRow), nbl_profiler_row_compare);
+    double samples = MAX(profiler->samples, 1);
+    fprintf(file, "\n   self   total  %s\n", title);
+    for (size_t i = 0; i < MIN(map->size, 20); i++) {
+        fprintf(file, "%6.1f%% %6.1f%%  %s\n", rows[i].count->self * 100 / samples, rows[i].count->total * 100 / samples, rows[i].key);
+    }
+    free(rows);
+}
+
+void nbl_profiler_print(NblProfiler *profiler, FILE *file) {
+    fprintf(file, "Profile: %" PRIi64 " samples of %d us\n", profiler->samples, profiler->interval);
+    nbl_profiler_print_counts(profiler, file, "function", profiler->functions);
+    nbl_profiler_print_counts(profiler, file, "line", profiler->lines);
+}
+
+void nbl_profiler_print_folded(NblProfiler *profiler, FILE *file) {
+    nbl_map_foreach(profiler->stacks, char *stack, NblProfilerCount *count, { fprintf(file, "%s %" PRIi64 "\n", stack, count->self); });
+}
+
+void nbl_profiler_free(NblProfiler *profiler) {
+    nbl_map_free(profiler->stacks, free);
+    nbl_map_free(profiler->functions, free);
+    nbl_map_free(profiler->lines, free);
+    free(profiler);
+}
+
+// Counters
+
+NblCounters *nbl_counters_new(void) {
+    NblCounters *counters = calloc(1, sizeof(NblCounters));
+    counters->calls = nbl_map_new();
+    return counters;
+}
+
+NblValue *nbl_counters_node(NblInterpreter *interpreter, NblScope *scope, NblNode *node) {
+    // A node only counts the values it allocated itself, so the values of its child nodes are subtracted
+    NblCounters *counters = interpreter->counters;
+    counters->nodes[node->type]++;
+    int64_t start = nbl_value_allocations;
+    int64_t parentChildren = nbl_counters_children;
+    nbl_counters_children = 0;
+    NblValue *value = nbl_interpreter_eval(interpreter, scope, node);
+    int64_t allocations = nbl_value_allocations - start;
+    counters->allocations[node->type] += allocations - nbl_counters_children;
+    nbl_counters_children = parentChildren + allocations;
+    return value;
+}
+
+void nbl_counters_call(NblCounters *counters, NblValue *function) {
+    NblToken *token = function->functionNode->token;
+    char key[1024];
+    if (token != NULL) {
+        snprintf(key, sizeof(key), "%s:%d:%d", token->source->path, token->line, token->column);
+    } else {
+        strcpy(key, "unknown");
+    }
+    int64_t *count = nbl_map_get(counters->calls, key);
+    if (count == NULL) {
+        count = calloc(1, sizeof(int64_t));
+        nbl_map_set(counters->calls, key, count);
+    }
+    (*count)++;
+}
+
+static void nbl_counters_print_string(FILE *file, char *string) {
+    fputc('"', file);
+    for (char *c = string; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char)*c < ' ') {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void nbl_counters_print_types(FILE *file, char *name, int64_t *counts) {
+    fprintf(file, ", \"%s\": {", name);
+    bool first = true;
+    for (int32_t i = 0; i < NBL_NODE_TYPES; i++) {
+        if (counts[i] == 0) continue;
+        fprintf(file, "%s\"%s\": %" PRIi64, first ? "" : ", ", nbl_node_type_to_string(i), counts[i]);
+        first = false;
+    }
+    fprintf(file, "}");
+}
+
+void nbl_counters_print(NblCounters *counters, FILE *file) {
+    // Prints the counters as the other keys of the stats object
+    int64_t nodes = 0;
+    for (int32_t i = 0; i < NBL_NODE_TYPES; i++) nodes += counters->nodes[i];
+    fprintf(file, ", \"nodes\": %" PRIi64 ", \"nativeCalls\": %" PRIi64 ", \"exceptions\": %" PRIi64, nodes, counters->nativeCalls,
+            counters->exceptions);
+    nbl_counters_print_types(file, "nodeTypes", counters->nodes);
+    nbl_counters_print_types(file, "allocations", counters->allocations);
+    fprintf(file, ", \"calls\": {");
+    nbl_map_foreach(counters->calls, char *key, int64_t *count, {
+        if (index > 0) fprintf(file, ", ");
+        nbl_counters_print_string(file, key);
+        fprintf(file, ": %" PRIi64, *count);
+    });
+    fprintf(file, "}");
+}
+
+void nbl_counters_free(NblCounters *counters) {
+    nbl_map_free(counters->calls, free);
+    free(counters);
+}
+
 #endif
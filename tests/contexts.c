@@ -0,0 +1,498 @@
+// New Bastiaan Language Contexts Stress Test
+// Made by Bastiaan van der Plaat
+// gcc -Wall -Wextra -Wshadow -Wpedantic --std=c11 tests/contexts.c -lm -o contexts && ./contexts [threads] [runs]
+
+// Starting threads can be made to fail, to test that the interpreter does their work itself then
+#if !defined(NBL_NO_THREADS) && !defined(__STDC_NO_THREADS__) && defined(__has_include)
+#if __has_include(<threads.h>)
+#include <threads.h>
+static int failingThreads = 0;
+static int contexts_thrd_create(thrd_t *thread, thrd_start_t func, void *arg) {
+    if (failingThreads > 0) {
+        failingThreads--;
+        return thrd_error;
+    }
+    return thrd_create(thread, func, arg);
+}
+#define thrd_create contexts_thrd_create
+#endif
+#endif
+
+#define NBL_IMPLEMENTATION
+#include "../src/nbl.h"
+#include <time.h>
+
+// A script that allocates a lot of values, calls functions and natives and throws exceptions
+static char *script =
+    "class Counter {\n"
+    "    fn constructor(start) { this.value = start; }\n"
+    "    fn add(x) { this.value += x; return this; }\n"
+    "}\n"
+    "const counter = Counter(0);\n"
+    "let catched = 0;\n"
+    "for (let i = 0; i < 2000; i++) {\n"
+    "    const items = [ i, i + 1, i + 2 ].map(fn (x) => x * 2).filter(fn (x) => x % 3 == 0);\n"
+    "    for (const item in items) counter.add(item);\n"
+    "    const person = { name = 'Bastiaan' + (string)i, age = i };\n"
+    "    counter.add(person.name.length() + person.keys().length());\n"
+    "    try {\n"
+    "        if (i % 100 == 0) throw 'Exception ' + (string)i;\n"
+    "    } catch (const exception) {\n"
+    "        catched++;\n"
+    "    }\n"
+    "    assert(Math.random() < 1.0);\n"
+    "}\n"
+    "return counter.value + catched;\n";
+
+static int64_t run(void) {
+    NblContext *context = nbl_context_new();
+    NblValue *returnValue = nbl_context_eval_text(context, script);
+    int64_t result = returnValue->type == NBL_VALUE_INT ? returnValue->integer : -1;
+    nbl_value_free(returnValue);
+    nbl_context_free(context);
+    return result;
+}
+
+// Date.now() must return milliseconds, so it must be close to the time in seconds
+static bool run_time(void) {
+    int64_t difference = nbl_time_ms() - (int64_t)time(NULL) * 1000;
+    return difference > -2000 && difference < 2000;
+}
+
+// Scripts that never stop must be stopped by the limits of their context, the exception can be catched once
+static char *runaway_scripts[] = {
+    "let catched = false;\n"
+    "try { loop {} } catch (const exception) { catched = exception.error == 'Step limit exceeded'; }\n"
+    "return catched;\n",
+    "let catched = false;\n"
+    "try { const items = []; loop items.push('item'); } catch (const exception) { catched = exception.error == 'Memory limit exceeded'; }\n"
+    "return catched;\n",
+    "let catched = false;\n"
+    "try { let i = 0; while (true) i++; } catch (const exception) { catched = exception.error == 'Time limit exceeded'; }\n"
+    "return catched;\n",
+    "let catched = false;\n"
+    "try { const first = Int64Array(50000000); const second = Int64Array(50000000); } catch (const exception) { catched = exception.error == 'Memory limit exceeded'; }\n"
+    "return catched;\n",
+    "let catched = false;\n"
+    "try { const items = []; items[20000000] = 1; } catch (const exception) { catched = exception.error == 'Memory limit exceeded'; }\n"
+    "return catched;\n",
+};
+
+static bool run_limited(char *runaway, NblLimits limits) {
+    NblContext *context = nbl_context_new();
+    nbl_context_set_limits(context, limits);
+    NblValue *returnValue = nbl_context_eval_text(context, runaway);
+    bool catched = returnValue->type == NBL_VALUE_BOOL && returnValue->boolean;
+    nbl_value_free(returnValue);
+    nbl_context_free(context);
+    return catched;
+}
+
+// A context that is saved after its initialization is restored with the same variables and shared values
+static char *saved_script =
+    "class Point {\n"
+    "    fn constructor(x, y) { this.x = x; this.y = y; }\n"
+    "    fn sum() { return this.x + this.y; }\n"
+    "}\n"
+    "const origin = Point(1, 2);\n"
+    "const pair = [ origin, origin ];\n"
+    "fn total(point, extra = 10) => point.sum() + extra;\n";
+
+static bool run_saved(void) {
+    NblContext *context = nbl_context_new();
+    nbl_value_free(nbl_context_eval_text(context, saved_script));
+    bool saved = nbl_context_save(context, "contexts.nbls");
+    nbl_context_free(context);
+    NblContext *restored = saved ? nbl_context_load("contexts.nbls") : NULL;
+    remove("contexts.nbls");
+    if (restored == NULL) return false;
+    NblValue *returnValue = nbl_context_eval_text(restored, "pair[0].x = 5; return total(pair[1]) + 'a'.length();\n");
+    bool same = returnValue->type == NBL_VALUE_INT && returnValue->integer == 18;
+    nbl_value_free(returnValue);
+    nbl_context_free(restored);
+    return same;
+}
+
+// A program is parsed once and run for every request in a context that is reset in between, so its globals can be
+// declared again
+static char *rule_script =
+    "const limit = 100;\n"
+    "fn score(order) => order.amount * (order.vip ? 2 : 1);\n"
+    "return score(request) > limit;\n";
+
+static bool run_program(void) {
+    NblProgram *program = nbl_program_new("rule", rule_script);
+    NblContext *context = nbl_context_new();
+    int32_t accepted = 0;
+    for (int32_t i = 0; i < 100; i++) {
+        NblMap *order = nbl_map_new();
+        nbl_map_set(order, "amount", nbl_value_new_int(i));
+        nbl_map_set(order, "vip", nbl_value_new_bool(i % 2 == 0));
+        nbl_context_set(context, "request", nbl_value_new_object(order));
+        NblValue *returnValue = nbl_context_run(context, program);
+        if (returnValue->type == NBL_VALUE_BOOL && returnValue->boolean) accepted++;
+        nbl_value_free(returnValue);
+        nbl_context_reset(context);
+    }
+    nbl_context_free(context);
+    nbl_program_free(program);
+    return accepted == 24;
+}
+
+// The memory of the globals of a request is given back when its context is reset, so a limited context keeps serving
+// requests
+static char *request_script =
+    "const items = [];\n"
+    "for (let i = 0; i < 1000; i++) items.push('item ' + (string)i + ' of request ' + (string)request);\n"
+    "return items.length();\n";
+
+static bool run_reset_limited(void) {
+    NblProgram *program = nbl_program_new("request", request_script);
+    NblContext *context = nbl_context_new();
+    nbl_context_set_limits(context, (NblLimits){.memory = 4000000, .steps = 0, .time = 0, .fatal = false});
+    int32_t served = 0;
+    for (int32_t i = 0; i < 100; i++) {
+        nbl_context_set(context, "request", nbl_value_new_int(i));
+        NblValue *returnValue = nbl_context_run(context, program);
+        if (returnValue->type == NBL_VALUE_INT && returnValue->integer == 1000) served++;
+        nbl_value_free(returnValue);
+        nbl_context_reset(context);
+    }
+    bool released = context->interpreter->memory->bytes < 1000000;
+    nbl_context_free(context);
+    nbl_program_free(program);
+    return served == 100 && released;
+}
+
+// Memory stats count the values of the calling context from its first call, not those of other contexts in the process.
+// Values that can't be reached anymore but are still alive are counted too
+static bool run_memory(void) {
+    NblContext *strings = nbl_context_new();
+    nbl_value_free(nbl_context_eval_text(strings, "Memory.stats();\n"));
+    nbl_value_free(nbl_context_eval_text(strings, "const strings = [];\nfor (let i = 0; i < 1000; i++) strings.push('string ' + (string)i);\n"));
+    NblContext *context = nbl_context_new();
+    NblValue *returnValue = nbl_context_eval_text(context, "return Memory.stats().types['string'].count;\n");
+    bool counted = returnValue->type == NBL_VALUE_INT && returnValue->integer < 100;
+    nbl_value_free(returnValue);
+    returnValue = nbl_context_eval_text(strings, "return Memory.stats().types['string'].count;\n");
+    counted = counted && returnValue->type == NBL_VALUE_INT && returnValue->integer >= 1000;
+    nbl_value_free(returnValue);
+    NblValue *held = nbl_context_eval_text(strings, "const objects = [];\nfor (let i = 0; i < 500; i++) objects.push({ i = i });\nreturn objects;\n");
+    nbl_context_reset(strings);
+    returnValue = nbl_context_eval_text(strings, "return Memory.stats().types['object'].count;\n");
+    counted = counted && returnValue->type == NBL_VALUE_INT && returnValue->integer >= 500;
+    nbl_value_free(returnValue);
+    nbl_value_free(held);
+    nbl_context_free(context);
+    nbl_context_free(strings);
+    return counted;
+}
+
+// The builtins of a new context are made on their first lookup, also when the interpreter throws its own exception
+static char *lazy_script =
+    "let catched = null;\n"
+    "try { const x = 1 + 'one'; } catch (const exception) { catched = exception; }\n"
+    "return catched instanceof Exception && Math.floor(2.5) == 2.0;\n";
+
+static bool run_lazy(void) {
+    NblContext *context = nbl_context_new();
+    bool made = true;
+    for (int32_t i = 0; i < 2; i++) {
+        NblValue *returnValue = nbl_context_eval_text(context, lazy_script);
+        made = made && returnValue->type == NBL_VALUE_BOOL && returnValue->boolean;
+        nbl_value_free(returnValue);
+        nbl_context_reset(context);
+    }
+
+    // Embedders look builtins up with nbl_std_env_get, a variable without a value that isn't a builtin is null
+    made = made && nbl_std_env_get(context->env, "Date")->value != NULL;
+    nbl_map_set(context->env, "empty", nbl_variable_new(NBL_VALUE_ANY, false, NULL));
+    NblValue *returnValue = nbl_context_eval_text(context, "return empty == null;");
+    made = made && returnValue->type == NBL_VALUE_BOOL && returnValue->boolean;
+    nbl_value_free(returnValue);
+    nbl_context_free(context);
+    return made;
+}
+
+// A module of typed natives is bound in bulk, the natives get plain C values and are also called by other natives
+static int64_t text_vowels(char *text) {
+    int64_t vowels = 0;
+    for (char *c = text; *c != '\0'; c++) {
+        if (strchr("aeiou", *c) != NULL) vowels++;
+    }
+    return vowels;
+}
+
+static char *text_shout(char *text) {
+    if (*text == '\0') return NULL;
+    char *shout = malloc(strlen(text) + 2);
+    for (size_t i = 0; i <= strlen(text); i++) shout[i] = toupper(text[i]);
+    return strcat(shout, "!");
+}
+
+static int64_t text_compare(int64_t a, int64_t b) { return b - a; }
+
+static double text_half(double x) { return x / 2; }
+
+static double text_average(double a, double b) { return (a + b) / 2; }
+
+static int64_t text_square(int64_t x) { return x * x; }
+
+static NblValue *text_count(NblContext *context, NblValue *this, NblList *values) {
+    (void)context;
+    (void)this;
+    return nbl_value_new_int(values->size);
+}
+
+static NblBinding text_bindings[] = {
+    {"vowels", NBL_SIGNATURE_INT_STRING, (NblTypedFunc *)text_vowels},
+    {"shout", NBL_SIGNATURE_STRING_STRING, (NblTypedFunc *)text_shout},
+    {"compare", NBL_SIGNATURE_INT_INT_INT, (NblTypedFunc *)text_compare},
+    {"half", NBL_SIGNATURE_FLOAT_FLOAT, (NblTypedFunc *)text_half},
+    {"average", NBL_SIGNATURE_FLOAT_FLOAT_FLOAT, (NblTypedFunc *)text_average},
+    {"square", NBL_SIGNATURE_INT_INT, (NblTypedFunc *)text_square},
+    {"count", NBL_SIGNATURE_VALUES, (NblTypedFunc *)text_count},
+};
+
+static char *bound_script =
+    "let wrongType = false;\n"
+    "try { [ 'a', 'b' ].sort(Text.compare); } catch (const exception) { wrongType = true; }\n"
+    "assert(Text.vowels('bastiaan') == 4 && Text.shout('hi') == 'HI!');\n"
+    "assert(Text.half(5.0) == 2.5 && Text.average(1.0, 2.0) == 1.5 && Text.square(-7) == 49 && Text.count(1, 'two', null) == 3);\n"
+    "let wrongArgument = false;\n"
+    "try { Text.square(2.0); } catch (const exception) { wrongArgument = true; }\n"
+    "let noString = false;\n"
+    "try { Text.shout(''); } catch (const exception) { noString = true; }\n"
+    "return wrongType && wrongArgument && noString && [ 1, 3, 2 ].sort(Text.compare).join() == '3,2,1';\n";
+
+static bool run_bound(void) {
+    NblContext *context = nbl_context_new();
+    nbl_context_bind(context, "Text", text_bindings, sizeof(text_bindings) / sizeof(NblBinding));
+    NblValue *returnValue = nbl_context_eval_text(context, bound_script);
+    bool bound = returnValue->type == NBL_VALUE_BOOL && returnValue->boolean;
+    nbl_value_free(returnValue);
+    nbl_context_free(context);
+    return bound;
+}
+
+// Natives of the embedder are saved only when they are registered, a file with a native that isn't registered is not
+// loaded
+static bool run_registered(void) {
+    NblContext *context = nbl_context_new();
+    nbl_context_bind(context, "Text", text_bindings, sizeof(text_bindings) / sizeof(NblBinding));
+    nbl_value_free(nbl_context_eval_text(context, "const root = Math.sqrt;\n"));
+    bool unregistered = !nbl_context_save(context, "contexts.nbls");
+    nbl_native_register(text_bindings, sizeof(text_bindings) / sizeof(NblBinding));
+    bool saved = nbl_context_save(context, "contexts.nbls");
+    nbl_context_free(context);
+    NblContext *restored = saved ? nbl_context_load("contexts.nbls") : NULL;
+    if (!unregistered || restored == NULL) {
+        remove("contexts.nbls");
+        return false;
+    }
+    NblValue *returnValue = nbl_context_eval_text(restored, "return root(16.0) == 4.0 && Text.square(3) == 9 && Text.count(1, 2) == 2;\n");
+    bool same = returnValue->type == NBL_VALUE_BOOL && returnValue->boolean;
+    nbl_value_free(returnValue);
+    nbl_context_free(restored);
+
+    // The index of Text.count is changed to one that isn't in the table, with a valid hash
+    FILE *file = fopen("contexts.nbls", "rb");
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    size_t read = fread(data, 1, size, file);
+    fclose(file);
+    NblValue *count = nbl_value_new_native_typed(NBL_SIGNATURE_VALUES, (NblTypedFunc *)text_count);
+    uint8_t index = nbl_native_index(count);
+    nbl_value_free(count);
+    bool changed = false;
+    for (size_t i = sizeof(NblContextHeader); i + 1 < read && !changed; i++) {
+        if (data[i] == NBL_VALUE_NATIVE_FUNCTION && data[i + 1] == index) {
+            data[i + 1] = 127;
+            changed = true;
+        }
+    }
+    NblContextHeader *header = (NblContextHeader *)data;
+    header->dataHash = nbl_cache_hash(data + sizeof(NblContextHeader), header->dataSize);
+    file = fopen("contexts.nbls", "wb");
+    fwrite(data, 1, read, file);
+    fclose(file);
+    free(data);
+    NblContext *damaged = nbl_context_load("contexts.nbls");
+    remove("contexts.nbls");
+    if (damaged != NULL) nbl_context_free(damaged);
+    return same && changed && damaged == NULL;
+}
+
+#ifdef NBL_THREADS
+// The includes are preloaded by the threads that did start, or only by the calling thread when none did
+static bool run_preloaded(int32_t threads, int failing) {
+    NblContext *context = nbl_context_new();
+    context->interpreter->threads = threads;
+    failingThreads = failing;
+    NblValue *returnValue = nbl_context_eval_file(context, "tests/preload.nbl");
+    failingThreads = 0;
+    bool preloaded = returnValue->type == NBL_VALUE_BOOL && returnValue->boolean && nbl_map_get(context->interpreter->includes, "tests/preload/shared.nbl") != NULL;
+    nbl_value_free(returnValue);
+    nbl_context_free(context);
+    return preloaded;
+}
+
+typedef struct Worker {
+    int32_t runs;
+    int64_t expected;
+    int32_t failures;
+} Worker;
+
+// An interrupt from another thread stops a script that never stops, also while it sleeps or waits for a worker or
+// parallel threads, which are stopped too, and can't be catched
+static char *interrupted_scripts[] = {
+    "try { loop {} } catch (const exception) {}\n"
+    "return true;\n",
+    "try { await Task.sleep(1000000); } catch (const exception) {}\n"
+    "return true;\n",
+    "const worker = Worker(fn () { loop {} });\n"
+    "try { worker.join(); } catch (const exception) {}\n"
+    "return true;\n",
+    "const worker = Worker(fn () { loop {} });\n"
+    "try { worker.receive(); } catch (const exception) {}\n"
+    "return true;\n",
+    "try { [ 1, 2, 3, 4 ].parallelMap(fn (x) { loop {} }); } catch (const exception) {}\n"
+    "return true;\n",
+};
+
+static int interrupter_run(void *data) {
+    thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 50000000}, NULL);
+    nbl_context_interrupt(data);
+    return 0;
+}
+
+static bool run_interrupted(char *text, bool early) {
+    // The uncatched exception is printed, which is expected here. An interrupt that comes before the eval stops it too
+    NblContext *context = nbl_context_new();
+    thrd_t interrupter;
+    if (early) {
+        nbl_context_interrupt(context);
+    } else {
+        thrd_create(&interrupter, interrupter_run, context);
+    }
+    fflush(stderr);
+    int stderrCopy = dup(STDERR_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDERR_FILENO);
+    NblValue *returnValue = nbl_context_eval_text(context, text);
+    dup2(stderrCopy, STDERR_FILENO);
+    close(devNull);
+    close(stderrCopy);
+    if (!early) thrd_join(interrupter, NULL);
+    bool interrupted = returnValue->type == NBL_VALUE_NULL;
+    nbl_value_free(returnValue);
+
+    // The interrupt is cleared by the eval that handled it, so the next eval runs
+    if (early) {
+        returnValue = nbl_context_eval_text(context, "for (let i = 0; i < 10; i++) {}\nreturn true;\n");
+        interrupted = interrupted && returnValue->type == NBL_VALUE_BOOL;
+        nbl_value_free(returnValue);
+    }
+    nbl_context_free(context);
+    return interrupted;
+}
+
+static int worker_run(void *data) {
+    Worker *worker = data;
+    for (int32_t i = 0; i < worker->runs; i++) {
+        if (run() != worker->expected) worker->failures++;
+    }
+    return 0;
+}
+#endif
+
+int main(int argc, char **argv) {
+    if (!run_time()) {
+        printf("contexts: time is not in milliseconds\n");
+        return EXIT_FAILURE;
+    }
+    if (!run_limited(runaway_scripts[0], (NblLimits){.memory = 0, .steps = 100000, .time = 0, .fatal = false}) ||
+        !run_limited(runaway_scripts[1], (NblLimits){.memory = 1000000, .steps = 0, .time = 0, .fatal = false}) ||
+        !run_limited(runaway_scripts[2], (NblLimits){.memory = 0, .steps = 0, .time = 50, .fatal = false}) ||
+        !run_limited(runaway_scripts[3], (NblLimits){.memory = 1000000, .steps = 0, .time = 0, .fatal = false}) ||
+        !run_limited(runaway_scripts[4], (NblLimits){.memory = 1000000, .steps = 0, .time = 0, .fatal = false})) {
+        printf("contexts: limits failed\n");
+        return EXIT_FAILURE;
+    }
+    if (!run_saved()) {
+        printf("contexts: save and load failed\n");
+        return EXIT_FAILURE;
+    }
+    if (!run_program()) {
+        printf("contexts: program failed\n");
+        return EXIT_FAILURE;
+    }
+    if (!run_reset_limited()) {
+        printf("contexts: limited reset failed\n");
+        return EXIT_FAILURE;
+    }
+    if (!run_memory()) {
+        printf("contexts: memory stats failed\n");
+        return EXIT_FAILURE;
+    }
+    if (!run_lazy()) {
+        printf("contexts: lazy builtins failed\n");
+        return EXIT_FAILURE;
+    }
+    if (!run_bound()) {
+        printf("contexts: bound natives failed\n");
+        return EXIT_FAILURE;
+    }
+    if (!run_registered()) {
+        printf("contexts: registered natives failed\n");
+        return EXIT_FAILURE;
+    }
+
+#ifdef NBL_THREADS
+    if (!run_preloaded(4, 1) || !run_preloaded(4, 3)) {
+        printf("contexts: preload without threads failed\n");
+        return EXIT_FAILURE;
+    }
+    bool interrupted = run_interrupted(interrupted_scripts[0], true);
+    for (size_t i = 0; i < sizeof(interrupted_scripts) / sizeof(char *); i++) interrupted = interrupted && run_interrupted(interrupted_scripts[i], false);
+    if (!interrupted) {
+        printf("contexts: interrupt failed\n");
+        return EXIT_FAILURE;
+    }
+
+    int32_t threadsSize = argc >= 2 ? atoi(argv[1]) : 8;
+    int32_t runs = argc >= 3 ? atoi(argv[2]) : 4;
+
+    // Run the script once on the main thread to get the expected result
+    int64_t expected = run();
+    if (expected == -1) {
+        printf("contexts: script failed\n");
+        return EXIT_FAILURE;
+    }
+
+    // Run independent contexts on all threads at the same time
+    thrd_t *threads = malloc(sizeof(thrd_t) * threadsSize);
+    Worker *workers = malloc(sizeof(Worker) * threadsSize);
+    for (int32_t i = 0; i < threadsSize; i++) {
+        workers[i] = (Worker){.runs = runs, .expected = expected, .failures = 0};
+        thrd_create(&threads[i], worker_run, &workers[i]);
+    }
+    int32_t failures = 0;
+    for (int32_t i = 0; i < threadsSize; i++) {
+        thrd_join(threads[i], NULL);
+        failures += workers[i].failures;
+    }
+    free(threads);
+    free(workers);
+
+    printf("contexts: %d threads, %d runs each, %d failures\n", threadsSize, runs, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+#else
+    (void)argc;
+    (void)argv;
+    printf("contexts: skipped, no thread support\n");
+    return EXIT_SUCCESS;
+#endif
+}